@@ -131,10 +131,14 @@ void RenderImDrawLists(ImDrawData *draw_data) {
 		idxBytesize += cmd_list->IdxBuffer.size() * sizeof(ImDrawIdx);
 	}
 
-	FGPUResourceRef VertexBuffer = GetUploadAllocator()->CreateBuffer(vtxBytesize, 8);
-	FGPUResourceRef IndexBuffer = GetUploadAllocator()->CreateBuffer(idxBytesize, 8);
-	auto vtxDst = (ImDrawVert*)VertexBuffer->GetMappedPtr();
-	auto idxDst = (ImDrawIdx*)IndexBuffer->GetMappedPtr();
+	// vertex data lives in staging ring until this context completes
+	FGPUContext Context;
+	Context.Open(EContextType::DIRECT);
+
+	FStagingAllocation VertexData = GetStagingAllocator()->Allocate(vtxBytesize, 16, Context.GetCompletionGPUSyncPoint());
+	FStagingAllocation IndexData = GetStagingAllocator()->Allocate(idxBytesize, 16, Context.GetCompletionGPUSyncPoint());
+	auto vtxDst = (ImDrawVert*)VertexData.CPUPtr;
+	auto idxDst = (ImDrawIdx*)IndexData.CPUPtr;
 
 	for (int n = 0; n < draw_data->CmdListsCount; n++) {
 		const ImDrawList* cmd_list = draw_data->CmdLists[n];
@@ -145,13 +149,13 @@ void RenderImDrawLists(ImDrawData *draw_data) {
 	}
 
 	FBufferLocation VB;
-	VB.Address = VertexBuffer->GetGPUAddress();
+	VB.Address = VertexData.GPUAddress;
 	VB.Size = vtxBytesize;
 	VB.Stride = sizeof(ImDrawVert);
 	Stream.SetVB(VB, 0);
 
 	FBufferLocation IB;
-	IB.Address = IndexBuffer->GetGPUAddress();
+	IB.Address = IndexData.GPUAddress;
 	IB.Size = idxBytesize;
 	IB.Stride = sizeof(u16);
 	Stream.SetIB(IB);
@@ -165,6 +169,7 @@ void RenderImDrawLists(ImDrawData *draw_data) {
 	Stream.SetAccess(GetBackbuffer(), EAccessType::WRITE_RT);
 
 	Stream.SetPipelineState(UIPipelineState);
+	Stream.SetTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	Stream.SetConstantBuffer(&UIShaderState.ConstantBuffer, CreateCBVFromData(&UIShaderState.ConstantBuffer, matrix));
 	Stream.SetRenderTarget(GetBackbuffer()->GetRTV(DXGI_FORMAT_R8G8B8A8_UNORM));
 	Stream.SetViewport(GetBackbuffer()->GetSizeAsViewport());
@@ -199,9 +204,9 @@ void RenderImDrawLists(ImDrawData *draw_data) {
 	}
 
 	Stream.Close();
+	// texture and scissor are set per command, mostly to the same values
+	Stream.Compact();
 
-	FGPUContext Context;
-	Context.Open(EContextType::DIRECT);
 	Playback(Context, &Stream);
 	Context.Execute();
 }
@@ -5,50 +5,35 @@
 #include <EASTL\sort.h>
 #include "BVH.h"
 #include "AssertionMacros.h"
+#include "Tasks.h"
+#include "Print.h"
+#include "tiny_obj_loader.h"
 
-u32 FLinearBVH::GetDepth() const {
-	struct FStackElem {
-		u32 Node;
-		u32 Depth;
-	};
-
-	FStackElem Stack[64];
-	i32 StackIndex = -1;
+// SAH costs, relative to ray-triangle test
+const float RAY_BBOX_RATIO = 0.25f;
+const float RAY_TRI_RATIO = 1.f;
 
-	u32 Index = 0;
-	u32 Depth = 1;
+u32 FLinearBVH::GetDepth() const {
+	if (Nodes.empty()) {
+		return 0;
+	}
 
+	// parents come before children, so depth of node is known when loop reaches it, no stack to overflow
+	eastl::vector<u32> Depths(Nodes.size());
+	Depths[0] = 1;
 	u32 MaxDepth = 1;
-
-	while (1) {
-		if (Nodes[Index].PrimitivesNum) {
-			Depth--;
-
-			if (StackIndex >= 0) {
-				Index = Stack[StackIndex].Node;
-				Depth = Stack[StackIndex].Depth;
-				StackIndex--;
-			}
-			else {
-				break;
-			}
-		}
-		else {
-			StackIndex++;
-			Stack[StackIndex].Node = Nodes[Index].SecondChild;
-			Stack[StackIndex].Depth = Depth + 1;
-
-			Depth++;
-			Index = Index + 1;
-
-			MaxDepth = eastl::max(Depth, MaxDepth);
+	for (u32 Index = 0; Index < (u32)Nodes.size(); ++Index) {
+		if (!Nodes[Index].PrimitivesNum) {
+			Depths[Index + 1] = Depths[Index] + 1;
+			Depths[Nodes[Index].SecondChild] = Depths[Index] + 1;
+			MaxDepth = eastl::max(MaxDepth, Depths[Index] + 1);
 		}
 	}
 
 	return MaxDepth;
 }
 
-bool FLinearBVH::CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) {
+bool FLinearBVH::CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const {
 	FRayInv RayInv = FRayInv(Ray);
 	bool DirIsNeg[3] = { Ray.Direction.x < 0, Ray.Direction.y < 0, Ray.Direction.z < 0 };
 
@@ -114,7 +99,7 @@ bool FLinearBVH::CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) {
 	return bHit;
 }
 
-bool FLinearBVH::CastShadowRay(FRay const& Ray) {
+bool FLinearBVH::CastShadowRay(FRay const& Ray) const {
 	FRayInv RayInv = FRayInv(Ray);
 	bool DirIsNeg[3] = { Ray.Direction.x < 0, Ray.Direction.y < 0, Ray.Direction.z < 0 };
 
@@ -175,6 +160,163 @@ bool FLinearBVH::CastShadowRay(FRay const& Ray) {
 	return false;
 }
 
+// spreads low 9 bits, two zero bits between each
+static u32 ExpandBits9(u32 Value) {
+	Value &= 0x1FF;
+	Value = (Value | (Value << 16)) & 0x030000FF;
+	Value = (Value | (Value << 8)) & 0x0300F00F;
+	Value = (Value | (Value << 4)) & 0x030C30C3;
+	Value = (Value | (Value << 2)) & 0x09249249;
+	return Value;
+}
+
+void SortRaysForCoherence(FRay const * Rays, u32 RaysNum, eastl::vector<u32> & OutOrder) {
+	FBBox Bounds = CreateInvalidBBox();
+	for (u32 Index = 0; Index < RaysNum; ++Index) {
+		Bounds.Inflate(Rays[Index].Origin);
+	}
+	float3 Extent = Bounds.VMax - Bounds.VMin;
+	float3 Scale = float3(Extent.x > 0 ? 511.f / Extent.x : 0, Extent.y > 0 ? 511.f / Extent.y : 0, Extent.z > 0 ? 511.f / Extent.z : 0);
+
+	// octant:3 | morton:27 | ray index:32, index keeps sort stable
+	eastl::vector<u64> Keys(RaysNum);
+	ParallelFor(RaysNum, 16 * 1024, [&](u32 Begin, u32 End) {
+		for (u32 Index = Begin; Index < End; ++Index) {
+			float3 Direction = Rays[Index].Direction;
+			float3 Cell = (Rays[Index].Origin - Bounds.VMin) * Scale;
+			u32 Octant = (Direction.x < 0 ? 1 : 0) | (Direction.y < 0 ? 2 : 0) | (Direction.z < 0 ? 4 : 0);
+			u32 Key = (Octant << 27) | ExpandBits9((u32)Cell.x) | (ExpandBits9((u32)Cell.y) << 1) | (ExpandBits9((u32)Cell.z) << 2);
+			Keys[Index] = ((u64)Key << 32) | Index;
+		}
+	});
+	eastl::sort(Keys.begin(), Keys.end());
+
+	OutOrder.resize(RaysNum);
+	for (u32 Index = 0; Index < RaysNum; ++Index) {
+		OutOrder[Index] = (u32)Keys[Index];
+	}
+}
+
+void FLinearBVH::CastRays(FRay const * Rays, FRayHit * OutHits, u32 RaysNum) const {
+	eastl::vector<u32> Order;
+	SortRaysForCoherence(Rays, RaysNum, Order);
+
+	ParallelFor(RaysNum, RAY_BATCH_SIZE, [&](u32 Begin, u32 End) {
+		for (u32 Index = Begin; Index < End; ++Index) {
+			u32 Ray = Order[Index];
+			OutHits[Ray].T = FINF;
+			OutHits[Ray].PrimitiveId = 0xFFFFFFFF;
+			CastRay(Rays[Ray], OutHits[Ray].T, OutHits[Ray].PrimitiveId);
+		}
+	});
+}
+
+void FLinearBVH::CastShadowRays(FRay const * Rays, bool * OutOccluded, u32 RaysNum) const {
+	eastl::vector<u32> Order;
+	SortRaysForCoherence(Rays, RaysNum, Order);
+
+	ParallelFor(RaysNum, RAY_BATCH_SIZE, [&](u32 Begin, u32 End) {
+		for (u32 Index = Begin; Index < End; ++Index) {
+			u32 Ray = Order[Index];
+			OutOccluded[Ray] = CastShadowRay(Rays[Ray]);
+		}
+	});
+}
+
+float FLinearBVH::GetSAHCost() const {
+	if (Nodes.empty()) {
+		return 0;
+	}
+
+	float RootArea = Nodes[0].Bounds.SurfaceArea();
+	RootArea = RootArea > 0 ? RootArea : 1;
+
+	float Cost = 0;
+	for (auto const& Node : Nodes) {
+		float Area = Node.Bounds.SurfaceArea() / RootArea;
+		Cost += Node.PrimitivesNum ? Area * Node.PrimitivesNum * RAY_TRI_RATIO : Area * RAY_BBOX_RATIO;
+	}
+
+	return Cost;
+}
+
+void FLinearBVH::Refit(float3 * NewPositions) {
+	Positions = NewPositions;
+
+	// children are always stored after their parent, reverse order visits them first
+	for (i32 Index = (i32)Nodes.size() - 1; Index >= 0; --Index) {
+		FBVHNode & Node = Nodes[Index];
+		if (Node.PrimitivesNum) {
+			Node.Bounds = CreateInvalidBBox();
+			for (u32 PolygonIndex = 0; PolygonIndex < Node.PrimitivesNum; ++PolygonIndex) {
+				u32 Primitive = Primitives[Node.PrimitivesOffset + PolygonIndex];
+				Node.Bounds.Inflate(Positions[Indices[Primitive * 3]]);
+				Node.Bounds.Inflate(Positions[Indices[Primitive * 3 + 1]]);
+				Node.Bounds.Inflate(Positions[Indices[Primitive * 3 + 2]]);
+			}
+		}
+		else {
+			Node.Bounds = Nodes[Index + 1].Bounds;
+			Node.Bounds.Inflate(Nodes[Node.SecondChild].Bounds);
+		}
+	}
+}
+
+void FLinearBVH::Refit(FBBox const * PrimitiveBounds) {
+	for (i32 Index = (i32)Nodes.size() - 1; Index >= 0; --Index) {
+		FBVHNode & Node = Nodes[Index];
+		if (Node.PrimitivesNum) {
+			Node.Bounds = CreateInvalidBBox();
+			for (u32 PrimitiveIndex = 0; PrimitiveIndex < Node.PrimitivesNum; ++PrimitiveIndex) {
+				Node.Bounds.Inflate(PrimitiveBounds[Primitives[Node.PrimitivesOffset + PrimitiveIndex]]);
+			}
+		}
+		else {
+			Node.Bounds = Nodes[Index + 1].Bounds;
+			Node.Bounds.Inflate(Nodes[Node.SecondChild].Bounds);
+		}
+	}
+}
+
+FDynamicBVH::~FDynamicBVH() {
+	WaitForTasks(RebuildCounter);
+}
+
+void FDynamicBVH::Init(float3 * Positions, u32 PositionsNum, u32 * Indices, u32 IndicesNum) {
+	WaitForTasks(RebuildCounter);
+	bRebuildInFlight = false;
+
+	BuildBVH(Positions, PositionsNum, Indices, IndicesNum, &BVH);
+	SAHCost = BuiltSAHCost = BVH.GetSAHCost();
+}
+
+void FDynamicBVH::Update(float3 * Positions) {
+	if (bRebuildInFlight && RebuildCounter.IsDone()) {
+		// topology of the rebuilt tree is valid for live positions too, refit below catches up with the motion since snapshot
+		// baseline is cost of the fresh tree, measured before swap leaves the degraded one in RebuiltBVH
+		BuiltSAHCost = RebuiltBVH.GetSAHCost();
+		eastl::swap(BVH.Nodes, RebuiltBVH.Nodes);
+		eastl::swap(BVH.Primitives, RebuiltBVH.Primitives);
+		bRebuildInFlight = false;
+		RebuildsNum++;
+	}
+
+	BVH.Refit(Positions);
+	SAHCost = BVH.GetSAHCost();
+
+	if (!bRebuildInFlight && SAHCost > BuiltSAHCost * RebuildThreshold) {
+		RebuildPositions.assign(Positions, Positions + BVH.PositionsNum);
+		bRebuildInFlight = true;
+
+		u32 PositionsNum = BVH.PositionsNum;
+		u32 * Indices = BVH.Indices;
+		u32 IndicesNum = BVH.IndicesNum;
+		SpawnTask(RebuildCounter, [this, PositionsNum, Indices, IndicesNum]() {
+			BuildBVH(RebuildPositions.data(), PositionsNum, Indices, IndicesNum, &RebuiltBVH);
+		});
+	}
+}
+
 enum class EBVHSplitMethod {
 	EQUAL_COUNT,
 	SAH
@@ -259,9 +401,6 @@ public:
 			// compare to mid
 			u32 SplitIndex;
 			if (SplitMethod == EBVHSplitMethod::SAH) {
-				const float RAY_BBOX_RATIO = 0.25f;
-				const float RAY_TRI_RATIO = 1.f;
-
 				const u32 BucketsNum = 16;
 				struct FBucket {
 					u32		Count;
@@ -436,6 +575,354 @@ public:
 	}
 };
 
+class FBinnedBVHBuilder {
+public:
+	static const u32 BucketsNum = 16;
+	// ranges above this build left subtree as a task
+	static const u32 TaskPrimitivesThreshold = 4096;
+	// ranges above this compute bounds and bins in parallel chunks
+	static const u32 ParallelBinningThreshold = 128 * 1024;
+	static const u32 BinningChunkSize = 32 * 1024;
+	static const u32 MaxLeafPrimitives = 16;
+
+	struct FPrimitiveInfo {
+		FBBox	BBox;
+		float3	Centroid;
+		u32		Index;
+	};
+
+	struct FNodeRef {
+		u32 Arena;
+		u32 Index;
+	};
+
+	struct FNode {
+		FBBox		Bounds;
+		FNodeRef	Children[2];
+		u32			FirstPrimitive;
+		u32			PrimitivesNum;
+		u32			SplitAxis;
+	};
+
+	struct FBucket {
+		u32		Count;
+		FBBox	Bounds;
+	};
+
+	struct FBins {
+		FBucket Buckets[BucketsNum];
+	};
+
+	struct FRangeBounds {
+		FBBox Bounds;
+		FBBox CentroidBounds;
+	};
+
+	eastl::vector<FPrimitiveInfo>			Primitives;
+	// one arena per worker, only the owning thread appends to it
+	eastl::vector<eastl::vector<FNode>>		Arenas;
+
+	FNodeRef CreateNode() {
+		u32 Arena = GetCurrentWorkerIndex();
+		Arenas[Arena].push_back();
+		return{ Arena, (u32)Arenas[Arena].size() - 1 };
+	}
+
+	FNode & GetNode(FNodeRef Ref) {
+		return Arenas[Ref.Arena][Ref.Index];
+	}
+
+	FNodeRef CreateLeaf(FBBox const& Bounds, u32 Begin, u32 End) {
+		FNodeRef Ref = CreateNode();
+		FNode & Node = GetNode(Ref);
+		Node.Bounds = Bounds;
+		Node.FirstPrimitive = Begin;
+		Node.PrimitivesNum = End - Begin;
+		Node.SplitAxis = 0;
+		return Ref;
+	}
+
+	// Map(Begin, End, Result) accumulates range into Result, Merge(Result, Partial) combines chunks
+	// Result has to be initialized to identity, it's copied as initial value of every chunk
+	template<typename TResult, typename TMap, typename TMerge>
+	void Reduce(u32 Begin, u32 End, TResult & Result, TMap const& Map, TMerge const& Merge) {
+		u32 Num = End - Begin;
+		if (Num < ParallelBinningThreshold) {
+			Map(Begin, End, Result);
+			return;
+		}
+
+		u32 ChunksNum = (Num + BinningChunkSize - 1) / BinningChunkSize;
+		eastl::vector<TResult> Partials(ChunksNum, Result);
+		ParallelFor(ChunksNum, 1, [&](u32 ChunkBegin, u32 ChunkEnd) {
+			for (u32 Chunk = ChunkBegin; Chunk < ChunkEnd; ++Chunk) {
+				Map(Begin + Chunk * BinningChunkSize, eastl::min(End, Begin + (Chunk + 1) * BinningChunkSize), Partials[Chunk]);
+			}
+		});
+		for (auto const& Partial : Partials) {
+			Merge(Result, Partial);
+		}
+	}
+
+	FRangeBounds ComputeBounds(u32 Begin, u32 End) {
+		FRangeBounds Result = { CreateInvalidBBox(), CreateInvalidBBox() };
+		Reduce(Begin, End, Result,
+			[this](u32 B, u32 E, FRangeBounds & Out) {
+			for (u32 Index = B; Index < E; ++Index) {
+				Out.Bounds.Inflate(Primitives[Index].BBox);
+				Out.CentroidBounds.Inflate(Primitives[Index].Centroid);
+			}
+		},
+			[](FRangeBounds & Out, FRangeBounds const& Partial) {
+			Out.Bounds.Inflate(Partial.Bounds);
+			Out.CentroidBounds.Inflate(Partial.CentroidBounds);
+		});
+		return Result;
+	}
+
+	static u32 GetBucket(float Centroid, float Min, float Scale) {
+		u32 B = (u32)((Centroid - Min) * Scale);
+		return B >= BucketsNum ? BucketsNum - 1 : B;
+	}
+
+	FBins BinPrimitives(u32 Begin, u32 End, u32 Axis, float Min, float Scale) {
+		FBins Result;
+		for (u32 Index = 0; Index < BucketsNum; ++Index) {
+			Result.Buckets[Index].Count = 0;
+			Result.Buckets[Index].Bounds = CreateInvalidBBox();
+		}
+		Reduce(Begin, End, Result,
+			[this, Axis, Min, Scale](u32 B, u32 E, FBins & Out) {
+			for (u32 Index = B; Index < E; ++Index) {
+				FBucket & Bucket = Out.Buckets[GetBucket(Primitives[Index].Centroid[Axis], Min, Scale)];
+				Bucket.Count++;
+				Bucket.Bounds.Inflate(Primitives[Index].BBox);
+			}
+		},
+			[](FBins & Out, FBins const& Partial) {
+			for (u32 Index = 0; Index < BucketsNum; ++Index) {
+				Out.Buckets[Index].Count += Partial.Buckets[Index].Count;
+				Out.Buckets[Index].Bounds.Inflate(Partial.Buckets[Index].Bounds);
+			}
+		});
+		return Result;
+	}
+
+	// single sweep from both ends instead of rebuilding both sides for every split candidate
+	// returns last bucket of left side, OutCost is FINF if every primitive landed in one bucket
+	static u32 FindBestSplit(FBins const& Bins, float ParentArea, float & OutCost) {
+		float RightArea[BucketsNum];
+		u32 RightCount[BucketsNum];
+
+		FBBox Accumulated = CreateInvalidBBox();
+		u32 Count = 0;
+		for (u32 Index = BucketsNum - 1; Index > 0; --Index) {
+			Count += Bins.Buckets[Index].Count;
+			if (Bins.Buckets[Index].Count) {
+				Accumulated.Inflate(Bins.Buckets[Index].Bounds);
+			}
+			RightCount[Index - 1] = Count;
+			RightArea[Index - 1] = Count ? Accumulated.SurfaceArea() : 0;
+		}
+
+		Accumulated = CreateInvalidBBox();
+		Count = 0;
+		OutCost = FINF;
+		u32 SplitBucket = 0;
+		for (u32 Index = 0; Index < BucketsNum - 1; ++Index) {
+			Count += Bins.Buckets[Index].Count;
+			if (Bins.Buckets[Index].Count) {
+				Accumulated.Inflate(Bins.Buckets[Index].Bounds);
+			}
+			if (!Count || !RightCount[Index]) {
+				continue;
+			}
+
+			float Cost = RAY_BBOX_RATIO + RAY_TRI_RATIO * (Count * Accumulated.SurfaceArea() + RightCount[Index] * RightArea[Index]) / ParentArea;
+			if (Cost < OutCost) {
+				OutCost = Cost;
+				SplitBucket = Index;
+			}
+		}
+
+		return SplitBucket;
+	}
+
+	u32 SplitEqualCount(u32 Begin, u32 End, u32 Axis) {
+		u32 SplitIndex = (End - Begin) / 2 + Begin;
+		eastl::nth_element(Primitives.data() + Begin, Primitives.data() + SplitIndex, Primitives.data() + End,
+			[Axis](FPrimitiveInfo const& A, FPrimitiveInfo const& B) { return A.Centroid[Axis] < B.Centroid[Axis]; });
+		return SplitIndex;
+	}
+
+	FNodeRef RecursiveBuild(u32 Begin, u32 End) {
+		check(End > Begin);
+
+		FRangeBounds RangeBounds = ComputeBounds(Begin, End);
+		u32 PrimitivesNum = End - Begin;
+		if (PrimitivesNum == 1) {
+			return CreateLeaf(RangeBounds.Bounds, Begin, End);
+		}
+
+		float3 CentroidsExtent = RangeBounds.CentroidBounds.GetExtent();
+		float MaxExtent = eastl::max(CentroidsExtent.x, eastl::max(CentroidsExtent.y, CentroidsExtent.z));
+		if (MaxExtent == 0) {
+			return CreateLeaf(RangeBounds.Bounds, Begin, End);
+		}
+		u32 SplitAxis = CentroidsExtent.x == MaxExtent ? 0 : (CentroidsExtent.y == MaxExtent ? 1 : 2);
+
+		u32 SplitIndex;
+		if (PrimitivesNum <= 4) {
+			SplitIndex = SplitEqualCount(Begin, End, SplitAxis);
+		}
+		else {
+			float Min = RangeBounds.CentroidBounds.VMin[SplitAxis];
+			float Scale = BucketsNum / (RangeBounds.CentroidBounds.VMax[SplitAxis] - Min);
+			FBins Bins = BinPrimitives(Begin, End, SplitAxis, Min, Scale);
+
+			float ParentArea = RangeBounds.Bounds.SurfaceArea();
+			float MinCost;
+			u32 SplitBucket = FindBestSplit(Bins, ParentArea > 0 ? ParentArea : 1, MinCost);
+
+			if (MinCost >= RAY_TRI_RATIO * PrimitivesNum && PrimitivesNum <= MaxLeafPrimitives) {
+				return CreateLeaf(RangeBounds.Bounds, Begin, End);
+			}
+
+			if (MinCost == FINF) {
+				SplitIndex = SplitEqualCount(Begin, End, SplitAxis);
+			}
+			else {
+				FPrimitiveInfo * Mid = eastl::partition(Primitives.data() + Begin, Primitives.data() + End,
+					[SplitAxis, Min, Scale, SplitBucket](FPrimitiveInfo const& A) {
+					return GetBucket(A.Centroid[SplitAxis], Min, Scale) <= SplitBucket;
+				});
+				SplitIndex = (u32)(Mid - Primitives.data());
+			}
+		}
+		check(SplitIndex > Begin);
+		check(SplitIndex < End);
+
+		// children are written to locals, parent is created after both subtrees are done
+		FNodeRef Children[2];
+		if (PrimitivesNum > TaskPrimitivesThreshold) {
+			FTaskCounter Counter;
+			SpawnTask(Counter, [this, Begin, SplitIndex, &Children]() { Children[0] = RecursiveBuild(Begin, SplitIndex); });
+			Children[1] = RecursiveBuild(SplitIndex, End);
+			WaitForTasks(Counter);
+		}
+		else {
+			Children[0] = RecursiveBuild(Begin, SplitIndex);
+			Children[1] = RecursiveBuild(SplitIndex, End);
+		}
+
+		FNodeRef Ref = CreateNode();
+		FNode & Node = GetNode(Ref);
+		Node.Bounds = RangeBounds.Bounds;
+		Node.Children[0] = Children[0];
+		Node.Children[1] = Children[1];
+		Node.FirstPrimitive = 0;
+		Node.PrimitivesNum = 0;
+		Node.SplitAxis = SplitAxis;
+		return Ref;
+	}
+
+	void Build(float3 * Positions, u32 PositionsNum, u32 * Indices, u32 IndicesNum, u32 PrimitivesNum, FLinearBVH & LBVH) {
+		LBVH.Positions = Positions;
+		LBVH.PositionsNum = PositionsNum;
+		LBVH.Indices = Indices;
+		LBVH.IndicesNum = IndicesNum;
+
+		Primitives.resize(PrimitivesNum);
+		ParallelFor(PrimitivesNum, BinningChunkSize, [&](u32 Begin, u32 End) {
+			for (u32 PrimitiveIndex = Begin; PrimitiveIndex < End; ++PrimitiveIndex) {
+				FPrimitiveInfo & Primitive = Primitives[PrimitiveIndex];
+				Primitive.Index = PrimitiveIndex;
+				Primitive.BBox = FBBox({ Positions[Indices[PrimitiveIndex * 3]], Positions[Indices[PrimitiveIndex * 3 + 1]], Positions[Indices[PrimitiveIndex * 3 + 2]] });
+				Primitive.Centroid = Primitive.BBox.GetCentroid();
+			}
+		});
+
+		BuildNodes(LBVH);
+	}
+
+	void Build(FBBox const * PrimitiveBounds, u32 PrimitivesNum, FLinearBVH & LBVH) {
+		LBVH.Positions = nullptr;
+		LBVH.PositionsNum = 0;
+		LBVH.Indices = nullptr;
+		LBVH.IndicesNum = 0;
+
+		Primitives.resize(PrimitivesNum);
+		for (u32 PrimitiveIndex = 0; PrimitiveIndex < PrimitivesNum; ++PrimitiveIndex) {
+			Primitives[PrimitiveIndex].Index = PrimitiveIndex;
+			Primitives[PrimitiveIndex].BBox = PrimitiveBounds[PrimitiveIndex];
+			Primitives[PrimitiveIndex].Centroid = PrimitiveBounds[PrimitiveIndex].GetCentroid();
+		}
+
+		BuildNodes(LBVH);
+	}
+
+	// builds tree over Primitives and flattens it into LBVH
+	void BuildNodes(FLinearBVH & LBVH) {
+		u32 PrimitivesNum = (u32)Primitives.size();
+		LBVH.Nodes.clear();
+		LBVH.Primitives.clear();
+
+		if (!PrimitivesNum) {
+			return;
+		}
+
+		Arenas.clear();
+		Arenas.resize(GetWorkersNum());
+		for (auto & Arena : Arenas) {
+			Arena.reserve(2 * PrimitivesNum / Arenas.size() + 1);
+		}
+
+		FNodeRef Root = RecursiveBuild(0, PrimitivesNum);
+
+		u32 NodesNum = 0;
+		for (auto const& Arena : Arenas) {
+			NodesNum += (u32)Arena.size();
+		}
+		LBVH.Nodes.reserve(NodesNum);
+		LBVH.Primitives.resize(PrimitivesNum);
+		for (u32 Index = 0; Index < PrimitivesNum; ++Index) {
+			LBVH.Primitives[Index] = Primitives[Index].Index;
+		}
+
+		// depth first, left child follows parent, right child is patched into parent's SecondChild
+		struct FStack {
+			FNodeRef	Node;
+			i32			Parent;
+		};
+
+		eastl::vector<FStack> Stack;
+		Stack.push_back({ Root, -1 });
+		while (!Stack.empty()) {
+			FStack Top = Stack.back();
+			Stack.pop_back();
+
+			FNode const& Node = GetNode(Top.Node);
+			u32 OuterIndex = (u32)LBVH.Nodes.size();
+			if (Top.Parent >= 0) {
+				LBVH.Nodes[Top.Parent].SecondChild = OuterIndex;
+			}
+
+			FBVHNode OuterNode = {};
+			OuterNode.Bounds = Node.Bounds;
+			OuterNode.PrimitivesNum = Node.PrimitivesNum;
+			OuterNode.PrimitivesOffset = Node.FirstPrimitive;
+			OuterNode.SplitAxis = Node.SplitAxis;
+			OuterNode.SecondChild = 0xFFFFFFFF;
+			LBVH.Nodes.push_back(OuterNode);
+
+			if (!Node.PrimitivesNum) {
+				Stack.push_back({ Node.Children[1], (i32)OuterIndex });
+				Stack.push_back({ Node.Children[0], -1 });
+			}
+		}
+	}
+};
+
 /////////////////////////////////////////
 
 //#include "ModelHelpers.h"
@@ -448,6 +935,117 @@ void BuildBVH(FEditorMesh * Mesh, FLinearBVH * BVH) {
 		Mesh->GetIndicesNum() / 3, *BVH);*/
 }
 
+void BuildBVH(float3 * Positions, u32 PositionsNum, u32 * Indices, u32 IndicesNum, FLinearBVH * BVH, EBVHBuildMode Mode) {
+	if (Mode == EBVHBuildMode::Reference) {
+		FBVHBuilder Builder;
+		Builder.Build(Positions, PositionsNum, Indices, IndicesNum, IndicesNum / 3, *BVH);
+	}
+	else {
+		FBinnedBVHBuilder Builder;
+		Builder.Build(Positions, PositionsNum, Indices, IndicesNum, IndicesNum / 3, *BVH);
+	}
+}
+
+void BuildBVH(FBBox const * PrimitiveBounds, u32 PrimitivesNum, FLinearBVH * BVH) {
+	FBinnedBVHBuilder Builder;
+	Builder.Build(PrimitiveBounds, PrimitivesNum, *BVH);
+}
+
+void ForEachObjMesh(const wchar_t * Directory, eastl::function<void(const wchar_t *, eastl::vector<float3> &, eastl::vector<u32> &)> const& Func) {
+	eastl::wstring SearchPath = eastl::wstring(Directory) + L"*.obj";
+	WIN32_FIND_DATAW FindData;
+	HANDLE FindHandle = FindFirstFileW(SearchPath.c_str(), &FindData);
+	if (FindHandle == INVALID_HANDLE_VALUE) {
+		PrintFormated(L"No .obj files in %s\n", Directory);
+		return;
+	}
+
+	do {
+		eastl::string Filename = ConvertToString(eastl::wstring(Directory) + FindData.cFileName);
+
+		tinyobj::attrib_t Attrib;
+		std::vector<tinyobj::shape_t> Shapes;
+		std::vector<tinyobj::material_t> Materials;
+		std::string Error;
+		if (!tinyobj::LoadObj(&Attrib, &Shapes, &Materials, &Error, Filename.c_str(), ConvertToString(Directory).c_str())) {
+			PrintFormated(L"Failed to load %s\n", FindData.cFileName);
+			continue;
+		}
+
+		eastl::vector<float3> Positions(Attrib.vertices.size() / 3);
+		memcpy(Positions.data(), Attrib.vertices.data(), Positions.size() * sizeof(float3));
+		eastl::vector<u32> Indices;
+		for (auto const& Shape : Shapes) {
+			for (auto const& Index : Shape.mesh.indices) {
+				Indices.push_back((u32)Index.vertex_index);
+			}
+		}
+
+		Func(FindData.cFileName, Positions, Indices);
+	} while (FindNextFileW(FindHandle, &FindData));
+
+	FindClose(FindHandle);
+}
+
+void BenchmarkBVHBuild(const wchar_t * Directory) {
+	ForEachObjMesh(Directory, [](const wchar_t * Name, eastl::vector<float3> & Positions, eastl::vector<u32> & Indices) {
+		const EBVHBuildMode Modes[] = { EBVHBuildMode::Reference, EBVHBuildMode::BinnedParallel };
+		const wchar_t * ModeNames[] = { L"reference", L"binned parallel" };
+		for (u32 ModeIndex = 0; ModeIndex < _countof(Modes); ++ModeIndex) {
+			FLinearBVH BVH;
+			i64 StartTicks = GetCpuTicks();
+			BuildBVH(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size(), &BVH, Modes[ModeIndex]);
+			double Milliseconds = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+			PrintFormated(L"%s [%s]: %u triangles, %.2f ms, SAH cost %.2f, %u nodes, depth %u\n",
+				Name, ModeNames[ModeIndex], (u32)Indices.size() / 3, Milliseconds, BVH.GetSAHCost(), (u32)BVH.Nodes.size(), BVH.GetDepth());
+		}
+	});
+}
+
+
+void BenchmarkBVHRefit(const wchar_t * Directory) {
+	ForEachObjMesh(Directory, [](const wchar_t * Name, eastl::vector<float3> & Positions, eastl::vector<u32> & Indices) {
+		eastl::vector<float3> RestPositions = Positions;
+		FBBox Bounds = CreateInvalidBBox();
+		for (float3 P : RestPositions) {
+			Bounds.Inflate(P);
+		}
+		float3 Extent = Bounds.GetExtent();
+		float Amplitude = eastl::max(Extent.x, eastl::max(Extent.y, Extent.z)) * 0.1f;
+
+		FDynamicBVH DynamicBVH;
+		DynamicBVH.Init(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size());
+
+		const u32 FramesNum = 120;
+		double RefitMs = 0;
+		double RebuildMs = 0;
+		float RebuildSAHCost = 0;
+		for (u32 Frame = 0; Frame < FramesNum; ++Frame) {
+			// travelling wave along x, shears the mesh enough to degrade refitted bounds over time
+			float Phase = Frame * 0.1f;
+			for (u32 Index = 0; Index < Positions.size(); ++Index) {
+				float3 P = RestPositions[Index];
+				P.y += sinf(P.x / Amplitude + Phase) * Amplitude * (Frame / (float)FramesNum);
+				Positions[Index] = P;
+			}
+
+			i64 StartTicks = GetCpuTicks();
+			DynamicBVH.Update(Positions.data());
+			RefitMs += CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+			FLinearBVH Rebuilt;
+			StartTicks = GetCpuTicks();
+			BuildBVH(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size(), &Rebuilt);
+			RebuildMs += CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+			RebuildSAHCost = Rebuilt.GetSAHCost();
+		}
+
+		PrintFormated(L"%s: %u frames, refit %.3f ms/frame, full rebuild %.3f ms/frame, last SAH cost refit %.2f rebuild %.2f, %u background rebuilds\n",
+			Name, FramesNum, RefitMs / FramesNum, RebuildMs / FramesNum, DynamicBVH.GetSAHCost(), RebuildSAHCost, DynamicBVH.GetRebuildsNum());
+	});
+}
+
 
 
 ////////////////////
@@ -2,6 +2,8 @@
 #include "Essence.h"
 #include "MathMatrix.h"
 #include "MathGeometry.h"
+#include <EASTL/functional.h>
+#include "Tasks.h"
 class FEditorMesh;
 class FGPUContext;
 struct FRenderViewport;
@@ -14,6 +16,15 @@ struct FBVHNode {
 	u32		SplitAxis;
 };
 
+struct FRayHit {
+	// FINF on miss
+	float	T;
+	u32		PrimitiveId;
+};
+
+// rays per task in batch queries
+const u32 RAY_BATCH_SIZE = 1024;
+
 class FLinearBVH {
 public:
 	eastl::vector<FBVHNode>	Nodes;
@@ -24,8 +35,72 @@ public:
 	u32						IndicesNum;
 
 	u32 GetDepth() const;
-	bool CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId);
-	bool CastShadowRay(FRay const& Ray);
+	bool CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const;
+	bool CastShadowRay(FRay const& Ray) const;
+	// batches are sorted for coherence and split across task workers
+	// results are written at the index of their ray, nothing is allocated per ray
+	void CastRays(FRay const * Rays, FRayHit * OutHits, u32 RaysNum) const;
+	void CastShadowRays(FRay const * Rays, bool * OutOccluded, u32 RaysNum) const;
+	// expected traversal cost relative to root, lower is better
+	float GetSAHCost() const;
+	// recomputes bounds bottom-up in place for moved vertices, topology and indices stay the same
+	// pass the current positions (can be the same buffer as before)
+	void Refit(float3 * NewPositions);
+	// same for BVH built over bounds, PrimitiveBounds are indexed by primitive id
+	void Refit(FBBox const * PrimitiveBounds);
+};
+
+// BVH for deforming meshes, refitted every update and rebuilt in background once the refitted tree degrades
+class FDynamicBVH {
+public:
+	// rebuild once SAH cost grows past this ratio of cost right after the last build
+	float					RebuildThreshold = 1.5f;
+
+	FDynamicBVH() = default;
+	FDynamicBVH(FDynamicBVH const&) = delete;
+	~FDynamicBVH();
+
+	void Init(float3 * Positions, u32 PositionsNum, u32 * Indices, u32 IndicesNum);
+	// call after positions changed, swaps in finished rebuild, refits and checks quality
+	void Update(float3 * Positions);
+
+	FLinearBVH const& GetBVH() const { return BVH; }
+	float GetSAHCost() const { return SAHCost; }
+	float GetBuiltSAHCost() const { return BuiltSAHCost; }
+	bool IsRebuildInFlight() const { return bRebuildInFlight; }
+	u32 GetRebuildsNum() const { return RebuildsNum; }
+
+private:
+	FLinearBVH				BVH;
+	float					SAHCost = 0;
+	float					BuiltSAHCost = 0;
+	u32						RebuildsNum = 0;
+
+	// background rebuild works on a snapshot, live positions keep changing meanwhile
+	FTaskCounter			RebuildCounter;
+	FLinearBVH				RebuiltBVH;
+	eastl::vector<float3>	RebuildPositions;
+	bool					bRebuildInFlight = false;
+};
+
+// ray indices grouped by direction octant, then by origin along a Morton curve
+void SortRaysForCoherence(FRay const * Rays, u32 RaysNum, eastl::vector<u32> & OutOrder);
+
+enum class EBVHBuildMode {
+	Reference,		// serial recursive builder
+	BinnedParallel	// binned SAH with O(n) bucket sweep, subtrees built as tasks
 };
 
-void BuildBVH(FEditorMesh * Mesh, FLinearBVH * BVH);
\ No newline at end of file
+void BuildBVH(FEditorMesh * Mesh, FLinearBVH * BVH);
+// Positions and Indices are referenced, not copied, they have to outlive the BVH
+void BuildBVH(float3 * Positions, u32 PositionsNum, u32 * Indices, u32 IndicesNum, FLinearBVH * BVH, EBVHBuildMode Mode = EBVHBuildMode::BinnedParallel);
+// BVH over arbitrary bounds (instances, actors), only nodes and primitive ids are valid, triangle queries can't be used
+void BuildBVH(FBBox const * PrimitiveBounds, u32 PrimitivesNum, FLinearBVH * BVH);
+
+// calls Func(Name, Positions, Indices) for every .obj in Directory, used to feed benchmarks with test meshes
+void ForEachObjMesh(const wchar_t * Directory, eastl::function<void(const wchar_t *, eastl::vector<float3> &, eastl::vector<u32> &)> const& Func);
+
+// builds every .obj in Directory with each build mode, prints build time and SAH cost
+void BenchmarkBVHBuild(const wchar_t * Directory);
+// deforms every .obj in Directory over frames, compares refit against full rebuild
+void BenchmarkBVHRefit(const wchar_t * Directory);
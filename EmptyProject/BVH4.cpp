@@ -0,0 +1,772 @@
+#include "BVH4.h"
+#include "AssertionMacros.h"
+#include "MathFunctions.h"
+#include "Print.h"
+#include "Tasks.h"
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// fixed stack covers sane trees, deeper ones take it from heap
+const u32 BVH4_STACK_SIZE = 256;
+
+void FRayPacket8::SetRay(u32 Index, FRay const& Ray, float MaxT) {
+	check(Index < 8);
+	OriginX[Index] = Ray.Origin.x;
+	OriginY[Index] = Ray.Origin.y;
+	OriginZ[Index] = Ray.Origin.z;
+	DirectionX[Index] = Ray.Direction.x;
+	DirectionY[Index] = Ray.Direction.y;
+	DirectionZ[Index] = Ray.Direction.z;
+	MinT[Index] = MaxT;
+	PrimitiveId[Index] = 0xFFFFFFFF;
+}
+
+void FLinearBVH4::Build(FLinearBVH const& BVH) {
+	Nodes.clear();
+	Triangles.clear();
+	Depth = 0;
+
+	if (BVH.Nodes.empty()) {
+		return;
+	}
+
+	struct FWorkItem {
+		u32 Source;
+		u32 Node;
+		u32 Depth;
+	};
+
+	eastl::vector<FWorkItem> Work;
+	Nodes.push_back();
+	Work.push_back({ 0, 0, 1 });
+
+	while (!Work.empty()) {
+		FWorkItem Item = Work.back();
+		Work.pop_back();
+		Depth = eastl::max(Depth, Item.Depth);
+
+		u32 Sources[4];
+		u32 SourcesNum = 0;
+		if (BVH.Nodes[Item.Source].PrimitivesNum) {
+			Sources[SourcesNum++] = Item.Source;
+		}
+		else {
+			Sources[SourcesNum++] = Item.Source + 1;
+			Sources[SourcesNum++] = BVH.Nodes[Item.Source].SecondChild;
+		}
+
+		// open the largest inner child until node is full, keeps children in source order
+		while (SourcesNum < 4) {
+			i32 Largest = -1;
+			float LargestArea = -1;
+			for (u32 Index = 0; Index < SourcesNum; ++Index) {
+				FBVHNode const& Child = BVH.Nodes[Sources[Index]];
+				if (!Child.PrimitivesNum && Child.Bounds.SurfaceArea() > LargestArea) {
+					LargestArea = Child.Bounds.SurfaceArea();
+					Largest = (i32)Index;
+				}
+			}
+
+			if (Largest < 0) {
+				break;
+			}
+
+			u32 Opened = Sources[Largest];
+			for (u32 Index = SourcesNum; Index > (u32)Largest + 1; --Index) {
+				Sources[Index] = Sources[Index - 1];
+			}
+			Sources[Largest] = Opened + 1;
+			Sources[Largest + 1] = BVH.Nodes[Opened].SecondChild;
+			SourcesNum++;
+		}
+
+		for (u32 Slot = 0; Slot < 4; ++Slot) {
+			FBBox Bounds = CreateInvalidBBox();
+			u32 Child = BVH4_EMPTY;
+			u32 GroupsNum = 0;
+
+			if (Slot < SourcesNum) {
+				FBVHNode const& Source = BVH.Nodes[Sources[Slot]];
+				Bounds = Source.Bounds;
+
+				if (Source.PrimitivesNum) {
+					u32 FirstGroup = (u32)Triangles.size();
+					GroupsNum = (Source.PrimitivesNum + 3) / 4;
+					Triangles.resize(FirstGroup + GroupsNum);
+					memset(&Triangles[FirstGroup], 0, sizeof(FBVH4Triangles) * GroupsNum);
+
+					for (u32 Index = 0; Index < Source.PrimitivesNum; ++Index) {
+						u32 Primitive = BVH.Primitives[Source.PrimitivesOffset + Index];
+						float3 P0 = BVH.Positions[BVH.Indices[Primitive * 3]];
+						float3 E1 = BVH.Positions[BVH.Indices[Primitive * 3 + 1]] - P0;
+						float3 E2 = BVH.Positions[BVH.Indices[Primitive * 3 + 2]] - P0;
+
+						FBVH4Triangles & Group = Triangles[FirstGroup + Index / 4];
+						u32 Lane = Index % 4;
+						Group.P0X[Lane] = P0.x;
+						Group.P0Y[Lane] = P0.y;
+						Group.P0Z[Lane] = P0.z;
+						Group.E1X[Lane] = E1.x;
+						Group.E1Y[Lane] = E1.y;
+						Group.E1Z[Lane] = E1.z;
+						Group.E2X[Lane] = E2.x;
+						Group.E2Y[Lane] = E2.y;
+						Group.E2Z[Lane] = E2.z;
+						Group.Primitive[Lane] = Primitive;
+					}
+
+					Child = BVH4_LEAF_FLAG | FirstGroup;
+				}
+				else {
+					Child = (u32)Nodes.size();
+					Nodes.push_back();
+					Work.push_back({ Sources[Slot], Child, Item.Depth + 1 });
+				}
+			}
+
+			// fetched after push_back, Nodes can reallocate
+			FBVH4Node & Node = Nodes[Item.Node];
+			Node.MinX[Slot] = Bounds.VMin.x;
+			Node.MinY[Slot] = Bounds.VMin.y;
+			Node.MinZ[Slot] = Bounds.VMin.z;
+			Node.MaxX[Slot] = Bounds.VMax.x;
+			Node.MaxY[Slot] = Bounds.VMax.y;
+			Node.MaxZ[Slot] = Bounds.VMax.z;
+			Node.Children[Slot] = Child;
+			Node.GroupsNum[Slot] = GroupsNum;
+		}
+	}
+}
+
+struct FSimdRay {
+	__m128	OriginX;
+	__m128	OriginY;
+	__m128	OriginZ;
+	__m128	DirectionX;
+	__m128	DirectionY;
+	__m128	DirectionZ;
+	__m128	InvDirectionX;
+	__m128	InvDirectionY;
+	__m128	InvDirectionZ;
+};
+
+// same ray in every lane
+static FSimdRay CreateSimdRay(float3 Origin, float3 Direction) {
+	FSimdRay Result;
+	Result.OriginX = _mm_set1_ps(Origin.x);
+	Result.OriginY = _mm_set1_ps(Origin.y);
+	Result.OriginZ = _mm_set1_ps(Origin.z);
+	Result.DirectionX = _mm_set1_ps(Direction.x);
+	Result.DirectionY = _mm_set1_ps(Direction.y);
+	Result.DirectionZ = _mm_set1_ps(Direction.z);
+	Result.InvDirectionX = _mm_set1_ps(1.f / Direction.x);
+	Result.InvDirectionY = _mm_set1_ps(1.f / Direction.y);
+	Result.InvDirectionZ = _mm_set1_ps(1.f / Direction.z);
+	return Result;
+}
+
+// 4 rays of packet starting at First, one per lane
+static FSimdRay LoadSimdRays(FRayPacket8 const& Packet, u32 First) {
+	const __m128 One = _mm_set1_ps(1.f);
+
+	FSimdRay Result;
+	Result.OriginX = _mm_load_ps(Packet.OriginX + First);
+	Result.OriginY = _mm_load_ps(Packet.OriginY + First);
+	Result.OriginZ = _mm_load_ps(Packet.OriginZ + First);
+	Result.DirectionX = _mm_load_ps(Packet.DirectionX + First);
+	Result.DirectionY = _mm_load_ps(Packet.DirectionY + First);
+	Result.DirectionZ = _mm_load_ps(Packet.DirectionZ + First);
+	Result.InvDirectionX = _mm_div_ps(One, Result.DirectionX);
+	Result.InvDirectionY = _mm_div_ps(One, Result.DirectionY);
+	Result.InvDirectionZ = _mm_div_ps(One, Result.DirectionZ);
+	return Result;
+}
+
+static inline __m128 Dot3(__m128 AX, __m128 AY, __m128 AZ, __m128 BX, __m128 BY, __m128 BZ) {
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(AX, BX), _mm_mul_ps(AY, BY)), _mm_mul_ps(AZ, BZ));
+}
+
+// one ray against 4 children, DirIsNeg picks near/far planes so empty slots (inverted bounds) always miss
+static inline int IntersectNode(FBVH4Node const& Node, FSimdRay const& Ray, const bool DirIsNeg[3], __m128 MaxT, __m128 & OutTNear) {
+	__m128 TNearX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[0] ? Node.MaxX : Node.MinX), Ray.OriginX), Ray.InvDirectionX);
+	__m128 TNearY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[1] ? Node.MaxY : Node.MinY), Ray.OriginY), Ray.InvDirectionY);
+	__m128 TNearZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[2] ? Node.MaxZ : Node.MinZ), Ray.OriginZ), Ray.InvDirectionZ);
+	__m128 TFarX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[0] ? Node.MinX : Node.MaxX), Ray.OriginX), Ray.InvDirectionX);
+	__m128 TFarY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[1] ? Node.MinY : Node.MaxY), Ray.OriginY), Ray.InvDirectionY);
+	__m128 TFarZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(DirIsNeg[2] ? Node.MinZ : Node.MaxZ), Ray.OriginZ), Ray.InvDirectionZ);
+
+	__m128 TNear = _mm_max_ps(_mm_max_ps(TNearX, TNearY), _mm_max_ps(TNearZ, _mm_setzero_ps()));
+	__m128 TFar = _mm_min_ps(_mm_min_ps(TFarX, TFarY), _mm_min_ps(TFarZ, MaxT));
+
+	OutTNear = TNear;
+	return _mm_movemask_ps(_mm_cmple_ps(TNear, TFar));
+}
+
+// one child box against 4 rays with mixed directions, caller masks out empty slots
+static inline int IntersectBox(FBVH4Node const& Node, u32 Slot, FSimdRay const& Rays, __m128 MaxT, __m128 & OutTNear) {
+	__m128 T0X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MinX[Slot]), Rays.OriginX), Rays.InvDirectionX);
+	__m128 T0Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MinY[Slot]), Rays.OriginY), Rays.InvDirectionY);
+	__m128 T0Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MinZ[Slot]), Rays.OriginZ), Rays.InvDirectionZ);
+	__m128 T1X = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MaxX[Slot]), Rays.OriginX), Rays.InvDirectionX);
+	__m128 T1Y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MaxY[Slot]), Rays.OriginY), Rays.InvDirectionY);
+	__m128 T1Z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(Node.MaxZ[Slot]), Rays.OriginZ), Rays.InvDirectionZ);
+
+	__m128 TNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(T0X, T1X), _mm_min_ps(T0Y, T1Y)), _mm_max_ps(_mm_min_ps(T0Z, T1Z), _mm_setzero_ps()));
+	__m128 TFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(T0X, T1X), _mm_max_ps(T0Y, T1Y)), _mm_min_ps(_mm_max_ps(T0Z, T1Z), MaxT));
+
+	OutTNear = TNear;
+	return _mm_movemask_ps(_mm_cmple_ps(TNear, TFar));
+}
+
+// one ray against 4 triangles, same operations as RayTriangleIntersection (back faces are culled)
+// returns mask of lanes hit closer than MaxT
+static inline int IntersectTriangles(FBVH4Triangles const& Group, FSimdRay const& Ray, __m128 MaxT, __m128 & OutT) {
+	const __m128 Epsilon = _mm_set1_ps(0.000001f);
+	const __m128 Zero = _mm_setzero_ps();
+	const __m128 One = _mm_set1_ps(1.f);
+
+	__m128 E1X = _mm_load_ps(Group.E1X);
+	__m128 E1Y = _mm_load_ps(Group.E1Y);
+	__m128 E1Z = _mm_load_ps(Group.E1Z);
+	__m128 E2X = _mm_load_ps(Group.E2X);
+	__m128 E2Y = _mm_load_ps(Group.E2Y);
+	__m128 E2Z = _mm_load_ps(Group.E2Z);
+
+	__m128 PX = _mm_sub_ps(_mm_mul_ps(Ray.DirectionY, E2Z), _mm_mul_ps(Ray.DirectionZ, E2Y));
+	__m128 PY = _mm_sub_ps(_mm_mul_ps(Ray.DirectionZ, E2X), _mm_mul_ps(Ray.DirectionX, E2Z));
+	__m128 PZ = _mm_sub_ps(_mm_mul_ps(Ray.DirectionX, E2Y), _mm_mul_ps(Ray.DirectionY, E2X));
+	__m128 Det = Dot3(E1X, E1Y, E1Z, PX, PY, PZ);
+	__m128 DetRcp = _mm_div_ps(One, Det);
+
+	__m128 TX = _mm_sub_ps(Ray.OriginX, _mm_load_ps(Group.P0X));
+	__m128 TY = _mm_sub_ps(Ray.OriginY, _mm_load_ps(Group.P0Y));
+	__m128 TZ = _mm_sub_ps(Ray.OriginZ, _mm_load_ps(Group.P0Z));
+	__m128 U = _mm_mul_ps(Dot3(TX, TY, TZ, PX, PY, PZ), DetRcp);
+
+	__m128 QX = _mm_sub_ps(_mm_mul_ps(TY, E1Z), _mm_mul_ps(TZ, E1Y));
+	__m128 QY = _mm_sub_ps(_mm_mul_ps(TZ, E1X), _mm_mul_ps(TX, E1Z));
+	__m128 QZ = _mm_sub_ps(_mm_mul_ps(TX, E1Y), _mm_mul_ps(TY, E1X));
+	__m128 V = _mm_mul_ps(Dot3(Ray.DirectionX, Ray.DirectionY, Ray.DirectionZ, QX, QY, QZ), DetRcp);
+	__m128 T = _mm_mul_ps(Dot3(E2X, E2Y, E2Z, QX, QY, QZ), DetRcp);
+
+	__m128 Valid = _mm_cmpge_ps(Det, Epsilon);
+	Valid = _mm_and_ps(Valid, _mm_and_ps(_mm_cmpge_ps(U, Zero), _mm_cmple_ps(U, One)));
+	Valid = _mm_and_ps(Valid, _mm_and_ps(_mm_cmpge_ps(V, Zero), _mm_cmple_ps(_mm_add_ps(U, V), One)));
+	Valid = _mm_and_ps(Valid, _mm_and_ps(_mm_cmpgt_ps(T, Epsilon), _mm_cmplt_ps(T, MaxT)));
+
+	OutT = T;
+	return _mm_movemask_ps(Valid);
+}
+
+// updates closest hit from lanes in Mask, lower lane wins ties like the scalar loop
+static inline bool ResolveClosestHit(FBVH4Triangles const& Group, int Mask, __m128 T, float & MinT, u32 & PrimitiveId) {
+	alignas(16) float TValues[4];
+	_mm_store_ps(TValues, T);
+
+	bool bHit = false;
+	for (u32 Lane = 0; Lane < 4; ++Lane) {
+		if ((Mask & (1 << Lane)) && TValues[Lane] < MinT) {
+			MinT = TValues[Lane];
+			PrimitiveId = Group.Primitive[Lane];
+			bHit = true;
+		}
+	}
+	return bHit;
+}
+
+struct FBVH4StackEntry {
+	u32		Child;
+	u32		GroupsNum;
+	// TNear for single rays, ray mask for packets
+	union {
+		float	TNear;
+		u32		RayMask;
+	};
+};
+
+struct FBVH4Stack {
+	FBVH4StackEntry						Local[BVH4_STACK_SIZE];
+	eastl::vector<FBVH4StackEntry>		Heap;
+	FBVH4StackEntry *					Elems = Local;
+
+	explicit FBVH4Stack(u32 Depth) {
+		u32 Size = Depth * 3 + 1;
+		if (Size > BVH4_STACK_SIZE) {
+			Heap.resize(Size);
+			Elems = Heap.data();
+		}
+	}
+};
+
+// pushes hit children farthest first, so the nearest one is popped next
+static inline void PushChildren(FBVH4StackEntry * Stack, u32 & StackSize, FBVH4Node const& Node, const u32 RayMasks[4], const float TNear[4]) {
+	u32 Order[4];
+	u32 OrderNum = 0;
+	for (u32 Slot = 0; Slot < 4; ++Slot) {
+		if (!RayMasks[Slot]) {
+			continue;
+		}
+
+		u32 Index = OrderNum++;
+		while (Index > 0 && TNear[Order[Index - 1]] < TNear[Slot]) {
+			Order[Index] = Order[Index - 1];
+			--Index;
+		}
+		Order[Index] = Slot;
+	}
+
+	for (u32 Index = 0; Index < OrderNum; ++Index) {
+		u32 Slot = Order[Index];
+		Stack[StackSize].Child = Node.Children[Slot];
+		Stack[StackSize].GroupsNum = Node.GroupsNum[Slot];
+		Stack[StackSize].RayMask = RayMasks[Slot];
+		StackSize++;
+	}
+}
+
+static inline void PushChildren(FBVH4StackEntry * Stack, u32 & StackSize, FBVH4Node const& Node, int Mask, __m128 TNear) {
+	alignas(16) float TNearValues[4];
+	_mm_store_ps(TNearValues, TNear);
+
+	u32 First = StackSize;
+	for (u32 Slot = 0; Slot < 4; ++Slot) {
+		if (!(Mask & (1 << Slot))) {
+			continue;
+		}
+
+		FBVH4StackEntry Entry;
+		Entry.Child = Node.Children[Slot];
+		Entry.GroupsNum = Node.GroupsNum[Slot];
+		Entry.TNear = TNearValues[Slot];
+
+		u32 Index = StackSize++;
+		while (Index > First && Stack[Index - 1].TNear < Entry.TNear) {
+			Stack[Index] = Stack[Index - 1];
+			--Index;
+		}
+		Stack[Index] = Entry;
+	}
+}
+
+bool FLinearBVH4::CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const {
+	if (Nodes.empty()) {
+		return false;
+	}
+
+	FSimdRay SimdRay = CreateSimdRay(Ray.Origin, Ray.Direction);
+	float3 InvDirection = 1.f / Ray.Direction;
+	bool DirIsNeg[3] = { InvDirection.x < 0, InvDirection.y < 0, InvDirection.z < 0 };
+
+	FBVH4Stack StackStorage(Depth);
+	FBVH4StackEntry * Stack = StackStorage.Elems;
+	u32 StackSize = 0;
+	Stack[StackSize].Child = 0;
+	Stack[StackSize].GroupsNum = 0;
+	Stack[StackSize].TNear = 0;
+	StackSize++;
+
+	bool bHit = false;
+	while (StackSize) {
+		FBVH4StackEntry Entry = Stack[--StackSize];
+		if (Entry.TNear > MinT) {
+			continue;
+		}
+
+		if (Entry.Child & BVH4_LEAF_FLAG) {
+			u32 FirstGroup = Entry.Child & ~BVH4_LEAF_FLAG;
+			for (u32 Group = FirstGroup; Group < FirstGroup + Entry.GroupsNum; ++Group) {
+				__m128 T;
+				int Mask = IntersectTriangles(Triangles[Group], SimdRay, _mm_set1_ps(MinT), T);
+				if (Mask) {
+					bHit |= ResolveClosestHit(Triangles[Group], Mask, T, MinT, PrimitiveId);
+				}
+			}
+			continue;
+		}
+
+		FBVH4Node const& Node = Nodes[Entry.Child];
+		__m128 TNear;
+		int Mask = IntersectNode(Node, SimdRay, DirIsNeg, _mm_set1_ps(MinT), TNear);
+		PushChildren(Stack, StackSize, Node, Mask, TNear);
+	}
+
+	return bHit;
+}
+
+bool FLinearBVH4::CastShadowRay(FRay const& Ray, float MaxT) const {
+	if (Nodes.empty()) {
+		return false;
+	}
+
+	FSimdRay SimdRay = CreateSimdRay(Ray.Origin, Ray.Direction);
+	float3 InvDirection = 1.f / Ray.Direction;
+	bool DirIsNeg[3] = { InvDirection.x < 0, InvDirection.y < 0, InvDirection.z < 0 };
+	__m128 SimdMaxT = _mm_set1_ps(MaxT);
+
+	FBVH4Stack StackStorage(Depth);
+	FBVH4StackEntry * Stack = StackStorage.Elems;
+	u32 StackSize = 0;
+	Stack[StackSize].Child = 0;
+	Stack[StackSize].GroupsNum = 0;
+	StackSize++;
+
+	while (StackSize) {
+		FBVH4StackEntry Entry = Stack[--StackSize];
+		u32 Child = Entry.Child;
+
+		if (Child & BVH4_LEAF_FLAG) {
+			u32 FirstGroup = Child & ~BVH4_LEAF_FLAG;
+			for (u32 Group = FirstGroup; Group < FirstGroup + Entry.GroupsNum; ++Group) {
+				__m128 T;
+				if (IntersectTriangles(Triangles[Group], SimdRay, SimdMaxT, T)) {
+					return true;
+				}
+			}
+			continue;
+		}
+
+		// any hit is enough, children order doesn't matter
+		FBVH4Node const& Node = Nodes[Child];
+		__m128 TNear;
+		int Mask = IntersectNode(Node, SimdRay, DirIsNeg, SimdMaxT, TNear);
+		for (u32 Slot = 0; Slot < 4; ++Slot) {
+			if (Mask & (1 << Slot)) {
+				Stack[StackSize].Child = Node.Children[Slot];
+				Stack[StackSize].GroupsNum = Node.GroupsNum[Slot];
+				StackSize++;
+			}
+		}
+	}
+
+	return false;
+}
+
+// 8 rays against every child of node, returns per-child masks of rays that hit it
+static inline void IntersectNodePacket(FBVH4Node const& Node, FSimdRay const Rays[2], __m128 const MaxT[2], u32 ActiveMask, u32 OutRayMasks[4], float OutTNear[4]) {
+	for (u32 Slot = 0; Slot < 4; ++Slot) {
+		OutRayMasks[Slot] = 0;
+		OutTNear[Slot] = FINF;
+		if (Node.Children[Slot] == BVH4_EMPTY) {
+			continue;
+		}
+
+		alignas(16) float TNearValues[8];
+		__m128 TNear;
+		u32 Mask = IntersectBox(Node, Slot, Rays[0], MaxT[0], TNear);
+		_mm_store_ps(TNearValues, TNear);
+		Mask |= IntersectBox(Node, Slot, Rays[1], MaxT[1], TNear) << 4;
+		_mm_store_ps(TNearValues + 4, TNear);
+
+		Mask &= ActiveMask;
+		OutRayMasks[Slot] = Mask;
+		for (u32 Ray = 0; Ray < 8; ++Ray) {
+			if (Mask & (1 << Ray)) {
+				OutTNear[Slot] = eastl::min(OutTNear[Slot], TNearValues[Ray]);
+			}
+		}
+	}
+}
+
+u32 FLinearBVH4::CastRays(FRayPacket8 & Packet, u32 ActiveMask) const {
+	ActiveMask &= 0xFF;
+	if (Nodes.empty() || !ActiveMask) {
+		return 0;
+	}
+
+	FSimdRay Rays[2] = { LoadSimdRays(Packet, 0), LoadSimdRays(Packet, 4) };
+	FSimdRay SingleRays[8];
+	for (u32 Ray = 0; Ray < 8; ++Ray) {
+		SingleRays[Ray] = CreateSimdRay(
+			float3(Packet.OriginX[Ray], Packet.OriginY[Ray], Packet.OriginZ[Ray]),
+			float3(Packet.DirectionX[Ray], Packet.DirectionY[Ray], Packet.DirectionZ[Ray]));
+	}
+
+	FBVH4Stack StackStorage(Depth);
+	FBVH4StackEntry * Stack = StackStorage.Elems;
+	u32 StackSize = 0;
+	Stack[StackSize].Child = 0;
+	Stack[StackSize].GroupsNum = 0;
+	Stack[StackSize].RayMask = ActiveMask;
+	StackSize++;
+
+	u32 HitMask = 0;
+	while (StackSize) {
+		FBVH4StackEntry Entry = Stack[--StackSize];
+
+		if (Entry.Child & BVH4_LEAF_FLAG) {
+			u32 FirstGroup = Entry.Child & ~BVH4_LEAF_FLAG;
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				if (!(Entry.RayMask & (1 << Ray))) {
+					continue;
+				}
+				for (u32 Group = FirstGroup; Group < FirstGroup + Entry.GroupsNum; ++Group) {
+					__m128 T;
+					int Mask = IntersectTriangles(Triangles[Group], SingleRays[Ray], _mm_set1_ps(Packet.MinT[Ray]), T);
+					if (Mask && ResolveClosestHit(Triangles[Group], Mask, T, Packet.MinT[Ray], Packet.PrimitiveId[Ray])) {
+						HitMask |= 1 << Ray;
+					}
+				}
+			}
+			continue;
+		}
+
+		__m128 MaxT[2] = { _mm_load_ps(Packet.MinT), _mm_load_ps(Packet.MinT + 4) };
+		u32 RayMasks[4];
+		float TNear[4];
+		FBVH4Node const& Node = Nodes[Entry.Child];
+		IntersectNodePacket(Node, Rays, MaxT, Entry.RayMask, RayMasks, TNear);
+		PushChildren(Stack, StackSize, Node, RayMasks, TNear);
+	}
+
+	return HitMask;
+}
+
+u32 FLinearBVH4::CastShadowRays(FRayPacket8 const& Packet, u32 ActiveMask) const {
+	ActiveMask &= 0xFF;
+	if (Nodes.empty() || !ActiveMask) {
+		return 0;
+	}
+
+	FSimdRay Rays[2] = { LoadSimdRays(Packet, 0), LoadSimdRays(Packet, 4) };
+	__m128 MaxT[2] = { _mm_load_ps(Packet.MinT), _mm_load_ps(Packet.MinT + 4) };
+	FSimdRay SingleRays[8];
+	for (u32 Ray = 0; Ray < 8; ++Ray) {
+		SingleRays[Ray] = CreateSimdRay(
+			float3(Packet.OriginX[Ray], Packet.OriginY[Ray], Packet.OriginZ[Ray]),
+			float3(Packet.DirectionX[Ray], Packet.DirectionY[Ray], Packet.DirectionZ[Ray]));
+	}
+
+	FBVH4Stack StackStorage(Depth);
+	FBVH4StackEntry * Stack = StackStorage.Elems;
+	u32 StackSize = 0;
+	Stack[StackSize].Child = 0;
+	Stack[StackSize].GroupsNum = 0;
+	Stack[StackSize].RayMask = ActiveMask;
+	StackSize++;
+
+	u32 OccludedMask = 0;
+	while (StackSize && OccludedMask != ActiveMask) {
+		FBVH4StackEntry Entry = Stack[--StackSize];
+		Entry.RayMask &= ~OccludedMask;
+		if (!Entry.RayMask) {
+			continue;
+		}
+
+		if (Entry.Child & BVH4_LEAF_FLAG) {
+			u32 FirstGroup = Entry.Child & ~BVH4_LEAF_FLAG;
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				if (!(Entry.RayMask & (1 << Ray))) {
+					continue;
+				}
+				__m128 RayMaxT = _mm_set1_ps(Packet.MinT[Ray]);
+				for (u32 Group = FirstGroup; Group < FirstGroup + Entry.GroupsNum; ++Group) {
+					__m128 T;
+					if (IntersectTriangles(Triangles[Group], SingleRays[Ray], RayMaxT, T)) {
+						OccludedMask |= 1 << Ray;
+						break;
+					}
+				}
+			}
+			continue;
+		}
+
+		u32 RayMasks[4];
+		float TNear[4];
+		FBVH4Node const& Node = Nodes[Entry.Child];
+		IntersectNodePacket(Node, Rays, MaxT, Entry.RayMask, RayMasks, TNear);
+		PushChildren(Stack, StackSize, Node, RayMasks, TNear);
+	}
+
+	return OccludedMask;
+}
+
+// last lane is repeated into padding, so partial packets only need ActiveMask
+static u32 LoadPacket(FRayPacket8 & Packet, FRay const * Rays, u32 const * Order, u32 First, u32 End) {
+	u32 Num = eastl::min(8u, End - First);
+	for (u32 Lane = 0; Lane < 8; ++Lane) {
+		Packet.SetRay(Lane, Rays[Order[First + eastl::min(Lane, Num - 1)]]);
+	}
+	return (1 << Num) - 1;
+}
+
+void FLinearBVH4::CastRays(FRay const * Rays, FRayHit * OutHits, u32 RaysNum) const {
+	eastl::vector<u32> Order;
+	SortRaysForCoherence(Rays, RaysNum, Order);
+
+	ParallelFor(RaysNum, RAY_BATCH_SIZE, [&](u32 Begin, u32 End) {
+		FRayPacket8 Packet;
+		for (u32 First = Begin; First < End; First += 8) {
+			u32 ActiveMask = LoadPacket(Packet, Rays, Order.data(), First, End);
+			CastRays(Packet, ActiveMask);
+			for (u32 Lane = 0; ActiveMask & (1 << Lane); ++Lane) {
+				OutHits[Order[First + Lane]].T = Packet.MinT[Lane];
+				OutHits[Order[First + Lane]].PrimitiveId = Packet.PrimitiveId[Lane];
+			}
+		}
+	});
+}
+
+void FLinearBVH4::CastShadowRays(FRay const * Rays, bool * OutOccluded, u32 RaysNum) const {
+	eastl::vector<u32> Order;
+	SortRaysForCoherence(Rays, RaysNum, Order);
+
+	ParallelFor(RaysNum, RAY_BATCH_SIZE, [&](u32 Begin, u32 End) {
+		FRayPacket8 Packet;
+		for (u32 First = Begin; First < End; First += 8) {
+			u32 ActiveMask = LoadPacket(Packet, Rays, Order.data(), First, End);
+			u32 Occluded = CastShadowRays(Packet, ActiveMask);
+			for (u32 Lane = 0; ActiveMask & (1 << Lane); ++Lane) {
+				OutOccluded[Order[First + Lane]] = (Occluded & (1 << Lane)) != 0;
+			}
+		}
+	});
+}
+
+/////////////////////////////////////////
+
+void BenchmarkBVHTraversal(const wchar_t * Directory) {
+	ForEachObjMesh(Directory, [](const wchar_t * Name, eastl::vector<float3> & Positions, eastl::vector<u32> & Indices) {
+		FLinearBVH BVH;
+		BuildBVH(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size(), &BVH);
+		if (BVH.Nodes.empty()) {
+			return;
+		}
+		FLinearBVH4 BVH4;
+		BVH4.Build(BVH);
+
+		// primary rays from outside the mesh towards its center, every 8 consecutive rays form a 4x2 tile
+		const u32 Width = 512;
+		const u32 Height = 512;
+		FBBox Bounds = BVH.Nodes[0].Bounds;
+		float3 Center = Bounds.GetCentroid();
+		float Radius = length(Bounds.GetExtent());
+		float3 Eye = Center + normalize(float3(0.3f, 0.4f, 1.f)) * Radius * 1.5f;
+		float3 Forward = normalize(Center - Eye);
+		float3 Right = normalize(cross(float3(0, 1, 0), Forward));
+		float3 Up = cross(Forward, Right);
+
+		eastl::vector<FRay> PrimaryRays;
+		PrimaryRays.reserve(Width * Height);
+		for (u32 TileY = 0; TileY < Height; TileY += 2) {
+			for (u32 TileX = 0; TileX < Width; TileX += 4) {
+				for (u32 Y = TileY; Y < TileY + 2; ++Y) {
+					for (u32 X = TileX; X < TileX + 4; ++X) {
+						float U = ((X + 0.5f) / Width) * 2.f - 1.f;
+						float V = ((Y + 0.5f) / Height) * 2.f - 1.f;
+						PrimaryRays.push_back(FRay(Eye, normalize(Forward + Right * (U * 0.7f) - Up * (V * 0.7f))));
+					}
+				}
+			}
+		}
+		const u32 RaysNum = (u32)PrimaryRays.size();
+
+		eastl::vector<float> ReferenceT(RaysNum, FINF);
+		eastl::vector<u32> ReferencePrimitive(RaysNum, 0xFFFFFFFF);
+		u32 Mismatches = 0;
+
+		i64 StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < RaysNum; ++Index) {
+			BVH.CastRay(PrimaryRays[Index], ReferenceT[Index], ReferencePrimitive[Index]);
+		}
+		double ReferenceMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < RaysNum; ++Index) {
+			float MinT = FINF;
+			u32 Primitive = 0xFFFFFFFF;
+			BVH4.CastRay(PrimaryRays[Index], MinT, Primitive);
+			Mismatches += MinT != ReferenceT[Index];
+		}
+		double SingleMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		FRayPacket8 Packet;
+		StartTicks = GetCpuTicks();
+		for (u32 First = 0; First < RaysNum; First += 8) {
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				Packet.SetRay(Ray, PrimaryRays[First + Ray]);
+			}
+			BVH4.CastRays(Packet);
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				Mismatches += Packet.MinT[Ray] != ReferenceT[First + Ray];
+			}
+		}
+		double PacketMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		eastl::vector<FRayHit> Hits(RaysNum);
+		StartTicks = GetCpuTicks();
+		BVH.CastRays(PrimaryRays.data(), Hits.data(), RaysNum);
+		double BatchMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		for (u32 Index = 0; Index < RaysNum; ++Index) {
+			Mismatches += Hits[Index].T != ReferenceT[Index];
+		}
+
+		StartTicks = GetCpuTicks();
+		BVH4.CastRays(PrimaryRays.data(), Hits.data(), RaysNum);
+		double PacketBatchMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		for (u32 Index = 0; Index < RaysNum; ++Index) {
+			Mismatches += Hits[Index].T != ReferenceT[Index];
+		}
+
+		PrintFormated(L"%s primary: %u rays, reference %.2f Mrays/s, bvh4 %.2f Mrays/s, bvh4 packets %.2f Mrays/s, batch %.2f Mrays/s, bvh4 batch %.2f Mrays/s, %u mismatches\n",
+			Name, RaysNum, RaysNum / ReferenceMs / 1000.0, RaysNum / SingleMs / 1000.0, RaysNum / PacketMs / 1000.0, RaysNum / BatchMs / 1000.0, RaysNum / PacketBatchMs / 1000.0, Mismatches);
+
+		// shadow rays from primary hits towards directional light, kept in tile order so packets stay coherent
+		float3 LightDirection = normalize(float3(0.5f, 1.f, 0.2f));
+		eastl::vector<FRay> ShadowRays;
+		for (u32 Index = 0; Index < RaysNum; ++Index) {
+			if (ReferenceT[Index] != FINF) {
+				float3 Hit = PrimaryRays[Index].Origin + PrimaryRays[Index].Direction * (ReferenceT[Index] * 0.999f);
+				ShadowRays.push_back(FRay(Hit, LightDirection));
+			}
+		}
+		while (ShadowRays.size() % 8) {
+			ShadowRays.push_back(ShadowRays.empty() ? FRay(Eye, LightDirection) : ShadowRays.back());
+		}
+		const u32 ShadowRaysNum = (u32)ShadowRays.size();
+
+		eastl::vector<bool> ReferenceOccluded(ShadowRaysNum);
+		Mismatches = 0;
+
+		StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < ShadowRaysNum; ++Index) {
+			ReferenceOccluded[Index] = BVH.CastShadowRay(ShadowRays[Index]);
+		}
+		ReferenceMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < ShadowRaysNum; ++Index) {
+			Mismatches += BVH4.CastShadowRay(ShadowRays[Index]) != ReferenceOccluded[Index];
+		}
+		SingleMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		StartTicks = GetCpuTicks();
+		for (u32 First = 0; First < ShadowRaysNum; First += 8) {
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				Packet.SetRay(Ray, ShadowRays[First + Ray]);
+			}
+			u32 Occluded = BVH4.CastShadowRays(Packet);
+			for (u32 Ray = 0; Ray < 8; ++Ray) {
+				Mismatches += ((Occluded >> Ray) & 1) != (u32)ReferenceOccluded[First + Ray];
+			}
+		}
+		PacketMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		eastl::vector<bool> Occluded(ShadowRaysNum);
+		StartTicks = GetCpuTicks();
+		BVH.CastShadowRays(ShadowRays.data(), Occluded.data(), ShadowRaysNum);
+		BatchMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		for (u32 Index = 0; Index < ShadowRaysNum; ++Index) {
+			Mismatches += Occluded[Index] != ReferenceOccluded[Index];
+		}
+
+		StartTicks = GetCpuTicks();
+		BVH4.CastShadowRays(ShadowRays.data(), Occluded.data(), ShadowRaysNum);
+		PacketBatchMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		for (u32 Index = 0; Index < ShadowRaysNum; ++Index) {
+			Mismatches += Occluded[Index] != ReferenceOccluded[Index];
+		}
+
+		PrintFormated(L"%s shadow: %u rays, reference %.2f Mrays/s, bvh4 %.2f Mrays/s, bvh4 packets %.2f Mrays/s, batch %.2f Mrays/s, bvh4 batch %.2f Mrays/s, %u mismatches\n",
+			Name, ShadowRaysNum, ShadowRaysNum / ReferenceMs / 1000.0, ShadowRaysNum / SingleMs / 1000.0, ShadowRaysNum / PacketMs / 1000.0, ShadowRaysNum / BatchMs / 1000.0, ShadowRaysNum / PacketBatchMs / 1000.0, Mismatches);
+	});
+}
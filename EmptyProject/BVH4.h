@@ -0,0 +1,71 @@
+#pragma once
+#include "Essence.h"
+#include "BVH.h"
+
+const u32 BVH4_LEAF_FLAG = 0x80000000;
+const u32 BVH4_EMPTY = 0xFFFFFFFF;
+
+// children bounds are stored SoA, one SSE test covers the whole node
+struct alignas(16) FBVH4Node {
+	float	MinX[4];
+	float	MinY[4];
+	float	MinZ[4];
+	float	MaxX[4];
+	float	MaxY[4];
+	float	MaxZ[4];
+	// inner child: node index, leaf child: BVH4_LEAF_FLAG | first triangle group, unused slot: BVH4_EMPTY
+	u32		Children[4];
+	u32		GroupsNum[4];
+};
+
+// 4 triangles SoA with precomputed edges, leaves are padded with degenerate triangles
+struct alignas(16) FBVH4Triangles {
+	float	P0X[4];
+	float	P0Y[4];
+	float	P0Z[4];
+	float	E1X[4];
+	float	E1Y[4];
+	float	E1Z[4];
+	float	E2X[4];
+	float	E2Y[4];
+	float	E2Z[4];
+	u32		Primitive[4];
+};
+
+// 8 coherent rays (camera tile, AO hemisphere, lightmap texel), SoA so 4 of them fit a SSE register
+struct alignas(16) FRayPacket8 {
+	float	OriginX[8];
+	float	OriginY[8];
+	float	OriginZ[8];
+	float	DirectionX[8];
+	float	DirectionY[8];
+	float	DirectionZ[8];
+	// in: max distance, out: closest hit distance
+	float	MinT[8];
+	u32		PrimitiveId[8];
+
+	void SetRay(u32 Index, FRay const& Ray, float MaxT = FINF);
+};
+
+// collapsed 4-wide copy of FLinearBVH, primitive ids match the source BVH
+class FLinearBVH4 {
+public:
+	eastl::vector<FBVH4Node>		Nodes;
+	eastl::vector<FBVH4Triangles>	Triangles;
+	// inner nodes on the longest path, traversal stack holds at most 3 entries per level plus root
+	u32								Depth = 0;
+
+	void Build(FLinearBVH const& BVH);
+
+	bool CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const;
+	bool CastShadowRay(FRay const& Ray, float MaxT = FINF) const;
+	// return masks of rays that hit, unused lanes can be disabled with ActiveMask
+	u32 CastRays(FRayPacket8 & Packet, u32 ActiveMask = 0xFF) const;
+	u32 CastShadowRays(FRayPacket8 const& Packet, u32 ActiveMask = 0xFF) const;
+	// same as FLinearBVH batches, sorted rays are traced as packets
+	void CastRays(FRay const * Rays, FRayHit * OutHits, u32 RaysNum) const;
+	void CastShadowRays(FRay const * Rays, bool * OutOccluded, u32 RaysNum) const;
+};
+
+// scalar FLinearBVH against FLinearBVH4 single ray and packets, prints Mrays/s for every .obj in Directory
+void BenchmarkBVHTraversal(const wchar_t * Directory);
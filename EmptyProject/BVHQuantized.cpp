@@ -0,0 +1,353 @@
+#include "BVHQuantized.h"
+#include "AssertionMacros.h"
+#include "MathFunctions.h"
+#include "Print.h"
+#include <EASTL/numeric_limits.h>
+
+template<typename T>
+static float GetQuantizationStep() {
+	return 1.f / (float)eastl::numeric_limits<T>::max();
+}
+
+// same math in Build and traversal, encoder relies on decoding being bit exact
+template<typename T>
+static FBBox DecodeChildBounds(TQuantizedBVHNode<T> const& Node, u32 Child, FBBox const& Bounds) {
+	float3 Scale = (Bounds.VMax - Bounds.VMin) * GetQuantizationStep<T>();
+	FBBox Result;
+	for (i32 Axis = 0; Axis < 3; ++Axis) {
+		Result.VMin[Axis] = Bounds.VMin[Axis] + Node.Children.Min[Child][Axis] * Scale[Axis];
+		Result.VMax[Axis] = Bounds.VMax[Axis] - Node.Children.Max[Child][Axis] * Scale[Axis];
+	}
+	return Result;
+}
+
+// rounds towards parent's bounds, then steps back while float error would cut into the child
+template<typename T>
+static void EncodeChildBounds(TQuantizedBVHNode<T> & Node, u32 Child, FBBox const& Bounds, FBBox const& ChildBounds) {
+	const float QuantMax = (float)eastl::numeric_limits<T>::max();
+	float3 Scale = (Bounds.VMax - Bounds.VMin) * GetQuantizationStep<T>();
+	for (i32 Axis = 0; Axis < 3; ++Axis) {
+		T QMin = 0;
+		T QMax = 0;
+		if (Scale[Axis] > 0.f) {
+			QMin = (T)eastl::min(eastl::max(floorf((ChildBounds.VMin[Axis] - Bounds.VMin[Axis]) / Scale[Axis]), 0.f), QuantMax);
+			while (QMin > 0 && Bounds.VMin[Axis] + QMin * Scale[Axis] > ChildBounds.VMin[Axis]) {
+				QMin--;
+			}
+			QMax = (T)eastl::min(eastl::max(floorf((Bounds.VMax[Axis] - ChildBounds.VMax[Axis]) / Scale[Axis]), 0.f), QuantMax);
+			while (QMax > 0 && Bounds.VMax[Axis] - QMax * Scale[Axis] < ChildBounds.VMax[Axis]) {
+				QMax--;
+			}
+		}
+		Node.Children.Min[Child][Axis] = QMin;
+		Node.Children.Max[Child][Axis] = QMax;
+	}
+}
+
+template<typename T>
+void TQuantizedBVH<T>::Build(FLinearBVH const& BVH) {
+	Nodes.clear();
+	Primitives = BVH.Primitives;
+	Positions = BVH.Positions;
+	Indices = BVH.Indices;
+	MaxDepth = BVH.GetDepth();
+
+	if (BVH.Nodes.empty()) {
+		return;
+	}
+	check(BVH.Nodes.size() <= QBVH_CHILD_MASK);
+
+	RootBounds = BVH.Nodes[0].Bounds;
+	Nodes.resize(BVH.Nodes.size());
+
+	// decoded bounds are what traversal sees, children are quantized against them
+	// parents always come before children, so one pass in order is enough
+	eastl::vector<FBBox> Decoded(BVH.Nodes.size());
+	Decoded[0] = RootBounds;
+
+	for (u32 Index = 0; Index < (u32)BVH.Nodes.size(); ++Index) {
+		FBVHNode const& Source = BVH.Nodes[Index];
+		TQuantizedBVHNode<T> & Node = Nodes[Index];
+
+		if (Source.PrimitivesNum) {
+			Node.Leaf.PrimitivesOffset = Source.PrimitivesOffset;
+			Node.Leaf.PrimitivesNum = Source.PrimitivesNum;
+			Node.Data = QBVH_LEAF_FLAG;
+			continue;
+		}
+
+		u32 ChildIndex[2] = { Index + 1, Source.SecondChild };
+		for (u32 Child = 0; Child < 2; ++Child) {
+			EncodeChildBounds(Node, Child, Decoded[Index], BVH.Nodes[ChildIndex[Child]].Bounds);
+			Decoded[ChildIndex[Child]] = DecodeChildBounds(Node, Child, Decoded[Index]);
+		}
+		Node.Data = (Source.SplitAxis << QBVH_AXIS_SHIFT) | Source.SecondChild;
+	}
+}
+
+namespace {
+	struct FQuantizedStackElem {
+		u32		Node;
+		FBBox	Bounds;
+	};
+
+	// fixed stack covers sane trees, deeper ones take it from heap
+	struct FQuantizedStack {
+		FQuantizedStackElem						Local[64];
+		eastl::vector<FQuantizedStackElem>		Heap;
+		FQuantizedStackElem *					Elems = Local;
+
+		explicit FQuantizedStack(u32 MaxDepth) {
+			if (MaxDepth > _countof(Local)) {
+				Heap.resize(MaxDepth);
+				Elems = Heap.data();
+			}
+		}
+	};
+}
+
+template<typename T>
+bool TQuantizedBVH<T>::CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const {
+	FRayInv RayInv = FRayInv(Ray);
+	if (Nodes.empty() || !Intersects(RayInv, RootBounds)) {
+		return false;
+	}
+	bool DirIsNeg[3] = { Ray.Direction.x < 0, Ray.Direction.y < 0, Ray.Direction.z < 0 };
+
+	FQuantizedStack StackStorage(MaxDepth);
+	FQuantizedStackElem * Stack = StackStorage.Elems;
+	i32 StackIndex = -1;
+	bool bHit = false;
+
+	u32 Index = 0;
+	FBBox Bounds = RootBounds;
+	while (1) {
+		TQuantizedBVHNode<T> const& Node = Nodes[Index];
+
+		if (Node.Data & QBVH_LEAF_FLAG) {
+			for (u32 PolygonIndex = 0; PolygonIndex < Node.Leaf.PrimitivesNum; ++PolygonIndex) {
+				u32 Primitive = Primitives[Node.Leaf.PrimitivesOffset + PolygonIndex];
+				float3 P0 = Positions[Indices[Primitive * 3]];
+				float3 P1 = Positions[Indices[Primitive * 3 + 1]];
+				float3 P2 = Positions[Indices[Primitive * 3 + 2]];
+
+				float t = RayTriangleIntersection(Ray, P0, P1, P2);
+				if (t < MinT) {
+					MinT = t;
+					PrimitiveId = Primitive;
+					bHit = true;
+				}
+			}
+		}
+		else {
+			FBBox First = DecodeChildBounds(Node, 0, Bounds);
+			FBBox Second = DecodeChildBounds(Node, 1, Bounds);
+			bool bFirst = Intersects(RayInv, First);
+			bool bSecond = Intersects(RayInv, Second);
+			u32 SecondChild = Node.Data & QBVH_CHILD_MASK;
+
+			if (bFirst && bSecond) {
+				++StackIndex;
+				if (DirIsNeg[Node.Data >> QBVH_AXIS_SHIFT]) {
+					Stack[StackIndex] = { SecondChild, Second };
+					Index = Index + 1;
+					Bounds = First;
+				}
+				else {
+					Stack[StackIndex] = { Index + 1, First };
+					Index = SecondChild;
+					Bounds = Second;
+				}
+				continue;
+			}
+			else if (bFirst) {
+				Index = Index + 1;
+				Bounds = First;
+				continue;
+			}
+			else if (bSecond) {
+				Index = SecondChild;
+				Bounds = Second;
+				continue;
+			}
+		}
+
+		if (StackIndex >= 0) {
+			Index = Stack[StackIndex].Node;
+			Bounds = Stack[StackIndex].Bounds;
+			StackIndex--;
+		}
+		else {
+			break;
+		}
+	}
+
+	return bHit;
+}
+
+template<typename T>
+bool TQuantizedBVH<T>::CastShadowRay(FRay const& Ray) const {
+	FRayInv RayInv = FRayInv(Ray);
+	if (Nodes.empty() || !Intersects(RayInv, RootBounds)) {
+		return false;
+	}
+	bool DirIsNeg[3] = { Ray.Direction.x < 0, Ray.Direction.y < 0, Ray.Direction.z < 0 };
+
+	FQuantizedStack StackStorage(MaxDepth);
+	FQuantizedStackElem * Stack = StackStorage.Elems;
+	i32 StackIndex = -1;
+
+	u32 Index = 0;
+	FBBox Bounds = RootBounds;
+	while (1) {
+		TQuantizedBVHNode<T> const& Node = Nodes[Index];
+
+		if (Node.Data & QBVH_LEAF_FLAG) {
+			for (u32 PolygonIndex = 0; PolygonIndex < Node.Leaf.PrimitivesNum; ++PolygonIndex) {
+				u32 Primitive = Primitives[Node.Leaf.PrimitivesOffset + PolygonIndex];
+				float3 P0 = Positions[Indices[Primitive * 3]];
+				float3 P1 = Positions[Indices[Primitive * 3 + 1]];
+				float3 P2 = Positions[Indices[Primitive * 3 + 2]];
+
+				if (RayTriangleIntersection(Ray, P0, P1, P2) != FINF) {
+					return true;
+				}
+			}
+		}
+		else {
+			FBBox First = DecodeChildBounds(Node, 0, Bounds);
+			FBBox Second = DecodeChildBounds(Node, 1, Bounds);
+			bool bFirst = Intersects(RayInv, First);
+			bool bSecond = Intersects(RayInv, Second);
+			u32 SecondChild = Node.Data & QBVH_CHILD_MASK;
+
+			if (bFirst && bSecond) {
+				++StackIndex;
+				if (DirIsNeg[Node.Data >> QBVH_AXIS_SHIFT]) {
+					Stack[StackIndex] = { SecondChild, Second };
+					Index = Index + 1;
+					Bounds = First;
+				}
+				else {
+					Stack[StackIndex] = { Index + 1, First };
+					Index = SecondChild;
+					Bounds = Second;
+				}
+				continue;
+			}
+			else if (bFirst) {
+				Index = Index + 1;
+				Bounds = First;
+				continue;
+			}
+			else if (bSecond) {
+				Index = SecondChild;
+				Bounds = Second;
+				continue;
+			}
+		}
+
+		if (StackIndex >= 0) {
+			Index = Stack[StackIndex].Node;
+			Bounds = Stack[StackIndex].Bounds;
+			StackIndex--;
+		}
+		else {
+			break;
+		}
+	}
+
+	return false;
+}
+
+template class TQuantizedBVH<u8>;
+template class TQuantizedBVH<u16>;
+
+/////////////////////////////////////////
+
+template<typename TBVH>
+static void MeasureBVHQuantized(const wchar_t * Name, const wchar_t * Layout, u64 NodesMemory, TBVH const& BVH, eastl::vector<FRay> const& PrimaryRays, eastl::vector<float> const& ReferenceT, eastl::vector<FRay> const& ShadowRays, eastl::vector<bool> const& ReferenceOccluded) {
+	u32 Mismatches = 0;
+
+	i64 StartTicks = GetCpuTicks();
+	for (u32 Index = 0; Index < (u32)PrimaryRays.size(); ++Index) {
+		float MinT = FINF;
+		u32 Primitive = 0xFFFFFFFF;
+		BVH.CastRay(PrimaryRays[Index], MinT, Primitive);
+		Mismatches += MinT != ReferenceT[Index];
+	}
+	double PrimaryMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+	StartTicks = GetCpuTicks();
+	for (u32 Index = 0; Index < (u32)ShadowRays.size(); ++Index) {
+		Mismatches += BVH.CastShadowRay(ShadowRays[Index]) != ReferenceOccluded[Index];
+	}
+	double ShadowMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+	PrintFormated(L"%s %s: nodes %.1f KB, primary %.2f Mrays/s, shadow %.2f Mrays/s, %u mismatches\n",
+		Name, Layout, NodesMemory / 1024.0, PrimaryRays.size() / PrimaryMs / 1000.0, ShadowRays.size() / ShadowMs / 1000.0, Mismatches);
+}
+
+void BenchmarkBVHQuantized(const wchar_t * Directory) {
+	ForEachObjMesh(Directory, [](const wchar_t * Name, eastl::vector<float3> & Positions, eastl::vector<u32> & Indices) {
+		FLinearBVH BVH;
+		BuildBVH(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size(), &BVH);
+		if (BVH.Nodes.empty()) {
+			return;
+		}
+		FLinearBVH16 BVH16;
+		BVH16.Build(BVH);
+		FLinearBVH32 BVH32;
+		BVH32.Build(BVH);
+
+		// same views as traversal benchmark: primary rays towards mesh center, shadow rays from their hits
+		const u32 Width = 512;
+		const u32 Height = 512;
+		FBBox Bounds = BVH.Nodes[0].Bounds;
+		float3 Center = Bounds.GetCentroid();
+		float Radius = length(Bounds.GetExtent());
+		float3 Eye = Center + normalize(float3(0.3f, 0.4f, 1.f)) * Radius * 1.5f;
+		float3 Forward = normalize(Center - Eye);
+		float3 Right = normalize(cross(float3(0, 1, 0), Forward));
+		float3 Up = cross(Forward, Right);
+
+		eastl::vector<FRay> PrimaryRays;
+		PrimaryRays.reserve(Width * Height);
+		for (u32 Y = 0; Y < Height; ++Y) {
+			for (u32 X = 0; X < Width; ++X) {
+				float U = ((X + 0.5f) / Width) * 2.f - 1.f;
+				float V = ((Y + 0.5f) / Height) * 2.f - 1.f;
+				PrimaryRays.push_back(FRay(Eye, normalize(Forward + Right * (U * 0.7f) - Up * (V * 0.7f))));
+			}
+		}
+
+		eastl::vector<float> ReferenceT(PrimaryRays.size(), FINF);
+		u32 Primitive;
+		i64 StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < (u32)PrimaryRays.size(); ++Index) {
+			BVH.CastRay(PrimaryRays[Index], ReferenceT[Index], Primitive);
+		}
+		double PrimaryMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		float3 LightDirection = normalize(float3(0.5f, 1.f, 0.2f));
+		eastl::vector<FRay> ShadowRays;
+		for (u32 Index = 0; Index < (u32)PrimaryRays.size(); ++Index) {
+			if (ReferenceT[Index] != FINF) {
+				float3 Hit = PrimaryRays[Index].Origin + PrimaryRays[Index].Direction * (ReferenceT[Index] * 0.999f);
+				ShadowRays.push_back(FRay(Hit, LightDirection));
+			}
+		}
+
+		eastl::vector<bool> ReferenceOccluded(ShadowRays.size());
+		StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < (u32)ShadowRays.size(); ++Index) {
+			ReferenceOccluded[Index] = BVH.CastShadowRay(ShadowRays[Index]);
+		}
+		double ShadowMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		PrintFormated(L"%s float 40B: nodes %.1f KB, primary %.2f Mrays/s, shadow %.2f Mrays/s\n",
+			Name, BVH.Nodes.size() * sizeof(FBVHNode) / 1024.0, PrimaryRays.size() / PrimaryMs / 1000.0, ShadowRays.size() / ShadowMs / 1000.0);
+		MeasureBVHQuantized(Name, L"u16 32B", BVH32.GetNodesMemory(), BVH32, PrimaryRays, ReferenceT, ShadowRays, ReferenceOccluded);
+		MeasureBVHQuantized(Name, L"u8 16B", BVH16.GetNodesMemory(), BVH16, PrimaryRays, ReferenceT, ShadowRays, ReferenceOccluded);
+	});
+}
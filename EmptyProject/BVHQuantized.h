@@ -0,0 +1,59 @@
+#pragma once
+#include "Essence.h"
+#include "BVH.h"
+
+const u32 QBVH_LEAF_FLAG = 0x80000000;
+const u32 QBVH_AXIS_SHIFT = 29;
+const u32 QBVH_CHILD_MASK = (1 << QBVH_AXIS_SHIFT) - 1;
+
+// inner node keeps bounds of both children quantized relative to its own (decoded) bounds
+// min is stored as steps up from parent's min, max as steps down from parent's max, so 0 is exact
+// T = u8 gives 16 byte nodes, T = u16 gives 32 byte nodes
+template<typename T>
+struct alignas(16) TQuantizedBVHNode {
+	union {
+		struct {
+			T	Min[2][3];
+			T	Max[2][3];
+		} Children;
+		struct {
+			u32	PrimitivesOffset;
+			u32	PrimitivesNum;
+		} Leaf;
+	};
+	// QBVH_LEAF_FLAG | split axis << QBVH_AXIS_SHIFT | second child, first child is next node
+	u32		Data;
+};
+
+typedef TQuantizedBVHNode<u8>	FBVHNode16;
+typedef TQuantizedBVHNode<u16>	FBVHNode32;
+
+static_assert(sizeof(FBVHNode16) == 16, "FBVHNode16 should be 16 bytes");
+static_assert(sizeof(FBVHNode32) == 32, "FBVHNode32 should be 32 bytes");
+
+// compressed copy of FLinearBVH, same node order and primitive ids, bounds are decoded during traversal
+// quantized bounds only grow, so hits match the source BVH exactly
+template<typename T>
+class TQuantizedBVH {
+public:
+	eastl::vector<TQuantizedBVHNode<T>>	Nodes;
+	eastl::vector<u32>					Primitives;
+	FBBox								RootBounds;
+	float3 *							Positions;
+	u32 *								Indices;
+	// of source BVH, traversal stack never holds more entries
+	u32									MaxDepth = 0;
+
+	void Build(FLinearBVH const& BVH);
+
+	bool CastRay(FRay const& Ray, float &MinT, u32 &PrimitiveId) const;
+	bool CastShadowRay(FRay const& Ray) const;
+
+	u64 GetNodesMemory() const { return Nodes.size() * sizeof(TQuantizedBVHNode<T>); }
+};
+
+typedef TQuantizedBVH<u8>	FLinearBVH16;
+typedef TQuantizedBVH<u16>	FLinearBVH32;
+
+// node memory and Mrays/s of FLinearBVH against 16 and 32 byte nodes for every .obj in Directory
+void BenchmarkBVHQuantized(const wchar_t * Directory);
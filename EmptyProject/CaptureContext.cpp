@@ -0,0 +1,712 @@
+#include "CaptureContext.h"
+#include "Resource.h"
+#include "Hash.h"
+#include "Print.h"
+#include "Pipeline.h"
+#include <EASTL/algorithm.h>
+#include <random>
+#include <string.h>
+
+void FCaptureContext::Reset() {
+	Trace.clear();
+	Ids.clear();
+	PendingBarriers.clear();
+	OpenSplits.clear();
+	CallsNum = 0;
+	DrawsNum = 0;
+	BarriersNum = 0;
+	SplitBarriersNum = 0;
+	SplitErrorsNum = 0;
+	AliasingBarriersNum = 0;
+	AliasingErrorsNum = 0;
+}
+
+u64 FCaptureContext::GetTraceHash() const {
+	return MurmurHash2_64(Trace.data(), Trace.size() * sizeof(u32), 0);
+}
+
+bool FCaptureContext::BeginCall(ECall Call) {
+	CallsNum++;
+	if (bRecordTrace) {
+		Trace.push_back((u32)Call);
+	}
+	return bRecordTrace;
+}
+
+void FCaptureContext::Write(u32 Value) {
+	Trace.push_back(Value);
+}
+
+void FCaptureContext::Write(float Value) {
+	u32 Bits;
+	memcpy(&Bits, &Value, sizeof(Bits));
+	Trace.push_back(Bits);
+}
+
+void FCaptureContext::WriteId(u64 Value) {
+	if (Value == 0) {
+		Trace.push_back(0);
+		return;
+	}
+	auto Iter = Ids.insert(Value);
+	if (Iter.second) {
+		Iter.first->second = (u32)Ids.size();
+	}
+	Trace.push_back(Iter.first->second);
+}
+
+void FCaptureContext::ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE RTV, float4 Color) {
+	if (BeginCall(ECall::ClearRTV)) {
+		WriteId(RTV.ptr);
+		Write(Color.x);
+		Write(Color.y);
+		Write(Color.z);
+		Write(Color.w);
+	}
+}
+
+void FCaptureContext::ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE DSV, float Depth, u8 Stencil) {
+	if (BeginCall(ECall::ClearDSV)) {
+		WriteId(DSV.ptr);
+		Write(Depth);
+		Write((u32)Stencil);
+	}
+}
+
+void FCaptureContext::ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE UAV, FGPUResource * Resource, Vec4u Value) {
+	if (BeginCall(ECall::ClearUAV)) {
+		WriteId(UAV.ptr);
+		WriteId(Resource);
+		Write(Value.x);
+		Write(Value.y);
+		Write(Value.z);
+		Write(Value.w);
+	}
+}
+
+void FCaptureContext::SetCounter(FGPUResource * Dst, u32 Value) {
+	if (BeginCall(ECall::SetCounter)) {
+		WriteId(Dst);
+		Write(Value);
+	}
+}
+
+void FCaptureContext::CopyResource(FGPUResource * Dst, FGPUResource * Src) {
+	if (BeginCall(ECall::CopyResource)) {
+		WriteId(Dst);
+		WriteId(Src);
+	}
+}
+
+void FCaptureContext::CopyTextureRegion(FGPUResource * Dst, u32 DstSubresource, FGPUResource * Src, u32 SrcSubresource) {
+	if (BeginCall(ECall::CopyTextureRegion)) {
+		WriteId(Dst);
+		Write(DstSubresource);
+		WriteId(Src);
+		Write(SrcSubresource);
+	}
+}
+
+void FCaptureContext::SetPipelineState(FPipelineState const * PipelineState) {
+	if (BeginCall(ECall::SetPipelineState)) {
+		WriteId(PipelineState);
+	}
+}
+
+void FCaptureContext::SetTopology(D3D_PRIMITIVE_TOPOLOGY Topology) {
+	if (BeginCall(ECall::SetTopology)) {
+		Write((u32)Topology);
+	}
+}
+
+void FCaptureContext::SetRenderTarget(FRenderTargetView View, u32 Index) {
+	if (BeginCall(ECall::SetRenderTarget)) {
+		WriteId(View.RTV.ptr);
+		Write((u32)View.Format);
+		Write(Index);
+	}
+}
+
+void FCaptureContext::SetDepthStencil(FDepthStencilView View) {
+	if (BeginCall(ECall::SetDepthStencil)) {
+		WriteId(View.DSV.ptr);
+		Write((u32)View.Format);
+	}
+}
+
+void FCaptureContext::SetViewport(D3D12_VIEWPORT const & Viewport) {
+	if (BeginCall(ECall::SetViewport)) {
+		Write(Viewport.TopLeftX);
+		Write(Viewport.TopLeftY);
+		Write(Viewport.Width);
+		Write(Viewport.Height);
+		Write(Viewport.MinDepth);
+		Write(Viewport.MaxDepth);
+	}
+}
+
+void FCaptureContext::SetScissorRect(D3D12_RECT const & Rect) {
+	if (BeginCall(ECall::SetScissorRect)) {
+		Write((u32)Rect.left);
+		Write((u32)Rect.top);
+		Write((u32)Rect.right);
+		Write((u32)Rect.bottom);
+	}
+}
+
+void FCaptureContext::SetVB(FBufferLocation const & BufferView, u32 Stream) {
+	if (BeginCall(ECall::SetVB)) {
+		WriteId(BufferView.Address);
+		Write(BufferView.Size);
+		Write(BufferView.Stride);
+		Write(Stream);
+	}
+}
+
+void FCaptureContext::SetIB(FBufferLocation const & BufferView) {
+	if (BeginCall(ECall::SetIB)) {
+		WriteId(BufferView.Address);
+		Write(BufferView.Size);
+		Write(BufferView.Stride);
+	}
+}
+
+void FCaptureContext::SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV) {
+	if (BeginCall(ECall::SetConstantBuffer)) {
+		WriteId(ConstantBuffer);
+		WriteId(CBV.ptr);
+	}
+}
+
+void FCaptureContext::SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View) {
+	if (BeginCall(ECall::SetTexture)) {
+		WriteId(Texture);
+		WriteId(View.ptr);
+	}
+}
+
+void FCaptureContext::SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View) {
+	if (BeginCall(ECall::SetRWTexture)) {
+		WriteId(RWTexture);
+		WriteId(View.ptr);
+	}
+}
+
+// FGPUContext flushes pending barriers before every draw and dispatch, trace follows the same order
+void FCaptureContext::Draw(u32 VertexCount, u32 StartVertex, u32 Instances, u32 StartInstance) {
+	FlushBarriers();
+	DrawsNum++;
+	if (BeginCall(ECall::Draw)) {
+		Write(VertexCount);
+		Write(StartVertex);
+		Write(Instances);
+		Write(StartInstance);
+	}
+}
+
+void FCaptureContext::DrawIndexed(u32 IndexCount, u32 StartIndex, i32 BaseVertex, u32 Instances, u32 StartInstance) {
+	FlushBarriers();
+	DrawsNum++;
+	if (BeginCall(ECall::DrawIndexed)) {
+		Write(IndexCount);
+		Write(StartIndex);
+		Write((u32)BaseVertex);
+		Write(Instances);
+		Write(StartInstance);
+	}
+}
+
+void FCaptureContext::Dispatch(u32 X, u32 Y, u32 Z) {
+	FlushBarriers();
+	DrawsNum++;
+	if (BeginCall(ECall::Dispatch)) {
+		Write(X);
+		Write(Y);
+		Write(Z);
+	}
+}
+
+void FCaptureContext::Barriers(FResourceBarrier const * Barriers, u32 Num) {
+	PendingBarriers.insert(PendingBarriers.end(), Barriers, Barriers + Num);
+}
+
+// only barriers are seen here, accesses of draws inside split are checked by solver fuzz
+void FCaptureContext::CheckSplit(FResourceBarrier const& Barrier) {
+	auto Open = eastl::find_if(OpenSplits.begin(), OpenSplits.end(), [&](FResourceBarrier const& Split) {
+		return Split.Resource == Barrier.Resource
+			&& (Split.Subresource == Barrier.Subresource || Split.Subresource == ALL_SUBRESOURCES || Barrier.Subresource == ALL_SUBRESOURCES);
+	});
+
+	if (Barrier.Split == EBarrierSplit::END_ONLY) {
+		bool Paired = Open != OpenSplits.end() && Open->Subresource == Barrier.Subresource && Open->From == Barrier.From && Open->To == Barrier.To;
+		if (Paired) {
+			OpenSplits.erase_unsorted(Open);
+		}
+		else {
+			SplitErrorsNum++;
+		}
+		return;
+	}
+
+	if (Open != OpenSplits.end()) {
+		SplitErrorsNum++;
+	}
+	if (Barrier.Split == EBarrierSplit::BEGIN_ONLY) {
+		SplitBarriersNum++;
+		OpenSplits.push_back(Barrier);
+	}
+}
+
+void FCaptureContext::FlushBarriers() {
+	for (FResourceBarrier const& Barrier : PendingBarriers) {
+		BarriersNum++;
+		CheckSplit(Barrier);
+		if (BeginCall(ECall::Barrier)) {
+			WriteId(Barrier.Resource);
+			Write(Barrier.Subresource);
+			Write((u32)Barrier.From);
+			Write((u32)Barrier.To);
+			Write((u32)Barrier.Split);
+		}
+
+		// state changes when split transition ends
+		if (bApplyBarriers && Barrier.Resource->FatData->AutomaticBarriers && Barrier.Split != EBarrierSplit::BEGIN_ONLY) {
+			GetResourceStateRegistry()->SetCurrentState(Barrier.Resource, Barrier.Subresource, Barrier.To);
+		}
+	}
+	PendingBarriers.clear();
+}
+
+void FCaptureContext::AliasingBarrier(FGPUResource * Before, FGPUResource * After) {
+	FlushBarriers();
+
+	AliasingBarriersNum++;
+	for (FResourceBarrier const& Split : OpenSplits) {
+		if (Split.Resource == After || (Before && Split.Resource == Before)) {
+			AliasingErrorsNum++;
+		}
+	}
+	if (BeginCall(ECall::AliasingBarrier)) {
+		WriteId(Before);
+		WriteId(After);
+	}
+}
+
+void InitCaptureResource(FGPUResource & Resource, u32 MipmapsNum) {
+	Resource.FatData = eastl::make_unique<FGPUResourceFat>();
+	Resource.FatData->Desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+	Resource.FatData->Desc.MipLevels = (u16)MipmapsNum;
+	Resource.FatData->Desc.DepthOrArraySize = 1;
+	Resource.FatData->PlanesNum = 1;
+	Resource.FatData->AutomaticBarriers = 1;
+	GetResourceStateRegistry()->SetCurrentState(&Resource, ALL_SUBRESOURCES, EAccessType::COMMON);
+}
+
+/////////////////////////////////////////
+
+void BenchmarkPlayback() {
+	const u32 DrawsNum = 200000;
+	const u32 TexturesNum = 512;
+	const u32 RenderTargetsNum = 8;
+
+	eastl::vector<FGPUResource> Textures(TexturesNum);
+	eastl::vector<FGPUResource> RenderTargets(RenderTargetsNum);
+	for (auto & Texture : Textures) {
+		InitCaptureResource(Texture);
+	}
+	for (auto & RenderTarget : RenderTargets) {
+		InitCaptureResource(RenderTarget);
+	}
+
+	// pass per render target, each samples target of previous pass
+	// same frame is recorded with both packet encodings
+	FCommandsStream Streams[2];
+	Streams[1].Encoding = ECommandsEncoding::Opcode;
+	for (FCommandsStream & Stream : Streams) {
+		std::mt19937 Rng(DrawsNum);
+		const u32 DrawsPerPass = DrawsNum / RenderTargetsNum;
+		for (u32 Draw = 0; Draw < DrawsNum; ++Draw) {
+			u32 Pass = Draw / DrawsPerPass % RenderTargetsNum;
+			if (Draw % DrawsPerPass == 0) {
+				Stream.SetAccess(&RenderTargets[Pass], EAccessType::WRITE_RT);
+				Stream.SetRenderTarget(FRenderTargetView());
+				Stream.SetViewport(D3D12_VIEWPORT{ 0, 0, 1920, 1080, 0, 1 });
+				Stream.SetAccess(&RenderTargets[(Pass + RenderTargetsNum - 1) % RenderTargetsNum], EAccessType::READ_PIXEL);
+			}
+			// pipeline states only need to be distinct, capture never dereferences them
+			if (Draw % 16 == 0) {
+				Stream.SetPipelineState((FPipelineState*)(u64)(Draw / 16 % 64 + 1));
+			}
+			Stream.SetAccess(&Textures[Rng() % TexturesNum], EAccessType::READ_PIXEL);
+			Stream.SetTexture(nullptr, D3D12_CPU_DESCRIPTOR_HANDLE{ Rng() % 4096 + 1 });
+			Stream.DrawIndexed(36, Draw * 36);
+		}
+		Stream.Close();
+	}
+
+	// registry isn't updated, so every run resolves the same barriers
+	FCaptureContext Context;
+	Context.bApplyBarriers = false;
+
+	u64 EncodingTraceHashes[2] = {};
+	for (u32 Encoding = 0; Encoding < 2; ++Encoding) {
+		FCommandsStream & Stream = Streams[Encoding];
+		for (bool bRecordTrace : { false, true }) {
+			Context.bRecordTrace = bRecordTrace;
+
+			double PlaybackMs = 1e9;
+			u64 TraceHash = 0;
+			bool bStable = true;
+			for (u32 Run = 0; Run < 8; ++Run) {
+				Context.Reset();
+				i64 StartTicks = GetCpuTicks();
+				Playback(Context, &Stream);
+				PlaybackMs = eastl::min(PlaybackMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+
+				bStable &= Run == 0 || TraceHash == Context.GetTraceHash();
+				TraceHash = Context.GetTraceHash();
+			}
+			if (bRecordTrace) {
+				EncodingTraceHashes[Encoding] = TraceHash;
+			}
+
+			double ResolveMs = 1e9;
+			for (u32 Run = 0; Run < 8; ++Run) {
+				i64 StartTicks = GetCpuTicks();
+				Stream.ProcessBarriersPreExecution(*GetResourceStateRegistry());
+				ResolveMs = eastl::min(ResolveMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+			}
+
+			PrintFormated(L"%s playback into %s: %u packets in %u KB, %u calls, %u barriers (%u split, %u split errors, %u unpaired), %.3f ms (resolve %.3f ms), %.1f Mpackets/s, dispatch only %.1f Mpackets/s, trace %u KB %s\n",
+				Stream.Encoding == ECommandsEncoding::Opcode ? L"opcode" : L"function pointer",
+				bRecordTrace ? L"trace capture" : L"null context",
+				Stream.PacketsNum, (u32)(Stream.Size / 1024), Context.CallsNum, Context.BarriersNum, Context.SplitBarriersNum, Context.SplitErrorsNum, (u32)Context.OpenSplits.size(),
+				PlaybackMs, ResolveMs,
+				Stream.PacketsNum / PlaybackMs / 1000.,
+				Stream.PacketsNum / eastl::max(PlaybackMs - ResolveMs, 1e-6) / 1000.,
+				(u32)(Context.Trace.size() * sizeof(u32) / 1024),
+				bStable ? L"stable" : L"UNSTABLE");
+		}
+	}
+	PrintFormated(L"encodings give %s traces\n", EncodingTraceHashes[0] == EncodingTraceHashes[1] ? L"same" : L"DIFFERENT");
+}
+
+
+// shadow state player: every draw is logged with hash of state it sees, other calls are logged as events
+// bindings are forgotten on pipeline change like root params are on root signature change
+class FDrawStateLog final : public FPlaybackContext {
+public:
+	enum class EKind : u32 {
+		Event,
+		Draw,
+		DrawIndexed
+	};
+	struct FEntry {
+		EKind	Kind;
+		u64		Hash;
+		i32		BaseVertex;
+		u32		Start;
+		u32		Count;
+	};
+	eastl::vector<FEntry> Entries;
+
+	struct FState {
+		u64						PipelineState;
+		u64						Topology;
+		D3D12_VIEWPORT			Viewport;
+		D3D12_RECT				ScissorRect;
+		FBufferLocation			IB;
+		FBufferLocation			VBs[FStateCache::MAX_VBVS];
+		u64						RTVs[FStateCache::MAX_RTVS];
+		u64						DSV;
+	} State;
+	eastl::hash_map<void const*, u64> Bindings;
+
+	FDrawStateLog() {
+		memset(&State, 0, sizeof(State));
+	}
+
+	u64 GetStateHash() const {
+		u64 Hash = MurmurHash2_64(&State, sizeof(State), 0);
+		// order independent
+		u64 BindingsHash = 0;
+		for (auto const& Binding : Bindings) {
+			BindingsHash += HashCombine64((u64)Binding.first, Binding.second);
+		}
+		return HashCombine64(Hash, BindingsHash);
+	}
+
+	void LogEvent(u64 A, u64 B = 0, u64 C = 0) {
+		u64 Args[] = { A, B, C };
+		Entries.push_back({ EKind::Event, MurmurHash2_64(Args, sizeof(Args), 0), 0, 0, 0 });
+	}
+
+	void ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE RTV, float4 Color) override { LogEvent(1, RTV.ptr); }
+	void ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE DSV, float Depth, u8 Stencil) override { LogEvent(2, DSV.ptr); }
+	void ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE UAV, FGPUResource * Resource, Vec4u Value) override { LogEvent(3, UAV.ptr); }
+	void SetCounter(FGPUResource * Dst, u32 Value) override { LogEvent(4, (u64)Dst, Value); }
+	void CopyResource(FGPUResource * Dst, FGPUResource * Src) override { LogEvent(5, (u64)Dst, (u64)Src); }
+	void CopyTextureRegion(FGPUResource * Dst, u32 DstSubresource, FGPUResource * Src, u32 SrcSubresource) override { LogEvent(6, (u64)Dst, (u64)Src); }
+	void SetPipelineState(FPipelineState const * PipelineState) override {
+		if (State.PipelineState != (u64)PipelineState) {
+			Bindings.clear();
+		}
+		State.PipelineState = (u64)PipelineState;
+	}
+	void SetTopology(D3D_PRIMITIVE_TOPOLOGY Topology) override { State.Topology = Topology; }
+	void SetRenderTarget(FRenderTargetView View, u32 Index) override { State.RTVs[Index] = View.RTV.ptr; }
+	void SetDepthStencil(FDepthStencilView View) override { State.DSV = View.DSV.ptr; }
+	void SetViewport(D3D12_VIEWPORT const & Viewport) override { State.Viewport = Viewport; }
+	void SetScissorRect(D3D12_RECT const & Rect) override { State.ScissorRect = Rect; }
+	void SetVB(FBufferLocation const & BufferView, u32 Stream) override { State.VBs[Stream] = BufferView; }
+	void SetIB(FBufferLocation const & BufferView) override { State.IB = BufferView; }
+	void SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV) override { Bindings[ConstantBuffer] = CBV.ptr; }
+	void SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View) override { Bindings[Texture] = View.ptr; }
+	void SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View) override { Bindings[RWTexture] = View.ptr; }
+	void Draw(u32 VertexCount, u32 StartVertex, u32 Instances, u32 StartInstance) override {
+		Entries.push_back({ EKind::Draw, HashCombine64(GetStateHash(), ((u64)Instances << 32) | StartInstance), 0, StartVertex, VertexCount });
+	}
+	void DrawIndexed(u32 IndexCount, u32 StartIndex, i32 BaseVertex, u32 Instances, u32 StartInstance) override {
+		Entries.push_back({ EKind::DrawIndexed, HashCombine64(GetStateHash(), ((u64)Instances << 32) | StartInstance), BaseVertex, StartIndex, IndexCount });
+	}
+	void Dispatch(u32 X, u32 Y, u32 Z) override { LogEvent(GetStateHash(), ((u64)X << 32) | Y, Z); }
+	void AliasingBarrier(FGPUResource * Before, FGPUResource * After) override { LogEvent(7, (u64)Before, (u64)After); }
+	void Barriers(FResourceBarrier const * Barriers, u32 Num) override {
+		for (u32 Index = 0; Index < Num; ++Index) {
+			LogEvent((u64)Barriers[Index].Resource, ((u64)Barriers[Index].Subresource << 32) | (u32)Barriers[Index].To, (u32)Barriers[Index].From);
+		}
+	}
+	void FlushBarriers() override {}
+
+	// draws continuing previous one with the same state are joined, as compaction does
+	void MergeDraws() {
+		u32 Num = 0;
+		for (FEntry const& Entry : Entries) {
+			if (Num && Entry.Kind != EKind::Event) {
+				FEntry & Prev = Entries[Num - 1];
+				if (Prev.Kind == Entry.Kind && Prev.Hash == Entry.Hash && Prev.BaseVertex == Entry.BaseVertex && Prev.Start + Prev.Count == Entry.Start) {
+					Prev.Count += Entry.Count;
+					continue;
+				}
+			}
+			Entries[Num++] = Entry;
+		}
+		Entries.resize(Num);
+	}
+};
+
+void BenchmarkStreamCompaction() {
+	const u32 DrawsNum = 100000;
+	const u32 TexturesNum = 64;
+	const u32 MeshesNum = 16;
+
+	eastl::vector<FGPUResource> Textures(TexturesNum);
+	for (auto & Texture : Textures) {
+		InitCaptureResource(Texture);
+	}
+	FGPUResource RenderTarget;
+	InitCaptureResource(RenderTarget);
+
+	FSRVParam DiffuseParam = { GlobalBindId(1) };
+	FSRVParam AtlasParam = { GlobalBindId(2) };
+	FCBVParam ConstantsParam = { GlobalBindId(3), 256, nullptr };
+
+	// scene part binds everything per draw the way naive pass code does, ui part is a run of clipped quads
+	auto Record = [&](FCommandsStream & Stream) {
+		Stream.Reset();
+		std::mt19937 Rng(DrawsNum);
+		FRenderTargetView RTV = {};
+		RTV.RTV.ptr = 1;
+		RTV.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		Stream.SetAccess(&RenderTarget, EAccessType::WRITE_RT);
+		for (u32 Draw = 0; Draw < DrawsNum / 2; ++Draw) {
+			u32 Texture = Rng() % 4 ? Draw / 32 % TexturesNum : Rng() % TexturesNum;
+			u32 Mesh = Draw / 64 % MeshesNum;
+			Stream.SetAccess(&Textures[Texture], EAccessType::READ_PIXEL);
+			Stream.SetRenderTarget(RTV);
+			Stream.SetViewport(D3D12_VIEWPORT{ 0, 0, 1920, 1080, 0, 1 });
+			Stream.SetPipelineState((FPipelineState*)(u64)(Draw / 16 % 3 + 1));
+			Stream.SetTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			FBufferLocation VB = { (Mesh + 1) * 0x100000ull, 0x10000, 32 };
+			FBufferLocation IB = { (Mesh + 1) * 0x100000ull + 0x10000, 0x10000, 2 };
+			Stream.SetVB(VB, 0);
+			Stream.SetIB(IB);
+			Stream.SetConstantBuffer(&ConstantsParam, D3D12_CPU_DESCRIPTOR_HANDLE{ Draw / 4 + 1 });
+			Stream.SetTexture(&DiffuseParam, D3D12_CPU_DESCRIPTOR_HANDLE{ Texture + 0x1000 });
+			Stream.DrawIndexed(36 * 4, (Draw % 4) * 36 * 4, (i32)(Draw % 4) * 24);
+		}
+		Stream.SetPipelineState((FPipelineState*)(u64)100);
+		Stream.SetConstantBuffer(&ConstantsParam, D3D12_CPU_DESCRIPTOR_HANDLE{ 0x2000 });
+		u32 UIIndex = 0;
+		for (u32 Draw = 0; Draw < DrawsNum / 2; ++Draw) {
+			LONG Clip = Rng() % 8 ? 0 : (LONG)(Rng() % 4);
+			Stream.SetTexture(&AtlasParam, D3D12_CPU_DESCRIPTOR_HANDLE{ 0x3000 });
+			Stream.SetScissorRect(D3D12_RECT{ Clip, Clip, 1920, 1080 });
+			Stream.DrawIndexed(6, UIIndex, 0);
+			UIIndex += 6;
+		}
+		Stream.Close();
+	};
+
+	FCommandsStream Stream;
+	FCommandsStream Compacted;
+	for (ECommandsEncoding Encoding : { ECommandsEncoding::FunctionPointer, ECommandsEncoding::Opcode }) {
+		Stream.Reset();
+		Stream.Encoding = Encoding;
+		Compacted.Reset();
+		Compacted.Encoding = Encoding;
+		Record(Stream);
+
+		double CompactMs = 1e9;
+		FStreamCompactionStats Stats;
+		for (u32 Run = 0; Run < 8; ++Run) {
+			Record(Compacted);
+			i64 StartTicks = GetCpuTicks();
+			Stats = Compacted.Compact();
+			CompactMs = eastl::min(CompactMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+		}
+
+		FCaptureContext Context;
+		Context.bApplyBarriers = false;
+		Context.bRecordTrace = false;
+		auto TimePlayback = [&](FCommandsStream & Played) {
+			double PlaybackMs = 1e9;
+			for (u32 Run = 0; Run < 8; ++Run) {
+				Context.Reset();
+				i64 StartTicks = GetCpuTicks();
+				Playback(Context, &Played);
+				PlaybackMs = eastl::min(PlaybackMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+			}
+			return PlaybackMs;
+		};
+		double PlaybackMs = TimePlayback(Stream);
+		u32 CallsNum = Context.CallsNum;
+		double CompactedPlaybackMs = TimePlayback(Compacted);
+		u32 CompactedCallsNum = Context.CallsNum;
+
+		FDrawStateLog Log;
+		FDrawStateLog CompactedLog;
+		Playback(Log, &Stream);
+		Playback(CompactedLog, &Compacted);
+		Log.MergeDraws();
+		CompactedLog.MergeDraws();
+		u32 Mismatches = (u32)eastl::max(Log.Entries.size(), CompactedLog.Entries.size()) - (u32)eastl::min(Log.Entries.size(), CompactedLog.Entries.size());
+		for (u32 Index = 0; Index < eastl::min(Log.Entries.size(), CompactedLog.Entries.size()); ++Index) {
+			FDrawStateLog::FEntry const& A = Log.Entries[Index];
+			FDrawStateLog::FEntry const& B = CompactedLog.Entries[Index];
+			Mismatches += A.Kind != B.Kind || A.Hash != B.Hash || A.BaseVertex != B.BaseVertex || A.Start != B.Start || A.Count != B.Count;
+		}
+
+		PrintFormated(L"%s stream compaction: %u -> %u packets (%u draws merged), %u -> %u KB, %.3f ms, playback %.3f -> %.3f ms, %u -> %u calls, %u mismatches\n",
+			Encoding == ECommandsEncoding::Opcode ? L"opcode" : L"function pointer",
+			Stream.PacketsNum, Compacted.PacketsNum, Stats.DrawsMerged,
+			(u32)(Stream.Size / 1024), (u32)(Compacted.Size / 1024),
+			CompactMs, PlaybackMs, CompactedPlaybackMs, CallsNum, CompactedCallsNum, Mismatches);
+	}
+}
+
+void BenchmarkBundles() {
+	const u32 DrawsNum = 50000;
+	const u32 TexturesNum = 256;
+	const u32 FramesNum = 32;
+
+	eastl::vector<FGPUResource> Textures(TexturesNum);
+	for (auto & Texture : Textures) {
+		InitCaptureResource(Texture);
+	}
+	FGPUResource SceneColor;
+	FGPUResource Backbuffer;
+	InitCaptureResource(SceneColor);
+	InitCaptureResource(Backbuffer);
+
+	FSRVParam DiffuseParam = { GlobalBindId(1) };
+	FSRVParam SceneParam = { GlobalBindId(2) };
+
+	// static scene pass, variant changes its pipeline states the way recompiled PSO would
+	auto RecordScenePass = [&](FCommandsStream & Stream, u32 Variant) {
+		std::mt19937 Rng(DrawsNum);
+		FRenderTargetView RTV = {};
+		RTV.RTV.ptr = 1;
+		RTV.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+		Stream.SetAccess(&SceneColor, EAccessType::WRITE_RT);
+		Stream.SetRenderTarget(RTV);
+		Stream.ClearRTV(RTV.RTV, float4(0));
+		Stream.SetViewport(D3D12_VIEWPORT{ 0, 0, 1920, 1080, 0, 1 });
+		Stream.SetTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		for (u32 Draw = 0; Draw < DrawsNum; ++Draw) {
+			if (Draw % 64 == 0) {
+				Stream.SetPipelineState((FPipelineState*)(u64)(Draw / 64 % 8 + 1 + Variant * 8));
+			}
+			u32 Texture = Rng() % TexturesNum;
+			Stream.SetAccess(&Textures[Texture], EAccessType::READ_PIXEL);
+			Stream.SetTexture(&DiffuseParam, D3D12_CPU_DESCRIPTOR_HANDLE{ Texture + 0x1000 });
+			Stream.DrawIndexed(36, Draw * 36);
+		}
+	};
+
+	// frame around the pass touches its resources too, so barriers cross bundle boundary both ways
+	auto RecordFrame = [&](FCommandsStream & Stream, FCommandsBundle * Bundle, u32 Variant) {
+		Stream.Reset();
+		Stream.SetAccess(&SceneColor, EAccessType::READ_PIXEL);
+		Stream.CopyTextureRegion(&Textures[0], 0, &Textures[1], 0);
+		if (Bundle) {
+			if (Bundle->BeginRecording(Variant)) {
+				RecordScenePass(Bundle->Stream, Variant);
+				Bundle->EndRecording();
+			}
+			Stream.ExecuteBundle(*Bundle);
+		}
+		else {
+			RecordScenePass(Stream, Variant);
+		}
+		FRenderTargetView RTV = {};
+		RTV.RTV.ptr = 2;
+		RTV.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		Stream.SetAccess(&Backbuffer, EAccessType::WRITE_RT);
+		Stream.SetAccess(&SceneColor, EAccessType::READ_PIXEL);
+		Stream.SetRenderTarget(RTV);
+		Stream.SetPipelineState((FPipelineState*)(u64)1000);
+		Stream.SetTexture(&SceneParam, D3D12_CPU_DESCRIPTOR_HANDLE{ 0x2000 });
+		Stream.Draw(3);
+		Stream.Close();
+	};
+
+	FCommandsStream Direct;
+	FCommandsStream Spliced;
+	FCommandsBundle Bundle;
+	FCaptureContext Context;
+	Context.bApplyBarriers = false;
+
+	// scene pass changes every 8 frames
+	double DirectMs = 0;
+	double SplicedMs = 0;
+	u32 RecordingsNum = 0;
+	u32 Mismatches = 0;
+	u32 BarriersNum = 0;
+	for (u32 Frame = 0; Frame < FramesNum; ++Frame) {
+		u32 Variant = Frame / 8;
+
+		i64 StartTicks = GetCpuTicks();
+		RecordFrame(Direct, nullptr, Variant);
+		DirectMs += CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		bool bRecorded = !Bundle.IsRecorded || Bundle.InputsHash != Variant;
+		StartTicks = GetCpuTicks();
+		RecordFrame(Spliced, &Bundle, Variant);
+		SplicedMs += CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		RecordingsNum += bRecorded ? 1 : 0;
+
+		Context.Reset();
+		Playback(Context, &Direct);
+		u64 DirectHash = Context.GetTraceHash();
+		u32 DirectBarriersNum = Context.BarriersNum;
+		Context.Reset();
+		Playback(Context, &Spliced);
+		Mismatches += DirectHash != Context.GetTraceHash() || DirectBarriersNum != Context.BarriersNum;
+		BarriersNum = Context.BarriersNum;
+	}
+
+	PrintFormated(L"bundles: %u frames, %u draws per frame, record %.3f ms/frame direct, %.3f ms/frame spliced (%u bundle recordings), %u packets -> %u packets in frame stream, %u barriers, %u mismatches\n",
+		FramesNum, DrawsNum, DirectMs / FramesNum, SplicedMs / FramesNum, RecordingsNum,
+		Direct.PacketsNum, Spliced.PacketsNum, BarriersNum, Mismatches);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include "Essence.h"
+#include "Commands.h"
+#include <EASTL/vector.h>
+#include <EASTL/hash_map.h>
+
+// playback target without device: calls are written into a trace instead of a command list
+// pointers, descriptors and addresses are renamed to ids in order of first use, same frame gives same trace every run
+class FCaptureContext final : public FPlaybackContext {
+public:
+	enum class ECall : u32 {
+		ClearRTV,
+		ClearDSV,
+		ClearUAV,
+		SetCounter,
+		CopyResource,
+		CopyTextureRegion,
+		SetPipelineState,
+		SetTopology,
+		SetRenderTarget,
+		SetDepthStencil,
+		SetViewport,
+		SetScissorRect,
+		SetVB,
+		SetIB,
+		SetConstantBuffer,
+		SetTexture,
+		SetRWTexture,
+		Draw,
+		DrawIndexed,
+		Dispatch,
+		Barrier,
+		AliasingBarrier
+	};
+
+	// call id followed by its arguments, one word each
+	eastl::vector<u32>	Trace;
+	u32					CallsNum = 0;
+	u32					DrawsNum = 0;
+	u32					BarriersNum = 0;
+	// begin/end pairs, transitions without matching begin or overlapping an open split count as errors
+	u32					SplitBarriersNum = 0;
+	u32					SplitErrorsNum = 0;
+	// aliasing barrier while split transition of either resource is open counts as error
+	u32					AliasingBarriersNum = 0;
+	u32					AliasingErrorsNum = 0;
+	// begun split transitions, should be empty once frame is played
+	eastl::vector<FResourceBarrier>	OpenSplits;
+
+	// false makes it a null backend, only counters are updated
+	bool				bRecordTrace = true;
+	// flushed barriers update FResourceStateRegistry like FGPUContext does, so next playback starts from right states
+	bool				bApplyBarriers = true;
+
+	void Reset();
+	u64 GetTraceHash() const;
+
+	void ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE RTV, float4 Color) override;
+	void ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE DSV, float Depth, u8 Stencil) override;
+	void ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE UAV, FGPUResource * Resource, Vec4u Value) override;
+	void SetCounter(FGPUResource * Dst, u32 Value) override;
+	void CopyResource(FGPUResource * Dst, FGPUResource * Src) override;
+	void CopyTextureRegion(FGPUResource * Dst, u32 DstSubresource, FGPUResource * Src, u32 SrcSubresource) override;
+	void SetPipelineState(FPipelineState const * PipelineState) override;
+	void SetTopology(D3D_PRIMITIVE_TOPOLOGY Topology) override;
+	void SetRenderTarget(FRenderTargetView View, u32 Index) override;
+	void SetDepthStencil(FDepthStencilView View) override;
+	void SetViewport(D3D12_VIEWPORT const & Viewport) override;
+	void SetScissorRect(D3D12_RECT const & Rect) override;
+	void SetVB(FBufferLocation const & BufferView, u32 Stream) override;
+	void SetIB(FBufferLocation const & BufferView) override;
+	void SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV) override;
+	void SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View) override;
+	void SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View) override;
+	void Draw(u32 VertexCount, u32 StartVertex, u32 Instances, u32 StartInstance) override;
+	void DrawIndexed(u32 IndexCount, u32 StartIndex, i32 BaseVertex, u32 Instances, u32 StartInstance) override;
+	void Dispatch(u32 X, u32 Y, u32 Z) override;
+	void Barriers(FResourceBarrier const * Barriers, u32 Num) override;
+	void FlushBarriers() override;
+	void AliasingBarrier(FGPUResource * Before, FGPUResource * After) override;
+
+private:
+	eastl::hash_map<u64, u32>			Ids;
+	eastl::vector<FResourceBarrier>		PendingBarriers;
+
+	bool BeginCall(ECall Call);
+	void Write(u32 Value);
+	void Write(float Value);
+	// 0 stays 0, anything else gets id of its first occurrence
+	void WriteId(u64 Value);
+	void WriteId(void const * Value) { WriteId((u64)Value); }
+	void CheckSplit(FResourceBarrier const& Barrier);
+};
+
+// resource that only takes part in access tracking and barrier resolution, it never reaches device
+void InitCaptureResource(FGPUResource & Resource, u32 MipmapsNum = 1);
+
+// packets/s of Playback into null and trace capturing backends, for function pointer and opcode encoded streams
+void BenchmarkPlayback();
+
+// packets saved by FCommandsStream::Compact on redundant scene and ui draws, compacted playback is checked against original
+void BenchmarkStreamCompaction();
+
+// frame recorded directly and with static pass spliced in as FCommandsBundle, traces of both are compared
+void BenchmarkBundles();
@@ -1,130 +1,266 @@
 #include "CommandStream.h"
 #include "Pipeline.h"
 #include "Commands.h"
+#include <mutex>
 
-u64	FRenderCmdBarriersBatchFunc(FGPUContext * Context, void * DataVoidPtr) {
+static_assert(sizeof(FCommandsPage) == FCommandsPage::SIZE, "page header doesn't fit reserved bytes");
+
+class FCommandsPagePool {
+public:
+	std::mutex		Lock;
+	FCommandsPage *	FreeList = nullptr;
+	u32				AllocatedNum = 0;
+
+	~FCommandsPagePool() {
+		while (FreeList) {
+			FCommandsPage * Page = FreeList;
+			FreeList = Page->Next;
+			delete Page;
+		}
+	}
+};
+
+// constructed on first use, streams acquire a page when constructed, so pool outlives static streams
+static FCommandsPagePool & GetCommandsPagePool() {
+	static FCommandsPagePool Pool;
+	return Pool;
+}
+
+FCommandsPage * AcquireCommandsPage() {
+	FCommandsPagePool & Pool = GetCommandsPagePool();
+	FCommandsPage * Page;
+	{
+		std::lock_guard<std::mutex> Lock(Pool.Lock);
+		Page = Pool.FreeList;
+		if (Page) {
+			Pool.FreeList = Page->Next;
+		}
+		else {
+			Pool.AllocatedNum++;
+		}
+	}
+	if (!Page) {
+		Page = new FCommandsPage;
+	}
+	Page->Next = nullptr;
+	Page->Used = 0;
+	return Page;
+}
+
+void ReleaseCommandsPages(FCommandsPage * First, FCommandsPage * Last) {
+	FCommandsPagePool & Pool = GetCommandsPagePool();
+	std::lock_guard<std::mutex> Lock(Pool.Lock);
+	Last->Next = Pool.FreeList;
+	Pool.FreeList = First;
+}
+
+u32 GetCommandsPagesAllocatedNum() {
+	FCommandsPagePool & Pool = GetCommandsPagePool();
+	std::lock_guard<std::mutex> Lock(Pool.Lock);
+	return Pool.AllocatedNum;
+}
+
+u64	FRenderCmdBarriersBatchFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdBarriersBatch*)DataVoidPtr;
 	Data->This->ExecuteBatchedBarriers(Context, Data->BatchIndex);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdBarriersBatch);
 }
 
-u64	FRenderCmdClearRTVFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdClearRTVFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdClearRTV*)DataVoidPtr;
 	Context->ClearRTV(Data->RTV, Data->Color);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdClearRTV);
 }
 
-u64	FRenderCmdClearDSVFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdClearDSVFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdClearDSV*)DataVoidPtr;
 	Context->ClearDSV(Data->DSV, Data->Depth, Data->Stencil);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdClearDSV);
 }
 
-u64	FRenderCmdClearUAVFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdClearUAVFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdClearUAV*)DataVoidPtr;
 	Context->ClearUAV(Data->UAV, Data->Resource, Data->Value);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdClearUAV);
 }
 
-u64	FRenderCmdSetCounterFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdSetCounterFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetCounter*)DataVoidPtr;
 	Context->SetCounter(Data->Resource, Data->Value);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetCounter);
 }
 
-u64	FRenderCmdSetPipelineStateFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdSetPipelineStateFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetPipelineState*)DataVoidPtr;
-	Context->SetRoot(Data->State->ShaderState->RootLayout);
-	Context->SetPSO(Data->State);
+	Context->SetPipelineState(Data->State);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetPipelineState);
 }
 
-u64	FRenderCmdSetVBFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64	FRenderCmdSetVBFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetVB*)DataVoidPtr;
 	Context->SetVB(Data->Location, Data->Stream);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetVB);
 }
 
-u64 FRenderCmdSetIBFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetIBFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetIB*)DataVoidPtr;
 	Context->SetIB(Data->Location);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetIB);
 };
 
-u64 FRenderCmdSetTopologyFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetTopologyFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetTopology*)DataVoidPtr;
 	Context->SetTopology(Data->Topology);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetTopology);
 };
 
-u64 FRenderCmdSetViewportFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetViewportFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetViewport*)DataVoidPtr;
 	Context->SetViewport(Data->Viewport);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetViewport);
 };
 
-u64 FRenderCmdSetRenderTargetFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetRenderTargetFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetRenderTarget*)DataVoidPtr;
 	Context->SetRenderTarget(Data->View, Data->Index);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetRenderTarget);
 };
 
-u64 FRenderCmdSetDepthStencilFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetDepthStencilFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetDepthStencil*)DataVoidPtr;
 	Context->SetDepthStencil(Data->View);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetDepthStencil);
 }
 
-u64 FRenderCmdSetTextureFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetTextureFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetTexture*)DataVoidPtr;
 	Context->SetTexture(Data->Param, Data->SRV);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetTexture);
 };
 
-u64 FRenderCmdSetConstantBufferFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetConstantBufferFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetConstantBuffer*)DataVoidPtr;
 	Context->SetConstantBuffer(Data->Param, Data->CBV);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetConstantBuffer);
 };
 
-u64 FRenderCmdSetRWTextureFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetRWTextureFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetRWTexture*)DataVoidPtr;
 	Context->SetRWTexture(Data->Param, Data->UAV);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetRWTexture);
 }
 
-u64 FRenderCmdSetScissorRectFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdSetScissorRectFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdSetScissorRect*)DataVoidPtr;
 	Context->SetScissorRect(Data->Rect);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdSetScissorRect);
 };
 
-u64 FRenderCmdDrawFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdDrawFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdDraw*)DataVoidPtr;
 	Context->Draw(Data->VertexCount, Data->StartVertex, Data->Instances, Data->StartInstance);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdDraw);
 };
 
-u64 FRenderCmdDrawIndexedFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdDrawIndexedFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdDrawIndexed*)DataVoidPtr;
 	Context->DrawIndexed(Data->IndexCount, Data->StartIndex, Data->BaseVertex, Data->Instances, Data->StartInstance);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdDrawIndexed);
 };
 
-u64 FRenderCmdDispatchFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdDispatchFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdDispatch*)DataVoidPtr;
 	Context->Dispatch(Data->X, Data->Y, Data->Z);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdDispatch);
 }
 
-u64 FRenderCmdCopyResourceFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdCopyResourceFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdCopyResource*)DataVoidPtr;
 	Context->CopyResource(Data->Dst, Data->Src);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdCopyResource);
 }
 
-u64 FRenderCmdCopyTextureRegionFunc(FGPUContext * Context, void * DataVoidPtr) {
+u64 FRenderCmdCopyTextureRegionFunc(FPlaybackContext * Context, void * DataVoidPtr) {
 	auto Data = (FRenderCmdCopyTextureRegion*)DataVoidPtr;
 	Context->CopyTextureRegion(Data->Dst, Data->DstSubresource, Data->Src, Data->SrcSubresource);
 	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdCopyTextureRegion);
+}
+
+u64 FRenderCmdAliasingBarrierFunc(FPlaybackContext * Context, void * DataVoidPtr) {
+	auto Data = (FRenderCmdAliasingBarrier*)DataVoidPtr;
+	Context->AliasingBarrier(Data->Before, Data->After);
+	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdAliasingBarrier);
+}
+
+u64 FRenderCmdExecuteBundleFunc(FPlaybackContext * Context, void * DataVoidPtr) {
+	auto Data = (FRenderCmdExecuteBundle*)DataVoidPtr;
+	Data->Stream->PlaybackBundle(Context, Data->Bundle, Data->BaseBatch);
+	return sizeof(FRenderCmdHeader) + sizeof(FRenderCmdExecuteBundle);
+}
+
+const FRenderCmdInfo GRenderCmdInfos[(u32)ERenderCmd::Num] = {
+#define RENDER_CMD_INFO(Name) { FRenderCmd##Name##Func, (u32)sizeof(FRenderCmd##Name), (u32)alignof(FRenderCmd##Name) },
+	RENDER_CMD_LIST(RENDER_CMD_INFO)
+#undef RENDER_CMD_INFO
+};
+
+namespace {
+	// open addressing by function pointer, compacting and bundle playback look up every packet
+	struct FRenderCmdOpcodeTable {
+		static const u32 SIZE = 64;
+		RenderCmdFunc	Funcs[SIZE];
+		ERenderCmd		Opcodes[SIZE];
+
+		static u32 GetSlot(RenderCmdFunc Func) {
+			return (u32)(((u64)Func * 0x9E3779B97F4A7C15ull) >> 58);
+		}
+
+		FRenderCmdOpcodeTable() {
+			static_assert((u32)ERenderCmd::Num * 2 <= SIZE, "table should stay at most half full");
+			for (u32 Slot = 0; Slot < SIZE; ++Slot) {
+				Funcs[Slot] = nullptr;
+			}
+			for (u32 Opcode = 0; Opcode < (u32)ERenderCmd::Num; ++Opcode) {
+				u32 Slot = GetSlot(GRenderCmdInfos[Opcode].Func);
+				while (Funcs[Slot]) {
+					Slot = (Slot + 1) % SIZE;
+				}
+				Funcs[Slot] = GRenderCmdInfos[Opcode].Func;
+				Opcodes[Slot] = (ERenderCmd)Opcode;
+			}
+		}
+	};
+}
+
+ERenderCmd GetRenderCmdOpcode(RenderCmdFunc Func) {
+	static const FRenderCmdOpcodeTable Table;
+	for (u32 Slot = FRenderCmdOpcodeTable::GetSlot(Func); Table.Funcs[Slot]; Slot = (Slot + 1) % FRenderCmdOpcodeTable::SIZE) {
+		if (Table.Funcs[Slot] == Func) {
+			return Table.Opcodes[Slot];
+		}
+	}
+	check(0);
+	return ERenderCmd::Num;
+}
+
+// one switch over all packet types, functions are in this file so cases can inline them
+void PlaybackOpcodes(FPlaybackContext * Context, FCommandsPage const * Page) {
+	u8 * Data = (u8*)Page->Data;
+	u32 Offset = 0;
+	while (Offset < Page->Used) {
+		switch ((ERenderCmd)Data[Offset]) {
+#define RENDER_CMD_CASE(Name) \
+		case ERenderCmd::Name: { \
+			u32 PayloadOffset = (u32)padded_size(Offset + 1, alignof(FRenderCmd##Name)); \
+			FRenderCmd##Name##Func(Context, Data + PayloadOffset); \
+			Offset = PayloadOffset + sizeof(FRenderCmd##Name); \
+			break; \
+		}
+		RENDER_CMD_LIST(RENDER_CMD_CASE)
+#undef RENDER_CMD_CASE
+		default:
+			check(0);
+			return;
+		}
+	}
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Device.h"
 #include <d3d12.h>
 #include "MathVector.h"
+#include "PointerMath.h"
 
 enum class EPipelineType {
 	Graphics,
@@ -30,30 +31,135 @@ struct FDepthStencilView {
 };
 
 class FGPUContext;
+class FGPUResource;
 class FPipelineState;
 struct FSRVParam;
 struct FUAVParam;
 struct FCBVParam;
+struct FResourceBarrier;
+
+// what Playback executes packets on: FGPUContext records d3d12 command list, FCaptureContext a trace
+class FPlaybackContext {
+public:
+	virtual ~FPlaybackContext() {}
+
+	virtual void ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE RTV, float4 Color) = 0;
+	virtual void ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE DSV, float Depth, u8 Stencil) = 0;
+	virtual void ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE UAV, FGPUResource * Resource, Vec4u Value) = 0;
+	virtual void SetCounter(FGPUResource * Dst, u32 Value) = 0;
+	virtual void CopyResource(FGPUResource * Dst, FGPUResource * Src) = 0;
+	virtual void CopyTextureRegion(FGPUResource * Dst, u32 DstSubresource, FGPUResource * Src, u32 SrcSubresource) = 0;
+	virtual void SetPipelineState(FPipelineState const * PipelineState) = 0;
+	virtual void SetTopology(D3D_PRIMITIVE_TOPOLOGY Topology) = 0;
+	virtual void SetRenderTarget(FRenderTargetView View, u32 Index) = 0;
+	virtual void SetDepthStencil(FDepthStencilView View) = 0;
+	virtual void SetViewport(D3D12_VIEWPORT const & Viewport) = 0;
+	virtual void SetScissorRect(D3D12_RECT const & Rect) = 0;
+	virtual void SetVB(FBufferLocation const & BufferView, u32 Stream) = 0;
+	virtual void SetIB(FBufferLocation const & BufferView) = 0;
+	virtual void SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV) = 0;
+	virtual void SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View) = 0;
+	virtual void SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View) = 0;
+	virtual void Draw(u32 VertexCount, u32 StartVertex, u32 Instances, u32 StartInstance) = 0;
+	virtual void DrawIndexed(u32 IndexCount, u32 StartIndex, i32 BaseVertex, u32 Instances, u32 StartInstance) = 0;
+	virtual void Dispatch(u32 X, u32 Y, u32 Z) = 0;
+	// barriers of one batch are queued, then flushed together
+	virtual void Barriers(FResourceBarrier const * Barriers, u32 Num) = 0;
+	virtual void FlushBarriers() = 0;
+	// After takes over memory Before used, null Before stands for any resource placed there
+	virtual void AliasingBarrier(FGPUResource * Before, FGPUResource * After) = 0;
+};
+
+using RenderCmdFunc = u64(*) (FPlaybackContext *, void *);
+
+// stream memory, packets are appended until the next one doesn't fit, so a packet never straddles pages
+struct FCommandsPage {
+	static const u32 SIZE = 64 * 1024;
+	static const u32 CAPACITY = SIZE - 16;
 
-using RenderCmdFunc = u64(*) (FGPUContext *, void *);
+	FCommandsPage *	Next;
+	u32				Used;
+	u8				Data[CAPACITY];
+};
+
+// thread safe pool, pages are allocated only when it's empty and never freed
+// streams give their pages back on Reset, so steady frames record without heap allocations
+FCommandsPage * AcquireCommandsPage();
+// returns chain First..Last linked by Next
+void ReleaseCommandsPages(FCommandsPage * First, FCommandsPage * Last);
+u32 GetCommandsPagesAllocatedNum();
+
+// FunctionPointer: packet is FRenderCmdHeader followed by unaligned payload, playback calls the function
+// Opcode: packet is ERenderCmd byte, padding to payload alignment and payload, playback switches on the byte
+enum class ECommandsEncoding : u8 {
+	FunctionPointer,
+	Opcode
+};
 
 struct FRenderCmdHeader {
 	RenderCmdFunc	Func;
 };
 
+// every packet type, Name gives FRenderCmd##Name payload and FRenderCmd##Name##Func
+#define RENDER_CMD_LIST(X) \
+	X(BarriersBatch) \
+	X(ClearRTV) \
+	X(ClearDSV) \
+	X(ClearUAV) \
+	X(SetCounter) \
+	X(SetPipelineState) \
+	X(SetVB) \
+	X(SetIB) \
+	X(SetTopology) \
+	X(SetViewport) \
+	X(SetRenderTarget) \
+	X(SetDepthStencil) \
+	X(SetTexture) \
+	X(SetConstantBuffer) \
+	X(SetRWTexture) \
+	X(SetScissorRect) \
+	X(Draw) \
+	X(DrawIndexed) \
+	X(Dispatch) \
+	X(CopyResource) \
+	X(CopyTextureRegion) \
+	X(AliasingBarrier) \
+	X(ExecuteBundle)
+
+enum class ERenderCmd : u8 {
+#define RENDER_CMD_ENUM(Name) Name,
+	RENDER_CMD_LIST(RENDER_CMD_ENUM)
+#undef RENDER_CMD_ENUM
+	Num
+};
+
+// start of payload of packet starting at Offset
+inline u32 GetRenderCmdPayloadOffset(ECommandsEncoding Encoding, u32 Offset, u32 Alignment) {
+	return Encoding == ECommandsEncoding::Opcode ? (u32)padded_size(Offset + 1, Alignment) : Offset + (u32)sizeof(FRenderCmdHeader);
+}
+
+inline void WriteRenderCmdHeader(ECommandsEncoding Encoding, u8 * Packet, ERenderCmd Opcode, RenderCmdFunc Func) {
+	if (Encoding == ECommandsEncoding::Opcode) {
+		*Packet = (u8)Opcode;
+	}
+	else {
+		((FRenderCmdHeader*)Packet)->Func = Func;
+	}
+}
+
 struct	FRenderCmdBarriersBatch {
 	class FCommandsStream *	This;
 	u32						BatchIndex;
 };
 
-u64	FRenderCmdBarriersBatchFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdBarriersBatchFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct	FRenderCmdClearRTV {
 	D3D12_CPU_DESCRIPTOR_HANDLE RTV;
 	float4 Color;
 };
 
-u64	FRenderCmdClearRTVFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdClearRTVFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct	FRenderCmdClearDSV {
 	D3D12_CPU_DESCRIPTOR_HANDLE	DSV;
@@ -61,7 +167,7 @@ struct	FRenderCmdClearDSV {
 	u8 Stencil;
 };
 
-u64	FRenderCmdClearDSVFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdClearDSVFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct	FRenderCmdClearUAV {
 	D3D12_CPU_DESCRIPTOR_HANDLE	UAV;
@@ -69,85 +175,85 @@ struct	FRenderCmdClearUAV {
 	Vec4u Value;
 };
 
-u64	FRenderCmdClearUAVFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdClearUAVFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct	FRenderCmdSetCounter {
 	FGPUResource * Resource;
 	u32 Value;
 };
 
-u64	FRenderCmdSetCounterFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdSetCounterFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct	FRenderCmdSetPipelineState {
 	FPipelineState *	State;
 };
 
-u64	FRenderCmdSetPipelineStateFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdSetPipelineStateFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetVB {
 	FBufferLocation	Location;
 	u8				Stream;
 };
 
-u64	FRenderCmdSetVBFunc(FGPUContext * Context, void * DataVoidPtr);
+u64	FRenderCmdSetVBFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetIB {
 	FBufferLocation Location;
 };
 
-u64 FRenderCmdSetIBFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetIBFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetTopology {
 	D3D_PRIMITIVE_TOPOLOGY Topology;
 };
 
-u64 FRenderCmdSetTopologyFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetTopologyFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetViewport {
 	D3D12_VIEWPORT	Viewport;
 };
 
-u64 FRenderCmdSetViewportFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetViewportFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetRenderTarget {
 	FRenderTargetView			View;
 	u8							Index;
 };
 
-u64 FRenderCmdSetRenderTargetFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetRenderTargetFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetDepthStencil {
 	FDepthStencilView			View;
 };
 
-u64 FRenderCmdSetDepthStencilFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetDepthStencilFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetTexture {
 	FSRVParam *				Param;
 	D3D12_CPU_DESCRIPTOR_HANDLE	SRV;
 };
 
-u64 FRenderCmdSetTextureFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetTextureFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetConstantBuffer {
 	FCBVParam *			Param;
 	D3D12_CPU_DESCRIPTOR_HANDLE	CBV;
 };
 
-u64 FRenderCmdSetConstantBufferFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetConstantBufferFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetRWTexture {
 	FUAVParam *			Param;
 	D3D12_CPU_DESCRIPTOR_HANDLE	UAV;
 };
 
-u64 FRenderCmdSetRWTextureFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetRWTextureFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdSetScissorRect {
 	D3D12_RECT	Rect;
 };
 
-u64 FRenderCmdSetScissorRectFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdSetScissorRectFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdDraw {
 	u32 VertexCount;
@@ -156,7 +262,7 @@ struct FRenderCmdDraw {
 	u32 StartInstance;
 };
 
-u64 FRenderCmdDrawFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdDrawFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdDrawIndexed {
 	u32 IndexCount;
@@ -166,7 +272,7 @@ struct FRenderCmdDrawIndexed {
 	u32 StartInstance;
 };
 
-u64 FRenderCmdDrawIndexedFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdDrawIndexedFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdDispatch {
 	u32 X;
@@ -174,14 +280,14 @@ struct FRenderCmdDispatch {
 	u32 Z;
 };
 
-u64 FRenderCmdDispatchFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdDispatchFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdCopyResource {
 	FGPUResource * Dst;
 	FGPUResource * Src;
 };
 
-u64 FRenderCmdCopyResourceFunc(FGPUContext * Context, void * DataVoidPtr);
+u64 FRenderCmdCopyResourceFunc(FPlaybackContext * Context, void * DataVoidPtr);
 
 struct FRenderCmdCopyTextureRegion {
 	FGPUResource * Dst;
@@ -190,4 +296,38 @@ struct FRenderCmdCopyTextureRegion {
 	u16 SrcSubresource;
 };
 
-u64 FRenderCmdCopyTextureRegionFunc(FGPUContext * Context, void * DataVoidPtr);
\ No newline at end of file
+u64 FRenderCmdCopyTextureRegionFunc(FPlaybackContext * Context, void * DataVoidPtr);
+
+struct FRenderCmdAliasingBarrier {
+	FGPUResource * Before;
+	FGPUResource * After;
+};
+
+u64 FRenderCmdAliasingBarrierFunc(FPlaybackContext * Context, void * DataVoidPtr);
+
+// bundle packets are played in place, its batch N is batch BaseBatch + N of Stream
+struct FRenderCmdExecuteBundle {
+	class FCommandsStream *	Stream;
+	class FCommandsStream *	Bundle;
+	u32						BaseBatch;
+};
+
+u64 FRenderCmdExecuteBundleFunc(FPlaybackContext * Context, void * DataVoidPtr);
+
+template<typename T> struct TRenderCmdOpcode;
+#define RENDER_CMD_OPCODE(Name) template<> struct TRenderCmdOpcode<FRenderCmd##Name> { static const ERenderCmd Value = ERenderCmd::Name; };
+RENDER_CMD_LIST(RENDER_CMD_OPCODE)
+#undef RENDER_CMD_OPCODE
+
+struct FRenderCmdInfo {
+	RenderCmdFunc	Func;
+	u32				Size;
+	u32				Alignment;
+};
+
+// indexed by opcode
+extern const FRenderCmdInfo GRenderCmdInfos[(u32)ERenderCmd::Num];
+ERenderCmd GetRenderCmdOpcode(RenderCmdFunc Func);
+
+// executes packets of page recorded with ECommandsEncoding::Opcode
+void PlaybackOpcodes(FPlaybackContext * Context, FCommandsPage const * Page);
\ No newline at end of file
@@ -3,10 +3,15 @@
 #include <EASTL/vector.h>
 #include <EASTL/queue.h>
 #include <EASTL/array.h>
+#include <EASTL/sort.h>
 #include "d3dx12.h"
 #include "VideoMemory.h"
 #include "Pipeline.h"
 #include "Print.h"
+#include "Tasks.h"
+#include "CaptureContext.h"
+#include <random>
+#include <thread>
 
 #define WORKLOAD_STATS 1
 #define API_STATS 1
@@ -158,6 +163,8 @@ public:
 	u32													ListsNum = 0;
 	u32													AllocatorsNum = 0;
 
+	CommandListPool(D3D12_COMMAND_LIST_TYPE InType) : Type(InType) {}
+
 	CommandAllocator* ObtainAllocator(EContextLifetime lifetime) {
 		decltype(ReadyAllocators[0])& AllocatorPool = ReadyAllocators[(u32)lifetime];
 	
@@ -309,10 +316,13 @@ GPUCommandQueue::GPUCommandQueue(D3D12Device* device, TypeEnum type) :
 	switch (Type) {
 	case COMPUTE:
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+		break;
 	case COPY:
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+		break;
 	case GRAPHICS:
 		queueDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+		break;
 	}
 
 	VERIFYDX12(Device->D12Device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(D12CommandQueue.get_init())));
@@ -333,7 +343,12 @@ void GPUCommandQueue::WaitForCompletion(u64 syncValue) {
 
 void GPUCommandQueue::Wait(FGPUSyncPoint fence) {
 	check(fence.IsSet());
-	VERIFYDX12(D12CommandQueue->Wait(D12Fence.get(), FencesPool[fence.Index].Value));
+	if (fence.IsCompleted()) {
+		return;
+	}
+	// fence can come from other queue, wait has to be on fence of that queue
+	GPUFence const& Fence = FencesPool[fence.Index];
+	VERIFYDX12(D12CommandQueue->Wait(Fence.Queue->D12Fence.get(), Fence.Value));
 }
 
 void GPUCommandQueue::Execute(GPUCommandList* list) {
@@ -394,9 +409,9 @@ eastl::unique_ptr<GPUCommandQueue>	DirectQueue;
 eastl::unique_ptr<GPUCommandQueue>	CopyQueue;
 eastl::unique_ptr<GPUCommandQueue>	ComputeQueue;
 
-CommandListPool					DirectPool;
-CommandListPool					CopyPool;
-CommandListPool					ComputePool;
+CommandListPool					DirectPool(D3D12_COMMAND_LIST_TYPE_DIRECT);
+CommandListPool					CopyPool(D3D12_COMMAND_LIST_TYPE_COPY);
+CommandListPool					ComputePool(D3D12_COMMAND_LIST_TYPE_COMPUTE);
 
 GPUCommandQueue*		GetDirectQueue() {
 	if (!DirectQueue.get()) {
@@ -406,17 +421,17 @@ GPUCommandQueue*		GetDirectQueue() {
 }
 
 GPUCommandQueue*		GetComputeQueue() {
-	if (!CopyQueue.get()) {
-		CopyQueue.reset(new GPUCommandQueue(GetPrimaryDevice(), GPUCommandQueue::COMPUTE));
+	if (!ComputeQueue.get()) {
+		ComputeQueue.reset(new GPUCommandQueue(GetPrimaryDevice(), GPUCommandQueue::COMPUTE));
 	}
-	return CopyQueue.get();
+	return ComputeQueue.get();
 }
 
 GPUCommandQueue*		GetCopyQueue() {
-	if (!ComputeQueue.get()) {
-		ComputeQueue.reset(new GPUCommandQueue(GetPrimaryDevice(), GPUCommandQueue::COPY));
+	if (!CopyQueue.get()) {
+		CopyQueue.reset(new GPUCommandQueue(GetPrimaryDevice(), GPUCommandQueue::COPY));
 	}
-	return ComputeQueue.get();
+	return CopyQueue.get();
 }
 
 void FGPUContext::Close() {
@@ -501,6 +516,12 @@ void FGPUContext::FlushBarriers() {
 			barrier.Transition.StateBefore = GetAPIResourceState(BarriersList[Index].From);
 			barrier.Transition.StateAfter = GetAPIResourceState(BarriersList[Index].To);
 			barrier.Transition.Subresource = BarriersList[Index].Subresource;
+			if (BarriersList[Index].Split == EBarrierSplit::BEGIN_ONLY) {
+				barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY;
+			}
+			else if (BarriersList[Index].Split == EBarrierSplit::END_ONLY) {
+				barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
+			}
 			ScratchMem.push_back(barrier);
 
 			if(GLogBarriers) {
@@ -510,7 +531,8 @@ void FGPUContext::FlushBarriers() {
 					);
 			}
 
-			if(BarriersList[Index].Resource->FatData->AutomaticBarriers) {
+			// state changes when split transition ends
+			if(BarriersList[Index].Resource->FatData->AutomaticBarriers && BarriersList[Index].Split != EBarrierSplit::BEGIN_ONLY) {
 				GetResourceStateRegistry()->SetCurrentState(BarriersList[Index].Resource, BarriersList[Index].Subresource, BarriersList[Index].To);
 			}
 		}
@@ -519,6 +541,13 @@ void FGPUContext::FlushBarriers() {
 	}
 }
 
+void FGPUContext::AliasingBarrier(FGPUResource * Before, FGPUResource * After) {
+	FlushBarriers();
+
+	D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Aliasing(Before ? Before->D12Resource.get() : nullptr, After->D12Resource.get());
+	RawCommandList()->ResourceBarrier(1, &barrier);
+}
+
 void FGPUContext::CopyDataToSubresource(FGPUResource* Dst, u32 Subresource, void const * Src, u64 RowPitch, u64 SlicePitch) {
 	FlushBarriers();
 
@@ -532,12 +561,15 @@ void FGPUContext::CopyDataToSubresource(FGPUResource* Dst, u32 Subresource, void
 	u64 rowPitch;
 	u64 bytesTotal;
 	GetPrimaryDevice()->D12Device->GetCopyableFootprints(&Dst->FatData->Desc, Subresource, 1, 0, &Footprint, &numRows, &rowPitch, &bytesTotal);
-	auto uploadBuffer = GetUploadAllocator()->CreateBuffer(bytesTotal, 0);
-	D3D12_MEMCPY_DEST dest = { (u8*)uploadBuffer->FatData->CpuPtr + Footprint.Offset, Footprint.Footprint.RowPitch, Footprint.Footprint.RowPitch * numRows };
+	FStagingAllocation Staging = GetStagingAllocator()->Allocate(bytesTotal, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, GetCompletionGPUSyncPoint());
+	D3D12_MEMCPY_DEST dest = { (u8*)Staging.CPUPtr + Footprint.Offset, Footprint.Footprint.RowPitch, Footprint.Footprint.RowPitch * numRows };
 	MemcpySubresource(&dest, &SubresourceData, rowPitch, numRows, Footprint.Footprint.Depth);
 
+	// footprint was computed for offset 0
+	Footprint.Offset += Staging.Offset;
+
 	D3D12_TEXTURE_COPY_LOCATION SrcLocation;
-	SrcLocation.pResource = uploadBuffer->D12Resource.get();
+	SrcLocation.pResource = Staging.Resource->D12Resource.get();
 	SrcLocation.PlacedFootprint = Footprint;
 	SrcLocation.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
 
@@ -547,23 +579,50 @@ void FGPUContext::CopyDataToSubresource(FGPUResource* Dst, u32 Subresource, void
 	DstLocation.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
 
 	RawCommandList()->CopyTextureRegion(&DstLocation, 0, 0, 0, &SrcLocation, nullptr);
-	uploadBuffer->FenceDeletion(GetCompletionGPUSyncPoint());
 }
 
 void FGPUContext::CopyToBuffer(FGPUResource * Dst, void const* Src, u64 Size) {
 	FlushBarriers();
 
-	D3D12_SUBRESOURCE_DATA SubresourceData;
-	SubresourceData.pData = Src;
-	SubresourceData.RowPitch = Size;
-	SubresourceData.SlicePitch = Size;
+	FStagingAllocation Staging = GetStagingAllocator()->Allocate(Size, 16, GetCompletionGPUSyncPoint());
+	memcpy(Staging.CPUPtr, Src, Size);
+
+	RawCommandList()->CopyBufferRegion(Dst->D12Resource.get(), 0, Staging.Resource->D12Resource.get(), Staging.Offset, Size);
+}
+
+FUploadQueue GUploadQueue;
+
+FUploadQueue * GetUploadQueue() {
+	return &GUploadQueue;
+}
+
+void FUploadQueue::Open() {
+	if (!bOpen) {
+		Context.Open(EContextType::COPY);
+		bOpen = true;
+	}
+}
 
-	auto uploadBuffer = GetUploadAllocator()->CreateBuffer(Size, 0);
-	memcpy(uploadBuffer->GetMappedPtr(), Src, Size);
+void FUploadQueue::CopyDataToSubresource(FGPUResource * Dst, u32 Subresource, void const * Src, u64 RowPitch, u64 SlicePitch) {
+	Open();
+	Context.CopyDataToSubresource(Dst, Subresource, Src, RowPitch, SlicePitch);
+}
+
+void FUploadQueue::CopyToBuffer(FGPUResource * Dst, void const* Src, u64 Size) {
+	Open();
+	Context.CopyToBuffer(Dst, Src, Size);
+}
 
-	RawCommandList()->CopyBufferRegion(Dst->D12Resource.get(), 0, uploadBuffer->D12Resource.get(), 0, Size);
+FGPUSyncPoint FUploadQueue::Flush() {
+	if (!bOpen) {
+		return GetDummyGPUSyncPoint();
+	}
+	bOpen = false;
 
-	uploadBuffer->FenceDeletion(GetCompletionGPUSyncPoint());
+	FGPUSyncPoint Sync = Context.GetCompletionGPUSyncPoint();
+	Context.ExecuteImmediately();
+	GetDirectQueue()->Wait(Sync);
+	return Sync;
 }
 
 ID3D12GraphicsCommandList* FGPUContext::RawCommandList() const {
@@ -722,7 +781,12 @@ void FGPUContext::Open(EContextType Type, EContextLifetime Lifetime) {
 		RawCommandList()->SetDescriptorHeaps(_countof(Heaps), Heaps);
 	}
 	else if (Type == EContextType::COPY) {
-		check(0);
+		CommandList = CopyPool.ObtainList(Lifetime);
+		Queue = GetCopyQueue();
+		Device = GetPrimaryDevice()->D12Device.get();
+
+		// copy lists can't bind descriptor heaps
+		Reset();
 	}
 }
 
@@ -1025,7 +1089,43 @@ FGPUSyncPoint GetLastFrameGPUSyncPoint() {
 	return LastFrameFGPUSyncPoint;
 }
 
+commands_stats_t& operator += (commands_stats_t& lhs, commands_stats_t const& rhs) {
+	lhs.graphic_pipeline_state_changes += rhs.graphic_pipeline_state_changes;
+	lhs.graphic_root_signature_changes += rhs.graphic_root_signature_changes;
+	lhs.graphic_root_params_set += rhs.graphic_root_params_set;
+	lhs.draw_calls += rhs.draw_calls;
+	lhs.compute_pipeline_state_changes += rhs.compute_pipeline_state_changes;
+	lhs.compute_root_signature_changes += rhs.compute_root_signature_changes;
+	lhs.compute_root_params_set += rhs.compute_root_params_set;
+	lhs.dispatches += rhs.dispatches;
+	lhs.constants_bytes_uploaded += rhs.constants_bytes_uploaded;
+	lhs.barriers += rhs.barriers;
+	lhs.barriers_elided += rhs.barriers_elided;
+	lhs.packets_compacted += rhs.packets_compacted;
+	lhs.bytes_compacted += rhs.bytes_compacted;
+	lhs.bundles_recorded += rhs.bundles_recorded;
+	lhs.bundles_executed += rhs.bundles_executed;
+	lhs.aliasing_barriers += rhs.aliasing_barriers;
+	lhs.transient_bytes += rhs.transient_bytes;
+	lhs.transient_bytes_packed += rhs.transient_bytes_packed;
+	return lhs;
+}
+
+frame_stats_t GCurrentFrameStats;
+frame_stats_t GLastFrameStats;
+
+frame_stats_t & GetCurrentFrameStats() {
+	return GCurrentFrameStats;
+}
+
+frame_stats_t const& GetLastFrameStats() {
+	return GLastFrameStats;
+}
+
 void EndFrame() {
+	GLastFrameStats = GCurrentFrameStats;
+	GCurrentFrameStats = {};
+
 	DirectPool.ResetAllocators();
 	CopyPool.ResetAllocators();
 	ComputePool.ResetAllocators();
@@ -1036,12 +1136,18 @@ void EndFrame() {
 
 	GetOnlineDescriptorsAllocator()->FenceTemporaryAllocations(FrameEndSync);
 	GetConstantsAllocator()->FenceFrameAllocations(FrameEndSync);
+	// copies nobody flushed go with the frame, their staging batch would never complete otherwise
+	GetUploadQueue()->Flush();
+	GetStagingAllocator()->FenceFrameAllocations();
 
 	GetOnlineDescriptorsAllocator()->Tick();
 	GetTexturesAllocator()->Tick();
 	GetConstantsAllocator()->Tick();
 	GetUploadAllocator()->Tick();
+	GetStagingAllocator()->Tick();
 	GetBuffersAllocator()->Tick();
+	GetPooledRenderTargetAllocator()->Tick();
+	GetTransientTexturesAllocator()->Tick();
 
 	TickDescriptors(FrameEndSync);
 
@@ -1062,62 +1168,152 @@ FResourceStateRegistry * GetResourceStateRegistry() {
 	return GResourceStateRegistry.get();
 }
 
-void ProcessResourceBarriers(
-	FGPUResource * Resource,
-	eastl::vector<FResourceAccessNode>& InitialNodes,
-	eastl::vector<FResourceAccess> const& Requests,
-	eastl::hash_map<u32, eastl::vector<FResourceBarrier>> &OutBarriers
-	) {
-	auto & Nodes = InitialNodes;
+// barriers come in batch order, transition into state no command used before next transition in the same batch
+// is merged with it, A->B->A disappears completely, returns number of removed barriers
+static u32 MergeSameBatchBarriers(eastl::vector<FBatchedBarrier> & Barriers, u32 First) {
+	u32 Num = First;
+	for (u32 Index = First; Index < Barriers.size(); ++Index) {
+		FBatchedBarrier const& Barrier = Barriers[Index];
 
-	u32 LastAllSubresNode = 0;
-	eastl::hash_map<u32, u32> LastSubresourceNode;
-	u32 LastComplementaryNode = -1;
+		// only last earlier barrier of the same batch touching the subresource can be merged with
+		u32 Earlier = Num;
+		while (Earlier > First && Barriers[Earlier - 1].BatchIndex == Barrier.BatchIndex) {
+			u32 Subresource = Barriers[Earlier - 1].Barrier.Subresource;
+			if (Subresource == Barrier.Barrier.Subresource || Subresource == ALL_SUBRESOURCES || Barrier.Barrier.Subresource == ALL_SUBRESOURCES) {
+				break;
+			}
+			--Earlier;
+		}
 
-	if (Nodes[0].Complementary == 1) {
-		LastAllSubresNode = -1;
-		LastComplementaryNode = 0;
+		bool Mergeable = Earlier > First && Barriers[Earlier - 1].BatchIndex == Barrier.BatchIndex
+			&& Barriers[Earlier - 1].Barrier.Subresource == Barrier.Barrier.Subresource
+			&& Barriers[Earlier - 1].Barrier.To == Barrier.Barrier.From;
+		if (!Mergeable) {
+			Barriers[Num++] = Barrier;
+			continue;
+		}
 
-		for (u32 Index = 1; Index < Nodes.size(); Index++) {
-			LastSubresourceNode[Nodes[Index].Subresource] = Index;
+		FResourceBarrier & Merged = Barriers[Earlier - 1].Barrier;
+		Merged.To = Barrier.Barrier.To;
+		if (Merged.From == Merged.To) {
+			Barriers.erase(Barriers.begin() + Earlier - 1);
+			--Num;
+			--Index;
 		}
 	}
+	u32 Removed = (u32)Barriers.size() - Num;
+	Barriers.resize(Num);
+	return Removed;
+}
+
+// node of per resource access graph, prevs are accesses that have to finish before it
+struct FBarrierNode {
+	static const u32 INLINE_PREVS = 3;
+
+	u32			Subresource;
+	EAccessType	Access;
+	u32			BatchIndex;
+	// first batch after last access served in this state
+	u32			FreeBatchIndex;
+	u32			PrevsNum : 30;
+	u32			Immutable : 1;
+	u32			Complementary : 1;
+	union {
+		u32		InlinePrevs[INLINE_PREVS];
+		u32 *	Prevs;
+	};
 
-	auto SpawnNode = [&](u32 Prev, EAccessType Access, u32 Subres, u32 BatchIndex) {
-		FResourceAccessNode NewNode = {};
-		NewNode.Access = Access;
-		if (IsReadAccess(Access) && IsReadAccess(Nodes[Prev].Access)) {
-			NewNode.Access |= Nodes[Prev].Access;
+	u32 const * GetPrevs() const {
+		return PrevsNum <= INLINE_PREVS ? InlinePrevs : Prevs;
+	}
+};
+
+u32 ProcessResourceBarriers(
+	FGPUResource * Resource,
+	FResourceStateRegistry::FResourceEntry & InitialState,
+	FResourceAccess const * Requests,
+	u32 RequestsNum,
+	FLinearArena & Arena,
+	eastl::vector<FBatchedBarrier> & OutBarriers
+	) {
+	const u32 None = 0xFFFFFFFF;
+	const u32 SubresourcesNum = Resource->GetSubresourcesNum();
+	const u32 FirstBarrier = (u32)OutBarriers.size();
+
+	// every request adds at most two nodes
+	const u32 MaxNodes = 1 + (u32)InitialState.Subresources.size() + 2 * RequestsNum;
+	FBarrierNode * Nodes = Arena.Allocate<FBarrierNode>(MaxNodes);
+	u32 NodesNum = 0;
+	u32 * Stack = Arena.Allocate<u32>(MaxNodes);
+
+	// last node of every subresource that diverged from complementary state, table is allocated on first divergence
+	u32 * LastSubresourceNode = nullptr;
+	u32 * DivergedSubresources = nullptr;
+	u32 DivergedNum = 0;
+
+	auto GetLastSubresourceNode = [&](u32 Subresource) {
+		check(Subresource < SubresourcesNum);
+		return LastSubresourceNode ? LastSubresourceNode[Subresource] : None;
+	};
+
+	auto SetLastSubresourceNode = [&](u32 Subresource, u32 Node) {
+		check(Subresource < SubresourcesNum);
+		if (!LastSubresourceNode) {
+			LastSubresourceNode = Arena.Allocate<u32>(SubresourcesNum);
+			DivergedSubresources = Arena.Allocate<u32>(SubresourcesNum);
+			for (u32 Index = 0; Index < SubresourcesNum; ++Index) {
+				LastSubresourceNode[Index] = None;
+			}
 		}
-		NewNode.Subresource = Subres;
-		NewNode.PrevIndices.push_back(Prev);
-		NewNode.BatchIndex = BatchIndex;
-		Nodes.push_back(NewNode);
-		return (u32)Nodes.size() - 1;
+		if (LastSubresourceNode[Subresource] == None) {
+			DivergedSubresources[DivergedNum++] = Subresource;
+		}
+		LastSubresourceNode[Subresource] = Node;
 	};
 
-	auto AddConnection = [&](u32 Prev, u32 Post) {
-		Nodes[Post].PrevIndices.push_back(Prev);
-		if (IsReadAccess(Nodes[Post].Access) && IsReadAccess(Nodes[Prev].Access)) {
-			Nodes[Post].Access |= Nodes[Prev].Access;
+	auto AddNode = [&](u32 Subresource, EAccessType Access, u32 BatchIndex) -> FBarrierNode & {
+		check(NodesNum < MaxNodes);
+		FBarrierNode & Node = Nodes[NodesNum++];
+		Node.Subresource = Subresource;
+		Node.Access = Access;
+		Node.BatchIndex = BatchIndex;
+		Node.FreeBatchIndex = BatchIndex + 1;
+		Node.PrevsNum = 0;
+		Node.Immutable = 0;
+		Node.Complementary = 0;
+		return Node;
+	};
+
+	auto SpawnNode = [&](u32 Prev, EAccessType Access, u32 Subresource, u32 BatchIndex) {
+		FBarrierNode & Node = AddNode(Subresource, Access, BatchIndex);
+		if (IsReadAccess(Access) && IsReadAccess(Nodes[Prev].Access)) {
+			Node.Access |= Nodes[Prev].Access;
 		}
+		Node.PrevsNum = 1;
+		Node.InlinePrevs[0] = Prev;
+		return NodesNum - 1;
 	};
 
-	eastl::queue<u32> HelperQueue;
+	auto CanPropagateRead = [&](u32 Index, EAccessType Access) {
+		return IsReadAccess(Nodes[Index].Access) && !Nodes[Index].Immutable && (Nodes[Index].Access | Access) != Nodes[Index].Access;
+	};
+
+	// node access is extended when pushed, so every node is pushed at most once
 	auto PropagateRead = [&](u32 Index, EAccessType Access) {
-		HelperQueue.empty();
 		check(IsReadAccess(Access));
-		if (IsReadAccess(Nodes[Index].Access) && !Nodes[Index].Immutable && (Nodes[Index].Access | Access) != Nodes[Index].Access) {
-			HelperQueue.push(Index);
+		u32 StackSize = 0;
+		if (CanPropagateRead(Index, Access)) {
+			Nodes[Index].Access |= Access;
+			Stack[StackSize++] = Index;
 		}
-		while (!HelperQueue.empty()) {
-			u32 Node = HelperQueue.front();
-			HelperQueue.pop();
-			Nodes[Node].Access |= Access;
-			for (u32 i = 0; i < Nodes[Node].PrevIndices.size(); i++) {
-				u32 Prev = Nodes[Node].PrevIndices[i];
-				if (IsReadAccess(Nodes[Prev].Access) && !Nodes[Prev].Immutable && (Nodes[Prev].Access | Access) != Nodes[Prev].Access) {
-					HelperQueue.push(Prev);
+		while (StackSize) {
+			FBarrierNode const& Node = Nodes[Stack[--StackSize]];
+			u32 const * Prevs = Node.GetPrevs();
+			for (u32 PrevIndex = 0; PrevIndex < Node.PrevsNum; PrevIndex++) {
+				u32 Prev = Prevs[PrevIndex];
+				if (CanPropagateRead(Prev, Access)) {
+					Nodes[Prev].Access |= Access;
+					Stack[StackSize++] = Prev;
 				}
 			}
 		}
@@ -1128,117 +1324,203 @@ void ProcessResourceBarriers(
 		return (IsExclusiveAccess(Nodes[Prev].Access) || IsExclusiveAccess(Access) || Nodes[Prev].Immutable) && Differs;
 	};
 
-	for (auto & Request : Requests) {
+	// request is served in state of existing node
+	auto UseNode = [&](u32 Index, FResourceAccess const& Request) {
+		Nodes[Index].FreeBatchIndex = eastl::max(Nodes[Index].FreeBatchIndex, Request.BatchIndex + 1);
+		if (IsReadAccess(Request.Access)) {
+			PropagateRead(Index, Request.Access);
+		}
+	};
+
+	// graph roots from state resource will be in when stream executes
+	u32 LastAllSubresNode = None;
+	u32 LastComplementaryNode = None;
+	if (InitialState.AllSubresources != EAccessType::UNSPECIFIED) {
+		AddNode(ALL_SUBRESOURCES, InitialState.AllSubresources, 0).Immutable = 1;
+		LastAllSubresNode = 0;
+	}
+	else {
+		check(InitialState.Complementary != EAccessType::UNSPECIFIED);
+		FBarrierNode & Complementary = AddNode(ALL_SUBRESOURCES, InitialState.Complementary, 0);
+		Complementary.Immutable = 1;
+		Complementary.Complementary = 1;
+		LastComplementaryNode = 0;
+
+		for (auto SubresourceAccess : InitialState.Subresources) {
+			AddNode(SubresourceAccess.first, SubresourceAccess.second, 0).Immutable = 1;
+			SetLastSubresourceNode(SubresourceAccess.first, NodesNum - 1);
+		}
+	}
+	// stream didn't use initial states yet, transitions out of them can begin at its start
+	for (u32 Index = 0; Index < NodesNum; ++Index) {
+		Nodes[Index].FreeBatchIndex = 0;
+	}
+
+	// reads requested before first non read access
+	EAccessType LeadingReads = EAccessType::UNSPECIFIED;
+	bool Leading = true;
+
+	for (u32 RequestIndex = 0; RequestIndex < RequestsNum; ++RequestIndex) {
+		FResourceAccess const& Request = Requests[RequestIndex];
+
+		Leading = Leading && IsReadAccess(Request.Access);
+		if (Leading) {
+			LeadingReads |= Request.Access;
+		}
+
 		if (Request.Subresource == ALL_SUBRESOURCES) {
-			bool SubresourcesShareState = LastSubresourceNode.size() == 0 && LastComplementaryNode == -1;
+			bool SubresourcesShareState = DivergedNum == 0 && LastComplementaryNode == None;
 			if (SubresourcesShareState) {
 				u32 Prev = LastAllSubresNode;
 
 				if (NeedNewNode(Prev, Request.Access)) {
 					LastAllSubresNode = SpawnNode(Prev, Request.Access, Request.Subresource, Request.BatchIndex);
 				}
-				else if (IsReadAccess(Request.Access)) {
-					PropagateRead(Prev, Request.Access);
+				else {
+					UseNode(Prev, Request);
 				}
 			}
-			// !SubresourcesShareState
+			// node joining complementary node and all diverged subresources
 			else {
-				// LastComplementaryNode
+				check(LastComplementaryNode != None);
 				LastAllSubresNode = SpawnNode(LastComplementaryNode, Request.Access, Request.Subresource, Request.BatchIndex);
-				// foreach LastSubresourceNode
-				for (auto PrevPair : LastSubresourceNode) {
-					u32 Prev = PrevPair.second;
-					u32 Subres = PrevPair.first;
 
-					AddConnection(Prev, LastAllSubresNode);
+				FBarrierNode & Node = Nodes[LastAllSubresNode];
+				u32 PrevsNum = 1 + DivergedNum;
+				u32 * Prevs = PrevsNum <= FBarrierNode::INLINE_PREVS ? Node.InlinePrevs : Arena.Allocate<u32>(PrevsNum);
+				Prevs[0] = LastComplementaryNode;
+				for (u32 Index = 0; Index < DivergedNum; ++Index) {
+					u32 Prev = LastSubresourceNode[DivergedSubresources[Index]];
+					Prevs[1 + Index] = Prev;
+					if (IsReadAccess(Node.Access) && IsReadAccess(Nodes[Prev].Access)) {
+						Node.Access |= Nodes[Prev].Access;
+					}
+					LastSubresourceNode[DivergedSubresources[Index]] = None;
 				}
+				if (PrevsNum > FBarrierNode::INLINE_PREVS) {
+					Node.Prevs = Prevs;
+				}
+				Node.PrevsNum = PrevsNum;
 
-				LastSubresourceNode.clear();
-				LastComplementaryNode = -1;
-				if(IsReadAccess(Request.Access)) {
+				DivergedNum = 0;
+				LastComplementaryNode = None;
+				if (IsReadAccess(Request.Access)) {
 					PropagateRead(LastAllSubresNode, Request.Access);
 				}
 			}
 		}
 		// Request.Subresource != ALL_SUBRESOURCES
 		else {
-			auto SubresFindIter = LastSubresourceNode.find(Request.Subresource);
-			if (SubresFindIter != LastSubresourceNode.end()) {
-				if (NeedNewNode(SubresFindIter->second, Request.Access)) {
-					LastSubresourceNode[Request.Subresource] = SpawnNode(SubresFindIter->second, Request.Access, Request.Subresource, Request.BatchIndex);
+			u32 LastNode = GetLastSubresourceNode(Request.Subresource);
+			if (LastNode != None) {
+				if (NeedNewNode(LastNode, Request.Access)) {
+					SetLastSubresourceNode(Request.Subresource, SpawnNode(LastNode, Request.Access, Request.Subresource, Request.BatchIndex));
 				}
-				else if (IsReadAccess(Request.Access)) {
-					PropagateRead(SubresFindIter->second, Request.Access);
+				else {
+					UseNode(LastNode, Request);
 				}
 			}
-			else if (LastSubresourceNode.size()) {
+			else if (DivergedNum) {
 				if (NeedNewNode(LastComplementaryNode, Request.Access)) {
-					LastSubresourceNode[Request.Subresource] = SpawnNode(LastComplementaryNode, Request.Access, Request.Subresource, Request.BatchIndex);
+					SetLastSubresourceNode(Request.Subresource, SpawnNode(LastComplementaryNode, Request.Access, Request.Subresource, Request.BatchIndex));
 				}
-				else if (IsReadAccess(Request.Access)) {
-					PropagateRead(LastComplementaryNode, Request.Access);
+				else {
+					UseNode(LastComplementaryNode, Request);
 				}
 			}
 			else {
 				if (NeedNewNode(LastAllSubresNode, Request.Access)) {
 					LastComplementaryNode = SpawnNode(LastAllSubresNode, Nodes[LastAllSubresNode].Access, ALL_SUBRESOURCES, Request.BatchIndex);
 					Nodes[LastComplementaryNode].Complementary = 1;
-					LastSubresourceNode[Request.Subresource] = SpawnNode(LastAllSubresNode, Request.Access, Request.Subresource, Request.BatchIndex);
+					// holds state of not diverged subresources, they were last accessed as whole resource
+					Nodes[LastComplementaryNode].FreeBatchIndex = Nodes[LastAllSubresNode].FreeBatchIndex;
+					SetLastSubresourceNode(Request.Subresource, SpawnNode(LastAllSubresNode, Request.Access, Request.Subresource, Request.BatchIndex));
 				}
-				else if (IsReadAccess(Request.Access)) {
-					PropagateRead(LastAllSubresNode, Request.Access);
+				else {
+					UseNode(LastAllSubresNode, Request);
 				}
 			}
 		}
 	}
 
-	for (u32 Index = 0; Index < Nodes.size(); Index++) {
-		if (Nodes[Index].Complementary || Nodes[Index].Immutable) {
+	// all reads were requested on this resource before, so combined read state is valid for it
+	if (DivergedNum == 0 && LastComplementaryNode == None && InitialState.LearnedReads != EAccessType::UNSPECIFIED) {
+		PropagateRead(LastAllSubresNode, InitialState.LearnedReads);
+	}
+	InitialState.LearnedReads = LeadingReads;
+
+	// bit per subresource, set for subresources that diverged from complementary node
+	u64 * DivergedMask = nullptr;
+
+	for (u32 Index = 0; Index < NodesNum; Index++) {
+		FBarrierNode const& Node = Nodes[Index];
+		if (Node.Complementary || Node.Immutable) {
 			// this is helper node
 			continue;
 		}
-		for (u32 Prev : Nodes[Index].PrevIndices) {
-			if (Nodes[Prev].Access != Nodes[Index].Access) {
-				if (Nodes[Prev].Complementary && Nodes[Index].Subresource == ALL_SUBRESOURCES) {
-					// todo: this should be solved by producing nodes differently? 
-					eastl::hash_set<u32> SubresourcesComplement;
-					for (u32 Prev : Nodes[Index].PrevIndices) {
-						if (Nodes[Prev].Subresource != ALL_SUBRESOURCES) {
-							SubresourcesComplement.insert(Nodes[Prev].Subresource);
-						}
-					}
-
-					for (u32 Subresource = 0; Subresource < Resource->GetSubresourcesNum(); ++Subresource) {
-						if (SubresourcesComplement.count(Subresource) == 0) {
-							FResourceBarrier Barrier = {};
 
-							Barrier.Resource = Resource;
-							Barrier.Subresource = Subresource;
-							Barrier.From = Nodes[Prev].Access;
-							Barrier.To = Nodes[Index].Access;
+		u32 const * Prevs = Node.GetPrevs();
+		for (u32 PrevIndex = 0; PrevIndex < Node.PrevsNum; PrevIndex++) {
+			FBarrierNode const& Prev = Nodes[Prevs[PrevIndex]];
+			if (Prev.Access == Node.Access) {
+				continue;
+			}
 
-							OutBarriers[Nodes[Index].BatchIndex].push_back(Barrier);
-						}
+			FBatchedBarrier Barrier = {};
+			Barrier.Barrier.Resource = Resource;
+			Barrier.Barrier.From = Prev.Access;
+			Barrier.Barrier.To = Node.Access;
+			Barrier.BatchIndex = Node.BatchIndex;
+			Barrier.BeginBatchIndex = eastl::min(Prev.FreeBatchIndex, Node.BatchIndex);
+
+			if (Prev.Complementary && Node.Subresource == ALL_SUBRESOURCES) {
+				const u32 WordsNum = (SubresourcesNum + 63) / 64;
+				if (!DivergedMask) {
+					DivergedMask = Arena.Allocate<u64>(WordsNum);
+					memset(DivergedMask, 0, WordsNum * sizeof(u64));
+				}
+				for (u32 Other = 0; Other < Node.PrevsNum; Other++) {
+					u32 Subresource = Nodes[Prevs[Other]].Subresource;
+					if (Subresource != ALL_SUBRESOURCES) {
+						DivergedMask[Subresource / 64] |= 1ull << (Subresource % 64);
 					}
 				}
-				else {
-					FResourceBarrier Barrier = {};
-					Barrier.Resource = Resource;
-					Barrier.Subresource = Nodes[Prev].Subresource != ALL_SUBRESOURCES ? Nodes[Prev].Subresource : Nodes[Index].Subresource;
-					Barrier.From = Nodes[Prev].Access;
-					Barrier.To = Nodes[Index].Access;
 
-					OutBarriers[Nodes[Index].BatchIndex].push_back(Barrier);
+				for (u32 Subresource = 0; Subresource < SubresourcesNum; ++Subresource) {
+					if ((DivergedMask[Subresource / 64] & (1ull << (Subresource % 64))) == 0) {
+						Barrier.Barrier.Subresource = Subresource;
+						OutBarriers.push_back(Barrier);
+					}
 				}
+
+				memset(DivergedMask, 0, WordsNum * sizeof(u64));
+			}
+			else {
+				Barrier.Barrier.Subresource = Prev.Subresource != ALL_SUBRESOURCES ? Prev.Subresource : Node.Subresource;
+				OutBarriers.push_back(Barrier);
 			}
 		}
 	}
+
+	return MergeSameBatchBarriers(OutBarriers, FirstBarrier);
 }
 
 void FResourceStateRegistry::SetCurrentState(FGPUResource* Resource, u32 Subresource, EAccessType Access) {
 	check(Resource->FatData->AutomaticBarriers);
 
-	FResourceEntry & Entry = Resources[Resource];
+	auto Inserted = Resources.insert(Resource);
+	FResourceEntry & Entry = Inserted.first->second;
+	if (Inserted.second) {
+		if (FreeSlots.size()) {
+			Entry.Slot = FreeSlots.back();
+			FreeSlots.pop_back();
+		}
+		else {
+			Entry.Slot = SlotsNum++;
+		}
+	}
+	Resource->FatData->StateSlot = Entry.Slot;
+
 	if (Subresource == ALL_SUBRESOURCES) {
 		Entry.AllSubresources = Access;
 		Entry.Complementary = EAccessType::UNSPECIFIED;
@@ -1272,7 +1554,11 @@ void FResourceStateRegistry::SetCurrentState(FGPUResource* Resource, u32 Subreso
 }
 
 void FResourceStateRegistry::Deregister(FGPUResource* Resource) {
-	Resources.erase(Resource);
+	auto Iter = Resources.find(Resource);
+	if (Iter != Resources.end()) {
+		FreeSlots.push_back(Iter->second.Slot);
+		Resources.erase(Iter);
+	}
 }
 
 void	FCommandsStream::SetAccess(FGPUResource * Resource, EAccessType Access, u32 Subresource) {
@@ -1287,149 +1573,1200 @@ void	FCommandsStream::SetAccess(FGPUResource * Resource, EAccessType Access, u32
 		Subresource = ALL_SUBRESOURCES;
 	}
 
-	FResourceAccess ResourceAccess;
-	ResourceAccess.Subresource = Subresource;
-	ResourceAccess.Access = Access;
-	ResourceAccess.BatchIndex = -1;
+	u32 Slot = Resource->FatData->StateSlot;
+	auto & List = GetAccessList(Resource);
 
-	bool Ignore = ResourceAccessList[Resource].Accesses.size()
-		&& ResourceAccessList[Resource].Accesses.back().Subresource == Subresource
-		&& ResourceAccessList[Resource].Accesses.back().Access == Access;
+	bool Ignore = List.Accesses.size()
+		&& List.Accesses.back().Subresource == Subresource
+		&& List.Accesses.back().Access == Access;
 
 	if (!Ignore) {
-		ResourceAccessList[Resource].Accesses.push_back(ResourceAccess);
-		ProcessList.insert(Resource);
-	}
-}
+		// first unbatched access puts resource on the list
+		if (List.BatchedNum == List.Accesses.size()) {
+			ProcessList.push_back(Slot);
+		}
 
-void	FCommandsStream::ReserveStreamSize(u64 Size) {
-	u8 * NewData = new u8[Size];
-	memcpy(NewData, Data.get(), MaxSize);
-	Data.reset(NewData);
-	MaxSize = Size;
+		FResourceAccess ResourceAccess;
+		ResourceAccess.Subresource = Subresource;
+		ResourceAccess.Access = Access;
+		ResourceAccess.BatchIndex = -1;
+		List.Accesses.push_back(ResourceAccess);
+	}
 }
 
-void*   FCommandsStream::Reserve(u64 Size) {
-	while (Offset + Size > MaxSize) {
-		ReserveStreamSize(MaxSize * 2);
+FCommandsStream::FResourceAccessList & FCommandsStream::GetAccessList(FGPUResource * Resource) {
+	u32 Slot = Resource->FatData->StateSlot;
+	check(Slot != INVALID_STATE_SLOT);
+	if (Slot >= ResourceAccessList.size()) {
+		ResourceAccessList.resize(Slot + 1);
 	}
-	u64 CurrentOffset = Offset;
-	Offset += Size;
-	return Data.get() + CurrentOffset;
-}
 
-void FCommandsStream::Reset() {
-	Offset = 0;
-	IsClosed = 0;
-	ResourceAccessList.clear();
-	BatchCounter = 0;
+	auto & List = ResourceAccessList[Slot];
+	if (List.Stamp != Stamp) {
+		List.Resource = Resource;
+		List.Accesses.clear();
+		List.BatchedNum = 0;
+		List.AliasedBatch = 0;
+		List.Stamp = Stamp;
+		AccessedSlots.push_back(Slot);
+	}
+	check(List.Resource == Resource);
+	return List;
 }
 
-void FCommandsStream::Close() {
+void FCommandsStream::AliasingBarrier(FGPUResource * Before, FGPUResource * After) {
+	PreCommandAdd();
+	// bundles are spliced by reference, barrier would be in place where packets are played but not where accesses are merged
+	check(!IsBundle);
 	BatchBarriers();
-	IsClosed = 1;
-}
-
-//void FCommandsStream::SetRenderTargetsBundle(FRenderTargetsBundle const * RenderTargets) {
-//	if(RenderTargets->DepthBuffer) {
-//		SetAccess(RenderTargets->DepthBuffer, EAccessType::WRITE_DEPTH);
-//	}
-//	SetDepthStencil(RenderTargets->DepthBuffer ? RenderTargets->DepthBuffer->GetDSV() : D3D12_CPU_DESCRIPTOR_HANDLE());
-//	u32 Index = 0;
-//	for (auto & RT : RenderTargets->Outputs) {
-//		SetAccess(RenderTargets->Outputs[Index].Resource, EAccessType::WRITE_RT);
-//		SetRenderTarget(RT.GetRTV(), Index);
-//		Index++;
-//	}
-//	SetViewport(RenderTargets->Viewport);
-//}
-
-void FCommandsStream::SetConstantBufferData(FCBVParam * ConstantBuffer, const void * Data, u64 Size) {
-	SetConstantBuffer(ConstantBuffer, CreateCBVFromData(ConstantBuffer, Data, Size));
-}
 
-void FCommandsStream::ProcessBarriersPreExecution(FResourceStateRegistry & Registry) {
-	eastl::vector<FResourceAccessNode>	InitialGraph;
-	Barriers.clear();
+	GetAccessList(After).AliasedBatch = BatchCounter;
 
-	for (auto & ResourceAccess : ResourceAccessList) {
-		check(Registry.Resources.find(ResourceAccess.first) != Registry.Resources.end());
+	auto Data = ReservePacket<FRenderCmdAliasingBarrier, FRenderCmdAliasingBarrierFunc>();
+	Data->Before = Before;
+	Data->After = After;
 
-		InitialGraph.clear();
-		check(ResourceAccess.second.BatchedNum == ResourceAccess.second.Accesses.size());
+	GetCurrentFrameStats().command_stats.aliasing_barriers++;
+}
 
-		if (Registry.Resources[ResourceAccess.first].AllSubresources != EAccessType::UNSPECIFIED) {
-			FResourceAccessNode Node = {};
-			Node.Access = Registry.Resources[ResourceAccess.first].AllSubresources;
-			Node.Subresource = ALL_SUBRESOURCES;
-			Node.Immutable = 1;
-			InitialGraph.push_back(Node);
-		}
-		else {
-			check(Registry.Resources[ResourceAccess.first].Complementary != EAccessType::UNSPECIFIED);
-			FResourceAccessNode Node = {};
-			Node.Access = Registry.Resources[ResourceAccess.first].Complementary;
-			Node.Subresource = ALL_SUBRESOURCES;
-			Node.Immutable = 1;
-			Node.Complementary = 1;
-			InitialGraph.push_back(Node);
+// bundle batches get numbers after batches recorded so far, accesses keep their order per resource
+// so resolve gives the same barriers as recording bundle commands directly into this stream
+void FCommandsStream::ExecuteBundle(FCommandsBundle const & Bundle) {
+	PreCommandAdd();
+	check(!IsBundle && Bundle.IsRecorded && Bundle.Stream.IsClosed);
+	BatchBarriers();
 
-			for (auto SubresourceAccess : Registry.Resources[ResourceAccess.first].Subresources) {
-				Node.Access = SubresourceAccess.second;
-				Node.Subresource = SubresourceAccess.first;
-				Node.Immutable = 1;
-				Node.Complementary = 0;
-				InitialGraph.push_back(Node);
+	FCommandsStream const & Source = Bundle.Stream;
+	const u32 BaseBatch = BatchCounter;
+	for (u32 SourceSlot : Source.AccessedSlots) {
+		auto const & SourceList = Source.ResourceAccessList[SourceSlot];
+		auto & List = GetAccessList(SourceList.Resource);
+		for (FResourceAccess Access : SourceList.Accesses) {
+			if (List.Accesses.size() && List.Accesses.back().Subresource == Access.Subresource && List.Accesses.back().Access == Access.Access) {
+				continue;
 			}
+			Access.BatchIndex += BaseBatch;
+			List.Accesses.push_back(Access);
 		}
-
-		ProcessResourceBarriers(ResourceAccess.first, InitialGraph, ResourceAccess.second.Accesses, Barriers);
+		List.BatchedNum = (u32)List.Accesses.size();
 	}
-}
+	BatchCounter += Source.BatchCounter;
 
-// assigns kickoff index to barriers
-void FCommandsStream::BatchBarriers() {
-	if (ProcessList.size()) {
-		check(Mode == ECommandsStreamMode::Indirect);
+	auto Data = ReservePacket<FRenderCmdExecuteBundle, FRenderCmdExecuteBundleFunc>();
+	Data->Stream = this;
+	Data->Bundle = const_cast<FCommandsStream*>(&Source);
+	Data->BaseBatch = BaseBatch;
 
-		for (FGPUResource* Resource : ProcessList) {
-			auto & List = ResourceAccessList[Resource];
-			for (u32 Index = List.BatchedNum; Index < List.Accesses.size(); Index++) {
-				List.Accesses[Index].BatchIndex = BatchCounter;
+	GetCurrentFrameStats().command_stats.bundles_executed++;
+}
+
+// barrier batches of bundle are redirected to batches this stream resolved for it
+void FCommandsStream::PlaybackBundle(FPlaybackContext * Context, FCommandsStream const * Bundle, u32 BaseBatch) {
+	for (FCommandsPage * Page = Bundle->FirstPage; Page; Page = Page->Next) {
+		if (Bundle->Encoding == ECommandsEncoding::FunctionPointer) {
+			// only barrier batches are redirected, everything else is called as recorded
+			for (u32 Offset = 0; Offset < Page->Used; ) {
+				RenderCmdFunc Func = ((FRenderCmdHeader*)(Page->Data + Offset))->Func;
+				void * Payload = Page->Data + Offset + sizeof(FRenderCmdHeader);
+				if (Func == FRenderCmdBarriersBatchFunc) {
+					ExecuteBatchedBarriers(Context, BaseBatch + ((FRenderCmdBarriersBatch*)Payload)->BatchIndex);
+					Offset += sizeof(FRenderCmdHeader) + sizeof(FRenderCmdBarriersBatch);
+				}
+				else {
+					Offset += (u32)Func(Context, Payload);
+				}
 			}
-			List.BatchedNum = (u32)List.Accesses.size();
+			continue;
 		}
 
-		ProcessList.clear();
-
-		auto Data = ReservePacket<FRenderCmdBarriersBatch, FRenderCmdBarriersBatchFunc>();
-		Data->This = this;
-		Data->BatchIndex = BatchCounter;
+		for (u32 Offset = 0; Offset < Page->Used; ) {
+			ERenderCmd Opcode = (ERenderCmd)Page->Data[Offset];
+			FRenderCmdInfo const& Info = GRenderCmdInfos[(u32)Opcode];
+			void * Payload = Page->Data + GetRenderCmdPayloadOffset(Bundle->Encoding, Offset, Info.Alignment);
+			Offset = GetRenderCmdPayloadOffset(Bundle->Encoding, Offset, Info.Alignment) + Info.Size;
 
-		BatchCounter++;
+			if (Opcode == ERenderCmd::BarriersBatch) {
+				ExecuteBatchedBarriers(Context, BaseBatch + ((FRenderCmdBarriersBatch*)Payload)->BatchIndex);
+			}
+			else {
+				Info.Func(Context, Payload);
+			}
+		}
 	}
 }
 
-void FCommandsStream::ExecuteBatchedBarriers(FGPUContext * Context, u32 BatchIndex) {
-	if (Barriers[BatchIndex].size()) {
-		Context->Barriers(Barriers[BatchIndex].data(), (u32)Barriers[BatchIndex].size());
-		Context->FlushBarriers();
+bool FCommandsBundle::BeginRecording(u64 InInputsHash) {
+	if (IsRecorded && InputsHash == InInputsHash) {
+		return false;
 	}
+	InputsHash = InInputsHash;
+	IsRecorded = false;
+	Stream.Reset();
+	return true;
 }
 
-void Playback(FGPUContext & Context, FCommandsStream * Stream) {
-	check(Stream->IsClosed);
-	Stream->ProcessBarriersPreExecution(*GetResourceStateRegistry());
-	u64 Offset = 0;
-	while (Offset < Stream->Offset) {
-		FRenderCmdHeader * Header = (FRenderCmdHeader*)pointer_add(Stream->Data.get(), Offset);
-		Offset += Header->Func(&Context, Header + 1);
-	}
+void FCommandsBundle::EndRecording() {
+	Stream.Close();
+	IsRecorded = true;
+	GetCurrentFrameStats().command_stats.bundles_recorded++;
 }
 
-D3D12_CPU_DESCRIPTOR_HANDLE CreateCBVFromData(FCBVParam * CB, void const * Data, u64 Size) {
-	check(Size <= CB->Size);
-	auto allocation = GetConstantsAllocator()->Allocate(Size);
-	memcpy(allocation.CPUPtr, Data, Size);
+void FCommandsStream::AddPage(u64 Bytes) {
+	check(Bytes <= FCommandsPage::CAPACITY);
+	LastPage->Next = AcquireCommandsPage();
+	LastPage = LastPage->Next;
+}
+
+void FCommandsStream::Reset() {
+	if (FirstPage != LastPage) {
+		ReleaseCommandsPages(FirstPage->Next, LastPage);
+		FirstPage->Next = nullptr;
+		LastPage = FirstPage;
+	}
+	FirstPage->Used = 0;
+	Size = 0;
+	PacketsNum = 0;
+	IsClosed = 0;
+	// stamp 0 is never current, after wraparound every list is invalidated explicitly
+	if (++Stamp == 0) {
+		for (auto & List : ResourceAccessList) {
+			List.Stamp = 0;
+		}
+		Stamp = 1;
+	}
+	AccessedSlots.clear();
+	ProcessList.clear();
+	BatchCounter = 0;
+	Barriers.clear();
+	BarrierOffsets.clear();
+}
+
+void FCommandsStream::Close() {
+	BatchBarriers();
+	IsClosed = 1;
+}
+
+static bool IsListTopology(D3D_PRIMITIVE_TOPOLOGY Topology, u32 * OutPrimitiveSize) {
+	switch (Topology) {
+	case D3D_PRIMITIVE_TOPOLOGY_POINTLIST:
+		*OutPrimitiveSize = 1;
+		return true;
+	case D3D_PRIMITIVE_TOPOLOGY_LINELIST:
+		*OutPrimitiveSize = 2;
+		return true;
+	case D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST:
+		*OutPrimitiveSize = 3;
+		return true;
+	}
+	return false;
+}
+
+// packets are moved towards the start of the page chain, kept packets are never overwritten
+// so last value of each state is compared against the packet that set it
+FStreamCompactionStats FCommandsStream::Compact() {
+	check(IsClosed);
+	FStreamCompactionStats Stats = {};
+
+	enum {
+		SLOT_PIPELINE_STATE,
+		SLOT_TOPOLOGY,
+		SLOT_VIEWPORT,
+		SLOT_SCISSOR_RECT,
+		SLOT_IB,
+		SLOT_DEPTH_STENCIL,
+		SLOT_RENDER_TARGET,
+		SLOT_VB = SLOT_RENDER_TARGET + FStateCache::MAX_RTVS,
+		SLOTS_NUM = SLOT_VB + FStateCache::MAX_VBVS
+	};
+	// payloads of kept packets that set the state, null when unknown
+	void * StatePackets[SLOTS_NUM] = {};
+	// descriptor bindings by bind id, root layout can change with pipeline state so they are forgotten then
+	struct FBindingPacket {
+		RenderCmdFunc	Func;
+		void *			Payload;
+	};
+	eastl::hash_map<u64, FBindingPacket> BindingPackets;
+	void * LastDraw = nullptr;
+	RenderCmdFunc LastDrawFunc = nullptr;
+
+	FCommandsPage * WritePage = FirstPage;
+	u32 WriteOffset = 0;
+	u32 KeptNum = 0;
+	u64 KeptSize = 0;
+	for (FCommandsPage * ReadPage = FirstPage; ReadPage; ReadPage = ReadPage->Next) {
+		for (u32 ReadOffset = 0; ReadOffset < ReadPage->Used; ) {
+			ERenderCmd Opcode = Encoding == ECommandsEncoding::Opcode ? (ERenderCmd)ReadPage->Data[ReadOffset] : GetRenderCmdOpcode(((FRenderCmdHeader*)(ReadPage->Data + ReadOffset))->Func);
+			FRenderCmdInfo const& Info = GRenderCmdInfos[(u32)Opcode];
+			RenderCmdFunc Func = Info.Func;
+			void * Payload = ReadPage->Data + GetRenderCmdPayloadOffset(Encoding, ReadOffset, Info.Alignment);
+			ReadOffset = GetRenderCmdPayloadOffset(Encoding, ReadOffset, Info.Alignment) + Info.Size;
+
+			// returns true when slot already holds the value, otherwise slot will point to this packet once it's kept
+			void ** KeptSlot = nullptr;
+			auto IsSet = [&](void *& Slot, auto Equal) {
+				if (Slot && Equal(Slot)) {
+					return true;
+				}
+				KeptSlot = &Slot;
+				return false;
+			};
+
+			bool bDrop = false;
+			bool bDraw = false;
+			if (Func == FRenderCmdSetPipelineStateFunc) {
+				auto Cmd = (FRenderCmdSetPipelineState*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_PIPELINE_STATE], [&](void * Prev) { return ((FRenderCmdSetPipelineState*)Prev)->State == Cmd->State; });
+				if (!bDrop) {
+					BindingPackets.clear();
+				}
+			}
+			else if (Func == FRenderCmdSetTopologyFunc) {
+				auto Cmd = (FRenderCmdSetTopology*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_TOPOLOGY], [&](void * Prev) { return ((FRenderCmdSetTopology*)Prev)->Topology == Cmd->Topology; });
+			}
+			else if (Func == FRenderCmdSetViewportFunc) {
+				auto Cmd = (FRenderCmdSetViewport*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_VIEWPORT], [&](void * Prev) { return memcmp(&((FRenderCmdSetViewport*)Prev)->Viewport, &Cmd->Viewport, sizeof(D3D12_VIEWPORT)) == 0; });
+			}
+			else if (Func == FRenderCmdSetScissorRectFunc) {
+				auto Cmd = (FRenderCmdSetScissorRect*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_SCISSOR_RECT], [&](void * Prev) { return memcmp(&((FRenderCmdSetScissorRect*)Prev)->Rect, &Cmd->Rect, sizeof(D3D12_RECT)) == 0; });
+			}
+			else if (Func == FRenderCmdSetIBFunc) {
+				auto Cmd = (FRenderCmdSetIB*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_IB], [&](void * Prev) { return memcmp(&((FRenderCmdSetIB*)Prev)->Location, &Cmd->Location, sizeof(FBufferLocation)) == 0; });
+			}
+			else if (Func == FRenderCmdSetVBFunc) {
+				auto Cmd = (FRenderCmdSetVB*)Payload;
+				if (Cmd->Stream < FStateCache::MAX_VBVS) {
+					bDrop = IsSet(StatePackets[SLOT_VB + Cmd->Stream], [&](void * Prev) { return memcmp(&((FRenderCmdSetVB*)Prev)->Location, &Cmd->Location, sizeof(FBufferLocation)) == 0; });
+				}
+			}
+			else if (Func == FRenderCmdSetRenderTargetFunc) {
+				auto Cmd = (FRenderCmdSetRenderTarget*)Payload;
+				if (Cmd->Index < FStateCache::MAX_RTVS) {
+					bDrop = IsSet(StatePackets[SLOT_RENDER_TARGET + Cmd->Index], [&](void * Prev) {
+						auto PrevCmd = (FRenderCmdSetRenderTarget*)Prev;
+						return PrevCmd->View.RTV == Cmd->View.RTV && PrevCmd->View.Format == Cmd->View.Format;
+					});
+				}
+			}
+			else if (Func == FRenderCmdSetDepthStencilFunc) {
+				auto Cmd = (FRenderCmdSetDepthStencil*)Payload;
+				bDrop = IsSet(StatePackets[SLOT_DEPTH_STENCIL], [&](void * Prev) {
+					auto PrevCmd = (FRenderCmdSetDepthStencil*)Prev;
+					return PrevCmd->View.DSV == Cmd->View.DSV && PrevCmd->View.Format == Cmd->View.Format;
+				});
+			}
+			// binding packets share layout: param pointer, then descriptor
+			// bind id keys all three kinds, packet of other kind under the same key just never compares equal
+			else if (Func == FRenderCmdSetTextureFunc || Func == FRenderCmdSetConstantBufferFunc || Func == FRenderCmdSetRWTextureFunc) {
+				auto Cmd = (FRenderCmdSetTexture*)Payload;
+				u64 BindId = Func == FRenderCmdSetTextureFunc ? Cmd->Param->BindId.hash
+					: Func == FRenderCmdSetConstantBufferFunc ? ((FRenderCmdSetConstantBuffer*)Payload)->Param->BindId.hash
+					: ((FRenderCmdSetRWTexture*)Payload)->Param->BindId.hash;
+				FBindingPacket & Binding = BindingPackets.insert(eastl::make_pair(BindId, FBindingPacket{})).first->second;
+				bDrop = IsSet(Binding.Payload, [&](void * Prev) {
+					auto PrevCmd = (FRenderCmdSetTexture*)Prev;
+					return Binding.Func == Func && PrevCmd->Param == Cmd->Param && PrevCmd->SRV == Cmd->SRV;
+				});
+				Binding.Func = Func;
+			}
+			else if (Func == FRenderCmdDrawFunc || Func == FRenderCmdDrawIndexedFunc) {
+				bDraw = true;
+				u32 PrimitiveSize;
+				bool bList = StatePackets[SLOT_TOPOLOGY] && IsListTopology(((FRenderCmdSetTopology*)StatePackets[SLOT_TOPOLOGY])->Topology, &PrimitiveSize);
+				if (bList && LastDraw && LastDrawFunc == Func) {
+					if (Func == FRenderCmdDrawFunc) {
+						auto Cmd = (FRenderCmdDraw*)Payload;
+						auto Prev = (FRenderCmdDraw*)LastDraw;
+						if (Prev->Instances == 1 && Cmd->Instances == 1 && Prev->StartInstance == Cmd->StartInstance
+							&& Prev->VertexCount % PrimitiveSize == 0 && Prev->StartVertex + Prev->VertexCount == Cmd->StartVertex) {
+							Prev->VertexCount += Cmd->VertexCount;
+							bDrop = true;
+						}
+					}
+					else {
+						auto Cmd = (FRenderCmdDrawIndexed*)Payload;
+						auto Prev = (FRenderCmdDrawIndexed*)LastDraw;
+						if (Prev->Instances == 1 && Cmd->Instances == 1 && Prev->StartInstance == Cmd->StartInstance && Prev->BaseVertex == Cmd->BaseVertex
+							&& Prev->IndexCount % PrimitiveSize == 0 && Prev->StartIndex + Prev->IndexCount == Cmd->StartIndex) {
+							Prev->IndexCount += Cmd->IndexCount;
+							bDrop = true;
+						}
+					}
+					Stats.DrawsMerged += bDrop ? 1 : 0;
+				}
+			}
+			// bundle can leave any state behind
+			else if (Func == FRenderCmdExecuteBundleFunc) {
+				memset(StatePackets, 0, sizeof(StatePackets));
+				BindingPackets.clear();
+			}
+
+			if (bDrop) {
+				Stats.PacketsRemoved++;
+				continue;
+			}
+
+			// write position never passes read position: page before read page gets more room or
+			// is left, and in read page itself the packet fits wherever it's moved (padding can only shrink)
+			u32 KeptPayloadOffset = GetRenderCmdPayloadOffset(Encoding, WriteOffset, Info.Alignment);
+			if (KeptPayloadOffset + Info.Size > FCommandsPage::CAPACITY) {
+				WritePage->Used = WriteOffset;
+				WritePage = WritePage->Next;
+				WriteOffset = 0;
+				KeptPayloadOffset = GetRenderCmdPayloadOffset(Encoding, 0, Info.Alignment);
+			}
+			void * Kept = WritePage->Data + KeptPayloadOffset;
+			if (Kept != Payload) {
+				memmove(Kept, Payload, Info.Size);
+			}
+			// opcode can move even when payload stays, padding absorbs the difference
+			WriteRenderCmdHeader(Encoding, WritePage->Data + WriteOffset, Opcode, Func);
+			if (KeptSlot) {
+				*KeptSlot = Kept;
+			}
+			// anything kept between two draws (barriers, clears, state changes) separates them
+			LastDraw = bDraw ? Kept : nullptr;
+			LastDrawFunc = Func;
+			KeptSize += KeptPayloadOffset + Info.Size - WriteOffset;
+			WriteOffset = KeptPayloadOffset + Info.Size;
+			KeptNum++;
+		}
+	}
+
+	check(KeptNum + Stats.PacketsRemoved == PacketsNum);
+	WritePage->Used = WriteOffset;
+	if (WritePage->Next) {
+		ReleaseCommandsPages(WritePage->Next, LastPage);
+		WritePage->Next = nullptr;
+		LastPage = WritePage;
+	}
+	Stats.BytesSaved = Size - KeptSize;
+	Size = KeptSize;
+	PacketsNum = KeptNum;
+
+	GetCurrentFrameStats().command_stats.packets_compacted += Stats.PacketsRemoved;
+	GetCurrentFrameStats().command_stats.bytes_compacted += Stats.BytesSaved;
+	return Stats;
+}
+
+//void FCommandsStream::SetRenderTargetsBundle(FRenderTargetsBundle const * RenderTargets) {
+//	if(RenderTargets->DepthBuffer) {
+//		SetAccess(RenderTargets->DepthBuffer, EAccessType::WRITE_DEPTH);
+//	}
+//	SetDepthStencil(RenderTargets->DepthBuffer ? RenderTargets->DepthBuffer->GetDSV() : D3D12_CPU_DESCRIPTOR_HANDLE());
+//	u32 Index = 0;
+//	for (auto & RT : RenderTargets->Outputs) {
+//		SetAccess(RenderTargets->Outputs[Index].Resource, EAccessType::WRITE_RT);
+//		SetRenderTarget(RT.GetRTV(), Index);
+//		Index++;
+//	}
+//	SetViewport(RenderTargets->Viewport);
+//}
+
+void FCommandsStream::SetConstantBufferData(FCBVParam * ConstantBuffer, const void * Data, u64 Size) {
+	// constants allocator memory lives one frame, bundle replaying the view in later frames would read stale data
+	check(!IsBundle);
+	SetConstantBuffer(ConstantBuffer, CreateCBVFromData(ConstantBuffer, Data, Size));
+}
+
+// counting sort by batch, barriers of one batch keep their order
+// barrier that can begin in earlier batch of the same stream is placed as begin/end pair
+// StreamBatchOffsets[N] is first batch of stream N, StreamBatchOffsets[StreamsNum] is batches number
+static void PlaceBarriersIntoBatches(eastl::vector<FBatchedBarrier> & Resolved, u32 const * StreamBatchOffsets, u32 StreamsNum, eastl::vector<FResourceBarrier> & OutBarriers, eastl::vector<u32> & OutOffsets) {
+	const u32 BatchesNum = StreamBatchOffsets[StreamsNum];
+
+	// pair can't span streams, they may be played into different command lists
+	for (FBatchedBarrier & Barrier : Resolved) {
+		u32 Stream = (u32)(eastl::upper_bound(StreamBatchOffsets, StreamBatchOffsets + StreamsNum, Barrier.BatchIndex) - StreamBatchOffsets) - 1;
+		Barrier.BeginBatchIndex = eastl::max(Barrier.BeginBatchIndex, StreamBatchOffsets[Stream]);
+	}
+
+	OutOffsets.assign(BatchesNum + 1, 0);
+	for (FBatchedBarrier const& Barrier : Resolved) {
+		OutOffsets[Barrier.BatchIndex + 1]++;
+		if (Barrier.BeginBatchIndex < Barrier.BatchIndex) {
+			OutOffsets[Barrier.BeginBatchIndex + 1]++;
+		}
+	}
+	for (u32 Batch = 0; Batch < BatchesNum; ++Batch) {
+		OutOffsets[Batch + 1] += OutOffsets[Batch];
+	}
+
+	// offsets serve as write cursors, afterwards each one points to start of next batch
+	OutBarriers.resize(OutOffsets[BatchesNum]);
+	for (FBatchedBarrier const& Barrier : Resolved) {
+		FResourceBarrier Placed = Barrier.Barrier;
+		if (Barrier.BeginBatchIndex < Barrier.BatchIndex) {
+			Placed.Split = EBarrierSplit::BEGIN_ONLY;
+			OutBarriers[OutOffsets[Barrier.BeginBatchIndex]++] = Placed;
+			Placed.Split = EBarrierSplit::END_ONLY;
+		}
+		OutBarriers[OutOffsets[Barrier.BatchIndex]++] = Placed;
+	}
+	for (u32 Batch = BatchesNum; Batch > 0; --Batch) {
+		OutOffsets[Batch] = OutOffsets[Batch - 1];
+	}
+	OutOffsets[0] = 0;
+}
+
+// barriers of resource resolved from First on are kept after its aliasing barrier
+static void ClampAliasedBarriers(eastl::vector<FBatchedBarrier> & Barriers, u32 First, u32 AliasedBatch) {
+	for (u32 Index = First; Index < Barriers.size(); ++Index) {
+		FBatchedBarrier & Barrier = Barriers[Index];
+		Barrier.BeginBatchIndex = eastl::min(eastl::max(Barrier.BeginBatchIndex, AliasedBatch), Barrier.BatchIndex);
+	}
+}
+
+void FCommandsStream::ProcessBarriersPreExecution(FResourceStateRegistry & Registry) {
+	BarrierArena.Reset();
+	ResolvedBarriers.clear();
+
+	u32 Elided = 0;
+	for (u32 Slot : AccessedSlots) {
+		auto & List = ResourceAccessList[Slot];
+		check(List.BatchedNum == List.Accesses.size());
+		auto Iter = Registry.Resources.find(List.Resource);
+		check(Iter != Registry.Resources.end());
+		u32 First = (u32)ResolvedBarriers.size();
+		Elided += ProcessResourceBarriers(List.Resource, Iter->second, List.Accesses.data(), (u32)List.Accesses.size(), BarrierArena, ResolvedBarriers);
+		if (List.AliasedBatch) {
+			ClampAliasedBarriers(ResolvedBarriers, First, List.AliasedBatch);
+		}
+	}
+	GetCurrentFrameStats().command_stats.barriers += (u32)ResolvedBarriers.size();
+	GetCurrentFrameStats().command_stats.barriers_elided += Elided;
+
+	u32 StreamBatchOffsets[] = { 0, BatchCounter };
+	PlaceBarriersIntoBatches(ResolvedBarriers, StreamBatchOffsets, 1, Barriers, BarrierOffsets);
+}
+
+void ProcessBarriersPreExecution(FCommandsStream * const * Streams, u32 StreamsNum, FResourceStateRegistry & Registry) {
+	if (StreamsNum == 1) {
+		Streams[0]->ProcessBarriersPreExecution(Registry);
+		return;
+	}
+
+	// batches of a stream are numbered after batches of all streams before it
+	eastl::vector<u32> BatchOffsets(StreamsNum + 1);
+	BatchOffsets[0] = 0;
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		check(Streams[Index]->IsClosed);
+		BatchOffsets[Index + 1] = BatchOffsets[Index] + Streams[Index]->BatchCounter;
+	}
+
+	// per resource accesses concatenated in stream order, same lists serial recording would produce
+	FLinearArena & Arena = Streams[0]->BarrierArena;
+	Arena.Reset();
+	u32 * MergedIndices = Arena.Allocate<u32>(Registry.SlotsNum);
+	for (u32 Slot = 0; Slot < Registry.SlotsNum; ++Slot) {
+		MergedIndices[Slot] = 0xFFFFFFFF;
+	}
+	eastl::vector<FGPUResource*> MergedResources;
+	eastl::vector<u32> ListOffsets;
+	eastl::vector<u32> AliasedBatches;
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		for (u32 Slot : Streams[Index]->AccessedSlots) {
+			auto & List = Streams[Index]->ResourceAccessList[Slot];
+			check(List.BatchedNum == List.Accesses.size());
+			if (MergedIndices[Slot] == 0xFFFFFFFF) {
+				MergedIndices[Slot] = (u32)MergedResources.size();
+				MergedResources.push_back(List.Resource);
+				ListOffsets.push_back(0);
+				AliasedBatches.push_back(0);
+			}
+			ListOffsets[MergedIndices[Slot]] += (u32)List.Accesses.size();
+			if (List.AliasedBatch) {
+				AliasedBatches[MergedIndices[Slot]] = List.AliasedBatch + BatchOffsets[Index];
+			}
+		}
+	}
+	u32 MergedNum = 0;
+	for (u32 & Offset : ListOffsets) {
+		u32 Num = Offset;
+		Offset = MergedNum;
+		MergedNum += Num;
+	}
+
+	// offsets serve as write cursors, afterwards each one points to start of next list
+	FResourceAccess * MergedAccesses = Arena.Allocate<FResourceAccess>(MergedNum);
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		for (u32 Slot : Streams[Index]->AccessedSlots) {
+			u32 & Cursor = ListOffsets[MergedIndices[Slot]];
+			for (FResourceAccess Access : Streams[Index]->ResourceAccessList[Slot].Accesses) {
+				Access.BatchIndex += BatchOffsets[Index];
+				MergedAccesses[Cursor++] = Access;
+			}
+		}
+	}
+
+	eastl::vector<FBatchedBarrier> Resolved;
+	u32 First = 0;
+	u32 Elided = 0;
+	for (u32 Index = 0; Index < MergedResources.size(); ++Index) {
+		auto Iter = Registry.Resources.find(MergedResources[Index]);
+		check(Iter != Registry.Resources.end());
+		u32 FirstResolved = (u32)Resolved.size();
+		Elided += ProcessResourceBarriers(MergedResources[Index], Iter->second, MergedAccesses + First, ListOffsets[Index] - First, Arena, Resolved);
+		if (AliasedBatches[Index]) {
+			ClampAliasedBarriers(Resolved, FirstResolved, AliasedBatches[Index]);
+		}
+		First = ListOffsets[Index];
+	}
+	GetCurrentFrameStats().command_stats.barriers += (u32)Resolved.size();
+	GetCurrentFrameStats().command_stats.barriers_elided += Elided;
+
+	eastl::vector<FResourceBarrier> MergedBarriers;
+	eastl::vector<u32> MergedOffsets;
+	PlaceBarriersIntoBatches(Resolved, BatchOffsets.data(), StreamsNum, MergedBarriers, MergedOffsets);
+
+	// hand barriers back to streams owning the batches
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		FCommandsStream * Stream = Streams[Index];
+		u32 FirstBatch = BatchOffsets[Index];
+		u32 BatchesNum = Stream->BatchCounter;
+		u32 FirstBarrier = MergedOffsets[FirstBatch];
+
+		Stream->Barriers.assign(MergedBarriers.begin() + FirstBarrier, MergedBarriers.begin() + MergedOffsets[FirstBatch + BatchesNum]);
+		Stream->BarrierOffsets.resize(BatchesNum + 1);
+		for (u32 Batch = 0; Batch <= BatchesNum; ++Batch) {
+			Stream->BarrierOffsets[Batch] = MergedOffsets[FirstBatch + Batch] - FirstBarrier;
+		}
+	}
+}
+
+// assigns kickoff index to barriers
+void FCommandsStream::BatchBarriers() {
+	if (ProcessList.size()) {
+		check(Mode == ECommandsStreamMode::Indirect);
+
+		for (u32 Slot : ProcessList) {
+			auto & List = ResourceAccessList[Slot];
+			for (u32 Index = List.BatchedNum; Index < List.Accesses.size(); Index++) {
+				List.Accesses[Index].BatchIndex = BatchCounter;
+			}
+			List.BatchedNum = (u32)List.Accesses.size();
+		}
+
+		ProcessList.clear();
+
+		auto Data = ReservePacket<FRenderCmdBarriersBatch, FRenderCmdBarriersBatchFunc>();
+		Data->This = this;
+		Data->BatchIndex = BatchCounter;
+
+		BatchCounter++;
+	}
+}
+
+void FCommandsStream::ExecuteBatchedBarriers(FPlaybackContext * Context, u32 BatchIndex) {
+	u32 First = BarrierOffsets[BatchIndex];
+	u32 Num = BarrierOffsets[BatchIndex + 1] - First;
+	if (Num) {
+		Context->Barriers(Barriers.data() + First, Num);
+		Context->FlushBarriers();
+	}
+}
+
+void Playback(FPlaybackContext & Context, FCommandsStream * Stream) {
+	Playback(Context, &Stream, 1);
+}
+
+void Playback(FPlaybackContext & Context, FCommandsStream * const * Streams, u32 StreamsNum) {
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		check(Streams[Index]->IsClosed && !Streams[Index]->IsBundle);
+	}
+	ProcessBarriersPreExecution(Streams, StreamsNum, *GetResourceStateRegistry());
+
+	for (u32 Index = 0; Index < StreamsNum; ++Index) {
+		for (FCommandsPage * Page = Streams[Index]->FirstPage; Page; Page = Page->Next) {
+			if (Streams[Index]->Encoding == ECommandsEncoding::Opcode) {
+				PlaybackOpcodes(&Context, Page);
+				continue;
+			}
+			u32 Offset = 0;
+			while (Offset < Page->Used) {
+				FRenderCmdHeader * Header = (FRenderCmdHeader*)(Page->Data + Offset);
+				Offset += (u32)Header->Func(&Context, Header + 1);
+			}
+		}
+	}
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE CreateCBVFromData(FCBVParam * CB, void const * Data, u64 Size) {
+	check(Size <= CB->Size);
+	auto allocation = GetConstantsAllocator()->Allocate(Size);
+	memcpy(allocation.CPUPtr, Data, Size);
 	return allocation.CPUHandle;
-}
\ No newline at end of file
+}
+
+/////////////////////////////////////////
+
+void BenchmarkCommandsRecording() {
+	const u32 DrawsNum = 200000;
+	const u32 ChunksNum = 64;
+	const u32 TexturesNum = 512;
+	const u32 RenderTargetsNum = 8;
+
+	eastl::vector<FGPUResource> Textures(TexturesNum);
+	eastl::vector<FGPUResource> RenderTargets(RenderTargetsNum);
+	for (auto & Texture : Textures) {
+		InitCaptureResource(Texture);
+	}
+	for (auto & RenderTarget : RenderTargets) {
+		InitCaptureResource(RenderTarget);
+	}
+
+	// same commands for a chunk no matter which stream or thread records it
+	// chunks render into one target and sample the one previous chunks rendered into, so barriers cross streams
+	auto RecordChunk = [&](FCommandsStream & Stream, u32 Chunk) {
+		std::mt19937 Rng(Chunk);
+		FGPUResource * Target = &RenderTargets[Chunk % RenderTargetsNum];
+		FGPUResource * Sampled = &RenderTargets[(Chunk + RenderTargetsNum - 1) % RenderTargetsNum];
+
+		Stream.SetAccess(Target, EAccessType::WRITE_RT);
+		Stream.SetRenderTarget(FRenderTargetView());
+		u32 Begin = DrawsNum * Chunk / ChunksNum;
+		u32 End = DrawsNum * (Chunk + 1) / ChunksNum;
+		for (u32 Draw = Begin; Draw < End; ++Draw) {
+			if (Draw % 16 == 0) {
+				Stream.SetPipelineState(nullptr);
+				Stream.SetAccess(Sampled, EAccessType::READ_PIXEL);
+			}
+			Stream.SetAccess(&Textures[Rng() % TexturesNum], EAccessType::READ_PIXEL);
+			Stream.SetTexture(nullptr, D3D12_CPU_DESCRIPTOR_HANDLE());
+			Stream.DrawIndexed(36, Draw * 36);
+		}
+	};
+
+	// barriers in execution order, sorted inside batch since order of independent barriers doesn't matter
+	// split transitions are compared by their end, begins can't cross streams so they land in different batches
+	auto FlattenBarriers = [](FCommandsStream * const * Streams, u32 StreamsNum, eastl::vector<FResourceBarrier> & Out) {
+		Out.clear();
+		for (u32 Index = 0; Index < StreamsNum; ++Index) {
+			FCommandsStream * Stream = Streams[Index];
+			for (u32 Batch = 0; Batch < Stream->BatchCounter; ++Batch) {
+				u64 First = Out.size();
+				for (u32 Barrier = Stream->BarrierOffsets[Batch]; Barrier < Stream->BarrierOffsets[Batch + 1]; ++Barrier) {
+					if (Stream->Barriers[Barrier].Split != EBarrierSplit::BEGIN_ONLY) {
+						Out.push_back(Stream->Barriers[Barrier]);
+					}
+				}
+				eastl::sort(Out.begin() + First, Out.end(), [](FResourceBarrier const& A, FResourceBarrier const& B) {
+					return A.Resource != B.Resource ? A.Resource < B.Resource : A.Subresource < B.Subresource;
+				});
+			}
+		}
+	};
+
+	FResourceStateRegistry & Registry = *GetResourceStateRegistry();
+
+	FCommandsStream SerialStream;
+	double SerialRecordMs = 1e9;
+	double SerialResolveMs = 1e9;
+	for (u32 Run = 0; Run < 4; ++Run) {
+		SerialStream.Reset();
+		i64 StartTicks = GetCpuTicks();
+		for (u32 Chunk = 0; Chunk < ChunksNum; ++Chunk) {
+			RecordChunk(SerialStream, Chunk);
+		}
+		SerialStream.Close();
+		SerialRecordMs = eastl::min(SerialRecordMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+
+		StartTicks = GetCpuTicks();
+		SerialStream.ProcessBarriersPreExecution(Registry);
+		SerialResolveMs = eastl::min(SerialResolveMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+	}
+
+	// stream created for one frame takes its pages from the pool, after first run none should be allocated
+	double TransientRecordMs = 1e9;
+	u32 WarmPagesNum = 0;
+	for (u32 Run = 0; Run < 4; ++Run) {
+		if (Run == 1) {
+			WarmPagesNum = GetCommandsPagesAllocatedNum();
+		}
+		i64 StartTicks = GetCpuTicks();
+		{
+			FCommandsStream Stream;
+			for (u32 Chunk = 0; Chunk < ChunksNum; ++Chunk) {
+				RecordChunk(Stream, Chunk);
+			}
+			Stream.Close();
+		}
+		TransientRecordMs = eastl::min(TransientRecordMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+	}
+
+	FCommandsStream * SerialStreamPtr = &SerialStream;
+	eastl::vector<FResourceBarrier> SerialBarriers;
+	FlattenBarriers(&SerialStreamPtr, 1, SerialBarriers);
+
+	PrintFormated(L"commands recording %u draws in %u chunks: one stream record %.3f ms, resolve %.3f ms, %u barriers, transient stream record %.3f ms, %u KB in %u pages, %u pages allocated after warm-up\n",
+		DrawsNum, ChunksNum, SerialRecordMs, SerialResolveMs, (u32)SerialBarriers.size(), TransientRecordMs,
+		(u32)(SerialStream.Size / 1024), GetCommandsPagesAllocatedNum(), GetCommandsPagesAllocatedNum() - WarmPagesNum);
+
+	eastl::vector<FCommandsStream> Streams(ChunksNum);
+	eastl::vector<FCommandsStream*> StreamPtrs;
+	for (auto & Stream : Streams) {
+		StreamPtrs.push_back(&Stream);
+	}
+
+	const u32 HardwareThreads = eastl::max(std::thread::hardware_concurrency(), 1u);
+	eastl::vector<FResourceBarrier> MergedBarriers;
+	for (u32 ThreadsNum = 1; ; ThreadsNum = eastl::min(ThreadsNum * 2, HardwareThreads)) {
+		// task system takes worker count only on init, 0 would mean all cores
+		ShutdownTaskSystem();
+		if (ThreadsNum > 1) {
+			InitTaskSystem(ThreadsNum - 1);
+		}
+
+		double RecordMs = 1e9;
+		double ResolveMs = 1e9;
+		for (u32 Run = 0; Run < 4; ++Run) {
+			i64 StartTicks = GetCpuTicks();
+			auto RecordStreams = [&](u32 Begin, u32 End) {
+				for (u32 Chunk = Begin; Chunk < End; ++Chunk) {
+					Streams[Chunk].Reset();
+					RecordChunk(Streams[Chunk], Chunk);
+					Streams[Chunk].Close();
+				}
+			};
+			if (ThreadsNum > 1) {
+				ParallelFor(ChunksNum, 1, RecordStreams);
+			}
+			else {
+				RecordStreams(0, ChunksNum);
+			}
+			RecordMs = eastl::min(RecordMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+
+			StartTicks = GetCpuTicks();
+			ProcessBarriersPreExecution(StreamPtrs.data(), ChunksNum, Registry);
+			ResolveMs = eastl::min(ResolveMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+		}
+
+		FlattenBarriers(StreamPtrs.data(), ChunksNum, MergedBarriers);
+		u32 Mismatches = (u32)eastl::max(MergedBarriers.size(), SerialBarriers.size()) - (u32)eastl::min(MergedBarriers.size(), SerialBarriers.size());
+		for (u32 Index = 0; Index < eastl::min(MergedBarriers.size(), SerialBarriers.size()); ++Index) {
+			FResourceBarrier const& A = MergedBarriers[Index];
+			FResourceBarrier const& B = SerialBarriers[Index];
+			Mismatches += A.Resource != B.Resource || A.Subresource != B.Subresource || A.From != B.From || A.To != B.To;
+		}
+
+		PrintFormated(L"%u threads, %u streams: record %.3f ms (%.2fx), merge + resolve %.3f ms, %u mismatches\n",
+			ThreadsNum, ChunksNum, RecordMs, SerialRecordMs / RecordMs, ResolveMs, Mismatches);
+
+		if (ThreadsNum == HardwareThreads) {
+			break;
+		}
+	}
+
+	ShutdownTaskSystem();
+	InitTaskSystem();
+}
+
+/////////////////////////////////////////
+
+// previous solver, graph in per node vectors and hash containers, kept as reference for BenchmarkBarrierSolver
+struct FResourceAccessNode {
+	u32					Subresource;
+	EAccessType			Access;
+	eastl::vector<u32>	PrevIndices;
+	u32					BatchIndex;
+	u8					Immutable : 1;
+	u8					Complementary : 1;
+};
+
+// graph roots from state resource will be in when stream executes
+static void BuildInitialAccessGraph(FResourceStateRegistry & Registry, FGPUResource * Resource, eastl::vector<FResourceAccessNode> & OutGraph) {
+	check(Registry.Resources.find(Resource) != Registry.Resources.end());
+	OutGraph.clear();
+
+	if (Registry.Resources[Resource].AllSubresources != EAccessType::UNSPECIFIED) {
+		FResourceAccessNode Node = {};
+		Node.Access = Registry.Resources[Resource].AllSubresources;
+		Node.Subresource = ALL_SUBRESOURCES;
+		Node.Immutable = 1;
+		OutGraph.push_back(Node);
+	}
+	else {
+		check(Registry.Resources[Resource].Complementary != EAccessType::UNSPECIFIED);
+		FResourceAccessNode Node = {};
+		Node.Access = Registry.Resources[Resource].Complementary;
+		Node.Subresource = ALL_SUBRESOURCES;
+		Node.Immutable = 1;
+		Node.Complementary = 1;
+		OutGraph.push_back(Node);
+
+		for (auto SubresourceAccess : Registry.Resources[Resource].Subresources) {
+			Node.Access = SubresourceAccess.second;
+			Node.Subresource = SubresourceAccess.first;
+			Node.Immutable = 1;
+			Node.Complementary = 0;
+			OutGraph.push_back(Node);
+		}
+	}
+}
+
+static void ProcessResourceBarriersReference(
+	FGPUResource * Resource,
+	eastl::vector<FResourceAccessNode>& InitialNodes,
+	eastl::vector<FResourceAccess> const& Requests,
+	eastl::vector<FBatchedBarrier> &OutBarriers
+	) {
+	auto & Nodes = InitialNodes;
+
+	u32 LastAllSubresNode = 0;
+	eastl::hash_map<u32, u32> LastSubresourceNode;
+	u32 LastComplementaryNode = -1;
+
+	if (Nodes[0].Complementary == 1) {
+		LastAllSubresNode = -1;
+		LastComplementaryNode = 0;
+
+		for (u32 Index = 1; Index < Nodes.size(); Index++) {
+			LastSubresourceNode[Nodes[Index].Subresource] = Index;
+		}
+	}
+
+	auto SpawnNode = [&](u32 Prev, EAccessType Access, u32 Subres, u32 BatchIndex) {
+		FResourceAccessNode NewNode = {};
+		NewNode.Access = Access;
+		if (IsReadAccess(Access) && IsReadAccess(Nodes[Prev].Access)) {
+			NewNode.Access |= Nodes[Prev].Access;
+		}
+		NewNode.Subresource = Subres;
+		NewNode.PrevIndices.push_back(Prev);
+		NewNode.BatchIndex = BatchIndex;
+		Nodes.push_back(NewNode);
+		return (u32)Nodes.size() - 1;
+	};
+
+	auto AddConnection = [&](u32 Prev, u32 Post) {
+		Nodes[Post].PrevIndices.push_back(Prev);
+		if (IsReadAccess(Nodes[Post].Access) && IsReadAccess(Nodes[Prev].Access)) {
+			Nodes[Post].Access |= Nodes[Prev].Access;
+		}
+	};
+
+	eastl::queue<u32> HelperQueue;
+	auto PropagateRead = [&](u32 Index, EAccessType Access) {
+		HelperQueue.empty();
+		check(IsReadAccess(Access));
+		if (IsReadAccess(Nodes[Index].Access) && !Nodes[Index].Immutable && (Nodes[Index].Access | Access) != Nodes[Index].Access) {
+			HelperQueue.push(Index);
+		}
+		while (!HelperQueue.empty()) {
+			u32 Node = HelperQueue.front();
+			HelperQueue.pop();
+			Nodes[Node].Access |= Access;
+			for (u32 i = 0; i < Nodes[Node].PrevIndices.size(); i++) {
+				u32 Prev = Nodes[Node].PrevIndices[i];
+				if (IsReadAccess(Nodes[Prev].Access) && !Nodes[Prev].Immutable && (Nodes[Prev].Access | Access) != Nodes[Prev].Access) {
+					HelperQueue.push(Prev);
+				}
+			}
+		}
+	};
+
+	auto NeedNewNode = [&](u32 Prev, EAccessType Access) -> bool {
+		bool Differs = Access != Nodes[Prev].Access;
+		return (IsExclusiveAccess(Nodes[Prev].Access) || IsExclusiveAccess(Access) || Nodes[Prev].Immutable) && Differs;
+	};
+
+	for (auto & Request : Requests) {
+		if (Request.Subresource == ALL_SUBRESOURCES) {
+			bool SubresourcesShareState = LastSubresourceNode.size() == 0 && LastComplementaryNode == -1;
+			if (SubresourcesShareState) {
+				u32 Prev = LastAllSubresNode;
+
+				if (NeedNewNode(Prev, Request.Access)) {
+					LastAllSubresNode = SpawnNode(Prev, Request.Access, Request.Subresource, Request.BatchIndex);
+				}
+				else if (IsReadAccess(Request.Access)) {
+					PropagateRead(Prev, Request.Access);
+				}
+			}
+			// !SubresourcesShareState
+			else {
+				// LastComplementaryNode
+				LastAllSubresNode = SpawnNode(LastComplementaryNode, Request.Access, Request.Subresource, Request.BatchIndex);
+				// foreach LastSubresourceNode
+				for (auto PrevPair : LastSubresourceNode) {
+					u32 Prev = PrevPair.second;
+					u32 Subres = PrevPair.first;
+
+					AddConnection(Prev, LastAllSubresNode);
+				}
+
+				LastSubresourceNode.clear();
+				LastComplementaryNode = -1;
+				if(IsReadAccess(Request.Access)) {
+					PropagateRead(LastAllSubresNode, Request.Access);
+				}
+			}
+		}
+		// Request.Subresource != ALL_SUBRESOURCES
+		else {
+			auto SubresFindIter = LastSubresourceNode.find(Request.Subresource);
+			if (SubresFindIter != LastSubresourceNode.end()) {
+				if (NeedNewNode(SubresFindIter->second, Request.Access)) {
+					LastSubresourceNode[Request.Subresource] = SpawnNode(SubresFindIter->second, Request.Access, Request.Subresource, Request.BatchIndex);
+				}
+				else if (IsReadAccess(Request.Access)) {
+					PropagateRead(SubresFindIter->second, Request.Access);
+				}
+			}
+			else if (LastSubresourceNode.size()) {
+				if (NeedNewNode(LastComplementaryNode, Request.Access)) {
+					LastSubresourceNode[Request.Subresource] = SpawnNode(LastComplementaryNode, Request.Access, Request.Subresource, Request.BatchIndex);
+				}
+				else if (IsReadAccess(Request.Access)) {
+					PropagateRead(LastComplementaryNode, Request.Access);
+				}
+			}
+			else {
+				if (NeedNewNode(LastAllSubresNode, Request.Access)) {
+					LastComplementaryNode = SpawnNode(LastAllSubresNode, Nodes[LastAllSubresNode].Access, ALL_SUBRESOURCES, Request.BatchIndex);
+					Nodes[LastComplementaryNode].Complementary = 1;
+					LastSubresourceNode[Request.Subresource] = SpawnNode(LastAllSubresNode, Request.Access, Request.Subresource, Request.BatchIndex);
+				}
+				else if (IsReadAccess(Request.Access)) {
+					PropagateRead(LastAllSubresNode, Request.Access);
+				}
+			}
+		}
+	}
+
+	for (u32 Index = 0; Index < Nodes.size(); Index++) {
+		if (Nodes[Index].Complementary || Nodes[Index].Immutable) {
+			// this is helper node
+			continue;
+		}
+		for (u32 Prev : Nodes[Index].PrevIndices) {
+			if (Nodes[Prev].Access != Nodes[Index].Access) {
+				if (Nodes[Prev].Complementary && Nodes[Index].Subresource == ALL_SUBRESOURCES) {
+					// todo: this should be solved by producing nodes differently? 
+					eastl::hash_set<u32> SubresourcesComplement;
+					for (u32 Prev : Nodes[Index].PrevIndices) {
+						if (Nodes[Prev].Subresource != ALL_SUBRESOURCES) {
+							SubresourcesComplement.insert(Nodes[Prev].Subresource);
+						}
+					}
+
+					for (u32 Subresource = 0; Subresource < Resource->GetSubresourcesNum(); ++Subresource) {
+						if (SubresourcesComplement.count(Subresource) == 0) {
+							FBatchedBarrier Barrier = {};
+
+							Barrier.Barrier.Resource = Resource;
+							Barrier.Barrier.Subresource = Subresource;
+							Barrier.Barrier.From = Nodes[Prev].Access;
+							Barrier.Barrier.To = Nodes[Index].Access;
+							Barrier.BatchIndex = Nodes[Index].BatchIndex;
+
+							OutBarriers.push_back(Barrier);
+						}
+					}
+				}
+				else {
+					FBatchedBarrier Barrier = {};
+					Barrier.Barrier.Resource = Resource;
+					Barrier.Barrier.Subresource = Nodes[Prev].Subresource != ALL_SUBRESOURCES ? Nodes[Prev].Subresource : Nodes[Index].Subresource;
+					Barrier.Barrier.From = Nodes[Prev].Access;
+					Barrier.Barrier.To = Nodes[Index].Access;
+					Barrier.BatchIndex = Nodes[Index].BatchIndex;
+
+					OutBarriers.push_back(Barrier);
+				}
+			}
+		}
+	}
+}
+
+void BenchmarkBarrierSolver() {
+	const u32 FuzzIterations = 20000;
+	const u32 ResourcesNum = 256;
+	const u32 MipmapsNum = 12;
+	const EAccessType Accesses[] = {
+		EAccessType::READ_PIXEL, EAccessType::READ_NON_PIXEL, EAccessType::READ_DEPTH, EAccessType::COPY_SRC,
+		EAccessType::WRITE_RT, EAccessType::WRITE_DEPTH, EAccessType::WRITE_UAV, EAccessType::COPY_DEST
+	};
+	const u32 AccessesNum = _countof(Accesses);
+
+	FResourceStateRegistry & Registry = *GetResourceStateRegistry();
+
+	// order of barriers inside batch isn't specified
+	auto CountMismatches = [](eastl::vector<FBatchedBarrier> & A, eastl::vector<FBatchedBarrier> & B) {
+		auto Less = [](FBatchedBarrier const& X, FBatchedBarrier const& Y) {
+			if (X.BatchIndex != Y.BatchIndex) return X.BatchIndex < Y.BatchIndex;
+			if (X.Barrier.Resource != Y.Barrier.Resource) return X.Barrier.Resource < Y.Barrier.Resource;
+			if (X.Barrier.Subresource != Y.Barrier.Subresource) return X.Barrier.Subresource < Y.Barrier.Subresource;
+			if (X.Barrier.From != Y.Barrier.From) return X.Barrier.From < Y.Barrier.From;
+			return X.Barrier.To < Y.Barrier.To;
+		};
+		eastl::sort(A.begin(), A.end(), Less);
+		eastl::sort(B.begin(), B.end(), Less);
+
+		u32 Mismatches = (u32)eastl::max(A.size(), B.size()) - (u32)eastl::min(A.size(), B.size());
+		for (u32 Index = 0; Index < eastl::min(A.size(), B.size()); ++Index) {
+			Mismatches += Less(A[Index], B[Index]) || Less(B[Index], A[Index]);
+		}
+		return Mismatches;
+	};
+
+	FLinearArena Arena;
+	eastl::vector<FResourceAccessNode> InitialGraph;
+	eastl::vector<FBatchedBarrier> Expected;
+	eastl::vector<FBatchedBarrier> Resolved;
+
+	// random state left by previous frames, random requests mixing whole resource and single mip accesses
+	{
+		std::mt19937 Rng(FuzzIterations);
+		FGPUResource Resource;
+		eastl::vector<FResourceAccess> Requests;
+		u32 Mismatches = 0;
+		u32 BarriersNum = 0;
+		u32 SplitsNum = 0;
+		u32 SplitViolations = 0;
+		for (u32 Iteration = 0; Iteration < FuzzIterations; ++Iteration) {
+			u32 SubresourcesNum = Rng() % MipmapsNum + 1;
+			if (Resource.FatData) {
+				Registry.Deregister(&Resource);
+			}
+			InitCaptureResource(Resource, SubresourcesNum);
+
+			EAccessType Shared = Accesses[Rng() % AccessesNum];
+			Registry.SetCurrentState(&Resource, ALL_SUBRESOURCES, Shared);
+			if (Rng() % 2) {
+				for (u32 Subresource = 0; Subresource < SubresourcesNum; ++Subresource) {
+					EAccessType Access = Accesses[Rng() % AccessesNum];
+					if (Rng() % 3 == 0 && Access != Shared) {
+						Registry.SetCurrentState(&Resource, Subresource, Access);
+					}
+				}
+			}
+
+			Requests.resize(Rng() % 32 + 1);
+			u32 BatchIndex = 0;
+			for (FResourceAccess & Request : Requests) {
+				BatchIndex += Rng() % 2;
+				Request.Subresource = Rng() % 4 == 0 ? ALL_SUBRESOURCES : Rng() % SubresourcesNum;
+				Request.Access = Accesses[Rng() % AccessesNum];
+				Request.BatchIndex = BatchIndex;
+			}
+
+			Expected.clear();
+			BuildInitialAccessGraph(Registry, &Resource, InitialGraph);
+			ProcessResourceBarriersReference(&Resource, InitialGraph, Requests, Expected);
+			MergeSameBatchBarriers(Expected, 0);
+
+			Resolved.clear();
+			Arena.Reset();
+			ProcessResourceBarriers(&Resource, Registry.Resources[&Resource], Requests.data(), (u32)Requests.size(), Arena, Resolved);
+
+			// subresource can't be accessed while its transition is split
+			for (FBatchedBarrier const& Barrier : Resolved) {
+				if (Barrier.BeginBatchIndex == Barrier.BatchIndex) {
+					continue;
+				}
+				SplitsNum++;
+				for (FResourceAccess const& Request : Requests) {
+					bool Overlaps = Request.Subresource == Barrier.Barrier.Subresource || Request.Subresource == ALL_SUBRESOURCES || Barrier.Barrier.Subresource == ALL_SUBRESOURCES;
+					SplitViolations += Overlaps && Request.BatchIndex >= Barrier.BeginBatchIndex && Request.BatchIndex < Barrier.BatchIndex;
+				}
+			}
+
+			Mismatches += CountMismatches(Expected, Resolved);
+			BarriersNum += (u32)Expected.size();
+		}
+		PrintFormated(L"fuzz: %u access lists, %u barriers, %u mismatches, %u splittable, %u accesses inside split\n", FuzzIterations, BarriersNum, Mismatches, SplitsNum, SplitViolations);
+	}
+
+	// mip chain generation, then per mip compute pass, both read back as whole resource
+	eastl::vector<FGPUResource> Resources(ResourcesNum);
+	eastl::vector<FResourceAccess> Requests;
+	for (auto & Resource : Resources) {
+		InitCaptureResource(Resource, MipmapsNum);
+		Registry.SetCurrentState(&Resource, ALL_SUBRESOURCES, EAccessType::READ_PIXEL);
+	}
+	u32 BatchIndex = 0;
+	for (u32 Mip = 1; Mip < MipmapsNum; ++Mip) {
+		Requests.push_back(FResourceAccess{ Mip - 1, EAccessType::READ_PIXEL, BatchIndex });
+		Requests.push_back(FResourceAccess{ Mip, EAccessType::WRITE_RT, BatchIndex++ });
+	}
+	Requests.push_back(FResourceAccess{ ALL_SUBRESOURCES, EAccessType::READ_PIXEL, BatchIndex++ });
+	for (u32 Mip = 0; Mip < MipmapsNum; ++Mip) {
+		Requests.push_back(FResourceAccess{ Mip, EAccessType::WRITE_UAV, BatchIndex });
+		Requests.push_back(FResourceAccess{ Mip, EAccessType::READ_NON_PIXEL, BatchIndex + 1 });
+	}
+	Requests.push_back(FResourceAccess{ ALL_SUBRESOURCES, EAccessType::READ_PIXEL | EAccessType::READ_NON_PIXEL, BatchIndex + 2 });
+
+	double ReferenceMs = 1e9;
+	double SolverMs = 1e9;
+	for (u32 Run = 0; Run < 8; ++Run) {
+		Expected.clear();
+		i64 StartTicks = GetCpuTicks();
+		for (auto & Resource : Resources) {
+			u32 First = (u32)Expected.size();
+			BuildInitialAccessGraph(Registry, &Resource, InitialGraph);
+			ProcessResourceBarriersReference(&Resource, InitialGraph, Requests, Expected);
+			MergeSameBatchBarriers(Expected, First);
+		}
+		ReferenceMs = eastl::min(ReferenceMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+
+		Resolved.clear();
+		StartTicks = GetCpuTicks();
+		Arena.Reset();
+		for (auto & Resource : Resources) {
+			auto Iter = Registry.Resources.find(&Resource);
+			ProcessResourceBarriers(&Resource, Iter->second, Requests.data(), (u32)Requests.size(), Arena, Resolved);
+		}
+		SolverMs = eastl::min(SolverMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+	}
+	u32 BarriersNum = (u32)Resolved.size();
+	u32 Mismatches = CountMismatches(Expected, Resolved);
+
+	PrintFormated(L"mip chains: %u resources x %u accesses, %u barriers, reference %.3f ms, arena solver %.3f ms (%.2fx), arena %u KB, %u mismatches\n",
+		ResourcesNum, (u32)Requests.size(), BarriersNum, ReferenceMs, SolverMs, ReferenceMs / SolverMs, (u32)(Arena.GetUsedSize() / 1024), Mismatches);
+
+	// same frame played repeatedly with states applied, transitions drop once registry learned reads frames start with
+	// history textures are reprojected, overwritten and displayed, overridden ones get access set twice before draw
+	eastl::vector<FGPUResource> History(ResourcesNum);
+	eastl::vector<FGPUResource> Overridden(ResourcesNum);
+	FGPUResource Backbuffer;
+	for (u32 Index = 0; Index < ResourcesNum; ++Index) {
+		InitCaptureResource(History[Index]);
+		InitCaptureResource(Overridden[Index]);
+	}
+	InitCaptureResource(Backbuffer);
+
+	FCommandsStream Stream;
+	FCaptureContext Context;
+	Context.bRecordTrace = false;
+	for (u32 Frame = 0; Frame < 4; ++Frame) {
+		Stream.Reset();
+		for (u32 Index = 0; Index < ResourcesNum; ++Index) {
+			Stream.SetAccess(&History[Index], EAccessType::READ_NON_PIXEL);
+			Stream.DrawIndexed(3);
+			Stream.SetAccess(&History[Index], EAccessType::WRITE_RT);
+			Stream.SetAccess(&Overridden[Index], EAccessType::COPY_DEST);
+			Stream.SetAccess(&Overridden[Index], EAccessType::WRITE_RT);
+			Stream.DrawIndexed(3);
+		}
+		Stream.SetAccess(&Backbuffer, EAccessType::WRITE_RT);
+		for (u32 Index = 0; Index < ResourcesNum; ++Index) {
+			Stream.SetAccess(&History[Index], EAccessType::READ_PIXEL);
+			Stream.SetAccess(&Overridden[Index], EAccessType::READ_PIXEL);
+		}
+		Stream.DrawIndexed(3);
+		Stream.SetAccess(&Backbuffer, EAccessType::COMMON);
+		Stream.Close();
+
+		Context.Reset();
+		GetCurrentFrameStats() = {};
+		Playback(Context, &Stream);
+		commands_stats_t const& Stats = GetCurrentFrameStats().command_stats;
+		PrintFormated(L"frame %u: %u transitions, %u elided, %u barriers issued (%u split), %u split errors\n",
+			Frame, Stats.barriers, Stats.barriers_elided, Context.BarriersNum, Context.SplitBarriersNum, Context.SplitErrorsNum + (u32)Context.OpenSplits.size());
+	}
+	GetCurrentFrameStats() = {};
+}
@@ -3,6 +3,7 @@
 #include "Device.h"
 #include "MathVector.h"
 #include "CommandStream.h"
+#include "PointerMath.h"
 
 #include <EASTL/vector.h>
 #include <EASTL/array.h>
@@ -85,6 +86,7 @@ public:
 };
 
 GPUCommandQueue*		GetDirectQueue();
+GPUCommandQueue*		GetCopyQueue();
 
 enum class CommandListStateEnum {
 	Unassigned,
@@ -109,6 +111,20 @@ struct commands_stats_t {
 	u32 compute_root_params_set;
 	u32 dispatches;
 	u64 constants_bytes_uploaded;
+	// resolved transitions, split pair counts once
+	u32 barriers;
+	// transitions cancelled out or merged with another one inside the same batch
+	u32 barriers_elided;
+	// removed from closed streams by Compact
+	u32 packets_compacted;
+	u64 bytes_compacted;
+	// bundles recorded again because their inputs changed, and all spliced into frame streams
+	u32 bundles_recorded;
+	u32 bundles_executed;
+	// render graph transients: aliasing barriers recorded, bytes if each had its own memory and bytes after packing
+	u32 aliasing_barriers;
+	u64 transient_bytes;
+	u64 transient_bytes_packed;
 };
 
 commands_stats_t& operator += (commands_stats_t& lhs, commands_stats_t const& rhs);
@@ -120,6 +136,10 @@ struct frame_stats_t {
 	u32					patchup_command_lists_num;
 };
 
+// accumulated by barrier resolves and stream compaction, moved to last frame stats by EndFrame
+frame_stats_t & GetCurrentFrameStats();
+frame_stats_t const& GetLastFrameStats();
+
 enum class EAccessType {
 	UNSPECIFIED = 0,
 	COMMON = 0x2000,
@@ -177,11 +197,20 @@ struct FCBVParam;
 struct FSRVParam;
 struct FUAVParam;
 
+// split transition is started with BEGIN_ONLY right after last use of From state
+// and finished with END_ONLY right before first use of To state, resource isn't accessed in between
+enum class EBarrierSplit : u32 {
+	NONE,
+	BEGIN_ONLY,
+	END_ONLY
+};
+
 struct FResourceBarrier {
 	FGPUResource *	Resource;
 	u32				Subresource;
 	EAccessType		From;
 	EAccessType		To;
+	EBarrierSplit	Split;
 };
 
 struct FStateCache {
@@ -212,7 +241,7 @@ struct FStateCache {
 	void Reset();
 };
 
-class FGPUContext {
+class FGPUContext final : public FPlaybackContext {
 public:
 	GPUCommandList*		CommandList;
 	GPUCommandQueue*	Queue;
@@ -226,9 +255,10 @@ public:
 
 	eastl::vector<FResourceBarrier>			BarriersList;
 	u32										FlushCounter;
-	void Barriers(FResourceBarrier const * Barriers, u32 Num);
+	void Barriers(FResourceBarrier const * Barriers, u32 Num) override;
 	void Barrier(FGPUResource* resource, u32 subresource, EAccessType before, EAccessType after);
-	void FlushBarriers();	
+	void FlushBarriers() override;
+	void AliasingBarrier(FGPUResource * Before, FGPUResource * After) override;
 
 	EPipelineType PipelineType;
 	u32 DirtyRoot : 1;
@@ -254,31 +284,31 @@ public:
 
 	// Raw calls
 
-	void ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE rtv, float4 color);
-	void ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE dsv, float depth = 1.f, u8 stencil = 0);
-	void ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE uav, FGPUResource * resource, Vec4u value = 0u);
-	void CopyResource(FGPUResource* dst, FGPUResource* src);
-	void SetTopology(D3D_PRIMITIVE_TOPOLOGY topology);
-	void SetRenderTarget(FRenderTargetView view, u32 index);
-	void SetDepthStencil(FDepthStencilView view);
-	void SetViewport(D3D12_VIEWPORT const & viewport);
-	void SetScissorRect(D3D12_RECT const & rect);
-	void Draw(u32 vertexCount, u32 startVertex = 0, u32 instances = 1, u32 startInstance = 0);
-	void DrawIndexed(u32 indexCount, u32 startIndex = 0, i32 baseVertex = 0, u32 instances = 1, u32 startInstance = 0);
-	void SetVB(FBufferLocation const & BufferView, u32 Stream = 0);
-	void SetIB(FBufferLocation const & BufferView);
-	void Dispatch(u32 X, u32 Y = 1, u32 Z = 1);
-	void CopyTextureRegion(FGPUResource * dst, u32 dstSubresource, FGPUResource * src, u32 srcSubresource);
-	void SetCounter(FGPUResource * dst, u32 value);
+	void ClearRTV(D3D12_CPU_DESCRIPTOR_HANDLE rtv, float4 color) override;
+	void ClearDSV(D3D12_CPU_DESCRIPTOR_HANDLE dsv, float depth = 1.f, u8 stencil = 0) override;
+	void ClearUAV(D3D12_CPU_DESCRIPTOR_HANDLE uav, FGPUResource * resource, Vec4u value = 0u) override;
+	void CopyResource(FGPUResource* dst, FGPUResource* src) override;
+	void SetTopology(D3D_PRIMITIVE_TOPOLOGY topology) override;
+	void SetRenderTarget(FRenderTargetView view, u32 index) override;
+	void SetDepthStencil(FDepthStencilView view) override;
+	void SetViewport(D3D12_VIEWPORT const & viewport) override;
+	void SetScissorRect(D3D12_RECT const & rect) override;
+	void Draw(u32 vertexCount, u32 startVertex = 0, u32 instances = 1, u32 startInstance = 0) override;
+	void DrawIndexed(u32 indexCount, u32 startIndex = 0, i32 baseVertex = 0, u32 instances = 1, u32 startInstance = 0) override;
+	void SetVB(FBufferLocation const & BufferView, u32 Stream = 0) override;
+	void SetIB(FBufferLocation const & BufferView) override;
+	void Dispatch(u32 X, u32 Y = 1, u32 Z = 1) override;
+	void CopyTextureRegion(FGPUResource * dst, u32 dstSubresource, FGPUResource * src, u32 srcSubresource) override;
+	void SetCounter(FGPUResource * dst, u32 value) override;
 
 	// Binding 
 
-	void SetPipelineState(FPipelineState const* PipelineState);
+	void SetPipelineState(FPipelineState const* PipelineState) override;
 	void SetPSO(FPipelineState const* pipelineState);
 	void SetRoot(FRootLayout const* rootLayout);
-	void SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV);
-	void SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View);
-	void SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View);
+	void SetConstantBuffer(FCBVParam const * ConstantBuffer, D3D12_CPU_DESCRIPTOR_HANDLE CBV) override;
+	void SetTexture(FSRVParam const * Texture, D3D12_CPU_DESCRIPTOR_HANDLE View) override;
+	void SetRWTexture(FUAVParam const * RWTexture, D3D12_CPU_DESCRIPTOR_HANDLE View) override;
 
 	// Helpers
 
@@ -287,6 +317,25 @@ public:
 	void Reset();
 };
 
+// copies recorded on copy queue, staging memory comes from ring fenced by copy list
+// destination has to be in COMMON state, it is promoted to copy dest and decays back to COMMON after copy
+class FUploadQueue {
+public:
+	void CopyDataToSubresource(FGPUResource * Dst, u32 Subresource, void const * Src, u64 RowPitch, u64 SlicePitch);
+	void CopyToBuffer(FGPUResource * Dst, void const* Src, u64 Size);
+	// submits copies recorded since last flush, direct queue waits for them before its next submission
+	// returned sync point completes with the copies, dummy when nothing was recorded
+	FGPUSyncPoint Flush();
+
+private:
+	FGPUContext		Context;
+	bool			bOpen = false;
+
+	void Open();
+};
+
+FUploadQueue * GetUploadQueue();
+
 #include <EASTL\hash_map.h>
 
 class FResourceStateRegistry {
@@ -296,9 +345,16 @@ public:
 		EAccessType		AllSubresources;
 		EAccessType		Complementary;
 		eastl::hash_map<u32, EAccessType> Subresources;
+		u32				Slot;
+		// reads previous resolve started with, next resolve widens its final read state by them
+		// so steady frames don't need read to read transition at start
+		EAccessType		LearnedReads = EAccessType::UNSPECIFIED;
 	};
 
 	eastl::hash_map<FGPUResource*, FResourceEntry>	Resources;
+	// every registered resource gets dense slot (stored in FGPUResourceFat::StateSlot), freed slots are reused
+	eastl::vector<u32>	FreeSlots;
+	u32					SlotsNum = 0;
 
 	void SetCurrentState(FGPUResource* Resource, u32 Subresource, EAccessType Access);
 	void Deregister(FGPUResource* Resource);
@@ -312,45 +368,77 @@ struct FResourceAccess {
 	u32			BatchIndex;
 };
 
-struct FResourceAccessNode {
-	u32					Subresource;
-	EAccessType			Access;
-	eastl::vector<u32>	PrevIndices;
+// resolved barrier before it's placed into its batch
+struct FBatchedBarrier {
+	FResourceBarrier	Barrier;
 	u32					BatchIndex;
-	u8					Immutable : 1;
-	u8					Complementary : 1;
+	// earliest batch transition can begin in, subresource isn't accessed from it until BatchIndex
+	u32					BeginBatchIndex;
 };
 
 #include <EASTL/hash_set.h>
 
+struct FStreamCompactionStats {
+	u32 PacketsRemoved;
+	// merged draws are included in removed packets
+	u32 DrawsMerged;
+	u64 BytesSaved;
+};
+
 enum class ECommandsStreamMode {
 	Direct, 
 	Indirect
 };
 
 class FCommandsStream {
-	// todo: bypass recoding when no access changes, go directly to d3d12 command list (for geometry passes)
+	// geometry passes whose inputs don't change are recorded once into FCommandsBundle and spliced in by reference
 public:
 	ECommandsStreamMode Mode = ECommandsStreamMode::Indirect;
-
-	eastl::unique_ptr<u8[]> Data;
-	u64 Offset = 0;
-	u64 MaxSize = 0;
+	// packet layout, can be changed only while stream is empty
+	ECommandsEncoding Encoding = ECommandsEncoding::FunctionPointer;
+	// stream of FCommandsBundle, never played or resolved on its own
+	bool IsBundle = false;
+
+	// chain of pages from the page pool, Reset gives back all but first one
+	FCommandsPage * FirstPage = nullptr;
+	FCommandsPage * LastPage = nullptr;
+	// bytes of packets in all pages
+	u64 Size = 0;
+	u32 PacketsNum = 0;
 	bool IsClosed = 0;
 
+	// indexed by resource state slot, list is valid only when its stamp matches stream stamp
+	// Reset just bumps the stamp, lists keep their memory between frames
 	struct FResourceAccessList {
+		FGPUResource * Resource = nullptr;
 		eastl::vector<FResourceAccess> Accesses;
-		u32 BatchedNum;
+		u32 BatchedNum = 0;
+		// set by AliasingBarrier, barriers of the resource can't begin before this batch
+		u32 AliasedBatch = 0;
+		u32 Stamp = 0;
 	};
-	eastl::hash_map<FGPUResource*, FResourceAccessList>	ResourceAccessList;
-	eastl::hash_set<FGPUResource*> ProcessList;
+	eastl::vector<FResourceAccessList> ResourceAccessList;
+	u32 Stamp = 1;
+	// slots accessed since Reset
+	eastl::vector<u32> AccessedSlots;
+	// slots with accesses not assigned to batch yet
+	eastl::vector<u32> ProcessList;
 	u32 BatchCounter = 0;
-	eastl::hash_map<u32, eastl::vector<FResourceBarrier>> Barriers;
+	// barriers of batch N are Barriers[BarrierOffsets[N], BarrierOffsets[N + 1])
+	eastl::vector<FResourceBarrier> Barriers;
+	eastl::vector<u32> BarrierOffsets;
+	eastl::vector<FBatchedBarrier> ResolvedBarriers;
+	// solver scratch, reset on every resolve
+	FLinearArena BarrierArena;
 
 	void Close();
+	// optional pass over closed stream: drops state packets setting what is already set and merges draws
+	// continuing range of previous draw (list topologies only, shaders can't rely on SV_PrimitiveID)
+	// stream is assumed to start with unknown state, so first set of anything is kept
+	FStreamCompactionStats Compact();
 	void ProcessBarriersPreExecution(FResourceStateRegistry & Registry);
 	void BatchBarriers();
-	void ExecuteBatchedBarriers(FGPUContext * Context, u32 BatchIndex);
+	void ExecuteBatchedBarriers(FPlaybackContext * Context, u32 BatchIndex);
 
 	//void SetRenderTargetsBundle(struct FRenderTargetsBundle const * Bundle);
 	void SetConstantBufferData(FCBVParam * ConstantBuffer, const void * Data, u64 Size);
@@ -394,6 +482,13 @@ public:
 	}
 
 	void SetAccess(FGPUResource * Resource, EAccessType Access, u32 Subresource = ALL_SUBRESOURCES);
+	// accesses before it end up in earlier batches, so Before is done with the memory when After transitions
+	// placed resource can't be used before aliasing barrier, not even by split barrier
+	void AliasingBarrier(FGPUResource * Before, FGPUResource * After);
+	// accesses of bundle are added as if its commands were recorded here, packets are played from the bundle
+	void ExecuteBundle(class FCommandsBundle const & Bundle);
+	void PlaybackBundle(FPlaybackContext * Context, FCommandsStream const * Bundle, u32 BaseBatch);
+	FResourceAccessList & GetAccessList(FGPUResource * Resource);
 
 	inline void Draw(u32 vertexCount, u32 startVertex = 0, u32 instances = 1, u32 startInstance = 0) {
 		PreCommandAdd();
@@ -516,27 +611,53 @@ public:
 
 	//
 
-	void	ReserveStreamSize(u64 Size);
-	void *	Reserve(u64 Size);
+	void	AddPage(u64 Bytes);
 	void	Reset();
 
 	FCommandsStream() {
-		ReserveStreamSize(10 * 1024);
+		FirstPage = LastPage = AcquireCommandsPage();
+	}
+	~FCommandsStream() {
+		ReleaseCommandsPages(FirstPage, LastPage);
 	}
+	FCommandsStream(FCommandsStream const&) = delete;
+	FCommandsStream& operator = (FCommandsStream const&) = delete;
 
-	template<typename T> inline T*	Reserve() {
-		return (T*)Reserve(sizeof(T));
+	// header and payload are reserved together, so they end up in the same page
+	template<typename T, RenderCmdFunc Func>
+	inline T* ReservePacket() {
+		PacketsNum++;
+		u32 PayloadOffset = GetRenderCmdPayloadOffset(Encoding, LastPage->Used, alignof(T));
+		if (PayloadOffset + sizeof(T) > FCommandsPage::CAPACITY) {
+			AddPage(PayloadOffset - LastPage->Used + sizeof(T));
+			PayloadOffset = GetRenderCmdPayloadOffset(Encoding, 0, alignof(T));
+		}
+		WriteRenderCmdHeader(Encoding, LastPage->Data + LastPage->Used, TRenderCmdOpcode<T>::Value, Func);
+		u32 End = PayloadOffset + (u32)sizeof(T);
+		Size += End - LastPage->Used;
+		LastPage->Used = End;
+		return (T*)(LastPage->Data + PayloadOffset);
 	}
+};
+
+// commands recorded once and spliced into frame streams by reference until inputs hash changes
+// resources it accesses must outlive the recording, bundles can't execute other bundles
+// per-frame constants (SetConstantBufferData, CreateCBVFromData) can't be recorded, their memory is reused after the frame
+class FCommandsBundle {
+public:
+	FCommandsStream Stream;
+	u64 InputsHash = 0;
+	bool IsRecorded = false;
 
-	inline FRenderCmdHeader*		ReserveHeader() {
-		return Reserve<FRenderCmdHeader>();
+	FCommandsBundle() {
+		Stream.IsBundle = true;
 	}
 
-	template<typename T, RenderCmdFunc Func>
-	inline T* ReservePacket() {
-		FRenderCmdHeader * Header = ReserveHeader();
-		Header->Func = Func;
-		return Reserve<T>();
+	// true when bundle has to be recorded again, Stream is then reset and ready for commands
+	bool BeginRecording(u64 InInputsHash);
+	void EndRecording();
+	void Invalidate() {
+		IsRecorded = false;
 	}
 };
 
@@ -547,9 +668,24 @@ inline D3D12_CPU_DESCRIPTOR_HANDLE CreateCBVFromData(FCBVParam * CB, T const& Da
 	return CreateCBVFromData(CB, &DataRef, sizeof(T));
 }
 
-void Playback(FGPUContext & Context, FCommandsStream * Stream);
+void Playback(FPlaybackContext & Context, FCommandsStream * Stream);
+
+// streams don't share state, so each can be recorded on a different thread (one per pass, chunk of render list...)
+// barriers are resolved over all streams at once before playback, in array order, giving the same barriers as recording
+// everything into one stream; stream N starts from resource states left by streams before it
+void ProcessBarriersPreExecution(FCommandsStream * const * Streams, u32 StreamsNum, FResourceStateRegistry & Registry);
+void Playback(FPlaybackContext & Context, FCommandsStream * const * Streams, u32 StreamsNum);
+
+// records draws into one stream and into per-thread streams, compares barriers and timings for 1..N threads
+void BenchmarkCommandsRecording();
+
+// barriers turning state resource is in into accesses of Requests, all memory comes from Arena
+// updates learned reads of the entry, returns number of transitions elided inside batches
+u32 ProcessResourceBarriers(FGPUResource * Resource, FResourceStateRegistry::FResourceEntry & InitialState, FResourceAccess const * Requests, u32 RequestsNum, FLinearArena & Arena, eastl::vector<FBatchedBarrier> & OutBarriers);
 
-void ProcessResourceBarriers(FGPUResource * Resource, eastl::vector<FResourceAccessNode>& InitialNodes, eastl::vector<FResourceAccess> const& Requests, eastl::hash_map<u32, eastl::vector<FResourceBarrier>> &OutBarriers);
+// compares solver against reference implementation on random access patterns and times both on mip-heavy ones
+// then plays same frame few times to show transitions removed by learned states
+void BenchmarkBarrierSolver();
 
 struct FBarrierScope {
 	FGPUResource*			Resource;
@@ -909,7 +909,7 @@ eastl::hash_map<u64, FGPUResourceRef> TextureRegistry;
 
 #include "Hash.h"
 
-FGPUResourceRef	LoadDDSImageInternal(const wchar_t * filename, bool forceSrgb, FGPUContext & CopyContext) {
+FGPUResourceRef	LoadDDSImageInternal(const wchar_t * filename, bool forceSrgb) {
 	
 	u64 textureNameHash = MurmurHash2_64(filename, wcslen(filename) * sizeof(wchar_t), 0);
 	auto findIter = TextureRegistry.find(textureNameHash);
@@ -957,10 +957,11 @@ FGPUResourceRef	LoadDDSImageInternal(const wchar_t * filename, bool forceSrgb, F
 
 	FillInitData(ResDesc.Width, ResDesc.Height, 1, ResDesc.MipLevels, ResDesc.DepthOrArraySize, ResDesc.Format, 0, ddsData.BitSize, ddsData.Data, twidth, theight, tdepth, skipMip, SubresourceData);
 
+	// texture is created in COMMON and decays back to it after copy queue is done, shader reads on direct queue promote it
+	FUploadQueue * UploadQueue = GetUploadQueue();
 	for (u32 mip = 0; mip < ResDesc.MipLevels; ++mip) {
-		CopyContext.CopyDataToSubresource(result.get(), mip, SubresourceData[mip].pData, SubresourceData[mip].RowPitch, SubresourceData[mip].SlicePitch);
+		UploadQueue->CopyDataToSubresource(result.get(), mip, SubresourceData[mip].pData, SubresourceData[mip].RowPitch, SubresourceData[mip].SlicePitch);
 	}
-	CopyContext.Barrier(result.get(), ALL_SUBRESOURCES, EAccessType::COPY_DEST, EAccessType::READ_PIXEL);
 
 	TextureRegistry[textureNameHash] = FGPUResourceRef(result);
 
@@ -969,8 +970,8 @@ FGPUResourceRef	LoadDDSImageInternal(const wchar_t * filename, bool forceSrgb, F
 
 #include "Print.h"
 
-FGPUResourceRef  LoadDdsTexture(const wchar_t * filename, bool forceSrgb, FGPUContext & CopyContext) {
-	FGPUResourceRef Loaded = LoadDDSImageInternal(filename, forceSrgb, CopyContext);
+FGPUResourceRef  LoadDdsTexture(const wchar_t * filename, bool forceSrgb) {
+	FGPUResourceRef Loaded = LoadDDSImageInternal(filename, forceSrgb);
 
 	if (!Loaded.get()) {
 		PrintFormated(L"Failed to load %s\n", filename);
@@ -0,0 +1,427 @@
+#include "DescriptorRanges.h"
+#include "AssertionMacros.h"
+#include "Print.h"
+#include "Tasks.h"
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <random>
+
+FDescriptorRanges::FDescriptorRanges(u32 InMaxDescriptors, u32 ThreadsNum) :
+	MaxDescriptors(InMaxDescriptors), Blocks(InMaxDescriptors / BLOCK_SIZE), Cursors(ThreadsNum)
+{
+	check((MaxDescriptors % BLOCK_SIZE) == 0);
+	PartialBlocks.fill(INVALID_BLOCK);
+}
+
+u32 FDescriptorRanges::AllocateBlock() {
+	if (FreeBlocks.size()) {
+		u32 BlockIndex = FreeBlocks.back();
+		FreeBlocks.pop_back();
+		return BlockIndex;
+	}
+
+	check(NextFreeBlock * BLOCK_SIZE < MaxDescriptors);
+	return NextFreeBlock++;
+}
+
+void FDescriptorRanges::FreeBlock(u32 BlockIndex) {
+	FreeBlocks.push_back(BlockIndex);
+}
+
+void FDescriptorRanges::LinkPartial(u32 BlockIndex) {
+	FBlock & Block = Blocks[BlockIndex];
+	u32 & Head = PartialBlocks[Block.Bucket];
+	Block.PrevPartial = INVALID_BLOCK;
+	Block.NextPartial = Head;
+	if (Head != INVALID_BLOCK) {
+		Blocks[Head].PrevPartial = BlockIndex;
+	}
+	Head = BlockIndex;
+	PartialBlocksNum++;
+}
+
+void FDescriptorRanges::UnlinkPartial(u32 BlockIndex) {
+	FBlock & Block = Blocks[BlockIndex];
+	if (Block.PrevPartial != INVALID_BLOCK) {
+		Blocks[Block.PrevPartial].NextPartial = Block.NextPartial;
+	}
+	else {
+		PartialBlocks[Block.Bucket] = Block.NextPartial;
+	}
+	if (Block.NextPartial != INVALID_BLOCK) {
+		Blocks[Block.NextPartial].PrevPartial = Block.PrevPartial;
+	}
+	Block.PrevPartial = INVALID_BLOCK;
+	Block.NextPartial = INVALID_BLOCK;
+	PartialBlocksNum--;
+}
+
+u32 FDescriptorRanges::Allocate(u32 Num) {
+	const u32 Bucket = GetBucket(Num);
+	check(Num > 0 && Bucket < BUCKETS_NUM);
+
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	u32 BlockIndex = PartialBlocks[Bucket];
+	if (BlockIndex == INVALID_BLOCK) {
+		BlockIndex = AllocateBlock();
+		FBlock & Block = Blocks[BlockIndex];
+		Block.Bucket = Bucket;
+		Block.FreeRanges.resize(BLOCK_SIZE >> Bucket);
+		Block.NextFreeRange = FREELIST_GUARD;
+		Block.UntouchedRange = 0;
+		Block.UsedRangesNum = 0;
+		LinkPartial(BlockIndex);
+		BucketBlocksNum++;
+	}
+
+	FBlock & Block = Blocks[BlockIndex];
+	u32 Range;
+	if (Block.NextFreeRange != FREELIST_GUARD) {
+		Range = Block.NextFreeRange;
+		Block.NextFreeRange = Block.FreeRanges[Range];
+	}
+	else {
+		Range = Block.UntouchedRange++;
+	}
+	Block.FreeRanges[Range] = USED_RANGE;
+	Block.UsedRangesNum++;
+	if (Block.UsedRangesNum == Block.FreeRanges.size()) {
+		UnlinkPartial(BlockIndex);
+	}
+
+	RequestedDescriptors += Num;
+	AllocatedDescriptors += 1 << Bucket;
+	return BlockIndex * BLOCK_SIZE + (Range << Bucket);
+}
+
+void FDescriptorRanges::Free(u32 Offset, u32 Num) {
+	const u32 Bucket = GetBucket(Num);
+	const u32 BlockIndex = Offset / BLOCK_SIZE;
+	const u32 Range = (Offset % BLOCK_SIZE) >> Bucket;
+
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	FBlock & Block = Blocks[BlockIndex];
+	check(Block.Bucket == Bucket);
+	check(Block.FreeRanges[Range] == USED_RANGE);
+
+	const bool bWasFull = Block.UsedRangesNum == Block.FreeRanges.size();
+	Block.FreeRanges[Range] = Block.NextFreeRange;
+	Block.NextFreeRange = Range;
+	Block.UsedRangesNum--;
+
+	RequestedDescriptors -= Num;
+	AllocatedDescriptors -= 1 << Bucket;
+
+	if (Block.UsedRangesNum == 0) {
+		if (!bWasFull) {
+			UnlinkPartial(BlockIndex);
+		}
+		// keeping one empty block avoids refilling free list when single allocation comes and goes
+		if (PartialBlocks[Bucket] == INVALID_BLOCK) {
+			LinkPartial(BlockIndex);
+			return;
+		}
+		Block.FreeRanges.clear();
+		Block.Bucket = BUCKETS_NUM;
+		FreeBlock(BlockIndex);
+		BucketBlocksNum--;
+		ReleasedBlocksNum++;
+	}
+	else if (bWasFull) {
+		LinkPartial(BlockIndex);
+	}
+}
+
+u32 FDescriptorRanges::AllocateTemporary(u32 ThreadIndex, u32 Num) {
+	check(ThreadIndex < Cursors.size());
+	check(Num > 0 && Num <= BLOCK_SIZE);
+
+	FTemporaryCursor & Cursor = Cursors[ThreadIndex];
+	if (Cursor.NextOffset + Num > BLOCK_SIZE) {
+		std::lock_guard<std::mutex> Guard(Lock);
+		Cursor.Block = AllocateBlock();
+		Cursor.NextOffset = 0;
+		FrameTemporaryBlocks.push_back(Cursor.Block);
+		TemporaryBlocksNum++;
+	}
+
+	u32 Offset = Cursor.Block * BLOCK_SIZE + Cursor.NextOffset;
+	Cursor.NextOffset += Num;
+	return Offset;
+}
+
+void FDescriptorRanges::CloseTemporaryFrame(eastl::vector<u32> & OutBlocks) {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	OutBlocks.insert(OutBlocks.end(), FrameTemporaryBlocks.begin(), FrameTemporaryBlocks.end());
+	FrameTemporaryBlocks.clear();
+	// next frame starts in fresh blocks, so these can be released as whole
+	for (FTemporaryCursor & Cursor : Cursors) {
+		Cursor = FTemporaryCursor();
+	}
+}
+
+void FDescriptorRanges::FreeTemporaryBlocks(eastl::vector<u32> const& TemporaryBlocks) {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	for (u32 BlockIndex : TemporaryBlocks) {
+		FreeBlock(BlockIndex);
+	}
+	TemporaryBlocksNum -= (u32)TemporaryBlocks.size();
+}
+
+FDescriptorRangesStats FDescriptorRanges::GetStats() const {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	FDescriptorRangesStats Stats;
+	Stats.BlocksNum = MaxDescriptors / BLOCK_SIZE;
+	Stats.UsedBlocksNum = NextFreeBlock - (u32)FreeBlocks.size();
+	Stats.BucketBlocksNum = BucketBlocksNum;
+	Stats.PartialBlocksNum = PartialBlocksNum;
+	Stats.TemporaryBlocksNum = TemporaryBlocksNum;
+	Stats.RequestedDescriptors = RequestedDescriptors;
+	Stats.AllocatedDescriptors = AllocatedDescriptors;
+	Stats.ReleasedBlocksNum = ReleasedBlocksNum;
+	return Stats;
+}
+
+/////////////////////////////////////////
+
+// how buckets worked before: every allocation scans bucket blocks for free range, blocks are never given back
+class FLinearScanDescriptorRanges {
+public:
+	static const u32 BLOCK_SIZE = FDescriptorRanges::BLOCK_SIZE;
+
+	struct FBlock {
+		u32					Index;
+		u32					NextFreeRange;
+		eastl::vector<u32>	FreeRanges;
+	};
+	eastl::array<eastl::vector<FBlock>, FDescriptorRanges::BUCKETS_NUM> Buckets;
+	u32 BlocksNum = 0;
+
+	u32 Allocate(u32 Num) {
+		u32 Bucket = FDescriptorRanges::GetBucket(Num);
+		for (FBlock & Block : Buckets[Bucket]) {
+			if (Block.NextFreeRange != 0xFFFFFFFF) {
+				return Take(Block, Bucket);
+			}
+		}
+		Buckets[Bucket].push_back({ BlocksNum++, 0, eastl::vector<u32>(BLOCK_SIZE >> Bucket) });
+		FBlock & Block = Buckets[Bucket].back();
+		for (u32 Index = 0; Index < Block.FreeRanges.size(); ++Index) {
+			Block.FreeRanges[Index] = Index + 1;
+		}
+		Block.FreeRanges.back() = 0xFFFFFFFF;
+		return Take(Block, Bucket);
+	}
+
+	void Free(u32 Offset, u32 Num) {
+		u32 Bucket = FDescriptorRanges::GetBucket(Num);
+		for (FBlock & Block : Buckets[Bucket]) {
+			if (Block.Index == Offset / BLOCK_SIZE) {
+				u32 Range = (Offset % BLOCK_SIZE) >> Bucket;
+				Block.FreeRanges[Range] = Block.NextFreeRange;
+				Block.NextFreeRange = Range;
+				return;
+			}
+		}
+	}
+
+private:
+	u32 Take(FBlock & Block, u32 Bucket) {
+		u32 Range = Block.NextFreeRange;
+		Block.NextFreeRange = Block.FreeRanges[Range];
+		return Block.Index * BLOCK_SIZE + (Range << Bucket);
+	}
+};
+
+void BenchmarkDescriptorAllocator() {
+	const u32 MaxDescriptors = 1024 * 1024;
+
+	// view churn: 1 or 2 planes for most textures, mip chains and array slices for the rest
+	// live set grows to a peak and shrinks back, like level streaming in and out
+	{
+		const u32 OpsNum = 400000;
+		const u32 PeakLive = 80000;
+
+		struct FOp {
+			u32		Num;
+			u32		FreeIndex;
+			bool	bFree;
+		};
+		eastl::vector<FOp> Ops(OpsNum);
+		std::mt19937 Rng(OpsNum);
+		u32 LiveNum = 0;
+		for (u32 Index = 0; Index < OpsNum; ++Index) {
+			FOp & Op = Ops[Index];
+			// drifts towards target and stays around it
+			const u32 Target = Index < OpsNum / 2 ? PeakLive : PeakLive / 20;
+			Op.bFree = LiveNum > 0 && Rng() % 4 < (LiveNum < Target ? 1u : 3u);
+			if (Op.bFree) {
+				Op.FreeIndex = Rng() % LiveNum;
+				LiveNum--;
+			}
+			else {
+				u32 Pick = Rng() % 20;
+				Op.Num = Pick < 15 ? 1 + Rng() % 2 : (Pick < 19 ? 6 + Rng() % 8 : 16 + Rng() % 48);
+				LiveNum++;
+			}
+		}
+
+		struct FLive {
+			u32 Offset;
+			u32 Num;
+		};
+		eastl::vector<FLive> Live;
+		Live.reserve(PeakLive * 2);
+
+		// validated run marks every descriptor it hands out, timed runs only allocate
+		u32 Errors = 0;
+		double BucketsMs = 1e9;
+		FDescriptorRangesStats PeakStats = {};
+		FDescriptorRangesStats Stats = {};
+		for (u32 Run = 0; Run < 4; ++Run) {
+			const bool bValidate = Run == 0;
+			eastl::vector<u8> Used(bValidate ? MaxDescriptors : 0);
+			FDescriptorRanges Ranges(MaxDescriptors, 1);
+			Live.clear();
+			i64 StartTicks = GetCpuTicks();
+			for (FOp const& Op : Ops) {
+				if (Op.bFree) {
+					FLive Allocation = Live[Op.FreeIndex];
+					Ranges.Free(Allocation.Offset, Allocation.Num);
+					if (bValidate) {
+						u32 Rounded = 1 << FDescriptorRanges::GetBucket(Allocation.Num);
+						memset(Used.data() + Allocation.Offset, 0, Rounded);
+					}
+					Live[Op.FreeIndex] = Live.back();
+					Live.pop_back();
+					continue;
+				}
+				FLive Allocation = { Ranges.Allocate(Op.Num), Op.Num };
+				if (bValidate) {
+					u32 Rounded = 1 << FDescriptorRanges::GetBucket(Op.Num);
+					// range never crosses block and never overlaps live one
+					Errors += Allocation.Offset / FDescriptorRanges::BLOCK_SIZE != (Allocation.Offset + Rounded - 1) / FDescriptorRanges::BLOCK_SIZE;
+					for (u32 Index = 0; Index < Rounded; ++Index) {
+						Errors += Used[Allocation.Offset + Index];
+						Used[Allocation.Offset + Index] = 1;
+					}
+					FDescriptorRangesStats Current = Ranges.GetStats();
+					if (Current.UsedBlocksNum > PeakStats.UsedBlocksNum) {
+						PeakStats = Current;
+					}
+				}
+				Live.push_back(Allocation);
+			}
+			if (!bValidate) {
+				BucketsMs = eastl::min(BucketsMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+				continue;
+			}
+
+			u32 LiveDescriptors = 0;
+			u32 LiveRounded = 0;
+			for (FLive const& Allocation : Live) {
+				LiveDescriptors += Allocation.Num;
+				LiveRounded += 1 << FDescriptorRanges::GetBucket(Allocation.Num);
+			}
+			Stats = Ranges.GetStats();
+			Errors += Stats.RequestedDescriptors != LiveDescriptors || Stats.AllocatedDescriptors != LiveRounded;
+			Errors += Stats.UsedBlocksNum != Stats.BucketBlocksNum;
+			// with everything freed each bucket keeps at most one empty block
+			for (FLive const& Allocation : Live) {
+				Ranges.Free(Allocation.Offset, Allocation.Num);
+			}
+			FDescriptorRangesStats Empty = Ranges.GetStats();
+			Errors += Empty.AllocatedDescriptors != 0 || Empty.UsedBlocksNum > FDescriptorRanges::BUCKETS_NUM || Empty.PartialBlocksNum != Empty.BucketBlocksNum;
+		}
+
+		FLinearScanDescriptorRanges LinearScan;
+		Live.clear();
+		i64 StartTicks = GetCpuTicks();
+		for (FOp const& Op : Ops) {
+			if (Op.bFree) {
+				FLive Allocation = Live[Op.FreeIndex];
+				LinearScan.Free(Allocation.Offset, Allocation.Num);
+				Live[Op.FreeIndex] = Live.back();
+				Live.pop_back();
+				continue;
+			}
+			Live.push_back({ LinearScan.Allocate(Op.Num), Op.Num });
+		}
+		double LinearScanMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		PrintFormated(L"view churn, %u ops, peak %u live: partial lists %.3f ms (%.1f Mops/s), peak %u blocks with occupancy %.1f%% and rounding waste %.1f%%, %u blocks at end (%u partial, %u released); linear scan %.3f ms (%.1f Mops/s), %u blocks kept; %u errors\n",
+			OpsNum, PeakLive,
+			BucketsMs, OpsNum / BucketsMs / 1000., PeakStats.UsedBlocksNum,
+			100.f * PeakStats.AllocatedDescriptors / (PeakStats.BucketBlocksNum * FDescriptorRanges::BLOCK_SIZE),
+			100.f * (PeakStats.AllocatedDescriptors - PeakStats.RequestedDescriptors) / PeakStats.AllocatedDescriptors,
+			Stats.BucketBlocksNum, Stats.PartialBlocksNum, Stats.ReleasedBlocksNum,
+			LinearScanMs, OpsNum / LinearScanMs / 1000., LinearScan.BlocksNum,
+			Errors);
+	}
+
+	// temporary tables recorded from many threads, every run is a frame and its blocks are freed before next one
+	{
+		const u32 AllocationsPerThread = 4096;
+		const u32 RunsNum = 4;
+		const u32 ThreadsCounts[] = { 1, 2, 4, 8, 16, 32 };
+
+		eastl::vector<eastl::vector<u32>> Nums(32);
+		eastl::vector<eastl::vector<u32>> Offsets(32);
+		for (u32 Thread = 0; Thread < 32; ++Thread) {
+			std::mt19937 Rng(Thread);
+			Nums[Thread].resize(AllocationsPerThread);
+			Offsets[Thread].resize(AllocationsPerThread);
+			for (u32 & Num : Nums[Thread]) {
+				Num = 1 + Rng() % 8;
+			}
+		}
+
+		for (u32 ThreadsNum : ThreadsCounts) {
+			u32 Errors = 0;
+			FDescriptorRanges Ranges(MaxDescriptors, ThreadsNum);
+			eastl::vector<u32> FrameBlocks;
+			u32 FrameBlocksNum = 0;
+			double Ms = 1e9;
+			for (u32 Run = 0; Run < RunsNum; ++Run) {
+				Ms = eastl::min(Ms, RunOnThreads(ThreadsNum, [&](u32 Thread) {
+					for (u32 Index = 0; Index < AllocationsPerThread; ++Index) {
+						Offsets[Thread][Index] = Ranges.AllocateTemporary(Thread, Nums[Thread][Index]);
+					}
+				}));
+
+				if (Run == 0) {
+					eastl::vector<eastl::pair<u32, u32>> Sorted;
+					for (u32 Thread = 0; Thread < ThreadsNum; ++Thread) {
+						for (u32 Index = 0; Index < AllocationsPerThread; ++Index) {
+							u32 Offset = Offsets[Thread][Index];
+							u32 Num = Nums[Thread][Index];
+							Errors += Offset / FDescriptorRanges::BLOCK_SIZE != (Offset + Num - 1) / FDescriptorRanges::BLOCK_SIZE;
+							Sorted.push_back({ Offset, Offset + Num });
+						}
+					}
+					eastl::sort(Sorted.begin(), Sorted.end());
+					for (u32 Index = 1; Index < Sorted.size(); ++Index) {
+						Errors += Sorted[Index].first < Sorted[Index - 1].second;
+					}
+				}
+
+				FrameBlocks.clear();
+				Ranges.CloseTemporaryFrame(FrameBlocks);
+				FrameBlocksNum = (u32)FrameBlocks.size();
+				Errors += Ranges.GetStats().TemporaryBlocksNum != FrameBlocksNum;
+				Ranges.FreeTemporaryBlocks(FrameBlocks);
+			}
+			FDescriptorRangesStats Stats = Ranges.GetStats();
+			Errors += Stats.UsedBlocksNum != 0 || Stats.TemporaryBlocksNum != 0;
+
+			const u32 AllocationsNum = ThreadsNum * AllocationsPerThread;
+			PrintFormated(L"temporary, %2u threads, %u allocations: %.3f ms (%.1f Mallocs/s), %u blocks and lock takes per frame, %u errors\n",
+				ThreadsNum, AllocationsNum, Ms, AllocationsNum / Ms / 1000., FrameBlocksNum, Errors);
+		}
+	}
+}
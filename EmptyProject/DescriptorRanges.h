@@ -0,0 +1,108 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/vector.h>
+#include <EASTL/array.h>
+#include <mutex>
+
+inline u32 FastLog2(u32 v) {
+	u32 r; // result of log2(v) will go here
+	u32 shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+
+	return r;
+}
+
+struct FDescriptorRangesStats {
+	u32 BlocksNum;
+	u32 UsedBlocksNum;
+	u32 BucketBlocksNum;
+	// bucket blocks with at least one free range
+	u32 PartialBlocksNum;
+	// held by temporary allocations of current and not yet completed frames
+	u32 TemporaryBlocksNum;
+	// live bucket allocations as asked for and with power of two rounding
+	u32 RequestedDescriptors;
+	u32 AllocatedDescriptors;
+	// empty bucket blocks given back since start
+	u32 ReleasedBlocksNum;
+};
+
+// descriptor heap offsets without the heap, heap is split into blocks used either by one bucket or by temporary allocations
+// bucket block holds ranges of one power of two size, blocks with free ranges are linked per bucket so allocation takes list head
+// block left empty goes back to free blocks, unless it is last one with free ranges in its bucket
+// temporary allocations bump inside block owned by calling thread, lock is taken only to get next block
+class FDescriptorRanges {
+public:
+	static const u32 BLOCK_SIZE = 512;
+	static const u32 BUCKETS_NUM = 10;
+
+	FDescriptorRanges(u32 InMaxDescriptors, u32 ThreadsNum);
+
+	// thread safe, Num is rounded up to power of two
+	u32 Allocate(u32 Num);
+	void Free(u32 Offset, u32 Num);
+
+	// thread safe as long as ThreadIndex is unique among allocating threads
+	u32 AllocateTemporary(u32 ThreadIndex, u32 Num);
+	// no AllocateTemporary can run concurrently, blocks taken since last call go to OutBlocks until they are freed
+	void CloseTemporaryFrame(eastl::vector<u32> & OutBlocks);
+	void FreeTemporaryBlocks(eastl::vector<u32> const& TemporaryBlocks);
+
+	FDescriptorRangesStats GetStats() const;
+
+	static u32 GetBucket(u32 Num) {
+		return Num > 1 ? FastLog2(Num - 1) + 1 : 0;
+	}
+
+private:
+	static const u32 INVALID_BLOCK = 0xFFFFFFFF;
+	static const u32 FREELIST_GUARD = 0xFFFFFFFF;
+	static const u32 USED_RANGE = 0xFFFFFFFE;
+
+	struct FBlock {
+		// next free range for freed ones, USED_RANGE for allocated ones
+		// ranges from UntouchedRange up were never handed out and are not in free list
+		eastl::vector<u32>	FreeRanges;
+		u32					NextFreeRange = FREELIST_GUARD;
+		u32					UntouchedRange = 0;
+		u32					UsedRangesNum = 0;
+		u32					Bucket = BUCKETS_NUM;
+		u32					PrevPartial = INVALID_BLOCK;
+		u32					NextPartial = INVALID_BLOCK;
+	};
+
+	// padded so cursors of different threads never share cache line
+	struct alignas(64) FTemporaryCursor {
+		u32 Block = INVALID_BLOCK;
+		u32 NextOffset = BLOCK_SIZE;
+	};
+
+	const u32								MaxDescriptors;
+	mutable std::mutex						Lock;
+	eastl::vector<FBlock>					Blocks;
+	u32										NextFreeBlock = 0;
+	eastl::vector<u32>						FreeBlocks;
+	eastl::array<u32, BUCKETS_NUM>			PartialBlocks;
+	eastl::vector<FTemporaryCursor>			Cursors;
+	eastl::vector<u32>						FrameTemporaryBlocks;
+
+	u32 BucketBlocksNum = 0;
+	u32 PartialBlocksNum = 0;
+	u32 TemporaryBlocksNum = 0;
+	u32 RequestedDescriptors = 0;
+	u32 AllocatedDescriptors = 0;
+	u32 ReleasedBlocksNum = 0;
+
+	u32 AllocateBlock();
+	void FreeBlock(u32 BlockIndex);
+	void LinkPartial(u32 BlockIndex);
+	void UnlinkPartial(u32 BlockIndex);
+};
+
+// bucket churn against linear scan of bucket blocks, temporary allocations from 1 to 32 threads
+void BenchmarkDescriptorAllocator();
@@ -1,9 +1,11 @@
 #include "Descriptors.h"
 #include "d3dx12.h"
+#include "Tasks.h"
 
 FDescriptorAllocator::FDescriptorAllocator(D3D12_DESCRIPTOR_HEAP_TYPE type, u32 maxDescriptors, bool shaderVisible) :
 	Type(type), MaxDescriptors(maxDescriptors), IsShaderVisible(shaderVisible),
-	IncrementSize(GetPrimaryDevice()->D12Device->GetDescriptorHandleIncrementSize(type))
+	IncrementSize(GetPrimaryDevice()->D12Device->GetDescriptorHandleIncrementSize(type)),
+	Ranges(maxDescriptors, GetWorkersNum())
 {
 	D3D12_DESCRIPTOR_HEAP_DESC desc = {};
 	desc.NumDescriptors = maxDescriptors;
@@ -12,85 +14,23 @@ FDescriptorAllocator::FDescriptorAllocator(D3D12_DESCRIPTOR_HEAP_TYPE type, u32
 	desc.NodeMask = 0;
 
 	VERIFYDX12(GetPrimaryDevice()->D12Device->CreateDescriptorHeap(&desc, IID_PPV_ARGS(D12DescriptorHeap.get_init())));
-
-	check((maxDescriptors % BlockSize) == 0);
-	const u32 BlocksPoolSize = maxDescriptors / BlockSize;
-	Blocks.resize(BlocksPoolSize);
-	for (u32 index = 0; index < BlocksPoolSize; ++index) {
-		Blocks[index].BlockIndex = index;
-	}
 }
 
-u32 FDescriptorAllocator::AllocateBlock() {
-	if (FreeBlocks.size()) {
-		u32 val = FreeBlocks.back();
-		FreeBlocks.pop_back();
-		return val;
-	}
-
-	check(NextFreeBlock * BlockSize < MaxDescriptors);
-	return NextFreeBlock++;
-}
-
-void FDescriptorAllocator::FreeBlock(u32 index) {
-	FreeBlocks.push_back(index);
-}
-
-const u32 FREELIST_GUARD = 0xFFFFFFFF;
-
-FDescriptorsAllocation FDescriptorAllocator::AllocateFromBucketBlock(BucketBlock &Block, u32 num) {
+FDescriptorsAllocation FDescriptorAllocator::Allocate(u32 num) {
 	FDescriptorsAllocation result = {};
 	result.Allocator = this;
 	result.DescriptorsNum = num;
-
-	u32 rangeIndex = Block.NextFreeRange;
-	result.HeapOffset = Block.BlockIndex * BlockSize + rangeIndex * num;
-	Block.NextFreeRange = Block.FreeRanges[rangeIndex];
-	Block.FreeRanges[rangeIndex] = FREELIST_GUARD;
-
+	result.HeapOffset = Ranges.Allocate(num);
 	return result;
 }
 
-void FDescriptorAllocator::FreeToBucketBlock(BucketBlock &Block, u32 freedIndex) {
-	if (Block.NextFreeRange != FREELIST_GUARD) {
-		Block.FreeRanges[Block.NextFreeRange] = freedIndex;
-	}
-	Block.NextFreeRange = freedIndex;
-}
-
-FDescriptorsAllocation FDescriptorAllocator::Allocate(u32 num) {
-	u32 bucketIndex = FastLog2(num);
-	check(bucketIndex < BucketsNum);
-
-	for (auto blockIndex : Buckets[bucketIndex]) {
-		auto& Block = Blocks[blockIndex];
-		if (Block.NextFreeRange != FREELIST_GUARD) {
-			return AllocateFromBucketBlock(Block, num);
-		}
-	}
-
-	Buckets[bucketIndex].push_back(AllocateBlock());
-	auto& Block = Blocks[Buckets[bucketIndex].back()];
-
-	u32 rangesNum = BlockSize / (1 << bucketIndex);
-	for (u32 index = 0; index < rangesNum; ++index) {
-		Block.FreeRanges.push_back(index + 1);
-	}
-	Block.FreeRanges.back() = FREELIST_GUARD;
-
-	return AllocateFromBucketBlock(Block, num);
-}
-
 void FDescriptorAllocator::FreeInternal(FDescriptorsAllocation allocation) {
-	u32 bucketIndex = FastLog2(allocation.DescriptorsNum);
-	check(bucketIndex < BucketsNum);
-
-	u32 blockIndex = allocation.HeapOffset / BlockSize;
-	FreeToBucketBlock(Blocks[blockIndex], (allocation.HeapOffset - blockIndex * BlockSize) / (1 << bucketIndex));
+	Ranges.Free(allocation.HeapOffset, allocation.DescriptorsNum);
 }
 
 void FDescriptorAllocator::Free(FDescriptorsAllocation allocation, FGPUSyncPoint sync) {
 	if (!sync.IsCompleted()) {
+		std::lock_guard<std::mutex> guard(DeferredDeletionLock);
 		DeferredDeletionQueue.push(QueuedElement(sync, allocation));
 	}
 	else {
@@ -103,20 +43,16 @@ void FDescriptorAllocator::Free(FDescriptorsAllocation allocation) {
 }
 
 void FDescriptorAllocator::Tick() {
-	while (DeferredDeletionQueue.size() && DeferredDeletionQueue.front().first.IsCompleted()) {
-		FreeInternal(DeferredDeletionQueue.front().second);
-		DeferredDeletionQueue.pop();
+	{
+		std::lock_guard<std::mutex> guard(DeferredDeletionLock);
+		while (DeferredDeletionQueue.size() && DeferredDeletionQueue.front().first.IsCompleted()) {
+			FreeInternal(DeferredDeletionQueue.front().second);
+			DeferredDeletionQueue.pop();
+		}
 	}
 
 	while (DeferredFastAllocationDeletionQueue.size() && DeferredFastAllocationDeletionQueue.front().first.IsCompleted()) {
-		u32 num = DeferredFastAllocationDeletionQueue.front().second;
-
-		while (num--) {
-			check(FastAllocationBlocks.size());
-			FreeBlock(FastAllocationBlocks.front().BlockIndex);
-			FastAllocationBlocks.pop();
-		}
-
+		Ranges.FreeTemporaryBlocks(DeferredFastAllocationDeletionQueue.front().second);
 		DeferredFastAllocationDeletionQueue.pop();
 	}
 }
@@ -125,28 +61,13 @@ FDescriptorsAllocation FDescriptorAllocator::FastTemporaryAllocate(u32 num) {
 	FDescriptorsAllocation result = {};
 	result.Allocator = this;
 	result.DescriptorsNum = num;
-	result.HeapOffset;
-
-	if (!FastAllocationBlocks.size() || FastAllocationBlocks.back().NextOffset + num > BlockSize) {
-		FastAllocationBlock fab = {};
-		fab.BlockIndex = AllocateBlock();
-		fab.NextOffset = 0;
-		FastAllocationBlocks.push(fab);
-		FrameFastAllocationBlocksNum++;
-	}
-	check(FastAllocationBlocks.back().NextOffset + num <= BlockSize);
-	result.HeapOffset = FastAllocationBlocks.back().BlockIndex * BlockSize + FastAllocationBlocks.back().NextOffset;
-	FastAllocationBlocks.back().NextOffset += num;
-
+	result.HeapOffset = Ranges.AllocateTemporary(GetCurrentWorkerIndex(), num);
 	return result;
 }
 
 void FDescriptorAllocator::FenceTemporaryAllocations(FGPUSyncPoint sync) {
-	DeferredFastAllocationDeletionQueue.push(FencedFastAllocations(sync, FrameFastAllocationBlocksNum));
-	FrameFastAllocationBlocksNum = 0;
-	if (FastAllocationBlocks.size()) {
-		FastAllocationBlocks.back().NextOffset = BlockSize;
-	}
+	DeferredFastAllocationDeletionQueue.push(FencedFastAllocations(sync, {}));
+	Ranges.CloseTemporaryFrame(DeferredFastAllocationDeletionQueue.back().second);
 }
 
 void FDescriptorsAllocation::Free(FGPUSyncPoint sync) {
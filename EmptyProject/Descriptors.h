@@ -5,20 +5,10 @@
 #include <EASTL/vector.h>
 #include <EASTL/queue.h>
 #include <EASTL/array.h>
+#include "DescriptorRanges.h"
 
-inline u32 FastLog2(u32 v) {
-	u32 r; // result of log2(v) will go here
-	u32 shift;
-
-	r = (v > 0xFFFF) << 4; v >>= r;
-	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
-	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
-	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
-	r |= (v >> 1);
-
-	return r;
-}
-
+// d3d heap over FDescriptorRanges, Allocate, Free and FastTemporaryAllocate are thread safe
+// Tick and FenceTemporaryAllocations run once per frame with no allocations in flight
 class FDescriptorAllocator {
 public:
 	const u32								MaxDescriptors;
@@ -27,28 +17,7 @@ public:
 	const bool								IsShaderVisible;
 	unique_com_ptr<ID3D12DescriptorHeap>	D12DescriptorHeap;
 
-	// blocks are used for bucketed long-term allocations and fast allocations
-	static const u32						BlockSize = 512;
-	u32										NextFreeBlock = 0;
-	eastl::vector<u32>						FreeBlocks;
-
-	u32										AllocateBlock();
-	void									FreeBlock(u32 index);
-
-	class BucketBlock {
-	public:
-		u32 BlockIndex = -1;
-		u32 NextFreeRange = 0;
-		eastl::vector<u32> FreeRanges;
-	};
-
-	eastl::vector<BucketBlock>				Blocks; // pool
-	
-	static const u32						BucketsNum = 9;
-	eastl::array<eastl::vector<u32>, BucketsNum> Buckets; // index to pool
-
-	FDescriptorsAllocation AllocateFromBucketBlock(BucketBlock &Block, u32 num);
-	void FreeToBucketBlock(BucketBlock &Block, u32 num);
+	FDescriptorRanges						Ranges;
 
 	FDescriptorAllocator(D3D12_DESCRIPTOR_HEAP_TYPE type, u32 maxDescriptors, bool shaderVisible);
 
@@ -57,21 +26,17 @@ public:
 
 	typedef eastl::pair<FGPUSyncPoint, FDescriptorsAllocation> QueuedElement;
 	eastl::queue<QueuedElement>	DeferredDeletionQueue;
+	std::mutex					DeferredDeletionLock;
 
 	void					Free(FDescriptorsAllocation allocation, FGPUSyncPoint sync);
 	void					Free(FDescriptorsAllocation allocation);
 	void					Tick();
 
-	struct FastAllocationBlock {
-		u32 BlockIndex;
-		u32 NextOffset;
-	};
-
-	eastl::queue<FastAllocationBlock>	FastAllocationBlocks;
-	typedef eastl::pair<FGPUSyncPoint, u32> FencedFastAllocations;
+	typedef eastl::pair<FGPUSyncPoint, eastl::vector<u32>> FencedFastAllocations;
 	eastl::queue<FencedFastAllocations>	DeferredFastAllocationDeletionQueue;
-	u32 FrameFastAllocationBlocksNum = 0;
 
+	// bumps inside block owned by calling worker, num <= FDescriptorRanges::BLOCK_SIZE
 	FDescriptorsAllocation	FastTemporaryAllocate(u32 num);
 	void					FenceTemporaryAllocations(FGPUSyncPoint sync);
+	FDescriptorRangesStats	GetStats() const { return Ranges.GetStats(); }
 };
@@ -0,0 +1,628 @@
+#include "HeapAllocator.h"
+#include "AssertionMacros.h"
+#include "Print.h"
+#include <EASTL/map.h>
+#include <EASTL/algorithm.h>
+#include <random>
+#include <math.h>
+
+void * FCpuHeapBackend::CreateHeap(u64 Size) {
+	u64 Handle = NextHandle++;
+	Sizes[Handle] = Size;
+	HeapsNum++;
+	HeapsCreated++;
+	HeapsBytes += Size;
+	PeakHeapsBytes = eastl::max(PeakHeapsBytes, HeapsBytes);
+	return (void*)Handle;
+}
+
+void FCpuHeapBackend::DestroyHeap(void * Heap) {
+	auto Iter = Sizes.find((u64)Heap);
+	check(Iter != Sizes.end());
+	HeapsNum--;
+	HeapsBytes -= Iter->second;
+	Sizes.erase(Iter);
+}
+
+/////////////////////////////////////////
+
+static u32 HighestBit(u32 Value) {
+	u32 Bit = 0;
+	u32 Shift;
+	Bit = (Value > 0xFFFF) << 4; Value >>= Bit;
+	Shift = (Value > 0xFF) << 3; Value >>= Shift; Bit |= Shift;
+	Shift = (Value > 0xF) << 2; Value >>= Shift; Bit |= Shift;
+	Shift = (Value > 0x3) << 1; Value >>= Shift; Bit |= Shift;
+	return Bit | (Value >> 1);
+}
+
+static u32 LowestBit(u32 Value) {
+	return HighestBit(Value & (0 - Value));
+}
+
+// sizes below SL_NUM units have exact lists, above it every power of two range is split into SL_NUM lists
+static void MapSize(u64 Size, u32 * OutFL, u32 * OutSL) {
+	if (Size < FTLSFRangeAllocator::SL_NUM) {
+		*OutFL = 0;
+		*OutSL = (u32)Size;
+		return;
+	}
+	u32 Bit = HighestBit((u32)Size);
+	*OutFL = Bit - FTLSFRangeAllocator::SL_BITS + 1;
+	*OutSL = (u32)(Size >> (Bit - FTLSFRangeAllocator::SL_BITS)) ^ FTLSFRangeAllocator::SL_NUM;
+}
+
+void FTLSFRangeAllocator::Init(u64 Size, u64 InGranularity) {
+	Granularity = InGranularity;
+	TotalUnits = Size / Granularity;
+	check(TotalUnits > 0 && TotalUnits < (1ull << 31));
+
+	Blocks.clear();
+	UnusedBlocks.clear();
+	FLBitmap = 0;
+	memset(SLBitmaps, 0, sizeof(SLBitmaps));
+	for (u32 FL = 0; FL < FL_NUM; ++FL) {
+		for (u32 SL = 0; SL < SL_NUM; ++SL) {
+			FreeLists[FL][SL] = INVALID_BLOCK;
+		}
+	}
+	FreeUnits = TotalUnits;
+	FreeBlocksNum = 0;
+
+	InsertFree(NewBlock(0, TotalUnits));
+}
+
+u32 FTLSFRangeAllocator::NewBlock(u64 Offset, u64 Size) {
+	u32 Index;
+	if (UnusedBlocks.size()) {
+		Index = UnusedBlocks.back();
+		UnusedBlocks.pop_back();
+	}
+	else {
+		Index = (u32)Blocks.size();
+		Blocks.push_back();
+	}
+	Blocks[Index] = { Offset, Size, INVALID_BLOCK, INVALID_BLOCK, INVALID_BLOCK, INVALID_BLOCK, false };
+	return Index;
+}
+
+void FTLSFRangeAllocator::InsertFree(u32 Index) {
+	FBlock & Block = Blocks[Index];
+	u32 FL, SL;
+	MapSize(Block.Size, &FL, &SL);
+	Block.bFree = true;
+	Block.PrevFree = INVALID_BLOCK;
+	Block.NextFree = FreeLists[FL][SL];
+	if (Block.NextFree != INVALID_BLOCK) {
+		Blocks[Block.NextFree].PrevFree = Index;
+	}
+	FreeLists[FL][SL] = Index;
+	FLBitmap |= 1u << FL;
+	SLBitmaps[FL] |= 1u << SL;
+	FreeBlocksNum++;
+}
+
+void FTLSFRangeAllocator::RemoveFree(u32 Index) {
+	FBlock & Block = Blocks[Index];
+	check(Block.bFree);
+	u32 FL, SL;
+	MapSize(Block.Size, &FL, &SL);
+	if (Block.PrevFree != INVALID_BLOCK) {
+		Blocks[Block.PrevFree].NextFree = Block.NextFree;
+	}
+	else {
+		FreeLists[FL][SL] = Block.NextFree;
+		if (Block.NextFree == INVALID_BLOCK) {
+			SLBitmaps[FL] &= ~(1u << SL);
+			if (!SLBitmaps[FL]) {
+				FLBitmap &= ~(1u << FL);
+			}
+		}
+	}
+	if (Block.NextFree != INVALID_BLOCK) {
+		Blocks[Block.NextFree].PrevFree = Block.PrevFree;
+	}
+	Block.bFree = false;
+	FreeBlocksNum--;
+}
+
+// good fit: size is rounded up to next list boundary, so any block of found list fits
+u32 FTLSFRangeAllocator::FindFree(u64 Size) const {
+	if (Size >= SL_NUM) {
+		Size += (1ull << (HighestBit((u32)Size) - SL_BITS)) - 1;
+		if (Size >= (1ull << 31)) {
+			return INVALID_BLOCK;
+		}
+	}
+	u32 FL, SL;
+	MapSize(Size, &FL, &SL);
+
+	u32 SLMap = SLBitmaps[FL] & (~0u << SL);
+	if (!SLMap) {
+		u32 FLMap = FL + 1 < 32 ? FLBitmap & (~0u << (FL + 1)) : 0;
+		if (!FLMap) {
+			return INVALID_BLOCK;
+		}
+		FL = LowestBit(FLMap);
+		SLMap = SLBitmaps[FL];
+	}
+	return FreeLists[FL][LowestBit(SLMap)];
+}
+
+u64 FTLSFRangeAllocator::GetFitSize(u64 Size, u64 Alignment, u64 Granularity) {
+	u64 Units = eastl::max<u64>((Size + Granularity - 1) / Granularity, 1) + eastl::max<u64>(Alignment / Granularity, 1) - 1;
+	// first size of the list FindFree starts from
+	if (Units >= SL_NUM) {
+		u64 Step = 1ull << (HighestBit((u32)Units) - SL_BITS);
+		Units = (Units + Step - 1) & ~(Step - 1);
+	}
+	return Units * Granularity;
+}
+
+bool FTLSFRangeAllocator::Allocate(u64 Size, u64 Alignment, u32 * OutBlock, u64 * OutOffset) {
+	const u64 SizeUnits = eastl::max<u64>((Size + Granularity - 1) / Granularity, 1);
+	const u64 AlignmentUnits = eastl::max<u64>(Alignment / Granularity, 1);
+	check(Alignment <= Granularity || Alignment % Granularity == 0);
+
+	u32 Index = FindFree(SizeUnits + AlignmentUnits - 1);
+	if (Index == INVALID_BLOCK) {
+		return false;
+	}
+	RemoveFree(Index);
+
+	// blocks can be added below, so Blocks is indexed again after every NewBlock
+	u64 AlignedOffset = (Blocks[Index].Offset + AlignmentUnits - 1) / AlignmentUnits * AlignmentUnits;
+	if (AlignedOffset > Blocks[Index].Offset) {
+		u32 Pad = NewBlock(Blocks[Index].Offset, AlignedOffset - Blocks[Index].Offset);
+		Blocks[Pad].PrevPhysical = Blocks[Index].PrevPhysical;
+		Blocks[Pad].NextPhysical = Index;
+		if (Blocks[Index].PrevPhysical != INVALID_BLOCK) {
+			Blocks[Blocks[Index].PrevPhysical].NextPhysical = Pad;
+		}
+		Blocks[Index].PrevPhysical = Pad;
+		Blocks[Index].Offset = AlignedOffset;
+		Blocks[Index].Size -= Blocks[Pad].Size;
+		InsertFree(Pad);
+	}
+
+	if (Blocks[Index].Size > SizeUnits) {
+		u32 Rest = NewBlock(Blocks[Index].Offset + SizeUnits, Blocks[Index].Size - SizeUnits);
+		Blocks[Rest].PrevPhysical = Index;
+		Blocks[Rest].NextPhysical = Blocks[Index].NextPhysical;
+		if (Blocks[Index].NextPhysical != INVALID_BLOCK) {
+			Blocks[Blocks[Index].NextPhysical].PrevPhysical = Rest;
+		}
+		Blocks[Index].NextPhysical = Rest;
+		Blocks[Index].Size = SizeUnits;
+		InsertFree(Rest);
+	}
+
+	FreeUnits -= SizeUnits;
+	*OutBlock = Index;
+	*OutOffset = Blocks[Index].Offset * Granularity;
+	return true;
+}
+
+void FTLSFRangeAllocator::Free(u32 Index) {
+	check(!Blocks[Index].bFree);
+	FreeUnits += Blocks[Index].Size;
+
+	u32 Next = Blocks[Index].NextPhysical;
+	if (Next != INVALID_BLOCK && Blocks[Next].bFree) {
+		RemoveFree(Next);
+		Blocks[Index].Size += Blocks[Next].Size;
+		Blocks[Index].NextPhysical = Blocks[Next].NextPhysical;
+		if (Blocks[Next].NextPhysical != INVALID_BLOCK) {
+			Blocks[Blocks[Next].NextPhysical].PrevPhysical = Index;
+		}
+		UnusedBlocks.push_back(Next);
+	}
+
+	u32 Prev = Blocks[Index].PrevPhysical;
+	if (Prev != INVALID_BLOCK && Blocks[Prev].bFree) {
+		RemoveFree(Prev);
+		Blocks[Prev].Size += Blocks[Index].Size;
+		Blocks[Prev].NextPhysical = Blocks[Index].NextPhysical;
+		if (Blocks[Index].NextPhysical != INVALID_BLOCK) {
+			Blocks[Blocks[Index].NextPhysical].PrevPhysical = Prev;
+		}
+		UnusedBlocks.push_back(Index);
+		Index = Prev;
+	}
+
+	InsertFree(Index);
+}
+
+u64 FTLSFRangeAllocator::GetLargestFreeSize() const {
+	if (!FLBitmap) {
+		return 0;
+	}
+	u32 FL = HighestBit(FLBitmap);
+	u32 SL = HighestBit(SLBitmaps[FL]);
+	u64 Largest = 0;
+	for (u32 Index = FreeLists[FL][SL]; Index != INVALID_BLOCK; Index = Blocks[Index].NextFree) {
+		Largest = eastl::max(Largest, Blocks[Index].Size);
+	}
+	return Largest * Granularity;
+}
+
+/////////////////////////////////////////
+
+FHeapSuballocator::FHeapSuballocator(FHeapBackend * InBackend, u64 InHeapSize) : Backend(InBackend), HeapSize(InHeapSize) {
+	check(HeapSize % HEAP_PLACEMENT_ALIGNMENT == 0);
+}
+
+FHeapSuballocator::~FHeapSuballocator() {
+	for (FHeap & Heap : Heaps) {
+		if (Heap.Heap) {
+			Backend->DestroyHeap(Heap.Heap);
+		}
+	}
+}
+
+FHeapAllocation FHeapSuballocator::Allocate(u64 Size, u64 Alignment) {
+	FHeapAllocation Allocation;
+	Alignment = eastl::max(Alignment, HEAP_PLACEMENT_ALIGNMENT);
+
+	u32 HeapIndex = 0;
+	bool bFound = false;
+	for (; HeapIndex < Heaps.size() && !bFound; ++HeapIndex) {
+		bFound = Heaps[HeapIndex].Heap && Heaps[HeapIndex].Ranges.Allocate(Size, Alignment, &Allocation.Block, &Allocation.Offset);
+	}
+
+	if (bFound) {
+		HeapIndex--;
+	}
+	else {
+		// dedicated heap covers alignment slack and list rounding, exact size would not be found by the search
+		u64 Bytes = eastl::max(HeapSize, FTLSFRangeAllocator::GetFitSize(Size, Alignment, HEAP_PLACEMENT_ALIGNMENT));
+		void * Heap = Backend->CreateHeap(Bytes);
+		if (!Heap) {
+			return FHeapAllocation();
+		}
+		HeapIndex = 0;
+		while (HeapIndex < Heaps.size() && Heaps[HeapIndex].Heap) {
+			HeapIndex++;
+		}
+		if (HeapIndex == Heaps.size()) {
+			Heaps.push_back();
+		}
+		Heaps[HeapIndex].Heap = Heap;
+		Heaps[HeapIndex].Ranges.Init(Bytes, HEAP_PLACEMENT_ALIGNMENT);
+		Heaps[HeapIndex].HighWaterMark = 0;
+		bFound = Heaps[HeapIndex].Ranges.Allocate(Size, Alignment, &Allocation.Block, &Allocation.Offset);
+		check(bFound);
+	}
+
+	FHeap & Heap = Heaps[HeapIndex];
+	Allocation.Heap = Heap.Heap;
+	Allocation.HeapIndex = HeapIndex;
+	Allocation.Size = (Size + HEAP_PLACEMENT_ALIGNMENT - 1) / HEAP_PLACEMENT_ALIGNMENT * HEAP_PLACEMENT_ALIGNMENT;
+	Allocation.bAliased = Allocation.Offset < Heap.HighWaterMark;
+	Heap.HighWaterMark = eastl::max(Heap.HighWaterMark, Allocation.Offset + Allocation.Size);
+	AllocatedBytes += Allocation.Size;
+	return Allocation;
+}
+
+void FHeapSuballocator::Free(FHeapAllocation const& Allocation) {
+	check(Allocation.IsValid() && Heaps[Allocation.HeapIndex].Heap == Allocation.Heap);
+	Heaps[Allocation.HeapIndex].Ranges.Free(Allocation.Block);
+	AllocatedBytes -= Allocation.Size;
+}
+
+u32 FHeapSuballocator::ReleaseEmptyHeaps() {
+	u32 ReleasedNum = 0;
+	for (FHeap & Heap : Heaps) {
+		if (Heap.Heap && Heap.Ranges.IsEmpty()) {
+			Backend->DestroyHeap(Heap.Heap);
+			Heap.Heap = nullptr;
+			ReleasedNum++;
+		}
+	}
+	return ReleasedNum;
+}
+
+FHeapStats FHeapSuballocator::GetStats() const {
+	FHeapStats Stats = {};
+	for (FHeap const& Heap : Heaps) {
+		if (Heap.Heap) {
+			Stats.HeapsNum++;
+			Stats.HeapsBytes += Heap.Ranges.GetSize();
+			Stats.FreeBytes += Heap.Ranges.GetFreeSize();
+			Stats.LargestFreeBytes = eastl::max(Stats.LargestFreeBytes, Heap.Ranges.GetLargestFreeSize());
+			Stats.FreeBlocksNum += Heap.Ranges.GetFreeBlocksNum();
+		}
+	}
+	Stats.AllocatedBytes = AllocatedBytes;
+	return Stats;
+}
+
+/////////////////////////////////////////
+
+// sorted free ranges scanned from the start, what placement without size classes costs
+class FFirstFitRanges {
+public:
+	struct FRange {
+		u64 Offset;
+		u64 Size;
+	};
+	eastl::vector<FRange> FreeRanges;
+
+	explicit FFirstFitRanges(u64 Size) {
+		FreeRanges.push_back({ 0, Size });
+	}
+
+	bool Allocate(u64 Size, u64 Alignment, u64 * OutOffset) {
+		for (u32 Index = 0; Index < FreeRanges.size(); ++Index) {
+			FRange Range = FreeRanges[Index];
+			u64 Aligned = (Range.Offset + Alignment - 1) / Alignment * Alignment;
+			if (Aligned + Size > Range.Offset + Range.Size) {
+				continue;
+			}
+			FreeRanges.erase(FreeRanges.begin() + Index);
+			if (Aligned + Size < Range.Offset + Range.Size) {
+				FreeRanges.insert(FreeRanges.begin() + Index, FRange{ Aligned + Size, Range.Offset + Range.Size - Aligned - Size });
+			}
+			if (Aligned > Range.Offset) {
+				FreeRanges.insert(FreeRanges.begin() + Index, FRange{ Range.Offset, Aligned - Range.Offset });
+			}
+			*OutOffset = Aligned;
+			return true;
+		}
+		return false;
+	}
+
+	void Free(u64 Offset, u64 Size) {
+		u32 Index = (u32)(eastl::lower_bound(FreeRanges.begin(), FreeRanges.end(), Offset, [](FRange const& Range, u64 Value) { return Range.Offset < Value; }) - FreeRanges.begin());
+		FreeRanges.insert(FreeRanges.begin() + Index, FRange{ Offset, Size });
+		if (Index + 1 < FreeRanges.size() && Offset + Size == FreeRanges[Index + 1].Offset) {
+			FreeRanges[Index].Size += FreeRanges[Index + 1].Size;
+			FreeRanges.erase(FreeRanges.begin() + Index + 1);
+		}
+		if (Index > 0 && FreeRanges[Index - 1].Offset + FreeRanges[Index - 1].Size == Offset) {
+			FreeRanges[Index - 1].Size += FreeRanges[Index].Size;
+			FreeRanges.erase(FreeRanges.begin() + Index);
+		}
+	}
+
+	u64 GetLargestFreeSize() const {
+		u64 Largest = 0;
+		for (FRange const& Range : FreeRanges) {
+			Largest = eastl::max(Largest, Range.Size);
+		}
+		return Largest;
+	}
+};
+
+void BenchmarkHeapAllocator() {
+	const u64 MB = 1024 * 1024;
+
+	// random churn over one 2GB range: log-uniform sizes 64KB-32MB, every 8th needs msaa alignment
+	{
+		const u64 RangeSize = 2048 * MB;
+		const u32 OpsNum = 200000;
+		const u32 LiveTarget = 192;
+
+		// free ops pick index into list of live allocations, both allocators see the same sequence
+		struct FOp {
+			u64		Size;
+			u64		Alignment;
+			u32		FreeIndex;
+			bool	bFree;
+		};
+		eastl::vector<FOp> Ops(OpsNum);
+		std::mt19937 Rng(OpsNum);
+		std::uniform_real_distribution<float> LogSize(16.f, 25.f);
+		u32 LiveNum = 0;
+		for (FOp & Op : Ops) {
+			Op.bFree = LiveNum > 0 && (LiveNum >= LiveTarget * 2 || Rng() % 2 == 0);
+			if (Op.bFree) {
+				Op.FreeIndex = Rng() % LiveNum;
+				LiveNum--;
+			}
+			else {
+				Op.Size = ((u64)exp2f(LogSize(Rng)) + HEAP_PLACEMENT_ALIGNMENT - 1) / HEAP_PLACEMENT_ALIGNMENT * HEAP_PLACEMENT_ALIGNMENT;
+				Op.Alignment = Rng() % 8 == 0 ? 4 * MB : HEAP_PLACEMENT_ALIGNMENT;
+				LiveNum++;
+			}
+		}
+
+		// failed allocation keeps its place in live list with zero size, so later frees line up
+		struct FLive {
+			u64		Offset;
+			u64		Size;
+			u32		Block;
+		};
+		eastl::vector<FLive> Live;
+		Live.reserve(LiveTarget * 2);
+
+		// validated run checks every placement against live ranges, timed run only allocates
+		u32 Errors = 0;
+		u32 TLSFFailed = 0;
+		double TLSFMs = 1e9;
+		FTLSFRangeAllocator TLSF;
+		for (u32 Run = 0; Run < 4; ++Run) {
+			const bool bValidate = Run == 0;
+			eastl::map<u64, u64> LiveRanges;
+			TLSF.Init(RangeSize, HEAP_PLACEMENT_ALIGNMENT);
+			Live.clear();
+			TLSFFailed = 0;
+			i64 StartTicks = GetCpuTicks();
+			for (FOp const& Op : Ops) {
+				if (Op.bFree) {
+					FLive Allocation = Live[Op.FreeIndex];
+					if (Allocation.Size) {
+						TLSF.Free(Allocation.Block);
+						if (bValidate) {
+							LiveRanges.erase(Allocation.Offset);
+						}
+					}
+					Live[Op.FreeIndex] = Live.back();
+					Live.pop_back();
+					continue;
+				}
+				FLive Allocation = { 0, Op.Size, 0 };
+				if (!TLSF.Allocate(Op.Size, Op.Alignment, &Allocation.Block, &Allocation.Offset)) {
+					Allocation.Size = 0;
+					TLSFFailed++;
+				}
+				else if (bValidate) {
+					Errors += Allocation.Offset % Op.Alignment != 0 || Allocation.Offset + Allocation.Size > RangeSize;
+					auto Next = LiveRanges.lower_bound(Allocation.Offset);
+					Errors += Next != LiveRanges.end() && Next->first < Allocation.Offset + Allocation.Size;
+					Errors += Next != LiveRanges.begin() && eastl::prev(Next)->second > Allocation.Offset;
+					LiveRanges[Allocation.Offset] = Allocation.Offset + Allocation.Size;
+				}
+				Live.push_back(Allocation);
+			}
+			if (!bValidate) {
+				TLSFMs = eastl::min(TLSFMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+			}
+		}
+		u64 LiveBytes = 0;
+		for (FLive const& Allocation : Live) {
+			LiveBytes += Allocation.Size;
+		}
+		Errors += TLSF.GetFreeSize() != RangeSize - LiveBytes;
+
+		// timed like tlsf, first run warms up and best of the rest counts
+		u32 FirstFitFailed = 0;
+		u32 FirstFitFreeRanges = 0;
+		u64 FirstFitLargestFree = 0;
+		double FirstFitMs = 1e9;
+		for (u32 Run = 0; Run < 4; ++Run) {
+			FFirstFitRanges FirstFit(RangeSize);
+			Live.clear();
+			FirstFitFailed = 0;
+			i64 StartTicks = GetCpuTicks();
+			for (FOp const& Op : Ops) {
+				if (Op.bFree) {
+					FLive Allocation = Live[Op.FreeIndex];
+					if (Allocation.Size) {
+						FirstFit.Free(Allocation.Offset, Allocation.Size);
+					}
+					Live[Op.FreeIndex] = Live.back();
+					Live.pop_back();
+					continue;
+				}
+				FLive Allocation = { 0, Op.Size, 0 };
+				if (!FirstFit.Allocate(Op.Size, Op.Alignment, &Allocation.Offset)) {
+					Allocation.Size = 0;
+					FirstFitFailed++;
+				}
+				Live.push_back(Allocation);
+			}
+			if (Run > 0) {
+				FirstFitMs = eastl::min(FirstFitMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+			}
+			FirstFitFreeRanges = (u32)FirstFit.FreeRanges.size();
+			FirstFitLargestFree = FirstFit.GetLargestFreeSize();
+		}
+
+		PrintFormated(L"random churn, %u ops in %u MB: tlsf %.3f ms (%.1f Mops/s), %u failed, %u free blocks, largest free %u MB; first fit %.3f ms (%.1f Mops/s), %u failed, %u free blocks, largest free %u MB; %u errors\n",
+			OpsNum, (u32)(RangeSize / MB),
+			TLSFMs, OpsNum / TLSFMs / 1000., TLSFFailed, TLSF.GetFreeBlocksNum(), (u32)(TLSF.GetLargestFreeSize() / MB),
+			FirstFitMs, OpsNum / FirstFitMs / 1000., FirstFitFailed, FirstFitFreeRanges, (u32)(FirstFitLargestFree / MB),
+			Errors);
+	}
+
+	// render target churn: every frame takes its targets from the cache and gives them back
+	// resolution changes twice, targets of old one idle out and next resolution is placed over their ranges
+	{
+		const u32 FramesNum = 240;
+		const u32 PhaseFrames = 80;
+		const u32 Resolutions[][2] = { { 1920, 1080 }, { 2560, 1440 }, { 1280, 720 } };
+		const u64 MaxIdleFrames = 30;
+
+		struct FTargetDesc {
+			u32 Width;
+			u32 Height;
+			u32 BytesPerPixel;
+		};
+		const FTargetDesc Descs[] = { { 1, 1, 8 }, { 1, 1, 4 }, { 2, 2, 4 }, { 4, 4, 8 }, { 1, 1, 4 }, { 8, 8, 4 } };
+
+		FCpuHeapBackend Backend;
+		FHeapSuballocator Heaps(&Backend, 256 * MB);
+		TPlacedResourceCache<u32> Cache;
+		// desc hash and entry of targets taken this frame
+		eastl::vector<eastl::pair<u64, TPlacedResourceCache<u32>::FEntry>> FrameTargets;
+
+		u32 Placements = 0;
+		u32 SteadyPlacements = 0;
+		u32 AliasedPlacements = 0;
+		u32 CacheHits = 0;
+		u32 Evicted = 0;
+		u32 HeapsReleased = 0;
+		u32 ResourceCounter = 0;
+		double FramesMs = 0;
+		for (u32 Frame = 0; Frame < FramesNum; ++Frame) {
+			u32 Width = Resolutions[Frame / PhaseFrames][0];
+			u32 Height = Resolutions[Frame / PhaseFrames][1];
+
+			i64 StartTicks = GetCpuTicks();
+			for (FTargetDesc const& Desc : Descs) {
+				u32 TargetWidth = Width / Desc.Width;
+				u32 TargetHeight = Height / Desc.Height;
+				u64 DescHash = ((u64)TargetWidth << 40) ^ ((u64)TargetHeight << 16) ^ Desc.BytesPerPixel;
+				TPlacedResourceCache<u32>::FEntry Entry;
+				if (Cache.Acquire(DescHash, &Entry)) {
+					CacheHits++;
+				}
+				else {
+					Entry.Resource = ResourceCounter++;
+					Entry.Allocation = Heaps.Allocate((u64)TargetWidth * TargetHeight * Desc.BytesPerPixel);
+					Placements++;
+					SteadyPlacements += Frame % PhaseFrames > 0 ? 1 : 0;
+					AliasedPlacements += Entry.Allocation.bAliased ? 1 : 0;
+				}
+				FrameTargets.push_back(eastl::make_pair(DescHash, Entry));
+			}
+			for (auto const& Target : FrameTargets) {
+				Cache.Release(Target.first, Target.second.Resource, Target.second.Allocation, Frame);
+			}
+			FrameTargets.clear();
+			Evicted += Cache.Evict(Frame, MaxIdleFrames, [&](TPlacedResourceCache<u32>::FEntry const& Entry) { Heaps.Free(Entry.Allocation); });
+			HeapsReleased += Heaps.ReleaseEmptyHeaps();
+			FramesMs += CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+		}
+
+		FHeapStats Stats = Heaps.GetStats();
+		PrintFormated(L"render target churn, %u frames: %u placements (%u after first frame of a resolution), %u aliased, %u cache hits, %u evicted, %u heaps created, %u released, peak %u MB, now %u heaps %u MB with %u MB in use, %.4f ms/frame\n",
+			FramesNum, Placements, SteadyPlacements, AliasedPlacements, CacheHits, Evicted,
+			Backend.HeapsCreated, HeapsReleased, (u32)(Backend.PeakHeapsBytes / MB),
+			Stats.HeapsNum, (u32)(Stats.HeapsBytes / MB), (u32)(Stats.AllocatedBytes / MB), FramesMs / FramesNum);
+	}
+
+	// requests at and over heap size, with and without msaa alignment, get fresh or dedicated heaps
+	{
+		struct FRequest {
+			u64 Size;
+			u64 Alignment;
+		};
+		const FRequest Requests[] = {
+			{ 256 * MB, HEAP_PLACEMENT_ALIGNMENT }, { 257 * MB, HEAP_PLACEMENT_ALIGNMENT }, { 300 * MB, HEAP_PLACEMENT_ALIGNMENT }, { 1000 * MB, HEAP_PLACEMENT_ALIGNMENT },
+			{ 254 * MB, 4 * MB }, { 256 * MB, 4 * MB }, { 300 * MB, 4 * MB }, { 64 * 1024, 4 * MB },
+		};
+
+		FCpuHeapBackend Backend;
+		FHeapSuballocator Heaps(&Backend, 256 * MB);
+		eastl::vector<FHeapAllocation> Allocations;
+		u32 Errors = 0;
+		for (FRequest const& Request : Requests) {
+			FHeapAllocation Allocation = Heaps.Allocate(Request.Size, Request.Alignment);
+			Errors += !Allocation.IsValid() || Allocation.Offset % Request.Alignment != 0 || Allocation.Size < Request.Size;
+			if (Allocation.IsValid()) {
+				Allocations.push_back(Allocation);
+			}
+		}
+		u32 HeapsCreated = Backend.HeapsCreated;
+		for (FHeapAllocation const& Allocation : Allocations) {
+			Heaps.Free(Allocation);
+		}
+		Heaps.ReleaseEmptyHeaps();
+		Errors += Backend.HeapsNum != 0 || Backend.HeapsBytes != 0;
+
+		PrintFormated(L"large requests, %u over 256 MB heaps: %u heaps created, peak %u MB, %u errors\n",
+			(u32)_countof(Requests), HeapsCreated, (u32)(Backend.PeakHeapsBytes / MB), Errors);
+	}
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/vector.h>
+#include <EASTL/hash_map.h>
+
+// placed resources start at 64KB boundary, msaa ones at 4MB
+const u64 HEAP_PLACEMENT_ALIGNMENT = 64 * 1024;
+
+// source of heap memory, D3D12 heaps in engine, counters in benchmarks
+class FHeapBackend {
+public:
+	virtual ~FHeapBackend() {}
+	// opaque handle, null when out of memory
+	virtual void * CreateHeap(u64 Size) = 0;
+	virtual void DestroyHeap(void * Heap) = 0;
+};
+
+// fake backend, heaps are just numbered, only sizes are tracked
+class FCpuHeapBackend final : public FHeapBackend {
+public:
+	u32 HeapsNum = 0;
+	u32 HeapsCreated = 0;
+	u64 HeapsBytes = 0;
+	u64 PeakHeapsBytes = 0;
+
+	void * CreateHeap(u64 Size) override;
+	void DestroyHeap(void * Heap) override;
+
+private:
+	eastl::hash_map<u64, u64> Sizes;
+	u64 NextHandle = 1;
+};
+
+// two level segregated fit over [0, Size), sizes and offsets are kept in units of granularity
+// allocation and free are O(1): bitmaps find nonempty free list, freed block merges with free physical neighbours
+class FTLSFRangeAllocator {
+public:
+	static const u32 SL_BITS = 4;
+	static const u32 SL_NUM = 1 << SL_BITS;
+	static const u32 FL_NUM = 32 - SL_BITS;
+	static const u32 INVALID_BLOCK = 0xFFFFFFFF;
+
+	void Init(u64 Size, u64 Granularity);
+	// false when no free block fits, out block is needed by Free
+	bool Allocate(u64 Size, u64 Alignment, u32 * OutBlock, u64 * OutOffset);
+	void Free(u32 Block);
+	// range of at least this size fits the request when empty, Allocate only searches lists whose every block fits
+	static u64 GetFitSize(u64 Size, u64 Alignment, u64 Granularity);
+
+	u64 GetSize() const { return TotalUnits * Granularity; }
+	u64 GetFreeSize() const { return FreeUnits * Granularity; }
+	u64 GetLargestFreeSize() const;
+	u32 GetFreeBlocksNum() const { return FreeBlocksNum; }
+	bool IsEmpty() const { return FreeUnits == TotalUnits; }
+
+private:
+	struct FBlock {
+		u64 Offset;
+		u64 Size;
+		u32 PrevPhysical;
+		u32 NextPhysical;
+		u32 PrevFree;
+		u32 NextFree;
+		bool bFree;
+	};
+	eastl::vector<FBlock> Blocks;
+	eastl::vector<u32> UnusedBlocks;
+	u32 FLBitmap = 0;
+	u32 SLBitmaps[FL_NUM] = {};
+	u32 FreeLists[FL_NUM][SL_NUM];
+	u64 Granularity = 0;
+	u64 TotalUnits = 0;
+	u64 FreeUnits = 0;
+	u32 FreeBlocksNum = 0;
+
+	u32 NewBlock(u64 Offset, u64 Size);
+	void InsertFree(u32 Block);
+	void RemoveFree(u32 Block);
+	u32 FindFree(u64 Size) const;
+};
+
+// range of one heap, Heap is backend handle
+struct FHeapAllocation {
+	void *	Heap = nullptr;
+	u32		HeapIndex = 0;
+	u32		Block = 0;
+	u64		Offset = 0;
+	u64		Size = 0;
+	// range overlaps memory earlier allocations used, only counted in stats
+	// ranges are freed once gpu is done with them, so placed resources need no aliasing barrier, just full initialization
+	bool	bAliased = false;
+
+	bool IsValid() const { return Heap != nullptr; }
+};
+
+struct FHeapStats {
+	u32 HeapsNum;
+	u64 HeapsBytes;
+	u64 AllocatedBytes;
+	u64 FreeBytes;
+	u64 LargestFreeBytes;
+	u32 FreeBlocksNum;
+};
+
+// heaps of one kind created on demand and split by TLSF, requests larger than heap size get dedicated heap
+class FHeapSuballocator {
+public:
+	FHeapSuballocator(FHeapBackend * InBackend, u64 InHeapSize);
+	~FHeapSuballocator();
+
+	// invalid allocation when backend is out of memory
+	FHeapAllocation Allocate(u64 Size, u64 Alignment = HEAP_PLACEMENT_ALIGNMENT);
+	void Free(FHeapAllocation const& Allocation);
+	// gives back heaps without allocations, returns their number
+	u32 ReleaseEmptyHeaps();
+	FHeapStats GetStats() const;
+
+private:
+	struct FHeap {
+		void *				Heap;
+		FTLSFRangeAllocator	Ranges;
+		// end of highest range ever allocated, anything below it may hold stale resource
+		u64					HighWaterMark;
+	};
+	FHeapBackend *				Backend;
+	const u64					HeapSize;
+	// released heaps leave null entries, so allocation heap indices stay valid
+	eastl::vector<FHeap>		Heaps;
+	u64							AllocatedBytes = 0;
+};
+
+// released placed resources keep their ranges, next request with the same desc hash takes resource back
+// resources not reused for MaxIdleFrames are evicted and their ranges freed
+template<typename TResource>
+class TPlacedResourceCache {
+public:
+	struct FEntry {
+		TResource			Resource;
+		FHeapAllocation		Allocation;
+		u64					ReleasedFrame;
+	};
+
+	bool Acquire(u64 DescHash, FEntry * OutEntry) {
+		auto Iter = Free.find(DescHash);
+		if (Iter == Free.end() || Iter->second.empty()) {
+			return false;
+		}
+		// most recently released one, its range is warmest
+		*OutEntry = Iter->second.back();
+		Iter->second.pop_back();
+		CachedNum--;
+		return true;
+	}
+
+	void Release(u64 DescHash, TResource Resource, FHeapAllocation const& Allocation, u64 Frame) {
+		Free[DescHash].push_back({ Resource, Allocation, Frame });
+		CachedNum++;
+	}
+
+	template<typename TEvict>
+	u32 Evict(u64 Frame, u64 MaxIdleFrames, TEvict OnEvict) {
+		u32 EvictedNum = 0;
+		for (auto & Pair : Free) {
+			auto & List = Pair.second;
+			u32 Kept = 0;
+			for (FEntry const& Entry : List) {
+				if (Frame - Entry.ReleasedFrame > MaxIdleFrames) {
+					OnEvict(Entry);
+					EvictedNum++;
+				}
+				else {
+					List[Kept++] = Entry;
+				}
+			}
+			List.resize(Kept);
+		}
+		CachedNum -= EvictedNum;
+		return EvictedNum;
+	}
+
+	// every cached resource regardless of its age, before heaps go away
+	template<typename TEvict>
+	u32 EvictAll(TEvict OnEvict) {
+		u32 EvictedNum = 0;
+		for (auto & Pair : Free) {
+			for (FEntry const& Entry : Pair.second) {
+				OnEvict(Entry);
+				EvictedNum++;
+			}
+		}
+		Free.clear();
+		CachedNum = 0;
+		return EvictedNum;
+	}
+
+	u32 GetCachedNum() const { return CachedNum; }
+
+private:
+	eastl::hash_map<u64, eastl::vector<FEntry>> Free;
+	u32 CachedNum = 0;
+};
+
+// TLSF placement against first fit reference on random and render target churn patterns, over fake heaps
+void BenchmarkHeapAllocator();
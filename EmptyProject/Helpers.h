@@ -18,6 +18,22 @@ ScopeExit<F> MakeScopeExit(F f) {
 	return ScopeExit<F>(f);
 };
 
+inline i64 GetCpuTicks() {
+	LARGE_INTEGER Ticks;
+	QueryPerformanceCounter(&Ticks);
+	return Ticks.QuadPart;
+}
+
+inline double CpuTicksToMilliseconds(i64 Ticks) {
+	static i64 Frequency;
+	if (!Frequency) {
+		LARGE_INTEGER Freq;
+		QueryPerformanceFrequency(&Freq);
+		Frequency = Freq.QuadPart;
+	}
+	return (double)Ticks * 1000.0 / (double)Frequency;
+}
+
 #define STRING_JOIN2(arg1, arg2) DO_STRING_JOIN2(arg1, arg2)
 #define DO_STRING_JOIN2(arg1, arg2) arg1 ## arg2
 #define SCOPE_EXIT(code) \
@@ -26,7 +42,7 @@ ScopeExit<F> MakeScopeExit(F f) {
 #include <EASTL/vector.h>
 
 template<typename T>
-void RemoveSwap(eastl::vector<T> Container, u64 Index) {
+void RemoveSwap(eastl::vector<T> & Container, u64 Index) {
 	if (Index != Container.size() - 1) {
 		eastl::swap(Container[Container.size() - 1], Container[Index]);
 	}
@@ -0,0 +1,307 @@
+#include "LinearAllocator.h"
+#include "AssertionMacros.h"
+#include "Print.h"
+#include "Tasks.h"
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <random>
+
+FConcurrentLinearAllocator::FConcurrentLinearAllocator(FLinearBlockBackend * InBackend, u64 InBlockSize, u32 ThreadsNum) :
+	Backend(InBackend), BlockSize(InBlockSize), Cursors(ThreadsNum)
+{
+	check(BlockSize >= SUB_BLOCK_SIZE && BlockSize % SUB_BLOCK_SIZE == 0);
+}
+
+FConcurrentLinearAllocator::~FConcurrentLinearAllocator() {
+	for (auto & Block : Blocks) {
+		Backend->DestroyBlock(Block.get());
+	}
+}
+
+FLinearAllocation FConcurrentLinearAllocator::Allocate(u32 ThreadIndex, u64 Size, u64 Alignment, bool bView) {
+	check(ThreadIndex < Cursors.size());
+	check(Size > 0 && Size <= BlockSize);
+	// one reservation per sub-block, bigger ranges would not fit backend view ranges
+	check(!bView || Size <= SUB_BLOCK_SIZE);
+	if (bView) {
+		Alignment = eastl::max(Alignment, VIEW_GRANULARITY);
+	}
+	check(Alignment <= SUB_BLOCK_SIZE);
+
+	FThreadCursor & Cursor = Cursors[ThreadIndex];
+	u64 Offset = (Cursor.Offset + Alignment - 1) & ~(Alignment - 1);
+	if (!Cursor.Block || Offset + Size > Cursor.End) {
+		Refill(Cursor, Size);
+		// sub-blocks start at SUB_BLOCK_SIZE multiples
+		Offset = Cursor.Offset;
+	}
+	Cursor.Offset = Offset + Size;
+
+	if (bView && Cursor.Views == INVALID_VIEW) {
+		std::lock_guard<std::mutex> Guard(Lock);
+		Cursor.Views = Backend->ReserveViews((u32)((Cursor.End - Cursor.SubBlockBegin) / VIEW_GRANULARITY));
+		ViewRangesNum.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	FLinearAllocation Result;
+	Result.Block = Cursor.Block;
+	Result.Offset = Offset;
+	Result.CPUPtr = Cursor.Block->CPUPtr + Offset;
+	Result.GPUAddress = Cursor.Block->GPUAddress + Offset;
+	Result.View = bView ? Cursor.Views + (u32)((Offset - Cursor.SubBlockBegin) / VIEW_GRANULARITY) : INVALID_VIEW;
+	return Result;
+}
+
+void FConcurrentLinearAllocator::Refill(FThreadCursor & Cursor, u64 Size) {
+	// rest of old sub-block is dropped, big requests get sub-block of their own size
+	const u64 Chunk = (Size + SUB_BLOCK_SIZE - 1) & ~(SUB_BLOCK_SIZE - 1);
+
+	FLinearBlock * Block = Current.load(std::memory_order_acquire);
+	while (1) {
+		if (Block) {
+			// exhausted block keeps getting bumped past its end until it is replaced, nothing reads that
+			u64 Begin = Block->Carved.fetch_add(Chunk, std::memory_order_relaxed);
+			if (Begin + Chunk <= BlockSize) {
+				Cursor.Block = Block;
+				Cursor.SubBlockBegin = Begin;
+				Cursor.Offset = Begin;
+				Cursor.End = Begin + Chunk;
+				Cursor.Views = INVALID_VIEW;
+				SubBlocksNum.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+		Block = NextBlock(Block);
+	}
+}
+
+FLinearBlock * FConcurrentLinearAllocator::NextBlock(FLinearBlock * Exhausted) {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	// someone else replaced it while we waited
+	FLinearBlock * Block = Current.load(std::memory_order_relaxed);
+	if (Block != Exhausted) {
+		return Block;
+	}
+
+	if (ReadyBlocks.size()) {
+		Block = ReadyBlocks.back();
+		ReadyBlocks.pop_back();
+	}
+	else {
+		Blocks.push_back(eastl::make_unique<FLinearBlock>());
+		Block = Blocks.back().get();
+		Backend->CreateBlock(BlockSize, Block);
+	}
+	Block->Carved.store(0, std::memory_order_relaxed);
+	FrameBlocks.push_back(Block);
+	Current.store(Block, std::memory_order_release);
+	return Block;
+}
+
+void FConcurrentLinearAllocator::CloseFrame(eastl::vector<FLinearBlock*> & OutBlocks) {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	Current.store(nullptr, std::memory_order_relaxed);
+	OutBlocks.insert(OutBlocks.end(), FrameBlocks.begin(), FrameBlocks.end());
+	FrameBlocks.clear();
+	for (FThreadCursor & Cursor : Cursors) {
+		Cursor = FThreadCursor();
+	}
+}
+
+void FConcurrentLinearAllocator::ReturnBlock(FLinearBlock * Block) {
+	std::lock_guard<std::mutex> Guard(Lock);
+	ReadyBlocks.push_back(Block);
+}
+
+FLinearAllocatorStats FConcurrentLinearAllocator::GetStats() const {
+	FLinearAllocatorStats Stats;
+	Stats.BlocksNum = (u32)Blocks.size();
+	Stats.FrameBlocksNum = (u32)FrameBlocks.size();
+	Stats.SubBlocksNum = SubBlocksNum.load(std::memory_order_relaxed);
+	Stats.ViewRangesNum = ViewRangesNum.load(std::memory_order_relaxed);
+	return Stats;
+}
+
+/////////////////////////////////////////
+
+// blocks are plain memory, gpu addresses are made up, views are just counted
+class FCpuLinearBlockBackend final : public FLinearBlockBackend {
+public:
+	u32 BlocksCreated = 0;
+	u32 ViewsReserved = 0;
+
+	void CreateBlock(u64 Size, FLinearBlock * OutBlock) override {
+		OutBlock->CPUPtr = new u8[Size];
+		OutBlock->GPUAddress = (u64)++BlocksCreated << 32;
+	}
+	void DestroyBlock(FLinearBlock * Block) override {
+		delete[] Block->CPUPtr;
+	}
+	u32 ReserveViews(u32 Num) override {
+		u32 First = ViewsReserved;
+		ViewsReserved += Num;
+		return First;
+	}
+};
+
+// what allocator did before: shared bump pointer and one view per allocation, everything under one lock
+class FLockedLinearAllocator {
+public:
+	FLockedLinearAllocator(FLinearBlockBackend * InBackend, u64 InBlockSize) : Backend(InBackend), BlockSize(InBlockSize) {}
+	~FLockedLinearAllocator() {
+		for (auto & Block : Blocks) {
+			Backend->DestroyBlock(Block.get());
+		}
+	}
+
+	FLinearAllocation Allocate(u64 Size, u64 Alignment) {
+		std::lock_guard<std::mutex> Guard(Lock);
+		u64 Offset = (CurrentOffset + Alignment - 1) & ~(Alignment - 1);
+		if (CurrentIndex == Blocks.size() || Offset + Size > BlockSize) {
+			if (CurrentIndex < Blocks.size()) {
+				++CurrentIndex;
+			}
+			if (CurrentIndex == Blocks.size()) {
+				Blocks.push_back(eastl::make_unique<FLinearBlock>());
+				Backend->CreateBlock(BlockSize, Blocks.back().get());
+			}
+			Offset = 0;
+		}
+		CurrentOffset = Offset + Size;
+
+		FLinearBlock * Block = Blocks[CurrentIndex].get();
+		FLinearAllocation Result;
+		Result.Block = Block;
+		Result.Offset = Offset;
+		Result.CPUPtr = Block->CPUPtr + Offset;
+		Result.GPUAddress = Block->GPUAddress + Offset;
+		Result.View = Backend->ReserveViews(1);
+		return Result;
+	}
+
+	void CloseFrame() {
+		CurrentIndex = 0;
+		CurrentOffset = 0;
+	}
+
+private:
+	FLinearBlockBackend *							Backend;
+	const u64										BlockSize;
+	std::mutex										Lock;
+	eastl::vector<eastl::unique_ptr<FLinearBlock>>	Blocks;
+	u32												CurrentIndex = 0;
+	u64												CurrentOffset = 0;
+};
+
+void BenchmarkConstantsAllocator() {
+	const u64 BlockSize = 1024 * 1024;
+	const u32 AllocationsPerThread = 8192;
+	const u32 RunsNum = 4;
+	const u32 ThreadsCounts[] = { 1, 2, 4, 8, 16, 32 };
+
+	// constant buffer sizes seen when recording draws: mostly small, some big material and skinning blocks
+	const u32 MaxThreads = 32;
+	eastl::vector<eastl::vector<u32>> Sizes(MaxThreads);
+	for (u32 Thread = 0; Thread < MaxThreads; ++Thread) {
+		std::mt19937 Rng(Thread);
+		Sizes[Thread].resize(AllocationsPerThread);
+		for (u32 & Size : Sizes[Thread]) {
+			u32 Pick = Rng() % 16;
+			Size = Pick < 10 ? 64 + Rng() % 192 : (Pick < 15 ? 256 + Rng() % 768 : 4096 + Rng() % 12288);
+		}
+	}
+
+	eastl::vector<eastl::vector<FLinearAllocation>> Allocations(MaxThreads);
+	for (auto & List : Allocations) {
+		List.resize(AllocationsPerThread);
+	}
+
+	for (u32 ThreadsNum : ThreadsCounts) {
+		u32 Errors = 0;
+
+		// first run is validated, every run is a frame: blocks go back before next one
+		FCpuLinearBlockBackend Backend;
+		FConcurrentLinearAllocator Allocator(&Backend, BlockSize, ThreadsNum);
+		eastl::vector<FLinearBlock*> UsedBlocks;
+		double ConcurrentMs = 1e9;
+		for (u32 Run = 0; Run < RunsNum; ++Run) {
+			double Ms = RunOnThreads(ThreadsNum, [&](u32 Thread) {
+				for (u32 Index = 0; Index < AllocationsPerThread; ++Index) {
+					u32 Size = Sizes[Thread][Index];
+					FLinearAllocation Allocation = Allocator.Allocate(Thread, Size, 256, true);
+					memset(Allocation.CPUPtr, Thread, Size);
+					Allocations[Thread][Index] = Allocation;
+				}
+			});
+			ConcurrentMs = eastl::min(ConcurrentMs, Ms);
+
+			if (Run == 0) {
+				struct FRange {
+					FLinearBlock *	Block;
+					u64				Begin;
+					u64				End;
+					u32				Thread;
+				};
+				eastl::vector<FRange> Ranges;
+				eastl::vector<u32> Views;
+				for (u32 Thread = 0; Thread < ThreadsNum; ++Thread) {
+					for (u32 Index = 0; Index < AllocationsPerThread; ++Index) {
+						FLinearAllocation const& Allocation = Allocations[Thread][Index];
+						u8 const* Data = (u8 const*)Allocation.CPUPtr;
+						u32 Size = Sizes[Thread][Index];
+						Errors += Allocation.Offset % 256 != 0 || Allocation.Offset + Size > BlockSize;
+						Errors += Allocation.GPUAddress != Allocation.Block->GPUAddress + Allocation.Offset;
+						// other thread writing over it would leave its index behind
+						Errors += Data[0] != (u8)Thread || Data[Size - 1] != (u8)Thread;
+						Ranges.push_back({ Allocation.Block, Allocation.Offset, Allocation.Offset + Size, Thread });
+						Views.push_back(Allocation.View);
+					}
+				}
+				eastl::sort(Ranges.begin(), Ranges.end(), [](FRange const& A, FRange const& B) {
+					return A.Block != B.Block ? A.Block < B.Block : A.Begin < B.Begin;
+				});
+				for (u32 Index = 1; Index < Ranges.size(); ++Index) {
+					Errors += Ranges[Index].Block == Ranges[Index - 1].Block && Ranges[Index].Begin < Ranges[Index - 1].End;
+				}
+				eastl::sort(Views.begin(), Views.end());
+				for (u32 Index = 1; Index < Views.size(); ++Index) {
+					Errors += Views[Index] == Views[Index - 1];
+				}
+				Errors += Views.back() >= Backend.ViewsReserved;
+			}
+
+			UsedBlocks.clear();
+			Allocator.CloseFrame(UsedBlocks);
+			for (FLinearBlock * Block : UsedBlocks) {
+				Allocator.ReturnBlock(Block);
+			}
+		}
+		FLinearAllocatorStats Stats = Allocator.GetStats();
+		// recycled blocks cover every frame after first
+		Errors += Stats.BlocksNum != Backend.BlocksCreated || Stats.FrameBlocksNum != 0;
+
+		FCpuLinearBlockBackend LockedBackend;
+		FLockedLinearAllocator Locked(&LockedBackend, BlockSize);
+		double LockedMs = 1e9;
+		for (u32 Run = 0; Run < RunsNum; ++Run) {
+			double Ms = RunOnThreads(ThreadsNum, [&](u32 Thread) {
+				for (u32 Index = 0; Index < AllocationsPerThread; ++Index) {
+					u32 Size = Sizes[Thread][Index];
+					FLinearAllocation Allocation = Locked.Allocate(Size, 256);
+					memset(Allocation.CPUPtr, Thread, Size);
+				}
+			});
+			LockedMs = eastl::min(LockedMs, Ms);
+			Locked.CloseFrame();
+		}
+
+		const u32 AllocationsNum = ThreadsNum * AllocationsPerThread;
+		PrintFormated(L"%2u threads, %u allocations: sub-blocks %.3f ms (%.1f Mallocs/s), %u blocks, %u shared block bumps and %u view reservations per frame; locked %.3f ms (%.1f Mallocs/s), %u views; %.2fx, %u errors\n",
+			ThreadsNum, AllocationsNum,
+			ConcurrentMs, AllocationsNum / ConcurrentMs / 1000., Stats.BlocksNum, Stats.SubBlocksNum / RunsNum, Stats.ViewRangesNum / RunsNum,
+			LockedMs, AllocationsNum / LockedMs / 1000., LockedBackend.ViewsReserved / RunsNum,
+			LockedMs / ConcurrentMs, Errors);
+	}
+}
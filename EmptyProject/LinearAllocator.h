@@ -0,0 +1,91 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/vector.h>
+#include <EASTL/unique_ptr.h>
+#include <atomic>
+#include <mutex>
+
+// upload memory block, threads carve sub-blocks out of it by bumping Carved
+struct FLinearBlock {
+	void *				Handle = nullptr;
+	u8 *				CPUPtr = nullptr;
+	u64					GPUAddress = 0;
+	std::atomic<u64>	Carved{ 0 };
+};
+
+// source of blocks and view slots, upload buffers and descriptor heap in engine, malloc and counters in benchmarks
+// called only under allocator lock
+class FLinearBlockBackend {
+public:
+	virtual ~FLinearBlockBackend() {}
+	virtual void CreateBlock(u64 Size, FLinearBlock * OutBlock) = 0;
+	virtual void DestroyBlock(FLinearBlock * Block) = 0;
+	// first of Num contiguous view slots, live until end of frame
+	virtual u32 ReserveViews(u32 Num) = 0;
+};
+
+struct FLinearAllocation {
+	FLinearBlock *	Block;
+	u64				Offset;
+	void *			CPUPtr;
+	u64				GPUAddress;
+	// view slot from backend, INVALID_VIEW when no view was asked for
+	u32				View;
+};
+
+struct FLinearAllocatorStats {
+	u32 BlocksNum;
+	u32 FrameBlocksNum;
+	u32 SubBlocksNum;
+	u32 ViewRangesNum;
+};
+
+// every thread bumps inside its own sub-block, only refill touches shared block with one fetch-add
+// lock is taken when shared block runs out or sub-block needs view slots, once per SUB_BLOCK_SIZE bytes at most
+// view slot of allocation is its offset in sub-block / VIEW_GRANULARITY, so one reservation covers whole sub-block
+class FConcurrentLinearAllocator {
+public:
+	static const u64 SUB_BLOCK_SIZE = 64 * 1024;
+	static const u64 VIEW_GRANULARITY = 256;
+	static const u32 INVALID_VIEW = 0xFFFFFFFF;
+
+	FConcurrentLinearAllocator(FLinearBlockBackend * InBackend, u64 InBlockSize, u32 ThreadsNum);
+	~FConcurrentLinearAllocator();
+
+	// thread safe as long as ThreadIndex is unique among allocating threads
+	// with bView alignment is raised to VIEW_GRANULARITY
+	FLinearAllocation Allocate(u32 ThreadIndex, u64 Size, u64 Alignment, bool bView);
+	// no Allocate can run concurrently, blocks used since last call go to OutBlocks until they are given back
+	void CloseFrame(eastl::vector<FLinearBlock*> & OutBlocks);
+	void ReturnBlock(FLinearBlock * Block);
+
+	u64 GetBlockSize() const { return BlockSize; }
+	FLinearAllocatorStats GetStats() const;
+
+private:
+	// padded so cursors of different threads never share cache line
+	struct alignas(64) FThreadCursor {
+		FLinearBlock *	Block = nullptr;
+		u64				SubBlockBegin = 0;
+		u64				Offset = 0;
+		u64				End = 0;
+		u32				Views = INVALID_VIEW;
+	};
+
+	FLinearBlockBackend *						Backend;
+	const u64									BlockSize;
+	eastl::vector<FThreadCursor>				Cursors;
+	std::atomic<FLinearBlock*>					Current{ nullptr };
+	std::mutex									Lock;
+	eastl::vector<eastl::unique_ptr<FLinearBlock>>	Blocks;
+	eastl::vector<FLinearBlock*>				FrameBlocks;
+	eastl::vector<FLinearBlock*>				ReadyBlocks;
+	std::atomic<u32>							SubBlocksNum{ 0 };
+	std::atomic<u32>							ViewRangesNum{ 0 };
+
+	void Refill(FThreadCursor & Cursor, u64 Size);
+	FLinearBlock * NextBlock(FLinearBlock * Exhausted);
+};
+
+// per-thread sub-blocks against one mutex guarded bump pointer, 1 to 32 threads over fake blocks
+void BenchmarkConstantsAllocator();
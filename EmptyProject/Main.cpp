@@ -91,9 +91,10 @@ void FApplicationImpl::Shutdown() {
 #include "RenderNodes.h"
 
 #include "Scene.h"
+#include "CaptureContext.h"
 
 FScene Scene;
-FSceneActorRef Actor;
+FSceneActorHandle Actor;
 FSceneRenderContext SceneRenderContext;
 
 void InitScene() {
@@ -106,10 +107,8 @@ FGPUResourceRef RenderSceneToTexture(FCommandsStream & CmdStream, FSceneRenderCo
 FGPUResourceRef Texture;
 
 void InitGraph() {
-	FGPUContext Context;
-	Context.Open(EContextType::DIRECT);
-	Texture = LoadDdsTexture(L"Textures/checker.dds", true, Context);
-	Context.ExecuteImmediately();
+	Texture = LoadDdsTexture(L"Textures/checker.dds", true);
+	GetUploadQueue()->Flush();
 
 	InitScene();
 }
@@ -144,6 +143,7 @@ void TestGraph() {
 	Context.Open(EContextType::DIRECT);
 
 	CmdStream.Close();
+	CmdStream.Compact();
 	Playback(Context, &CmdStream);
 	Context.Execute();
 }
@@ -181,7 +181,85 @@ bool FApplicationImpl::Update() {
 	return true;
 }
 
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int nCmdShow) {
+#include "BVH.h"
+#include "BVH4.h"
+#include "BVHQuantized.h"
+#include "SceneCulling.h"
+#include "RenderSort.h"
+#include "Print.h"
+#include "HeapAllocator.h"
+#include "LinearAllocator.h"
+#include "DescriptorRanges.h"
+#include "UploadRing.h"
+
+// "-benchmark=<name>" runs headless, before any window or device is created
+bool RunBenchmark(const char * CmdLine) {
+	const char * Arg = strstr(CmdLine, "-benchmark=");
+	if (!Arg) {
+		return false;
+	}
+	Arg += strlen("-benchmark=");
+	eastl::string Name(Arg, Arg + strcspn(Arg, " "));
+
+	if (Name == "bvh_build") {
+		BenchmarkBVHBuild(L"Models/");
+	}
+	else if (Name == "bvh_traversal") {
+		BenchmarkBVHTraversal(L"Models/");
+	}
+	else if (Name == "bvh_refit") {
+		BenchmarkBVHRefit(L"Models/");
+	}
+	else if (Name == "bvh_quantized") {
+		BenchmarkBVHQuantized(L"Models/");
+	}
+	else if (Name == "culling") {
+		BenchmarkCulling();
+	}
+	else if (Name == "render_sort") {
+		BenchmarkRenderSort();
+	}
+	else if (Name == "commands_recording") {
+		BenchmarkCommandsRecording();
+	}
+	else if (Name == "playback") {
+		BenchmarkPlayback();
+	}
+	else if (Name == "barrier_solver") {
+		BenchmarkBarrierSolver();
+	}
+	else if (Name == "stream_compaction") {
+		BenchmarkStreamCompaction();
+	}
+	else if (Name == "bundles") {
+		BenchmarkBundles();
+	}
+	else if (Name == "heap_allocator") {
+		BenchmarkHeapAllocator();
+	}
+	else if (Name == "transient_aliasing") {
+		BenchmarkTransientAliasing();
+	}
+	else if (Name == "constants_allocator") {
+		BenchmarkConstantsAllocator();
+	}
+	else if (Name == "descriptor_allocator") {
+		BenchmarkDescriptorAllocator();
+	}
+	else if (Name == "upload_ring") {
+		BenchmarkUploadRing();
+	}
+	else {
+		PrintFormated(L"Unknown benchmark %s\n", ConvertToWString(Name).c_str());
+	}
+	return true;
+}
+
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int nCmdShow) {
+	if (RunBenchmark(lpCmdLine)) {
+		return 0;
+	}
+
 	FApplicationImpl SampleApp(L"Essence2", 1024, 768);
 	return Win32::Run(&SampleApp, hInstance, nCmdShow);
 }
@@ -29,7 +29,7 @@ float3 FBBox::GetExtent() const {
 
 float FBBox::SurfaceArea() const {
 	float3 E = VMax - VMin;
-	return E.x * E.y * E.z;
+	return 2.f * (E.x * E.y + E.y * E.z + E.z * E.x);
 }
 
 FBBox CreateInvalidBBox() {
@@ -46,7 +46,65 @@ bool Intersects(FRayInv const & Ray, FBBox const& BBox) {
 	float TEnter = eastl::max(TMin.x, eastl::max(TMin.y, TMin.z));
 	float TExit = eastl::min(TMax.x, eastl::min(TMax.y, TMax.z));
 
-	return TExit > eastl::max(TEnter, 0);
+	return TExit >= eastl::max(TEnter, 0.f);
+}
+
+bool Intersects(FRayInv const & Ray, FBBox const& BBox, float MaxT) {
+	float3 T0 = (BBox.VMin - Ray.Origin) * Ray.InvDirection;
+	float3 T1 = (BBox.VMax - Ray.Origin) * Ray.InvDirection;
+
+	float3 TMin = min(T0, T1);
+	float3 TMax = max(T0, T1);
+
+	float TEnter = eastl::max(TMin.x, eastl::max(TMin.y, TMin.z));
+	float TExit = eastl::min(TMax.x, eastl::min(TMax.y, TMax.z));
+
+	return eastl::min(TExit, MaxT) >= eastl::max(TEnter, 0.f);
+}
+
+bool Intersects(FBBox const& A, FBBox const& B) {
+	return A.VMin.x <= B.VMax.x && A.VMax.x >= B.VMin.x
+		&& A.VMin.y <= B.VMax.y && A.VMax.y >= B.VMin.y
+		&& A.VMin.z <= B.VMax.z && A.VMax.z >= B.VMin.z;
+}
+
+bool Intersects(FFrustum const& Frustum, FBBox const& BBox) {
+	for (u32 Index = 0; Index < 6; ++Index) {
+		float4 Plane = Frustum.Planes[Index];
+		// corner furthest along plane normal
+		float3 P = float3(
+			Plane.x >= 0 ? BBox.VMax.x : BBox.VMin.x,
+			Plane.y >= 0 ? BBox.VMax.y : BBox.VMin.y,
+			Plane.z >= 0 ? BBox.VMax.z : BBox.VMin.z);
+		if (Plane.x * P.x + Plane.y * P.y + Plane.z * P.z + Plane.w < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+FFrustum CreateFrustum(float4x4 const& ViewProjection) {
+	auto Column = [&ViewProjection](u32 Index) {
+		return float4(ViewProjection.data[0][Index], ViewProjection.data[1][Index], ViewProjection.data[2][Index], ViewProjection.data[3][Index]);
+	};
+	float4 C0 = Column(0);
+	float4 C1 = Column(1);
+	float4 C2 = Column(2);
+	float4 C3 = Column(3);
+
+	FFrustum Frustum;
+	Frustum.Planes[0] = C3 + C0;
+	Frustum.Planes[1] = C3 - C0;
+	Frustum.Planes[2] = C3 + C1;
+	Frustum.Planes[3] = C3 - C1;
+	Frustum.Planes[4] = C2;
+	Frustum.Planes[5] = C3 - C2;
+
+	for (u32 Index = 0; Index < 6; ++Index) {
+		float Length = length(Frustum.Planes[Index].xyz);
+		Frustum.Planes[Index] = Frustum.Planes[Index] / Length;
+	}
+	return Frustum;
 }
 
 float RayTriangleIntersection(FRay Ray, float3 p0, float3 p1, float3 p2) {
@@ -2,6 +2,7 @@
 #include "Essence.h"
 #include "MathVector.h"
 #include "MathFunctions.h"
+#include "MathMatrix.h"
 
 #include <limits>
 
@@ -49,7 +50,20 @@ struct FBBoxCentroid {
 	explicit FBBoxCentroid(FBBox const & BBox) : FBBoxCentroid(BBox.GetCentroid(), BBox.GetExtent()) {}
 };
 
+// planes point inside, xyz is normal and w distance, point is inside when dot(xyz, P) + w >= 0
+// order: left, right, bottom, top, near, far
+struct FFrustum {
+	float4	Planes[6];
+};
+
+// row vector convention (P * ViewProjection), D3D clip space depth [0, 1]
+FFrustum CreateFrustum(float4x4 const& ViewProjection);
+
 FBBox CreateInvalidBBox();
 FBBox Union(FBBox const& A, FBBox const& B);
 bool Intersects(FRayInv const & Ray, FBBox const& BBox);
+bool Intersects(FRayInv const & Ray, FBBox const& BBox, float MaxT);
+bool Intersects(FBBox const& A, FBBox const& B);
+// conservative, boxes near frustum corners can pass
+bool Intersects(FFrustum const& Frustum, FBBox const& BBox);
 float RayTriangleIntersection(FRay Ray, float3 p0, float3 p1, float3 p2);
\ No newline at end of file
@@ -761,6 +761,7 @@ FPipelineState*			GetComputePipelineState(FShaderState * ShaderState, D3D12_COMP
 	pipeline->Type = EPipelineType::Compute;
 	pipeline->ShaderState = ShaderState;
 	pipeline->Compute.Desc = lookupDesc;
+	pipeline->SortId = (u32)PipelineLookup.size();
 
 	*PipelineLookup[pipelineHash].get_init() = pipeline;
 
@@ -797,6 +798,7 @@ FPipelineState*			GetGraphicsPipelineState(FShaderState * ShaderState, D3D12_GRA
 	pipeline->ShaderState = ShaderState;
 	pipeline->Graphics.InputLayout = InputLayout;
 	pipeline->Graphics.Desc = lookupDesc;
+	pipeline->SortId = (u32)PipelineLookup.size();
 
 	*PipelineLookup[pipelineHash].get_init() = pipeline;
 
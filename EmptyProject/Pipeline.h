@@ -110,6 +110,8 @@ public:
 	u64									BlobVersion = 0;
 	// last version of shaders we compiled with
 	u64									ShadersCompilationVersion = 0;
+	// dense creation index, used in draw sort keys
+	u32									SortId = 0;
 
 	void Compile();
 	bool IsOutdated() const;
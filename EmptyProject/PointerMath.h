@@ -30,4 +30,66 @@ inline u64 Kilobytes(u64 bytes) {
 
 inline u64 Megabytes(u64 bytes) {
 	return Kilobytes(bytes) / 1024;
-}
\ No newline at end of file
+}
+
+#include <EASTL/vector.h>
+#include <EASTL/unique_ptr.h>
+#include <EASTL/algorithm.h>
+
+// bump allocator for per-frame scratch, Reset releases everything at once
+// memory stays for next use, after Reset blocks are merged into one big enough for previous use
+class FLinearArena {
+public:
+	explicit FLinearArena(u64 InBlockSize = 64 * 1024) : BlockSize(InBlockSize) {}
+
+	void * Allocate(u64 Size, u64 Alignment = 16) {
+		while (true) {
+			if (CurrentBlock < Blocks.size()) {
+				u8 * Base = Blocks[CurrentBlock].Data.get();
+				u8 * Ptr = (u8*)align_forward(Base + Offset, Alignment);
+				if (Ptr + Size <= Base + Blocks[CurrentBlock].Size) {
+					Offset = (u64)(Ptr + Size - Base);
+					UsedSize += Size;
+					return Ptr;
+				}
+				CurrentBlock++;
+				Offset = 0;
+				continue;
+			}
+			u64 NewSize = eastl::max(BlockSize, Size + Alignment);
+			Blocks.push_back({ eastl::unique_ptr<u8[]>(new u8[NewSize]), NewSize });
+		}
+	}
+
+	template<typename T>
+	T * Allocate(u64 Num) {
+		return (T*)Allocate(sizeof(T) * Num, alignof(T));
+	}
+
+	void Reset() {
+		if (Blocks.size() > 1) {
+			u64 Total = 0;
+			for (auto const& Block : Blocks) {
+				Total += Block.Size;
+			}
+			Blocks.clear();
+			Blocks.push_back({ eastl::unique_ptr<u8[]>(new u8[Total]), Total });
+		}
+		CurrentBlock = 0;
+		Offset = 0;
+		UsedSize = 0;
+	}
+
+	u64 GetUsedSize() const { return UsedSize; }
+
+private:
+	struct FBlock {
+		eastl::unique_ptr<u8[]>	Data;
+		u64						Size;
+	};
+	eastl::vector<FBlock>	Blocks;
+	u64						BlockSize;
+	u32						CurrentBlock = 0;
+	u64						Offset = 0;
+	u64						UsedSize = 0;
+};
@@ -1,4 +1,12 @@
 #include "RenderGraph.h"
+#include "Commands.h"
+#include "VideoMemory.h"
+#include "CaptureContext.h"
+#include "Print.h"
+#include "Hash.h"
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <random>
 
 bool FRenderGraphNode::IsProcessed() {
 	return Processed;
@@ -32,7 +40,7 @@ FRenderGraphNode * FProcessingNode::GetInput(u32 Slot) {
 }
 
 FRenderGraphNode * FProcessingNode::GetOutput(u32 Slot) { 
-	return Outgoing[Inputs[Slot]].lock().get(); 
+	return Outgoing[Outputs[Slot]].lock().get(); 
 }
 
 
@@ -41,50 +49,65 @@ FRenderGraphNode * FProcessingNode::GetOutput(u32 Slot) {
 #include <EASTL\stack.h>
 #include <EASTL\deque.h>
 
+// depth first walk over inputs, node stays on path while its inputs are walked
+// shared inputs are reached many times, only reaching node that is on path means cycle
 void PreprocessGraph(FRenderGraphNode * FinalOutput, eastl::deque<FRenderGraphNode*> & Sources) {
+	enum : u8 {
+		ON_PATH,
+		DONE
+	};
 	eastl::hash_map<FRenderGraphNode*, u8> Nodes;
-	eastl::stack<FRenderGraphNode*> Stack;
+	// node and index of its next input
+	eastl::stack<eastl::pair<FRenderGraphNode*, u32>> Stack;
 
-	Stack.push(FinalOutput);
-	Nodes[FinalOutput] = 0;
+	Stack.push(eastl::make_pair(FinalOutput, 0u));
+	Nodes[FinalOutput] = ON_PATH;
+	FinalOutput->Processed = false;
 
 	while (!Stack.empty()) {
-		FRenderGraphNode * Node = Stack.top();
-		Stack.pop();
-		Node->Processed = false;
-
-		auto NodeIter = Nodes.find(Node);
+		FRenderGraphNode * Node = Stack.top().first;
+		u32 Input = Stack.top().second;
 
-		Nodes[Node] = 1;
-		if (Node->Incoming.size() == 0) {
-			Sources.push_back(Node);
-		}
-
-		for (auto & KV : Node->Incoming) {
-			auto ChildIter = Nodes.find(KV.get());
+		if (Input < Node->Incoming.size()) {
+			Stack.top().second++;
+			FRenderGraphNode * Child = Node->Incoming[Input].get();
+			auto ChildIter = Nodes.find(Child);
 			if (ChildIter == Nodes.end()) {
-				Nodes[KV.get()] = 0;
-				Stack.push(KV.get());
+				Nodes[Child] = ON_PATH;
+				Child->Processed = false;
+				Stack.push(eastl::make_pair(Child, 0u));
 			}
-			else if (ChildIter->second == 1) {
+			else if (ChildIter->second == ON_PATH) {
 				// cycle
 				check(0);
 			}
+			continue;
+		}
+
+		Nodes[Node] = DONE;
+		if (Node->Incoming.size() == 0) {
+			Sources.push_back(Node);
 		}
+		Stack.pop();
 	}
 }
 
-void ProcessGraph(FCommandsStream & CmdStream, FRenderGraphNode * FinalOutput) {
+void ScheduleGraph(FRenderGraphNode * FinalOutput, FRenderGraphSchedule & Out) {
+	Out.Order.clear();
+	Out.Transients.clear();
+	Out.Intervals.clear();
+
 	eastl::deque<FRenderGraphNode*> Queue;
 
 	PreprocessGraph(FinalOutput, Queue);
 
+	// same walk as execution, nodes are only marked
 	while (Queue.size()) {
 		FRenderGraphNode * Node = Queue.front();
 		Queue.pop_front();
 
-		Node->Process(CmdStream);
 		Node->Processed = true;
+		Out.Order.push_back(Node);
 
 		for (auto & KV : Node->Outgoing) {
 			if (KV.lock()->IsReadyToProcess()) {
@@ -93,9 +116,388 @@ void ProcessGraph(FCommandsStream & CmdStream, FRenderGraphNode * FinalOutput) {
 		}
 	}
 
+	eastl::hash_map<FRenderGraphNode*, u32> Steps;
+	for (u32 Step = 0; Step < Out.Order.size(); ++Step) {
+		Out.Order[Step]->Processed = false;
+		Steps[Out.Order[Step]] = Step;
+	}
+
+	// transient is alive from its first producer to its last consumer
+	for (u32 Step = 0; Step < Out.Order.size(); ++Step) {
+		FResourceNode * Node = Out.Order[Step]->AsResourceNode();
+		if (!Node || !Node->IsTransient) {
+			continue;
+		}
+		FTransientInterval Interval = {};
+		Interval.First = Step;
+		Interval.Last = Step;
+		for (auto & Producer : Node->Incoming) {
+			Interval.First = eastl::min(Interval.First, Steps[Producer.get()]);
+		}
+		for (auto & Consumer : Node->Outgoing) {
+			auto Iter = Steps.find(Consumer.lock().get());
+			if (Iter != Steps.end()) {
+				Interval.Last = eastl::max(Interval.Last, Iter->second);
+			}
+		}
+		Out.Transients.push_back(Node);
+		Out.Intervals.push_back(Interval);
+	}
+}
+
+void PackTransientResources(FTransientInterval const * Intervals, u32 Num, FTransientPacking & Out) {
+	Out.Placements.resize(Num);
+	Out.RangesNum = 0;
+	Out.UnaliasedBytes = 0;
+	Out.PeakLiveBytes = 0;
+	Out.PackedBytes = 0;
+
+	u32 StepsNum = 0;
+	eastl::vector<u32> Sorted(Num);
+	for (u32 Index = 0; Index < Num; ++Index) {
+		Sorted[Index] = Index;
+		Out.UnaliasedBytes += Intervals[Index].Size;
+		StepsNum = eastl::max(StepsNum, Intervals[Index].Last + 1);
+	}
+	// bigger one first among ones starting at the same step, it picks range before smaller ones fill it
+	eastl::sort(Sorted.begin(), Sorted.end(), [&](u32 A, u32 B) {
+		if (Intervals[A].First != Intervals[B].First) {
+			return Intervals[A].First < Intervals[B].First;
+		}
+		if (Intervals[A].Size != Intervals[B].Size) {
+			return Intervals[A].Size > Intervals[B].Size;
+		}
+		return A < B;
+	});
+
+	struct FRange {
+		u64 Size;
+		u64 Alignment;
+		// last step and index of transient using the range now
+		u32 Last;
+		u32 User;
+	};
+	eastl::vector<FRange> Ranges;
+	for (u32 Index : Sorted) {
+		FTransientInterval const& Interval = Intervals[Index];
+		u32 Best = INVALID_TRANSIENT;
+		u32 Largest = INVALID_TRANSIENT;
+		for (u32 RangeIndex = 0; RangeIndex < Ranges.size(); ++RangeIndex) {
+			FRange const& Range = Ranges[RangeIndex];
+			if (Range.Last >= Interval.First) {
+				continue;
+			}
+			if (Range.Size >= Interval.Size && (Best == INVALID_TRANSIENT || Range.Size < Ranges[Best].Size)) {
+				Best = RangeIndex;
+			}
+			if (Largest == INVALID_TRANSIENT || Range.Size > Ranges[Largest].Size) {
+				Largest = RangeIndex;
+			}
+		}
+		// growing free range always costs less than adding one
+		if (Best == INVALID_TRANSIENT) {
+			Best = Largest;
+		}
+		if (Best == INVALID_TRANSIENT) {
+			Best = (u32)Ranges.size();
+			Ranges.push_back({ 0, 1, 0, INVALID_TRANSIENT });
+		}
+
+		FRange & Range = Ranges[Best];
+		Range.Size = eastl::max(Range.Size, Interval.Size);
+		Range.Alignment = eastl::max(Range.Alignment, Interval.Alignment);
+		Range.Last = Interval.Last;
+		Out.Placements[Index].Range = Best;
+		Out.Placements[Index].Previous = Range.User;
+		Range.User = Index;
+	}
+
+	eastl::vector<u64> Offsets(Ranges.size());
+	u64 Cursor = 0;
+	for (u32 RangeIndex = 0; RangeIndex < Ranges.size(); ++RangeIndex) {
+		Cursor = padded_size(Cursor, Ranges[RangeIndex].Alignment);
+		Offsets[RangeIndex] = Cursor;
+		Cursor += Ranges[RangeIndex].Size;
+	}
+	for (u32 Index = 0; Index < Num; ++Index) {
+		Out.Placements[Index].Offset = Offsets[Out.Placements[Index].Range];
+	}
+	Out.RangesNum = (u32)Ranges.size();
+	Out.PackedBytes = Cursor;
+
+	eastl::vector<i64> LiveDeltas(StepsNum + 1, 0);
+	for (u32 Index = 0; Index < Num; ++Index) {
+		LiveDeltas[Intervals[Index].First] += Intervals[Index].Size;
+		LiveDeltas[Intervals[Index].Last + 1] -= Intervals[Index].Size;
+	}
+	i64 Live = 0;
+	for (u32 Step = 0; Step < StepsNum; ++Step) {
+		Live += LiveDeltas[Step];
+		Out.PeakLiveBytes = eastl::max(Out.PeakLiveBytes, (u64)Live);
+	}
+}
+
+// transients must have their resources, aliasing barrier is recorded before node using transient first
+static void ExecuteSchedule(FCommandsStream & CmdStream, FRenderGraphSchedule const & Schedule, FTransientPacking const & Packing) {
+	eastl::vector<u32> ByFirstStep(Schedule.Transients.size());
+	for (u32 Index = 0; Index < ByFirstStep.size(); ++Index) {
+		ByFirstStep[Index] = Index;
+	}
+	eastl::sort(ByFirstStep.begin(), ByFirstStep.end(), [&](u32 A, u32 B) {
+		return Schedule.Intervals[A].First != Schedule.Intervals[B].First ? Schedule.Intervals[A].First < Schedule.Intervals[B].First : A < B;
+	});
+
+	u32 Cursor = 0;
+	for (u32 Step = 0; Step < Schedule.Order.size(); ++Step) {
+		for (; Cursor < ByFirstStep.size() && Schedule.Intervals[ByFirstStep[Cursor]].First == Step; ++Cursor) {
+			u32 Transient = ByFirstStep[Cursor];
+			u32 Previous = Packing.Placements[Transient].Previous;
+			CmdStream.AliasingBarrier(Previous != INVALID_TRANSIENT ? Schedule.Transients[Previous]->GetResource() : nullptr, Schedule.Transients[Transient]->GetResource());
+		}
+
+		FRenderGraphNode * Node = Schedule.Order[Step];
+		Node->Process(CmdStream);
+		Node->Processed = true;
+	}
+}
+
+void ProcessGraph(FCommandsStream & CmdStream, FRenderGraphNode * FinalOutput) {
+	FRenderGraphSchedule Schedule;
+	ScheduleGraph(FinalOutput, Schedule);
+
+	FTransientTextureAllocator * Allocator = GetTransientTexturesAllocator();
+	for (u32 Index = 0; Index < Schedule.Transients.size(); ++Index) {
+		FTransientTextureDesc const& Desc = Schedule.Transients[Index]->TransientDesc;
+		D3D12_RESOURCE_ALLOCATION_INFO Info = Allocator->GetTextureAllocationInfo(Desc.Width, Desc.Height, Desc.Format, Desc.Flags);
+		Schedule.Intervals[Index].Size = Info.SizeInBytes;
+		Schedule.Intervals[Index].Alignment = Info.Alignment;
+	}
+
+	FTransientPacking Packing;
+	PackTransientResources(Schedule.Intervals.data(), (u32)Schedule.Intervals.size(), Packing);
+
+	Allocator->BeginFrame(Packing.PackedBytes);
+	for (u32 Index = 0; Index < Schedule.Transients.size(); ++Index) {
+		FTransientTextureDesc const& Desc = Schedule.Transients[Index]->TransientDesc;
+		Schedule.Transients[Index]->Resource = Allocator->CreateTexture(Packing.Placements[Index].Offset, Desc.Width, Desc.Height, Desc.Format, Desc.Flags, Desc.Name);
+	}
+	GetCurrentFrameStats().command_stats.transient_bytes += Packing.UnaliasedBytes;
+	GetCurrentFrameStats().command_stats.transient_bytes_packed += Packing.PackedBytes;
+
+	ExecuteSchedule(CmdStream, Schedule, Packing);
+
 	check(FinalOutput->Processed);
 }
 
 FRenderGraphNodeRef CreateDataNode(FGPUResourceRefParam Resource) {
 	return eastl::make_shared<FResourceNode>(Resource);
+}
+
+FRenderGraphNodeRef CreateTransientNode(FTransientTextureDesc const& Desc) {
+	return eastl::make_shared<FResourceNode>(Desc);
+}
+
+/////////////////////////////////////////
+
+// reads every input and writes every output, resources are given by benchmark
+class FSyntheticPass final : public FProcessingNode {
+public:
+	void Process(FCommandsStream & CmdStream) override {
+		for (auto & Input : Incoming) {
+			CmdStream.SetAccess(Input->GetResource(), EAccessType::READ_PIXEL);
+		}
+		for (auto & Output : Outgoing) {
+			CmdStream.SetAccess(Output.lock()->GetResource(), EAccessType::WRITE_RT);
+		}
+		CmdStream.Draw(3);
+	}
+};
+
+struct FSyntheticGraph {
+	FRenderGraphNodeRef Input;
+	FRenderGraphNodeRef FinalOutput;
+	// outgoing links are weak, passes with unread outputs would be gone otherwise
+	eastl::vector<FRenderGraphNodeRef> Nodes;
+};
+
+// chain of passes each reading few recent outputs and now and then an old one, like post processing and lighting do
+static void BuildSyntheticGraph(u32 Seed, u32 PassesNum, FSyntheticGraph & Graph) {
+	std::mt19937 Rng(Seed);
+	const Vec2u Resolutions[] = { Vec2u(1920, 1080), Vec2u(960, 540), Vec2u(480, 270), Vec2u(2048, 2048) };
+	const DXGI_FORMAT Formats[] = { DXGI_FORMAT_R16G16B16A16_FLOAT, DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R11G11B10_FLOAT, DXGI_FORMAT_R32_FLOAT, DXGI_FORMAT_D32_FLOAT };
+
+	Graph.Nodes.clear();
+	FGPUResourceRef Unset;
+	Graph.Input = CreateDataNode(Unset);
+	Graph.FinalOutput = CreateDataNode(Unset);
+	eastl::vector<FRenderGraphNodeRef> Produced;
+	for (u32 PassIndex = 0; PassIndex <= PassesNum; ++PassIndex) {
+		auto Pass = eastl::make_shared<FSyntheticPass>();
+		Graph.Nodes.push_back(Pass);
+
+		// links to the same node twice would queue pass twice
+		u32 Slot = 0;
+		auto Read = [&](FRenderGraphNodeRefParam Node) {
+			if (eastl::find(Pass->Incoming.begin(), Pass->Incoming.end(), Node) == Pass->Incoming.end()) {
+				Pass->LinkInput(Slot++, Node);
+			}
+		};
+		if (PassIndex == 0) {
+			Read(Graph.Input);
+		}
+		else if (PassIndex == PassesNum) {
+			Read(Produced.back());
+		}
+		else {
+			u32 ReadsNum = 1 + Rng() % 3;
+			u32 Window = eastl::min((u32)Produced.size(), 8u);
+			for (u32 Index = 0; Index < ReadsNum; ++Index) {
+				Read(Produced[Produced.size() - 1 - Rng() % Window]);
+			}
+			if (Rng() % 16 == 0) {
+				Read(Produced[Rng() % Produced.size()]);
+			}
+		}
+
+		if (PassIndex == PassesNum) {
+			Pass->LinkOutput(0, Graph.FinalOutput);
+			continue;
+		}
+		u32 WritesNum = Rng() % 4 == 0 ? 2 : 1;
+		for (u32 Index = 0; Index < WritesNum; ++Index) {
+			FTransientTextureDesc Desc = {};
+			Vec2u Resolution = Resolutions[Rng() % _countof(Resolutions)];
+			Desc.Width = Resolution.x;
+			Desc.Height = Resolution.y;
+			Desc.Format = Formats[Rng() % _countof(Formats)];
+			Desc.Flags = Desc.Format == DXGI_FORMAT_D32_FLOAT ? ALLOW_DEPTH_STENCIL : ALLOW_RENDER_TARGET;
+			Desc.Name = L"Synthetic";
+			FRenderGraphNodeRef Node = CreateTransientNode(Desc);
+			Pass->LinkOutput(Index, Node);
+			Produced.push_back(Node);
+			Graph.Nodes.push_back(Node);
+		}
+	}
+}
+
+// what device would ask for placed texture of the desc, without msaa and mips
+static void GetSyntheticAllocationInfo(FTransientTextureDesc const& Desc, FTransientInterval & Interval) {
+	u64 BytesPerPixel = Desc.Format == DXGI_FORMAT_R16G16B16A16_FLOAT ? 8 : 4;
+	Interval.Alignment = HEAP_PLACEMENT_ALIGNMENT;
+	Interval.Size = padded_size(Desc.Width * Desc.Height * BytesPerPixel, HEAP_PLACEMENT_ALIGNMENT);
+}
+
+void BenchmarkTransientAliasing() {
+	const u32 PassesNums[] = { 16, 64, 256, 1024 };
+	const u32 GraphsNum = 8;
+	const u64 MB = 1024 * 1024;
+
+	for (u32 PassesNum : PassesNums) {
+		u32 TransientsNum = 0;
+		u64 UnaliasedBytes = 0;
+		u64 PeakLiveBytes = 0;
+		u64 PackedBytes = 0;
+		u32 RangesNum = 0;
+		double PackMs = 0;
+		u32 ScheduleErrors = 0;
+		u32 OverlapErrors = 0;
+		u32 Mismatches = 0;
+		u32 AliasingBarriersNum = 0;
+		u32 AliasingErrorsNum = 0;
+		u32 SplitErrorsNum = 0;
+
+		for (u32 GraphIndex = 0; GraphIndex < GraphsNum; ++GraphIndex) {
+			const u32 Seed = PassesNum * 1000 + GraphIndex;
+			FSyntheticGraph Graph;
+			BuildSyntheticGraph(Seed, PassesNum, Graph);
+
+			FRenderGraphSchedule Schedule;
+			ScheduleGraph(Graph.FinalOutput.get(), Schedule);
+			// input, passes, transients and final output
+			ScheduleErrors += Schedule.Order.size() != Graph.Nodes.size() + 2 ? 1 : 0;
+			const u32 Num = (u32)Schedule.Transients.size();
+			for (u32 Index = 0; Index < Num; ++Index) {
+				GetSyntheticAllocationInfo(Schedule.Transients[Index]->TransientDesc, Schedule.Intervals[Index]);
+			}
+
+			FTransientPacking Packing;
+			double BestMs = 1e9;
+			for (u32 Run = 0; Run < 8; ++Run) {
+				u64 StartTicks = GetCpuTicks();
+				PackTransientResources(Schedule.Intervals.data(), Num, Packing);
+				BestMs = eastl::min(BestMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+			}
+			PackMs += BestMs;
+			TransientsNum += Num;
+			UnaliasedBytes += Packing.UnaliasedBytes;
+			PeakLiveBytes += Packing.PeakLiveBytes;
+			PackedBytes += Packing.PackedBytes;
+			RangesNum += Packing.RangesNum;
+
+			// transients alive at the same step can't share a byte, range users follow each other
+			FTransientInterval const * Intervals = Schedule.Intervals.data();
+			for (u32 A = 0; A < Num; ++A) {
+				FTransientPlacement const& Placement = Packing.Placements[A];
+				OverlapErrors += Placement.Offset % Intervals[A].Alignment != 0 ? 1 : 0;
+				if (Placement.Previous != INVALID_TRANSIENT) {
+					FTransientPlacement const& Previous = Packing.Placements[Placement.Previous];
+					OverlapErrors += Previous.Range != Placement.Range || Intervals[Placement.Previous].Last >= Intervals[A].First ? 1 : 0;
+				}
+				for (u32 B = A + 1; B < Num; ++B) {
+					bool bAlive = Intervals[A].First <= Intervals[B].Last && Intervals[B].First <= Intervals[A].Last;
+					bool bShared = Placement.Offset < Packing.Placements[B].Offset + Intervals[B].Size && Packing.Placements[B].Offset < Placement.Offset + Intervals[A].Size;
+					OverlapErrors += bAlive && bShared ? 1 : 0;
+				}
+			}
+			OverlapErrors += Packing.PackedBytes < Packing.PeakLiveBytes ? 1 : 0;
+
+			// same graph built again lives at other addresses, packing has to come out the same
+			FSyntheticGraph Rebuilt;
+			BuildSyntheticGraph(Seed, PassesNum, Rebuilt);
+			FRenderGraphSchedule RebuiltSchedule;
+			ScheduleGraph(Rebuilt.FinalOutput.get(), RebuiltSchedule);
+			for (u32 Index = 0; Index < RebuiltSchedule.Transients.size(); ++Index) {
+				GetSyntheticAllocationInfo(RebuiltSchedule.Transients[Index]->TransientDesc, RebuiltSchedule.Intervals[Index]);
+			}
+			FTransientPacking RebuiltPacking;
+			PackTransientResources(RebuiltSchedule.Intervals.data(), (u32)RebuiltSchedule.Intervals.size(), RebuiltPacking);
+			if (RebuiltPacking.Placements.size() != Num) {
+				Mismatches++;
+			}
+			else {
+				for (u32 Index = 0; Index < Num; ++Index) {
+					FTransientPlacement const& P0 = Packing.Placements[Index];
+					FTransientPlacement const& P1 = RebuiltPacking.Placements[Index];
+					Mismatches += P0.Offset != P1.Offset || P0.Range != P1.Range || P0.Previous != P1.Previous ? 1 : 0;
+				}
+			}
+
+			// recorded with aliasing barriers and played, split transitions must not cross them
+			eastl::vector<FGPUResource> Resources(Num + 2);
+			for (auto & Resource : Resources) {
+				InitCaptureResource(Resource);
+			}
+			auto NoDelete = [](FGPUResource *) {};
+			((FResourceNode*)Graph.Input.get())->Resource = FGPUResourceRef(&Resources[Num], NoDelete);
+			((FResourceNode*)Graph.FinalOutput.get())->Resource = FGPUResourceRef(&Resources[Num + 1], NoDelete);
+			for (u32 Index = 0; Index < Num; ++Index) {
+				Schedule.Transients[Index]->Resource = FGPUResourceRef(&Resources[Index], NoDelete);
+			}
+
+			FCommandsStream Stream;
+			ExecuteSchedule(Stream, Schedule, Packing);
+			Stream.Close();
+			FCaptureContext Context;
+			Context.bRecordTrace = false;
+			Playback(Context, &Stream);
+			AliasingBarriersNum += Context.AliasingBarriersNum;
+			AliasingErrorsNum += Context.AliasingErrorsNum + (Context.AliasingBarriersNum != Num ? 1 : 0);
+			SplitErrorsNum += Context.SplitErrorsNum + (u32)Context.OpenSplits.size();
+		}
+
+		PrintFormated(L"transient aliasing, %u graphs of %u passes: %u transients, unaliased %u MB, peak alive %u MB, packed %u MB (%.2fx less, %.2fx of peak alive) in %u ranges, pack %.3f ms/graph; %u schedule errors, %u overlap errors, %u determinism mismatches, %u aliasing barriers, %u aliasing errors, %u split errors\n",
+			GraphsNum, PassesNum, TransientsNum, (u32)(UnaliasedBytes / MB), (u32)(PeakLiveBytes / MB), (u32)(PackedBytes / MB),
+			(double)UnaliasedBytes / PackedBytes, (double)PackedBytes / PeakLiveBytes, RangesNum, PackMs / GraphsNum,
+			ScheduleErrors, OverlapErrors, Mismatches, AliasingBarriersNum, AliasingErrorsNum, SplitErrorsNum);
+	}
 }
\ No newline at end of file
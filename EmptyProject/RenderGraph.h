@@ -3,6 +3,7 @@
 
 class FRenderGraphNode;
 DECORATE_CLASS_REF(FRenderGraphNode);
+class FResourceNode;
 
 struct FOutputDesc {
 	FRenderTargetView RTV;
@@ -25,6 +26,7 @@ public:
 	// for data nodes
 	virtual FGPUResource * GetResource() { return nullptr; }
 	virtual FOutputDesc GetOutputDesc() { return{}; }
+	virtual FResourceNode * AsResourceNode() { return nullptr; }
 };
 
 class FProcessingNode : public FRenderGraphNode {
@@ -39,13 +41,26 @@ public:
 };
 DECORATE_CLASS_REF(FProcessingNode);
 
+struct FTransientTextureDesc {
+	u64					Width;
+	u32					Height;
+	DXGI_FORMAT			Format;
+	TextureFlags		Flags;
+	wchar_t const *		Name;
+};
+
 class FResourceNode : public FRenderGraphNode {
 public:
 	FGPUResourceRef Resource;
+	// transient node gets its resource from ProcessGraph, placed in memory shared with transients not alive at the same time
+	bool IsTransient = false;
+	FTransientTextureDesc TransientDesc = {};
 
 	FResourceNode(FGPUResourceRef InRes) : Resource(InRes) {}
+	FResourceNode(FTransientTextureDesc const& Desc) : IsTransient(true), TransientDesc(Desc) {}
 
 	FGPUResource * GetResource() override { return Resource.get(); }
+	FResourceNode * AsResourceNode() override { return this; }
 
 	FOutputDesc GetOutputDesc() override {
 		FOutputDesc desc = {};
@@ -57,5 +72,54 @@ public:
 DECORATE_CLASS_REF(FResourceNode);
 
 FRenderGraphNodeRef CreateDataNode(FGPUResourceRefParam Resource);
+// engine graphs don't create transients yet, only BenchmarkTransientAliasing does and it stops at packing,
+// so placement through FTransientTextureAllocator and aliasing barriers in ProcessGraph have no caller until a pass needs one
+FRenderGraphNodeRef CreateTransientNode(FTransientTextureDesc const& Desc);
+
+// lifetime of transient resource in steps of execution order, both ends inclusive
+struct FTransientInterval {
+	u64 Size;
+	u64 Alignment;
+	u32 First;
+	u32 Last;
+};
+
+struct FTransientPlacement {
+	u64 Offset;
+	u32 Range;
+	// resource that used the range before, INVALID_TRANSIENT when resource is first in it
+	u32 Previous;
+};
+
+const u32 INVALID_TRANSIENT = 0xFFFFFFFF;
+
+struct FTransientPacking {
+	// parallel to intervals
+	eastl::vector<FTransientPlacement> Placements;
+	u32 RangesNum;
+	// sum of sizes, what transients take when each has its own memory for the whole frame
+	u64 UnaliasedBytes;
+	// most bytes alive at one step, no packing can go below it
+	u64 PeakLiveBytes;
+	u64 PackedBytes;
+};
+
+// interval graph colouring: by start step each transient takes the smallest range whose last user ended before it starts
+// and fits it, else the largest such range grows, else new range is added; ranges are laid out one after another
+// result depends only on intervals and their order, ties are broken by index
+void PackTransientResources(FTransientInterval const * Intervals, u32 Num, FTransientPacking & Out);
+
+// nodes in execution order and lifetimes of transient nodes, interval sizes are left for caller
+struct FRenderGraphSchedule {
+	eastl::vector<FRenderGraphNode*> Order;
+	eastl::vector<FResourceNode*> Transients;
+	eastl::vector<FTransientInterval> Intervals;
+};
+
+void ScheduleGraph(FRenderGraphNode * FinalOutput, FRenderGraphSchedule & Out);
+
+// transients are packed and placed before first node runs, each gets aliasing barrier right before node that first uses it
+void ProcessGraph(FCommandsStream & CmdStream, FRenderGraphNode * FinalOutput);
 
-void ProcessGraph(FCommandsStream & CmdStream, FRenderGraphNode * FinalOutput);
\ No newline at end of file
+// packing of synthetic graphs: peak memory before and after, overlap check of ranges alive at the same step, determinism
+void BenchmarkTransientAliasing();
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "RenderMaterial.h"
 #include "Pipeline.h"
 #include "Scene.h"
+#include <atomic>
 
 class FTestMaterialShaderState : public FShaderState {
 public:
@@ -108,6 +109,10 @@ FRenderPass_MaterialInstance::FRenderPass_MaterialInstance(FRenderPass * InRende
 FSceneRenderPass_MaterialInstance::FSceneRenderPass_MaterialInstance(FSceneRenderPass * InSceneRenderPass, FRenderMaterialInstanceRefParam InRenderMaterialInstance, FInputLayout * InInputLayout) :
 	SceneRenderPass(InSceneRenderPass)
 {
+	// material instances can be created from scene tasks and recording threads
+	static std::atomic<u32> SortIdCounter{ 0 };
+	SortId = SortIdCounter.fetch_add(1, std::memory_order_relaxed);
+
 	// todo: caching, owned by renderpass?
 	RenderPass_MaterialInstance = eastl::make_shared<FRenderPass_MaterialInstance>(InSceneRenderPass->RenderPass, InRenderMaterialInstance, InInputLayout);
 }
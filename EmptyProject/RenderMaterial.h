@@ -137,6 +137,8 @@ public:
 	FRenderPass_MaterialInstanceRef RenderPass_MaterialInstance;
 	FSceneRenderPass * SceneRenderPass;
 	FPipelineState * PSO = nullptr;
+	// creation index, used in draw sort keys
+	u32 SortId;
 
 	void Prepare();
 	FSceneRenderPass_MaterialInstance(FSceneRenderPass * InSceneRenderPass, FRenderMaterialInstanceRefParam InRenderMaterialInstance, FInputLayout * InInputLayout);
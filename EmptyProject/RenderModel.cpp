@@ -24,6 +24,14 @@ FBufferLocation FRenderModel::GetIndexBufferView() const {
 	return Location;
 }
 
+FLinearBVH const& FRenderModel::GetBVH() {
+	if (!bBVHBuilt) {
+		BuildBVH(Positions.data(), (u32)Positions.size(), Indices.data(), (u32)Indices.size(), &BVH);
+		bBVHBuilt = true;
+	}
+	return BVH;
+}
+
 FRenderModelRef GetModel(const wchar_t * Filename, const wchar_t * Path, const wchar_t * TexturesPath) {
 	eastl::wstring combinedpath = eastl::wstring(Path) + Filename;
 	eastl::string scombinedpath = ConvertToString(combinedpath.data(), combinedpath.length());
@@ -57,6 +65,7 @@ FRenderModelRef GetModel(const wchar_t * Filename, const wchar_t * Path, const w
 	
 	for (size_t s = 0; s < shapes.size(); s++) {
 		u32 StartIndex = (u32)Indices.size();
+		const u32 ShapeStartIndex = StartIndex;
 		i32 BaseVertex = (i32)Vertices.size();
 		VertexLookup.clear();
 	
@@ -139,6 +148,15 @@ FRenderModelRef GetModel(const wchar_t * Filename, const wchar_t * Path, const w
 			Submesh.BaseVertex = BaseVertex;
 			Submesh.Material = GetBasicMaterialInstance(MaterialDesc);
 		}
+
+		for (u32 Index = ShapeStartIndex; Index < (u32)Indices.size(); ++Index) {
+			Model->Indices.push_back(Indices[Index] + BaseVertex);
+		}
+	}
+
+	Model->Positions.reserve(Vertices.size());
+	for (auto const& Vertex : Vertices) {
+		Model->Positions.push_back(Vertex.Position);
 	}
 
 	return Model;
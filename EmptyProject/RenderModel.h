@@ -1,6 +1,7 @@
 #pragma once
 #include "Resource.h"
 #include "RenderMaterial.h"
+#include "BVH.h"
 
 struct FMeshRichVertex {
 	float3 Position;
@@ -26,8 +27,17 @@ public:
 	FGPUResourceRef IndexBuffer;
 	FInputLayout * InputLayout;
 	eastl::vector<FSubmesh> Submeshes;
+	// CPU copy for ray and visibility queries, indices already include submesh BaseVertex
+	eastl::vector<float3> Positions;
+	eastl::vector<u32> Indices;
+	// bottom level BVH, shared by every actor instancing the model
+	FLinearBVH BVH;
+	bool bBVHBuilt = false;
+
 	FBufferLocation GetVertexBufferView(u32 Stream = 0) const;
 	FBufferLocation GetIndexBufferView() const;
+	// builds BVH on first call
+	FLinearBVH const& GetBVH();
 };
 DECORATE_CLASS_REF(FRenderModel);
 
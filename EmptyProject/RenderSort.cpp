@@ -0,0 +1,141 @@
+#include "RenderSort.h"
+#include "AssertionMacros.h"
+#include "Print.h"
+#include <EASTL/sort.h>
+#include <string.h>
+#include <random>
+
+u64 BuildRenderSortKey(u32 Pass, u32 PSOId, u32 MaterialId, u32 DepthBucket, u32 Submesh) {
+	u64 Key = Pass & ((1 << SORT_KEY_PASS_BITS) - 1);
+	Key = (Key << SORT_KEY_PSO_BITS) | (PSOId & ((1 << SORT_KEY_PSO_BITS) - 1));
+	Key = (Key << SORT_KEY_MATERIAL_BITS) | (MaterialId & ((1 << SORT_KEY_MATERIAL_BITS) - 1));
+	Key = (Key << SORT_KEY_DEPTH_BITS) | (DepthBucket & ((1 << SORT_KEY_DEPTH_BITS) - 1));
+	Key = (Key << SORT_KEY_SUBMESH_BITS) | (Submesh & ((1 << SORT_KEY_SUBMESH_BITS) - 1));
+	return Key;
+}
+
+u32 GetSortDepthBucket(float Distance) {
+	Distance = eastl::max(Distance, 0.f);
+	u32 Bits;
+	memcpy(&Bits, &Distance, sizeof(Bits));
+	// sign bit is always clear, drop it to keep one more bit of precision
+	return (Bits >> (31 - SORT_KEY_DEPTH_BITS)) & ((1 << SORT_KEY_DEPTH_BITS) - 1);
+}
+
+void FRadixSorter::Sort(u64 * Keys, u32 * Values, u32 Num) {
+	if (Num < 2) {
+		return;
+	}
+
+	const u32 DigitsNum = 8;
+	u32 Histograms[DigitsNum][256] = {};
+	for (u32 Index = 0; Index < Num; ++Index) {
+		u64 Key = Keys[Index];
+		for (u32 Digit = 0; Digit < DigitsNum; ++Digit) {
+			Histograms[Digit][(Key >> (Digit * 8)) & 0xFF]++;
+		}
+	}
+
+	TmpKeys.resize(Num);
+	TmpValues.resize(Num);
+
+	u64 * SrcKeys = Keys;
+	u32 * SrcValues = Values;
+	u64 * DstKeys = TmpKeys.data();
+	u32 * DstValues = TmpValues.data();
+
+	for (u32 Digit = 0; Digit < DigitsNum; ++Digit) {
+		u32 * Histogram = Histograms[Digit];
+		// every key has the same digit, pass would only copy
+		if (Histogram[(SrcKeys[0] >> (Digit * 8)) & 0xFF] == Num) {
+			continue;
+		}
+
+		u32 Offset = 0;
+		for (u32 Bucket = 0; Bucket < 256; ++Bucket) {
+			u32 Count = Histogram[Bucket];
+			Histogram[Bucket] = Offset;
+			Offset += Count;
+		}
+
+		for (u32 Index = 0; Index < Num; ++Index) {
+			u32 Target = Histogram[(SrcKeys[Index] >> (Digit * 8)) & 0xFF]++;
+			DstKeys[Target] = SrcKeys[Index];
+			DstValues[Target] = SrcValues[Index];
+		}
+
+		eastl::swap(SrcKeys, DstKeys);
+		eastl::swap(SrcValues, DstValues);
+	}
+
+	// odd number of passes leaves result in scratch
+	if (SrcKeys != Keys) {
+		memcpy(Keys, SrcKeys, sizeof(u64) * Num);
+		memcpy(Values, SrcValues, sizeof(u32) * Num);
+	}
+}
+
+/////////////////////////////////////////
+
+void BenchmarkRenderSort() {
+	// same size and layout as FRenderItem, without pulling scene headers
+	struct FBenchmarkRenderItem {
+		u64		SortIndex;
+		void *	Material;
+		u32		Actor;
+		u32		SubmeshIndex;
+		u32		Handle;
+	};
+
+	const u32 Counts[] = { 10000, 100000, 1000000 };
+	for (u32 ItemsNum : Counts) {
+		std::mt19937 Rng(ItemsNum);
+		std::uniform_int_distribution<u32> PSO(0, 63);
+		std::uniform_int_distribution<u32> Material(0, 1023);
+		std::uniform_int_distribution<u32> Submesh(0, 15);
+		std::uniform_real_distribution<float> Distance(0.5f, 2000.f);
+
+		eastl::vector<FBenchmarkRenderItem> Items(ItemsNum);
+		for (u32 Index = 0; Index < ItemsNum; ++Index) {
+			FBenchmarkRenderItem & Item = Items[Index];
+			Item.Actor = Index;
+			Item.Material = nullptr;
+			Item.SubmeshIndex = Submesh(Rng);
+			Item.SortIndex = BuildRenderSortKey(2, PSO(Rng), Material(Rng), GetSortDepthBucket(Distance(Rng)), Item.SubmeshIndex);
+		}
+
+		eastl::vector<FBenchmarkRenderItem> Reference = Items;
+		i64 StartTicks = GetCpuTicks();
+		eastl::stable_sort(Reference.begin(), Reference.end(), [](FBenchmarkRenderItem const& A, FBenchmarkRenderItem const& B) {
+			return A.SortIndex < B.SortIndex;
+		});
+		double StableSortMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		// every run starts from the same unsorted list, scratch stays warm like it would frame to frame
+		FRadixSorter Sorter;
+		eastl::vector<u64> Keys(ItemsNum);
+		eastl::vector<u32> Order(ItemsNum);
+		eastl::vector<FBenchmarkRenderItem> Sorted(ItemsNum);
+		double RadixMs = 1e9;
+		for (u32 Run = 0; Run < 4; ++Run) {
+			StartTicks = GetCpuTicks();
+			for (u32 Index = 0; Index < ItemsNum; ++Index) {
+				Keys[Index] = Items[Index].SortIndex;
+				Order[Index] = Index;
+			}
+			Sorter.Sort(Keys.data(), Order.data(), ItemsNum);
+			for (u32 Index = 0; Index < ItemsNum; ++Index) {
+				Sorted[Index] = Items[Order[Index]];
+			}
+			RadixMs = eastl::min(RadixMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+		}
+
+		u32 Mismatches = 0;
+		for (u32 Index = 0; Index < ItemsNum; ++Index) {
+			Mismatches += Sorted[Index].Actor != Reference[Index].Actor;
+		}
+
+		PrintFormated(L"render sort %u items: stable_sort %.3f ms, radix + gather %.3f ms, %u mismatches\n",
+			ItemsNum, StableSortMs, RadixMs, Mismatches);
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/vector.h>
+
+// draw sort key, most significant first: pass 4 | pso 16 | material 16 | depth 16 | submesh 12
+// sorting by key groups draws by state, then front to back inside a state
+const u32 SORT_KEY_PASS_BITS = 4;
+const u32 SORT_KEY_PSO_BITS = 16;
+const u32 SORT_KEY_MATERIAL_BITS = 16;
+const u32 SORT_KEY_DEPTH_BITS = 16;
+const u32 SORT_KEY_SUBMESH_BITS = 12;
+
+static_assert(SORT_KEY_PASS_BITS + SORT_KEY_PSO_BITS + SORT_KEY_MATERIAL_BITS + SORT_KEY_DEPTH_BITS + SORT_KEY_SUBMESH_BITS == 64, "sort key should fill u64");
+
+// fields are masked to their widths, ids past the range wrap and only weaken grouping
+u64 BuildRenderSortKey(u32 Pass, u32 PSOId, u32 MaterialId, u32 DepthBucket, u32 Submesh);
+
+// top bits of a non-negative float are monotonic, so no depth range is needed
+// buckets are logarithmic: finer close to camera
+u32 GetSortDepthBucket(float Distance);
+
+// LSD radix sort of (key, value) pairs, 8 bit digits, stable
+// digits equal for every key are skipped, scratch is kept between calls so per frame sorting doesn't allocate
+class FRadixSorter {
+public:
+	// sorts both arrays in place by Keys
+	void Sort(u64 * Keys, u32 * Values, u32 Num);
+
+private:
+	eastl::vector<u64>	TmpKeys;
+	eastl::vector<u32>	TmpValues;
+};
+
+// stable_sort of render items against radix sort of keys + gather, for 10k-1M items
+void BenchmarkRenderSort();
@@ -145,6 +145,8 @@ struct FGPUResourceRef : public eastl::shared_ptr<FGPUResource> {
 };
 typedef FGPUResourceRef & FGPUResourceRefParam;
 
+const u32 INVALID_STATE_SLOT = 0xFFFFFFFF;
+
 class FGPUResourceFat {
 public:
 	eastl::wstring			Name;
@@ -166,6 +168,8 @@ public:
 	u32						IsUnorderedAccess : 1;
 	u32						IsShaderReadable : 1;
 	u32						AutomaticBarriers : 1;
+	// dense index given by FResourceStateRegistry, commands streams track accesses by it
+	u32						StateSlot = INVALID_STATE_SLOT;
 	DXGI_FORMAT				ViewFormat;
 	u64						DataSizeBytes;
 	u64						UnaliasedHeapMemoryBytes;
@@ -197,5 +201,6 @@ bool			HasStencil(DXGI_FORMAT format);
 
 FGPUResourceRefParam GetBackbuffer();
 
-FGPUResourceRef	LoadDdsTexture(const wchar_t * Filename, bool ForceSrgb, FGPUContext & CopyContext);
+// data is copied on upload queue, flush it before direct queue reads the texture
+FGPUResourceRef	LoadDdsTexture(const wchar_t * Filename, bool ForceSrgb);
 
@@ -1,6 +1,7 @@
 #include "Scene.h"
 #include "Camera.h"
 #include "VideoMemory.h"
+#include "Hash.h"
 
 #include "ForwardPass.h"
 
@@ -21,6 +22,8 @@ FScene::FScene() :
 {
 	DepthPrePassActors.SceneRenderPass->CullBitIndex = 0;
 	ForwardPassActors.SceneRenderPass->CullBitIndex = 0;
+	PassLists[0] = &DepthPrePassActors;
+	PassLists[1] = &ForwardPassActors;
 }
 
 // frusta:
@@ -28,13 +31,17 @@ FScene::FScene() :
 // shadowmap frustum (8 vertices)
 // frustum type: Scene, Custom_Volume
 
+// ids start at 1, so 0 is never a valid handle
 u32 FScene::GenerateActorId() {
 	if (ActorId_FreeList.size()) {
 		u32 Id = ActorId_FreeList.back();
 		ActorId_FreeList.pop_back();
 		return Id;
 	}
-	return ++ActorId_Counter;
+	check(ActorId_Counter < SCENE_ACTOR_ID_MASK);
+	u32 Id = ++ActorId_Counter;
+	ActorSlots.resize(Id + 1, FActorSlot{ 0, 0 });
+	return Id;
 }
 
 void FScene::ReleaseActorId(u32 Id) {
@@ -45,27 +52,110 @@ void FScene::AdvanceToNextFrame() {
 	++CurrentFrameIndex;
 }
 
-FSceneActorRef FScene::SpawnActor(FRenderModelRefParam RenderModel, float3 Position) {
-	FSceneActorRef Actor = eastl::make_shared<FSceneActor>(this, GenerateActorId());
-	Actor->Position = Position;
-	Actor->RenderModel = RenderModel;
+static FBBox GetModelWorldBounds(FRenderModel * Model, float3 Position) {
+	FLinearBVH const& BLAS = Model->GetBVH();
+	if (BLAS.Nodes.empty()) {
+		return FBBox(Position, Position);
+	}
+	return FBBox(BLAS.Nodes[0].Bounds.VMin + Position, BLAS.Nodes[0].Bounds.VMax + Position);
+}
 
-	Actors.push_back(Actor);
+FSceneActorHandle FScene::SpawnActor(FRenderModelRefParam RenderModel, float3 Position) {
+	auto ModelIter = ModelLookup.find(RenderModel.get());
+	u32 ModelIndex;
+	if (ModelIter == ModelLookup.end()) {
+		ModelIndex = (u32)Models.size();
+		Models.push_back(RenderModel);
+		ModelLookup[RenderModel.get()] = ModelIndex;
+	}
+	else {
+		ModelIndex = ModelIter->second;
+	}
+
+	u32 Id = GenerateActorId();
+	u32 Index = (u32)ActorHandles.size();
+	ActorSlots[Id].Index = Index;
+	FSceneActorHandle Actor = (ActorSlots[Id].Generation << SCENE_ACTOR_ID_BITS) | Id;
+
+	FBBox Bounds = GetModelWorldBounds(RenderModel.get(), Position);
+	ActorHandles.push_back(Actor);
+	ActorPositions.push_back(Position);
+	ActorBounds.PushBack(Bounds);
+	ActorModels.push_back(ModelIndex);
+	ActorCullMasks.push_back(0);
 	ActorInfo.push_back();
 	ActorInfo.back().IsDirty = 1;
 	ActorInfo.back().LastFrameUpdated = -1;
+	ActorBoundsVersion++;
+
+	u32 PassMask = 0;
+	for (u32 PassIndex = 0; PassIndex < _countof(PassLists); ++PassIndex) {
+		if (PassLists[PassIndex]->Attach(Actor, RenderModel.get())) {
+			PassMask |= 1 << PassIndex;
+		}
+	}
+	ActorPassMasks.push_back(PassMask);
 
-	DepthPrePassActors.Attach(Actor);
-	ForwardPassActors.Attach(Actor);
+	BVH.AddActor(Actor, RenderModel.get(), Position, Bounds);
 
 	return Actor;
 }
 
-void FScene::RemoveActor(FSceneActorRefParam Actor)
-{
-	// todo
-	// remove id
-	// detach from passes
+void FScene::RemoveActor(FSceneActorHandle Actor) {
+	check(IsValid(Actor));
+	u32 Id = Actor & SCENE_ACTOR_ID_MASK;
+	u32 Index = ActorSlots[Id].Index;
+
+	for (u32 PassIndex = 0; PassIndex < _countof(PassLists); ++PassIndex) {
+		if (ActorPassMasks[Index] & (1 << PassIndex)) {
+			PassLists[PassIndex]->Detach(Actor);
+		}
+	}
+	BVH.RemoveActor(Actor);
+
+	// last actor moves into the hole
+	ActorSlots[ActorHandles.back() & SCENE_ACTOR_ID_MASK].Index = Index;
+	RemoveSwap(ActorHandles, Index);
+	RemoveSwap(ActorPositions, Index);
+	ActorBounds.RemoveSwap(Index);
+	RemoveSwap(ActorModels, Index);
+	RemoveSwap(ActorPassMasks, Index);
+	RemoveSwap(ActorCullMasks, Index);
+	RemoveSwap(ActorInfo, Index);
+	ActorBoundsVersion++;
+
+	// stale handles of the id stop passing IsValid
+	ActorSlots[Id].Generation = (ActorSlots[Id].Generation + 1) & (0xFFFFFFFF >> SCENE_ACTOR_ID_BITS);
+	ReleaseActorId(Id);
+}
+
+void FScene::SetActorPosition(FSceneActorHandle Actor, float3 Position) {
+	u32 Index = GetActorIndex(Actor);
+	FBBox Bounds = GetModelWorldBounds(Models[ActorModels[Index]].get(), Position);
+	ActorPositions[Index] = Position;
+	ActorBounds.Set(Index, Bounds);
+	ActorBoundsVersion++;
+	BVH.MoveActor(Actor, Position, Bounds);
+}
+
+bool FScene::IsValid(FSceneActorHandle Actor) const {
+	u32 Id = Actor & SCENE_ACTOR_ID_MASK;
+	return Id && Id < ActorSlots.size() && ActorSlots[Id].Generation == (Actor >> SCENE_ACTOR_ID_BITS)
+		&& ActorSlots[Id].Index < ActorHandles.size() && ActorHandles[ActorSlots[Id].Index] == Actor;
+}
+
+u32 FScene::GetActorIndex(FSceneActorHandle Actor) const {
+	check(IsValid(Actor));
+	return ActorSlots[Actor & SCENE_ACTOR_ID_MASK].Index;
+}
+
+FRenderModel * FScene::GetActorModel(FSceneActorHandle Actor) const {
+	return Models[ActorModels[GetActorIndex(Actor)]].get();
+}
+
+FSceneBVH const& FScene::GetBVH() {
+	BVH.Update();
+	return BVH;
 }
 
 void FSceneRenderPass::QueryRenderTargets(FSceneRenderContext & SceneRenderContext) {
@@ -100,68 +190,147 @@ void FSceneRenderPass::Begin(FSceneRenderContext & RenderSceneContext, FCommands
 	CmdStream.SetViewport(RenderSceneContext.State.GetViewport());
 }
 
-void FRenderPassList::Attach(FSceneActor * Actor) {
-	check(IdLookup.count(Actor->Id) == 0);
+u32 FSceneRenderPass::AddRenderItem(FRenderItem const& Item) {
+	u32 Handle;
+	if (RenderItemFreeHandles.size()) {
+		Handle = RenderItemFreeHandles.back();
+		RenderItemFreeHandles.pop_back();
+	}
+	else {
+		Handle = (u32)RenderItemIndices.size();
+		RenderItemIndices.push_back();
+	}
+
+	RenderItemIndices[Handle] = (u32)RenderList.size();
+	RenderList.push_back(Item);
+	RenderList.back().Handle = Handle;
+	bRenderListChanged = true;
+	RenderListVersion++;
+	return Handle;
+}
+
+void FSceneRenderPass::RemoveRenderItem(u32 Handle) {
+	u32 Index = RenderItemIndices[Handle];
+	check(RenderList[Index].Handle == Handle);
+
+	RenderItemIndices[RenderList.back().Handle] = Index;
+	RemoveSwap(RenderList, Index);
+	RenderItemFreeHandles.push_back(Handle);
+	bRenderListChanged = true;
+	RenderListVersion++;
+}
+
+void FSceneRenderPass::SortRenderList(FSceneRenderContext & RenderSceneContext) {
+	const u32 ItemsNum = (u32)RenderList.size();
+	float3 ViewPosition = RenderSceneContext.Camera ? RenderSceneContext.Camera->Position : float3(0);
+	const u64 BoundsVersion = RenderSceneContext.Scene->ActorBoundsVersion;
+
+	bool bViewMoved = ViewPosition.x != SortedViewPosition.x || ViewPosition.y != SortedViewPosition.y || ViewPosition.z != SortedViewPosition.z;
+	if (!bRenderListChanged && !bViewMoved && BoundsVersion == SortedBoundsVersion) {
+		return;
+	}
+	bRenderListChanged = false;
+	SortedViewPosition = ViewPosition;
+	SortedBoundsVersion = BoundsVersion;
+
+	SortKeys.resize(ItemsNum);
+	SortOrder.resize(ItemsNum);
+	for (u32 Index = 0; Index < ItemsNum; ++Index) {
+		FRenderItem & Item = RenderList[Index];
+		FSceneRenderPass_MaterialInstance * Material = Item.Material;
+		FBBox Bounds = RenderSceneContext.Scene->ActorBounds.Get(RenderSceneContext.Scene->GetActorIndex(Item.Actor));
+		float Distance = length(Bounds.GetCentroid() - ViewPosition);
+
+		Item.SortIndex = BuildRenderSortKey(
+			(u32)RenderPass->Pass,
+			Material->PSO ? Material->PSO->SortId : 0,
+			Material->SortId,
+			GetSortDepthBucket(Distance),
+			Item.SubmeshIndex);
+		SortKeys[Index] = Item.SortIndex;
+		SortOrder[Index] = Index;
+	}
+
+	RenderListSorter.Sort(SortKeys.data(), SortOrder.data(), ItemsNum);
+
+	SortedRenderList.resize(ItemsNum);
+	for (u32 Index = 0; Index < ItemsNum; ++Index) {
+		SortedRenderList[Index] = RenderList[SortOrder[Index]];
+		RenderItemIndices[SortedRenderList[Index].Handle] = Index;
+	}
+	RenderList.swap(SortedRenderList);
+	RenderListVersion++;
+}
+
+bool FRenderPassList::Attach(FSceneActorHandle Actor, FRenderModel * Model) {
+	check(IdLookup.count(Actor) == 0);
 
 	bool bUseWithPass = false;
-	{
-		u32 SubmeshIndex = 0;
-		for (auto & Submesh : Actor->RenderModel->Submeshes) {
-			if (Actor->RenderModel->Submeshes[SubmeshIndex].Material->IsRenderedWithPass(SceneRenderPass->RenderPass)) {
-				bUseWithPass = true;
-				break;
-			}
+	for (auto & Submesh : Model->Submeshes) {
+		if (Submesh.Material->IsRenderedWithPass(SceneRenderPass->RenderPass)) {
+			bUseWithPass = true;
+			break;
 		}
 	}
 	if (!bUseWithPass) {
-		return;
+		return false;
 	}
 
-	IdLookup[Actor->Id] = (u32)Items.size();
+	IdLookup[Actor] = (u32)Items.size();
 
 	FRenderListItem & Item = Items.push_back();
 	Item.Actor = Actor;
 
-	FSceneActor_RenderPass SceneActor_RenderPass = {};
-	SceneActor_RenderPass.SceneRenderPass = SceneRenderPass.get();
-	SceneActor_RenderPass.IsInAnyRenderList = false;
-
-	eastl::hash_map<FSceneRenderPass_MaterialInstance *, u32> PassMaterialInstanceLookup;
-
 	u32 SubmeshIndex = 0;
-	for (auto & Submesh : Actor->RenderModel->Submeshes) {
-		if (Actor->RenderModel->Submeshes[SubmeshIndex].Material->IsRenderedWithPass(SceneRenderPass->RenderPass)) {
+	for (auto & Submesh : Model->Submeshes) {
+		if (Submesh.Material->IsRenderedWithPass(SceneRenderPass->RenderPass)) {
 			auto & SubItem = Item.Submeshes.push_back();
 			SubItem.SubmeshIndex = SubmeshIndex;
-			SubItem.PassMaterialInstance = GetSceneRenderPass_MaterialInstance(SceneRenderPass.get(), Actor->RenderModel->Submeshes[SubmeshIndex].Material, Actor->RenderModel->InputLayout);
-
-			auto MaterialIter = PassMaterialInstanceLookup.find(SubItem.PassMaterialInstance.get());
-			if (MaterialIter == PassMaterialInstanceLookup.end()) {
-				u32 MaterialInnerIndex = (u32)PassMaterialInstanceLookup.size();
-				PassMaterialInstanceLookup[SubItem.PassMaterialInstance.get()] = MaterialInnerIndex;
-
-				FActorMaterial ActorMaterial = {};
-				ActorMaterial.Material = SubItem.PassMaterialInstance.get();
-
-				SceneActor_RenderPass.MaterialsUsed.push_back(ActorMaterial);
-				SceneActor_RenderPass.MaterialsUsed[MaterialInnerIndex].Submeshes.push_back(SubmeshIndex);
-			}
-			else {
-				SceneActor_RenderPass.MaterialsUsed[MaterialIter->second].Submeshes.push_back(SubmeshIndex);
-			}
+			SubItem.PassMaterialInstance = GetSceneRenderPass_MaterialInstance(SceneRenderPass.get(), Submesh.Material, Model->InputLayout);
 		}
 
 		++SubmeshIndex;
 	}
 
-	Actor->RenderPassInstances.push_back(SceneActor_RenderPass);
+	return true;
 }
 
-void FRenderPassList::Detach(FSceneActor * Actor) {
-	check(IdLookup.count(Actor->Id) == 1);
-	u32 Index = IdLookup[Actor->Id];
+void FRenderPassList::Detach(FSceneActorHandle Actor) {
+	check(IdLookup.count(Actor) == 1);
+	u32 Index = IdLookup[Actor];
+
+	for (u32 Handle : Items[Index].RenderItemHandles) {
+		SceneRenderPass->RemoveRenderItem(Handle);
+	}
+
+	IdLookup[Items.back().Actor] = Index;
 	RemoveSwap(Items, Index);
-	IdLookup.erase(Actor->Id);
+	IdLookup.erase(Actor);
+}
+
+void FRenderPassList::SetVisible(FSceneActorHandle Actor, bool bVisible, eastl::hash_set<FSceneRenderPass_MaterialInstance*> & OutAddedMaterials) {
+	FRenderListItem & Item = Items[IdLookup[Actor]];
+	if (bVisible == Item.bInRenderList) {
+		return;
+	}
+	Item.bInRenderList = bVisible;
+
+	if (!bVisible) {
+		for (u32 Handle : Item.RenderItemHandles) {
+			SceneRenderPass->RemoveRenderItem(Handle);
+		}
+		Item.RenderItemHandles.clear();
+		return;
+	}
+
+	for (auto & Submesh : Item.Submeshes) {
+		FRenderItem RenderItem = {};
+		RenderItem.Actor = Actor;
+		RenderItem.Material = Submesh.PassMaterialInstance.get();
+		RenderItem.SubmeshIndex = Submesh.SubmeshIndex;
+		Item.RenderItemHandles.push_back(SceneRenderPass->AddRenderItem(RenderItem));
+		OutAddedMaterials.insert(RenderItem.Material);
+	}
 }
 
 //void FRenderSceneContext::Render(FCommandsStream & CmdStream) {
@@ -207,7 +376,7 @@ struct FShaderParamItem {
 class FRenderPassDrawList_Material {
 public:
 	struct FListItem {
-		FSceneActorRef Actor;
+		FSceneActorHandle Actor;
 		eastl::vector<u32> SubmeshIndices;
 	};
 	FSceneRenderPass_MaterialInstanceRef Material;
@@ -242,7 +411,7 @@ public:
 struct FRenderPassDrawList {
 	FRenderPass* RenderPass;
 	struct FRenderItem {
-		FSceneActor * Actor;
+		FSceneActorHandle Actor;
 		FSceneRenderPass_MaterialInstance * MatInst;
 		u32 SubmeshIndex;
 	};
@@ -253,127 +422,74 @@ bool IsBitSet(u32 Val, u32 Index) {
 	return ((Val >> Index) & 0x1) > 0;
 }
 
-#include <EASTL\sort.h>
-
-template<typename T>
-void RemoveFromVector(eastl::vector<T> Vec, eastl::vector<u32> IndicesToRemove, bool Sorted = false) {
-	if (IndicesToRemove.size() == 0) {
-		return;
-	}
-	if (!Sorted) {
-		eastl::stable_sort(IndicesToRemove.begin(), IndicesToRemove.end());
-	}
-	
-	u64 TableIndex = 1;
-	u64 Removed = 0;
-	const u64 Last = IndicesToRemove[IndicesToRemove.size() - 1];
-	for (u64 Index = IndicesToRemove[0] + 1; Index <= Last; ++Index) {
-		if (Last - Index == IndicesToRemove.size() - Removed) {
-			break;
-		}
-
-		while(IndicesToRemove[TableIndex] == Index) {
-			++Index;
-			++TableIndex;
-		}
-			
-		eastl::swap(Vec[Index], Vec[IndicesToRemove[0] + Removed]);
-	}
-
-	u64 RangeStart = Last + 1 - IndicesToRemove.size();
-	for (u64 Index = Last + 1; Index < Vec.size(); ++Index) {
-		eastl::swap(Vec[RangeStart], Vec[Index]);
-		++RangeStart;
-	}
-
-	Vec.resize(Vec.size() - IndicesToRemove.size());
-}
-
-
 struct FCulledActor {
 	u32 Index;
 	u32 CullMask;
 };
 
-void CullScene(FSceneRenderContext * SceneContext, eastl::vector<FCulledActor> & OutVisibleActors) {
-#if 1
-	u32 AllFrustaCullMask = 0;
+// writes actors whose cull mask changed since last call, static view and scene skip culling
+void CullScene(FSceneRenderContext * SceneContext, eastl::vector<FCulledActor> & OutChangedActors) {
+	FScene * Scene = SceneContext->Scene;
 
+	u32 AllFrustaCullMask = 0;
 	for (FSceneRenderPass* SceneRenderPass : SceneContext->RenderPasses) {
+		check(SceneRenderPass->CullBitIndex < SceneContext->Frusta.size());
 		AllFrustaCullMask |= (1 << SceneRenderPass->CullBitIndex);
 	}
 
-	u32 Index = 0;
-	for (FSceneActor * SceneActor : SceneContext->Scene->Actors) {
-		FCulledActor CulledActor = {};
-		CulledActor.Index = Index;
-		CulledActor.CullMask = AllFrustaCullMask;
-		OutVisibleActors.push_back(CulledActor);
-		++Index;
+	eastl::vector<u32> & CullMasks = SceneContext->CullMasks;
+	const u32 ActorsNum = Scene->GetActorsNum();
+
+	bool bFrustaChanged = SceneContext->CulledFrusta.size() != SceneContext->Frusta.size()
+		|| memcmp(SceneContext->CulledFrusta.data(), SceneContext->Frusta.data(), sizeof(FFrustum) * SceneContext->Frusta.size()) != 0;
+	if (!bFrustaChanged
+		&& AllFrustaCullMask == SceneContext->CulledFrustaMask
+		&& Scene->ActorBoundsVersion == SceneContext->CulledBoundsVersion
+		&& CullMasks.size() == ActorsNum) {
+		return;
+	}
+	SceneContext->CulledFrusta = SceneContext->Frusta;
+	SceneContext->CulledFrustaMask = AllFrustaCullMask;
+	SceneContext->CulledBoundsVersion = Scene->ActorBoundsVersion;
+
+	// actors spawned since last call start with zero mask, so they show up as changed once visible
+	CullMasks.resize(ActorsNum);
+	CullBounds(Scene->ActorBounds, SceneContext->Frusta.data(), AllFrustaCullMask, CullMasks.data());
+
+	for (u32 Index = 0; Index < ActorsNum; ++Index) {
+		if (CullMasks[Index] != Scene->ActorCullMasks[Index]) {
+			FCulledActor CulledActor = {};
+			CulledActor.Index = Index;
+			CulledActor.CullMask = CullMasks[Index];
+			OutChangedActors.push_back(CulledActor);
+		}
 	}
-#endif
 }
 
 void ProcessScene(FSceneRenderContext * SceneContext) {
-	const FScene * Scene = SceneContext->Scene;
+	FScene * Scene = SceneContext->Scene;
 
 	const eastl::vector<FSceneRenderPass*> & RenderPasses = SceneContext->RenderPasses;
-	eastl::vector<FCulledActor> VisibleActors;
-
-	CullScene(SceneContext, VisibleActors);
-	
-	// filter dirty actors
-	eastl::vector<FCulledActor> UpdateActors;
-	for (FCulledActor CulledActor : VisibleActors) {
-		if (Scene->ActorInfo[CulledActor.Index].IsDirty) {
-			UpdateActors.push_back(CulledActor);
-		}
-	}
+	eastl::vector<FCulledActor> ChangedActors;
 
-	struct FActorMaterialUpdate {
-		FSceneActor * Actor;
-		FSceneRenderPass_MaterialInstance * Material;
+	CullScene(SceneContext, ChangedActors);
 
-		FActorMaterialUpdate() = default;
-	};
-	eastl::vector<FActorMaterialUpdate> ActorMaterialUpdateList;
-	eastl::vector<FActorMaterial*> ActorPassUpdateList;
-
-	const u64 CurrentFrameIndex = Scene->CurrentFrameIndex;
-
-	// prepare list of dirty actor-materials that will be used in frame rendering
-	// updates scene-pass lists of render items: (actor, submesh) tuples
+	// apply visibility changes to pass render lists, items of actors that entered a pass are added
+	// and items of actors that left are removed, actors with unchanged visibility aren't touched
+	// only mask columns are read here, per pass item lists are touched for changed actors only
 	eastl::hash_set<FSceneRenderPass_MaterialInstance*> UpdateMaterials;
-	for (FCulledActor CulledActor : UpdateActors) {
-		FSceneActor * Actor = Scene->Actors[CulledActor.Index];
-		Actor->LastFrameUsed = CurrentFrameIndex;
-		Actor->LastCullMask = CulledActor.CullMask;
-		for (FSceneActor_RenderPass & ActorPass : Actor->RenderPassInstances) {
-			if (IsBitSet(CulledActor.CullMask, ActorPass.SceneRenderPass->CullBitIndex)) {
-				// update render lists
-				// if actor is used in a pass, prepare subcalls for submeshes
-				if (!ActorPass.IsInAnyRenderList) {
-					for (FActorMaterial & ActorMaterial : ActorPass.MaterialsUsed) {
-						for (u32 SubmeshIndex : ActorMaterial.Submeshes) {
-							FRenderItem RenderItem = {};
-							RenderItem.Actor = Actor;
-							RenderItem.Material = &ActorMaterial;
-							RenderItem.SubmeshIndex = SubmeshIndex;
-							RenderItem.SortIndex = 0;
-							ActorPass.SceneRenderPass->RenderList.push_back(RenderItem);
-						}
-					}
-				}
-				// prepare list of specific actor-material tuples to update
-				for (FActorMaterial & ActorMaterial : ActorPass.MaterialsUsed) {
-					UpdateMaterials.insert(ActorMaterial.Material);
-					FActorMaterialUpdate Update = {};
-					Update.Actor = Actor;
-					Update.Material = ActorMaterial.Material;
-					ActorMaterialUpdateList.push_back(Update);
-				}
+	for (FCulledActor CulledActor : ChangedActors) {
+		Scene->ActorCullMasks[CulledActor.Index] = CulledActor.CullMask;
+		FSceneActorHandle Actor = Scene->ActorHandles[CulledActor.Index];
+		u32 PassMask = Scene->ActorPassMasks[CulledActor.Index];
+		for (u32 PassIndex = 0; PassIndex < _countof(Scene->PassLists); ++PassIndex) {
+			if (IsBitSet(PassMask, PassIndex)) {
+				FRenderPassList * PassList = Scene->PassLists[PassIndex];
+				bool bVisible = IsBitSet(CulledActor.CullMask, PassList->SceneRenderPass->CullBitIndex);
+				PassList->SetVisible(Actor, bVisible, UpdateMaterials);
 			}
 		}
+		Scene->ActorInfo[CulledActor.Index].IsDirty = 0;
 	}
 
 	// process list of materials that need update
@@ -382,33 +498,8 @@ void ProcessScene(FSceneRenderContext * SceneContext) {
 		// MatInst->UpdateMaterialDescriptors();
 	}
 
-	for (FActorMaterialUpdate ActorMatUpdate : ActorMaterialUpdateList) {
-		//ActorMatUpdate.Material->UpdateActorDescriptors(ActorMatUpdate.Actor);
-	}
-	
-	// clean render lists of elements that aren't visible this frame
-	{
-		for (FSceneRenderPass* SceneRenderPass : RenderPasses) {
-			eastl::vector<u32> RemoveIndices;
-			u32 Index = 0;
-			for (FRenderItem RenderItem : SceneRenderPass->RenderList) {
-				bool bRemove = RenderItem.Actor->LastFrameUsed != CurrentFrameIndex || !IsBitSet(RenderItem.Actor->LastCullMask, SceneRenderPass->CullBitIndex);
-				if (bRemove) {
-					RemoveIndices.push_back(Index);
-				}
-				Index++;
-			}
-			RemoveFromVector(SceneRenderPass->RenderList, RemoveIndices);
-		}
-	}
-
-	
 	for (FSceneRenderPass * Pass : RenderPasses) {
-#if 1
-		eastl::stable_sort(Pass->RenderList.begin(), Pass->RenderList.end(), [](FRenderItem A, FRenderItem B) {
-			return A.SortIndex < B.SortIndex;
-		});
-#endif
+		Pass->SortRenderList(*SceneContext);
 	}
 }
 
@@ -423,8 +514,8 @@ FGPUResource * FSceneRenderContext::GetColorBuffer() {
 void FSceneRenderContext::AllocateRenderTargets() {
 
 	if (!State.DepthBuffer.IsValid() || !State.ColorBuffer.IsValid()) {
-		State.DepthBuffer = GetTexturesAllocator()->CreateTexture(State.Resolution.x, State.Resolution.y, 1, DXGI_FORMAT_R24G8_TYPELESS, TextureFlags::ALLOW_DEPTH_STENCIL, L"SceneDepth", DXGI_FORMAT_UNKNOWN, float4(0), Config.ClearDepth);
-		State.ColorBuffer = GetTexturesAllocator()->CreateTexture(State.Resolution.x, State.Resolution.y, 1, DXGI_FORMAT_R16G16B16A16_FLOAT, TextureFlags::ALLOW_RENDER_TARGET, L"SceneColor");
+		State.DepthBuffer = GetPooledRenderTargetAllocator()->CreateTexture(State.Resolution.x, State.Resolution.y, 1, DXGI_FORMAT_R24G8_TYPELESS, TextureFlags::ALLOW_DEPTH_STENCIL, L"SceneDepth", DXGI_FORMAT_UNKNOWN, float4(0), Config.ClearDepth);
+		State.ColorBuffer = GetPooledRenderTargetAllocator()->CreateTexture(State.Resolution.x, State.Resolution.y, 1, DXGI_FORMAT_R16G16B16A16_FLOAT, TextureFlags::ALLOW_RENDER_TARGET, L"SceneColor");
 	}
 }
 
@@ -434,11 +525,69 @@ void FSceneRenderContext::SetupNextFrameRendering(FScene * InScene, Vec2u InReso
 	State.Resolution = InResolution;
 
 	AllocateRenderTargets();
-	
+
+	// row vectors like CreateFrustum expects, inverse depth swaps near and far planes
+	using namespace DirectX;
+	XMMATRIX View = XMMatrixLookToLH(ToSimd(Camera->Position), ToSimd(Camera->Direction), ToSimd(Camera->Up));
+	float Aspect = InResolution.y ? (float)InResolution.x / (float)InResolution.y : 1.f;
+	bool bInverseDepth = Config.Projection == EDepthProjection::InverseDepth;
+	XMMATRIX Projection = XMMatrixPerspectiveFovLH(Config.VerticalFov, Aspect,
+		bInverseDepth ? Config.FarPlane : Config.NearPlane,
+		bInverseDepth ? Config.NearPlane : Config.FarPlane);
+	XMStoreFloat4x4((XMFLOAT4X4*)&State.ViewMatrices.View, View);
+	XMStoreFloat4x4((XMFLOAT4X4*)&State.ViewMatrices.InvView, XMMatrixInverse(nullptr, View));
+	XMStoreFloat4x4((XMFLOAT4X4*)&State.ViewMatrices.Projection, Projection);
+	XMStoreFloat4x4((XMFLOAT4X4*)&State.ViewMatrices.InvProjection, XMMatrixInverse(nullptr, Projection));
+
+	float4x4 ViewProjection;
+	XMStoreFloat4x4((XMFLOAT4X4*)&ViewProjection, XMMatrixMultiply(View, Projection));
+	const FFrustum CameraFrustum = CreateFrustum(ViewProjection);
+
 	for (FSceneRenderPass* SceneRenderPass : RenderPasses) {
 		SceneRenderPass->QueryRenderTargets(*this);
 
+		// every pass renders from the camera for now
 		Frusta.resize(eastl::max(Frusta.size(), (u64)SceneRenderPass->CullBitIndex + 1));
+		Frusta[SceneRenderPass->CullBitIndex] = CameraFrustum;
+	}
+}
+
+// pass commands as they go into its bundle, materials are already prepared
+static void RecordRenderPass(FCommandsStream & CmdStream, FSceneRenderContext * SceneRenderContext, FSceneRenderPass * Pass) {
+	Pass->Begin(*SceneRenderContext, CmdStream);
+
+	FSceneRenderPass_MaterialInstance * PrevMaterial = nullptr;
+	for (FRenderItem Item : Pass->RenderList) {
+		Item.Actor;
+		Item.Material;
+		Item.SubmeshIndex;
+
+		
+		//Item.Actor->RenderModel->VertexBuffer->Get
+		/*FBufferLocation VB;
+		VB.Address = VertexBuffer->GetGPUAddress();
+		VB.Size = vtxBytesize;
+		VB.Stride = sizeof(ImDrawVert);
+		CmdStream.SetVB(, 0);*/
+		// SET VB
+		// SET IB
+
+
+		// setup material (pso, root params)
+		FSceneRenderPass_MaterialInstance * Material = Item.Material;
+
+		if (Material != PrevMaterial) {
+			// todo: does change root as return! =
+			CmdStream.SetPipelineState(Material->PSO);
+			PrevMaterial = Material;
+		}
+
+		//draw call params
+		FSubmesh const& Submesh = SceneRenderContext->Scene->GetActorModel(Item.Actor)->Submeshes[Item.SubmeshIndex];
+		auto A = Submesh.IndicesNum;
+		auto B = Submesh.StartIndex;
+		auto C = Submesh.BaseVertex;
+		//CmdStream.DrawIndexed(A, B, C);
 	}
 }
 
@@ -446,43 +595,39 @@ FGPUResourceRef RenderSceneToTexture(FCommandsStream & CmdStream, FSceneRenderCo
 	ProcessScene(SceneRenderContext);
 
 	for (FSceneRenderPass * Pass : SceneRenderContext->RenderPasses) {
-		Pass->Begin(*SceneRenderContext, CmdStream);
+		// everything pass commands are recorded from, bundle is recorded again when any of it changes
+		// per-frame constants are not part of it, they can't be recorded into bundle (FCommandsStream::SetConstantBufferData checks)
+		u64 InputsHash = HashCombine64(Pass->RenderListVersion, (u64)SceneRenderContext->Scene);
+		for (auto const & RenderTarget : Pass->RenderTargets.RenderTargets) {
+			if (RenderTarget.IsUsed()) {
+				InputsHash = HashCombine64(InputsHash, (u64)RenderTarget.Resource);
+				InputsHash = HashCombine64(InputsHash, (u64)RenderTarget.View.RTV.ptr);
+			}
+		}
+		if (Pass->RenderTargets.DepthStencil.IsUsed()) {
+			InputsHash = HashCombine64(InputsHash, (u64)Pass->RenderTargets.DepthStencil.Resource);
+			InputsHash = HashCombine64(InputsHash, (u64)Pass->RenderTargets.DepthStencil.View.DSV.ptr);
+		}
+		InputsHash = HashCombine64(InputsHash, ((u64)SceneRenderContext->State.Resolution.x << 32) | SceneRenderContext->State.Resolution.y);
+		u32 ClearDepthBits;
+		memcpy(&ClearDepthBits, &SceneRenderContext->Config.ClearDepth, sizeof(ClearDepthBits));
+		InputsHash = HashCombine64(InputsHash, (u64)ClearDepthBits);
 
 		FSceneRenderPass_MaterialInstance * PrevMaterial = nullptr;
-		for (FRenderItem Item : Pass->RenderList) {
-			Item.Actor;
-			Item.Material;
-			Item.SubmeshIndex;
-
-			
-			//Item.Actor->RenderModel->VertexBuffer->Get
-			/*FBufferLocation VB;
-			VB.Address = VertexBuffer->GetGPUAddress();
-			VB.Size = vtxBytesize;
-			VB.Stride = sizeof(ImDrawVert);
-			CmdStream.SetVB(, 0);*/
-			// SET VB
-			// SET IB
-
-
-			// setup material (pso, root params)
-			FSceneRenderPass_MaterialInstance * Material = Item.Material->Material;
-
-			if (Material != PrevMaterial) {
-				// todo: does change root as return! =
-				CmdStream.SetPipelineState(Material->PSO);
-				PrevMaterial = Material;
+		for (FRenderItem const& Item : Pass->RenderList) {
+			if (Item.Material != PrevMaterial) {
+				// materials are prepared when actors enter the list, this only recompiles outdated PSOs
+				Item.Material->Prepare();
+				InputsHash = HashCombine64(InputsHash, (u64)Item.Material->PSO);
+				PrevMaterial = Item.Material;
 			}
+		}
 
-			for (u32 SubmeshIndex : Item.Material->Submeshes) {
-				//draw call params
-				//Item.Actor->RenderModel->Submeshes[SubmeshIndex];
-				auto A = Item.Actor->RenderModel->Submeshes[SubmeshIndex].IndicesNum;
-				auto B = Item.Actor->RenderModel->Submeshes[SubmeshIndex].StartIndex;
-				auto C = Item.Actor->RenderModel->Submeshes[SubmeshIndex].BaseVertex;
-				//CmdStream.DrawIndexed(A, B, C);
-			}
+		if (Pass->Bundle.BeginRecording(InputsHash)) {
+			RecordRenderPass(Pass->Bundle.Stream, SceneRenderContext, Pass);
+			Pass->Bundle.EndRecording();
 		}
+		CmdStream.ExecuteBundle(Pass->Bundle);
 	}
 
 	return SceneRenderContext->State.ColorBuffer;
@@ -2,11 +2,14 @@
 #include "Essence.h"
 #include "RenderModel.h"
 #include "MathVector.h"
+#include "SceneBVH.h"
+#include "SceneCulling.h"
+#include "RenderSort.h"
+#include <EASTL/hash_set.h>
 
 class FScene;
 class FSceneRenderPass;
 class FSceneRenderContext;
-class FActorMaterial;
 class FSceneRenderPass_MaterialInstance;
 
 class FDummyStateConsumer {
@@ -33,9 +36,10 @@ public:
 
 struct FRenderItem {
 	u64 SortIndex;
-	FSceneActor * Actor;
-	FActorMaterial * Material;
+	FSceneRenderPass_MaterialInstance * Material;
+	FSceneActorHandle Actor;
 	u32 SubmeshIndex;
+	u32 Handle;
 };
 
 // encapsulates (scene, pass) tuple
@@ -47,62 +51,51 @@ public:
 
 	eastl::vector<u32> Actors;
 	// all items that need to be rendered (passed broad visibility test)
-	// updated each frame
+	// updated incrementally from visibility changes, order changes when sorted
 	eastl::vector<FRenderItem> RenderList;
+	// item handle -> index in RenderList, freed handles are reused
+	eastl::vector<u32> RenderItemIndices;
+	eastl::vector<u32> RenderItemFreeHandles;
+	bool bRenderListChanged = true;
+	float3 SortedViewPosition = float3(0);
+	u64 SortedBoundsVersion = 0;
+	// sort scratch, kept between frames
+	FRadixSorter RenderListSorter;
+	eastl::vector<u64> SortKeys;
+	eastl::vector<u32> SortOrder;
+	eastl::vector<FRenderItem> SortedRenderList;
+	// bumped when items are added, removed or reordered
+	u64 RenderListVersion = 0;
 
 	FRenderTargetsBundle RenderTargets = {};
+	// pass commands, recorded again only when render list, PSOs or targets change
+	FCommandsBundle Bundle;
 	
 	void QueryRenderTargets(FSceneRenderContext & SceneRenderContext);
 	void Begin(FSceneRenderContext & RenderSceneContext, FCommandsStream & CmdStream);
+	// O(1), removal moves last item into the hole
+	u32 AddRenderItem(FRenderItem const& Item);
+	void RemoveRenderItem(u32 Handle);
+	// fills SortIndex of every item and orders RenderList by it
+	// skipped when items, view position and actor bounds didn't change since last sort
+	void SortRenderList(FSceneRenderContext & RenderSceneContext);
 
 	FSceneRenderPass(FRenderPass * InRenderPass) : RenderPass(InRenderPass) {}
 };
 DECORATE_CLASS_REF(FSceneRenderPass);
 
-class FActorMaterial {
-public:
-	FSceneRenderPass_MaterialInstance * Material;
-	eastl::vector<u32> Submeshes;
-	eastl::vector<u32> RootParams;
-};
-
-struct FSceneActor_RenderPass {
-	FSceneRenderPass * SceneRenderPass;
-	eastl::vector<FActorMaterial> MaterialsUsed;
-	bool IsInAnyRenderList;
-};
-
-// this is tightly coupled with single scene instance
-class FSceneActor {
-public:
-	const u32 Id;
-	FScene * const Scene;
-
-	float3 Position;
-	FRenderModelRef RenderModel;
-
-	u64 LastFrameUsed = -1;
-	u32 LastCullMask = 0;
-
-	// all passes that use the actor
-	eastl::vector<FSceneActor_RenderPass> RenderPassInstances;
-
-	FSceneActor(FScene * InScene, u32 InId) : 
-		Id(InId),
-		Scene(InScene)
-		{
-	}
-};
-DECORATE_CLASS_REF(FSceneActor);
-
+// per pass data of one actor, touched only when actor is attached or changes visibility
 class FRenderListItem {
 public:
-	FSceneActor * Actor;
+	FSceneActorHandle Actor;
 	struct FSubmeshMaterial {
 		u32 SubmeshIndex;
 		FSceneRenderPass_MaterialInstanceRef PassMaterialInstance;
 	};
 	eastl::vector<FSubmeshMaterial> Submeshes;
+	// handles of submesh items in pass RenderList while actor is visible in the pass
+	eastl::vector<u32> RenderItemHandles;
+	bool bInRenderList = false;
 };
 
 class FRenderPass;
@@ -110,13 +103,17 @@ class FRenderPass;
 class FRenderPassList {
 public:
 	FSceneRenderPassRef SceneRenderPass;
+	// actor handle -> index in Items
 	eastl::hash_map<u32, u32> IdLookup;
 	eastl::vector<FRenderListItem> Items;
 
 	FRenderPassList(FSceneRenderPassRefParam);
 
-	void Attach(FSceneActor * Actor);
-	void Detach(FSceneActor * Actor);
+	// returns false when none of model submeshes is rendered with the pass
+	bool Attach(FSceneActorHandle Actor, FRenderModel * Model);
+	void Detach(FSceneActorHandle Actor);
+	// adds or removes actor items in pass RenderList, materials of added items are written to OutAddedMaterials
+	void SetVisible(FSceneActorHandle Actor, bool bVisible, eastl::hash_set<FSceneRenderPass_MaterialInstance*> & OutAddedMaterials);
 };
 
 struct FSceneObjectRenderInfo {
@@ -125,23 +122,63 @@ public:
 	u64 IsDirty : 1;
 };
 
+// handle: generation in top bits, actor id in the rest, id indexes ActorSlots
+const u32 SCENE_ACTOR_ID_BITS = 24;
+const u32 SCENE_ACTOR_ID_MASK = (1 << SCENE_ACTOR_ID_BITS) - 1;
+
+// actors are stored as columns indexed by dense actor index, removal moves last actor into the hole
+// handles stay valid until the actor is removed, stale handles are caught by generation check
 class FScene {
 public:
 	u64 CurrentFrameIndex; // used to identify outdated actors
 
-	eastl::vector<FSceneActorRef> Actors;
+	// columns, indexed by dense actor index
+	eastl::vector<FSceneActorHandle> ActorHandles;
+	eastl::vector<float3> ActorPositions;
+	// world bounds for culling
+	FBoundsSoA ActorBounds;
+	// index into Models
+	eastl::vector<u32> ActorModels;
+	// bit N set when actor is attached to PassLists[N]
+	eastl::vector<u32> ActorPassMasks;
+	// frusta containing actor when last processed
+	eastl::vector<u32> ActorCullMasks;
 	eastl::vector<FSceneObjectRenderInfo> ActorInfo;
+	// bumped on every bounds change, lets culling and sorting skip static frames
+	u64 ActorBoundsVersion = 0;
+
+	struct FActorSlot {
+		u32 Generation;
+		u32 Index;
+	};
+	// indexed by actor id
+	eastl::vector<FActorSlot> ActorSlots;
+
+	eastl::vector<FRenderModelRef> Models;
+	eastl::hash_map<FRenderModel*, u32> ModelLookup;
+
 	FRenderPassList DepthPrePassActors;
 	FRenderPassList ForwardPassActors;
+	FRenderPassList * PassLists[2];
 
-	u32 ActorId_Counter;
+	u32 ActorId_Counter = 0;
 	eastl::vector<u32> ActorId_FreeList;
+	FSceneBVH BVH;
 	u32 GenerateActorId();
 	void ReleaseActorId(u32);
 
 	FScene();
-	FSceneActorRef SpawnActor(FRenderModelRefParam RenderModel, float3 Position);
-	void RemoveActor(FSceneActorRefParam Actor);
+	FSceneActorHandle SpawnActor(FRenderModelRefParam RenderModel, float3 Position);
+	void RemoveActor(FSceneActorHandle Actor);
+	void SetActorPosition(FSceneActorHandle Actor, float3 Position);
+
+	bool IsValid(FSceneActorHandle Actor) const;
+	u32 GetActorsNum() const { return (u32)ActorHandles.size(); }
+	u32 GetActorIndex(FSceneActorHandle Actor) const;
+	FRenderModel * GetActorModel(FSceneActorHandle Actor) const;
+
+	// scene-wide ray and volume queries, pending spawns/moves/removals are applied first
+	FSceneBVH const& GetBVH();
 
 	void AdvanceToNextFrame();
 };
@@ -165,6 +202,10 @@ enum class EDepthProjection {
 struct FSceneRenderConfig {
 	EDepthProjection Projection = EDepthProjection::Standard;
 	float ClearDepth = 1.f;
+	// radians
+	float VerticalFov = 0.785398f;
+	float NearPlane = 0.1f;
+	float FarPlane = 1000.f;
 };
 
 class FSceneRenderState {
@@ -179,10 +220,6 @@ public:
 	D3D12_VIEWPORT GetViewport() const;
 };
 
-struct FFrustum {
-	// ?
-};
-
 class FSceneRenderContext {
 public:
 	FScene * Scene;
@@ -190,8 +227,14 @@ public:
 	FSceneRenderState State;
 	FSceneRenderConfig Config;
 
+	// indexed by FSceneRenderPass::CullBitIndex, zeroed frustum passes everything
 	eastl::vector<FFrustum> Frusta;
 	eastl::vector<FSceneRenderPass*> RenderPasses;
+	// per actor bits of frusta containing it, compared against FScene::ActorCullMasks to find visibility changes
+	eastl::vector<u32> CullMasks;
+	eastl::vector<FFrustum> CulledFrusta;
+	u32 CulledFrustaMask = 0;
+	u64 CulledBoundsVersion = 0;
 
 	FGPUResource * GetDepthBuffer();
 	FGPUResource * GetColorBuffer();
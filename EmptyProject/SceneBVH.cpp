@@ -0,0 +1,285 @@
+#include "SceneBVH.h"
+#include "RenderModel.h"
+#include "AssertionMacros.h"
+#include <EASTL/sort.h>
+
+const u32 INVALID_NODE_INDEX = 0xFFFFFFFF;
+
+void FSceneBVH::AddActor(FSceneActorHandle Actor, FRenderModel * Model, float3 Position, FBBox const& Bounds) {
+	check(Actor && InstanceLookup.count(Actor) == 0);
+
+	// point boxes of models without geometry keep the builder away from infinite centroids
+	InstanceLookup[Actor] = (u32)Instances.size();
+	Instances.push_back({ Actor, Model, Position });
+	InstanceBounds.push_back(Bounds);
+}
+
+void FSceneBVH::RemoveActor(FSceneActorHandle Actor) {
+	auto Iter = InstanceLookup.find(Actor);
+	check(Iter != InstanceLookup.end());
+
+	// point at old center keeps refit bounds finite and only shrinks parents, invalid box would make SAH cost infinite
+	float3 Center = InstanceBounds[Iter->second].GetCentroid();
+	Instances[Iter->second] = {};
+	InstanceBounds[Iter->second] = FBBox(Center, Center);
+	InstanceLookup.erase(Iter);
+	RemovedNum++;
+	bRefit = true;
+}
+
+void FSceneBVH::MoveActor(FSceneActorHandle Actor, float3 Position, FBBox const& Bounds) {
+	auto Iter = InstanceLookup.find(Actor);
+	check(Iter != InstanceLookup.end());
+
+	Instances[Iter->second].Position = Position;
+	InstanceBounds[Iter->second] = Bounds;
+	bRefit = true;
+}
+
+// every pending instance descends to the leaf whose bounds grow least, leaves that got some are rebuilt locally
+// and spliced in while the tree is copied in depth-first order, so layout stays the one FLinearBVH expects
+void FSceneBVH::InsertPending() {
+	const u32 NodesNum = (u32)TLAS.Nodes.size();
+	eastl::vector<eastl::pair<u32, u32>> LeafInserts;
+	for (u32 Instance = TreeInstancesNum; Instance < Instances.size(); ++Instance) {
+		if (!Instances[Instance].Actor) {
+			// removed before it got in, dropped by next rebuild
+			continue;
+		}
+
+		FBBox const& Bounds = InstanceBounds[Instance];
+		u32 Index = 0;
+		while (!TLAS.Nodes[Index].PrimitivesNum) {
+			FBBox First = TLAS.Nodes[Index + 1].Bounds;
+			FBBox Second = TLAS.Nodes[TLAS.Nodes[Index].SecondChild].Bounds;
+			float FirstArea = First.SurfaceArea();
+			float SecondArea = Second.SurfaceArea();
+			First.Inflate(Bounds);
+			Second.Inflate(Bounds);
+			float FirstGrowth = First.SurfaceArea() - FirstArea;
+			float SecondGrowth = Second.SurfaceArea() - SecondArea;
+			// inflated on the way, so following inserts see the grown bounds
+			TLAS.Nodes[Index].Bounds.Inflate(Bounds);
+			Index = FirstGrowth <= SecondGrowth ? Index + 1 : TLAS.Nodes[Index].SecondChild;
+		}
+		LeafInserts.push_back(eastl::make_pair(Index, Instance));
+	}
+	TreeInstancesNum = (u32)Instances.size();
+	if (LeafInserts.empty()) {
+		return;
+	}
+	eastl::sort(LeafInserts.begin(), LeafInserts.end());
+
+	eastl::vector<FBVHNode> Nodes;
+	eastl::vector<u32> Primitives;
+	Nodes.reserve(NodesNum + 2 * LeafInserts.size());
+	Primitives.reserve(TLAS.Primitives.size() + LeafInserts.size());
+
+	eastl::vector<FBBox> LocalBounds;
+	eastl::vector<u32> LocalInstances;
+	FLinearBVH Local;
+
+	// old node and new parent whose SecondChild it becomes, first children follow their parent directly
+	struct FCopyItem {
+		u32 Node;
+		u32 Parent;
+	};
+	eastl::vector<FCopyItem> Work;
+	Work.push_back({ 0, INVALID_NODE_INDEX });
+	u32 NextInsert = 0;
+	while (!Work.empty()) {
+		FCopyItem Item = Work.back();
+		Work.pop_back();
+
+		const u32 NewIndex = (u32)Nodes.size();
+		if (Item.Parent != INVALID_NODE_INDEX) {
+			Nodes[Item.Parent].SecondChild = NewIndex;
+		}
+
+		FBVHNode const& Node = TLAS.Nodes[Item.Node];
+		if (!Node.PrimitivesNum) {
+			Nodes.push_back(Node);
+			Work.push_back({ Node.SecondChild, NewIndex });
+			Work.push_back({ Item.Node + 1, INVALID_NODE_INDEX });
+			continue;
+		}
+
+		// copy goes in old preorder, which is index order, so inserts sorted by leaf are consumed along
+		if (NextInsert == LeafInserts.size() || LeafInserts[NextInsert].first != Item.Node) {
+			Nodes.push_back(Node);
+			Nodes.back().PrimitivesOffset = (u32)Primitives.size();
+			Primitives.insert(Primitives.end(), TLAS.Primitives.begin() + Node.PrimitivesOffset, TLAS.Primitives.begin() + Node.PrimitivesOffset + Node.PrimitivesNum);
+			continue;
+		}
+
+		LocalInstances.assign(TLAS.Primitives.begin() + Node.PrimitivesOffset, TLAS.Primitives.begin() + Node.PrimitivesOffset + Node.PrimitivesNum);
+		for (; NextInsert < LeafInserts.size() && LeafInserts[NextInsert].first == Item.Node; ++NextInsert) {
+			LocalInstances.push_back(LeafInserts[NextInsert].second);
+		}
+		LocalBounds.resize(LocalInstances.size());
+		for (u32 Index = 0; Index < LocalInstances.size(); ++Index) {
+			LocalBounds[Index] = InstanceBounds[LocalInstances[Index]];
+		}
+		BuildBVH(LocalBounds.data(), (u32)LocalBounds.size(), &Local);
+
+		for (FBVHNode LocalNode : Local.Nodes) {
+			if (LocalNode.PrimitivesNum) {
+				u32 LocalOffset = LocalNode.PrimitivesOffset;
+				LocalNode.PrimitivesOffset = (u32)Primitives.size();
+				for (u32 Index = 0; Index < LocalNode.PrimitivesNum; ++Index) {
+					Primitives.push_back(LocalInstances[Local.Primitives[LocalOffset + Index]]);
+				}
+			}
+			else {
+				LocalNode.SecondChild += NewIndex;
+			}
+			Nodes.push_back(LocalNode);
+		}
+	}
+
+	eastl::swap(TLAS.Nodes, Nodes);
+	eastl::swap(TLAS.Primitives, Primitives);
+}
+
+void FSceneBVH::Update() {
+	const u32 PendingNum = (u32)Instances.size() - TreeInstancesNum;
+	// few adds go into existing tree, batch comparable to it (first fill, level load) is better built from scratch
+	bRebuild |= PendingNum && (TLAS.Nodes.empty() || PendingNum * 4 > Instances.size());
+
+	if (!bRebuild && (bRefit || PendingNum)) {
+		if (PendingNum) {
+			InsertPending();
+			TLASDepth = TLAS.GetDepth();
+		}
+		TLAS.Refit(InstanceBounds.data());
+		bRebuild = TLAS.GetSAHCost() > BuiltSAHCost * RebuildThreshold || RemovedNum * 4 > Instances.size();
+	}
+
+	if (bRebuild) {
+		u32 Live = 0;
+		for (u32 Index = 0; Index < Instances.size(); ++Index) {
+			if (Instances[Index].Actor) {
+				Instances[Live] = Instances[Index];
+				InstanceBounds[Live] = InstanceBounds[Index];
+				InstanceLookup[Instances[Live].Actor] = Live;
+				Live++;
+			}
+		}
+		Instances.resize(Live);
+		InstanceBounds.resize(Live);
+		RemovedNum = 0;
+		TreeInstancesNum = Live;
+
+		BuildBVH(InstanceBounds.data(), (u32)InstanceBounds.size(), &TLAS);
+		BuiltSAHCost = TLAS.GetSAHCost();
+		TLASDepth = TLAS.GetDepth();
+	}
+
+	bRebuild = false;
+	bRefit = false;
+}
+
+template<typename TOverlaps, typename TVisit>
+void FSceneBVH::Traverse(TOverlaps const& Overlaps, TVisit const& Visit) const {
+	check(!bRebuild && !bRefit && TreeInstancesNum == Instances.size());
+	if (TLAS.Nodes.empty()) {
+		return;
+	}
+
+	// refit keeps topology, so depth of last build bounds the stack, unusually deep trees take it from heap
+	u32 LocalStack[64];
+	eastl::vector<u32> HeapStack;
+	u32 * Stack = LocalStack;
+	if (TLASDepth > _countof(LocalStack)) {
+		HeapStack.resize(TLASDepth);
+		Stack = HeapStack.data();
+	}
+	i32 StackIndex = -1;
+
+	u32 Index = 0;
+	while (1) {
+		FBVHNode const& Node = TLAS.Nodes[Index];
+		if (Overlaps(Node.Bounds)) {
+			if (Node.PrimitivesNum) {
+				for (u32 PrimitiveIndex = 0; PrimitiveIndex < Node.PrimitivesNum; ++PrimitiveIndex) {
+					u32 Instance = TLAS.Primitives[Node.PrimitivesOffset + PrimitiveIndex];
+					if (Instances[Instance].Actor && Overlaps(InstanceBounds[Instance]) && !Visit(Instance)) {
+						return;
+					}
+				}
+			}
+			else {
+				Stack[++StackIndex] = Node.SecondChild;
+				Index = Index + 1;
+				continue;
+			}
+		}
+
+		if (StackIndex < 0) {
+			break;
+		}
+		Index = Stack[StackIndex--];
+	}
+}
+
+bool FSceneBVH::CastRay(FRay const& Ray, FSceneRayHit & OutHit) const {
+	FRayInv RayInv = FRayInv(Ray);
+	float MinT = FINF;
+	bool bHit = false;
+
+	Traverse(
+		[&](FBBox const& Bounds) { return Intersects(RayInv, Bounds, MinT); },
+		[&](u32 Instance) {
+		FInstance const& Actor = Instances[Instance];
+		FLinearBVH const& BLAS = Actor.Model->BVH;
+		if (BLAS.Nodes.empty()) {
+			return true;
+		}
+
+		// translation only, distance along the ray is the same in model space
+		u32 PrimitiveId;
+		if (BLAS.CastRay(FRay(Ray.Origin - Actor.Position, Ray.Direction), MinT, PrimitiveId)) {
+			OutHit.Actor = Actor.Actor;
+			OutHit.T = MinT;
+			OutHit.PrimitiveId = PrimitiveId;
+			bHit = true;
+		}
+		return true;
+	});
+
+	return bHit;
+}
+
+bool FSceneBVH::CastShadowRay(FRay const& Ray) const {
+	FRayInv RayInv = FRayInv(Ray);
+	bool bHit = false;
+
+	Traverse(
+		[&](FBBox const& Bounds) { return Intersects(RayInv, Bounds); },
+		[&](u32 Instance) {
+		FInstance const& Actor = Instances[Instance];
+		FLinearBVH const& BLAS = Actor.Model->BVH;
+		bHit = !BLAS.Nodes.empty() && BLAS.CastShadowRay(FRay(Ray.Origin - Actor.Position, Ray.Direction));
+		return !bHit;
+	});
+
+	return bHit;
+}
+
+void FSceneBVH::QueryBox(FBBox const& Box, eastl::vector<FSceneActorHandle> & OutActors) const {
+	Traverse(
+		[&](FBBox const& Bounds) { return Intersects(Box, Bounds); },
+		[&](u32 Instance) {
+		OutActors.push_back(Instances[Instance].Actor);
+		return true;
+	});
+}
+
+void FSceneBVH::QueryFrustum(FFrustum const& Frustum, eastl::vector<FSceneActorHandle> & OutActors) const {
+	Traverse(
+		[&](FBBox const& Bounds) { return Intersects(Frustum, Bounds); },
+		[&](u32 Instance) {
+		OutActors.push_back(Instances[Instance].Actor);
+		return true;
+	});
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "Essence.h"
+#include "BVH.h"
+#include <EASTL/hash_map.h>
+
+class FRenderModel;
+
+// see FScene, 0 is never a valid handle
+typedef u32 FSceneActorHandle;
+
+struct FSceneRayHit {
+	FSceneActorHandle	Actor;
+	float				T;
+	// triangle of actor's FRenderModel
+	u32					PrimitiveId;
+};
+
+// top level BVH over actor instances
+// bottom level BVHs live in FRenderModel, instances only reference them
+// actors carry position only, so instance transform is a translation
+// instances keep their own copy of model and position, queries don't touch scene columns
+class FSceneBVH {
+public:
+	// refitting after moves degrades the tree, rebuild once SAH cost grows past this ratio
+	float RebuildThreshold = 1.5f;
+
+	// Bounds are model bounds moved to Position, model's BVH has to be built already
+	void AddActor(FSceneActorHandle Actor, FRenderModel * Model, float3 Position, FBBox const& Bounds);
+	void RemoveActor(FSceneActorHandle Actor);
+	void MoveActor(FSceneActorHandle Actor, float3 Position, FBBox const& Bounds);
+
+	// applies pending changes, queries expect it to be called after the last modification
+	// adds go into leaves they grow least, moves and removes refit
+	// degraded tree, too many removed instances or adds comparable to tree size rebuild
+	void Update();
+
+	bool CastRay(FRay const& Ray, FSceneRayHit & OutHit) const;
+	bool CastShadowRay(FRay const& Ray) const;
+	void QueryBox(FBBox const& Box, eastl::vector<FSceneActorHandle> & OutActors) const;
+	void QueryFrustum(FFrustum const& Frustum, eastl::vector<FSceneActorHandle> & OutActors) const;
+
+	u32 GetInstancesNum() const { return (u32)InstanceLookup.size(); }
+	FLinearBVH const& GetTLAS() const { return TLAS; }
+
+private:
+	struct FInstance {
+		FSceneActorHandle	Actor;
+		FRenderModel *		Model;
+		float3				Position;
+	};
+	// removed instances are nulled and compacted on next rebuild
+	eastl::vector<FInstance>		Instances;
+	eastl::vector<FBBox>			InstanceBounds;
+	// actor handle -> instance
+	eastl::hash_map<u32, u32>		InstanceLookup;
+	u32								RemovedNum = 0;
+	// instances past this were added since last update and aren't in TLAS yet
+	u32								TreeInstancesNum = 0;
+
+	FLinearBVH						TLAS;
+	float							BuiltSAHCost = 0;
+	u32								TLASDepth = 0;
+	bool							bRebuild = false;
+	bool							bRefit = false;
+
+	void InsertPending();
+
+	// Overlaps(FBBox) culls nodes, Visit(Instance) returns false to stop
+	template<typename TOverlaps, typename TVisit>
+	void Traverse(TOverlaps const& Overlaps, TVisit const& Visit) const;
+};
@@ -0,0 +1,216 @@
+#include "SceneCulling.h"
+#include "AssertionMacros.h"
+#include "MathFunctions.h"
+#include "Tasks.h"
+#include "Print.h"
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <random>
+
+void FBoundsSoA::Clear() {
+	MinX.clear();
+	MinY.clear();
+	MinZ.clear();
+	MaxX.clear();
+	MaxY.clear();
+	MaxZ.clear();
+	Num = 0;
+}
+
+void FBoundsSoA::PushBack(FBBox const& Bounds) {
+	if (Num == MinX.size()) {
+		// empty box: every p-vertex ends at -inf (or NaN for zero normal), test always fails
+		u32 PaddedNum = Num + 4;
+		MinX.resize(PaddedNum, FINF);
+		MinY.resize(PaddedNum, FINF);
+		MinZ.resize(PaddedNum, FINF);
+		MaxX.resize(PaddedNum, -FINF);
+		MaxY.resize(PaddedNum, -FINF);
+		MaxZ.resize(PaddedNum, -FINF);
+	}
+	Set(Num++, Bounds);
+}
+
+void FBoundsSoA::Set(u32 Index, FBBox const& Bounds) {
+	check(Index < MinX.size());
+	MinX[Index] = Bounds.VMin.x;
+	MinY[Index] = Bounds.VMin.y;
+	MinZ[Index] = Bounds.VMin.z;
+	MaxX[Index] = Bounds.VMax.x;
+	MaxY[Index] = Bounds.VMax.y;
+	MaxZ[Index] = Bounds.VMax.z;
+}
+
+FBBox FBoundsSoA::Get(u32 Index) const {
+	check(Index < Num);
+	return FBBox(float3(MinX[Index], MinY[Index], MinZ[Index]), float3(MaxX[Index], MaxY[Index], MaxZ[Index]));
+}
+
+void FBoundsSoA::RemoveSwap(u32 Index) {
+	check(Index < Num);
+	FBBox Last = Get(Num - 1);
+	--Num;
+	Set(Index, Last);
+	Set(Num, FBBox(float3(FINF), float3(-FINF)));
+	if (Num % 4 == 0) {
+		MinX.resize(Num);
+		MinY.resize(Num);
+		MinZ.resize(Num);
+		MaxX.resize(Num);
+		MaxY.resize(Num);
+		MaxZ.resize(Num);
+	}
+}
+
+// frustum planes splatted for SSE, with bounds arrays of the p-vertex picked once per plane
+struct FCullPlanes {
+	__m128			X[6];
+	__m128			Y[6];
+	__m128			Z[6];
+	__m128			W[6];
+	float const *	PX[6];
+	float const *	PY[6];
+	float const *	PZ[6];
+	u32				CullBit;
+};
+
+static void SetupCullPlanes(FCullPlanes & Out, FBoundsSoA const& Bounds, FFrustum const& Frustum, u32 CullBit) {
+	for (u32 PlaneIndex = 0; PlaneIndex < 6; ++PlaneIndex) {
+		float4 Plane = Frustum.Planes[PlaneIndex];
+		Out.X[PlaneIndex] = _mm_set1_ps(Plane.x);
+		Out.Y[PlaneIndex] = _mm_set1_ps(Plane.y);
+		Out.Z[PlaneIndex] = _mm_set1_ps(Plane.z);
+		Out.W[PlaneIndex] = _mm_set1_ps(Plane.w);
+		// corner furthest along plane normal
+		Out.PX[PlaneIndex] = Plane.x >= 0 ? Bounds.MaxX.data() : Bounds.MinX.data();
+		Out.PY[PlaneIndex] = Plane.y >= 0 ? Bounds.MaxY.data() : Bounds.MinY.data();
+		Out.PZ[PlaneIndex] = Plane.z >= 0 ? Bounds.MaxZ.data() : Bounds.MinZ.data();
+	}
+	Out.CullBit = CullBit;
+}
+
+// p-vertex test of 4 boxes, same math as scalar Intersects so results match exactly
+static __m128 CullBounds4(FCullPlanes const& Planes, u32 Index) {
+	__m128 Inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (u32 PlaneIndex = 0; PlaneIndex < 6; ++PlaneIndex) {
+		__m128 Distance = _mm_mul_ps(Planes.X[PlaneIndex], _mm_loadu_ps(Planes.PX[PlaneIndex] + Index));
+		Distance = _mm_add_ps(Distance, _mm_mul_ps(Planes.Y[PlaneIndex], _mm_loadu_ps(Planes.PY[PlaneIndex] + Index)));
+		Distance = _mm_add_ps(Distance, _mm_mul_ps(Planes.Z[PlaneIndex], _mm_loadu_ps(Planes.PZ[PlaneIndex] + Index)));
+		Distance = _mm_add_ps(Distance, Planes.W[PlaneIndex]);
+
+		Inside = _mm_and_ps(Inside, _mm_cmpge_ps(Distance, _mm_setzero_ps()));
+	}
+	return Inside;
+}
+
+void CullBounds(FBoundsSoA const& Bounds, FFrustum const * Frusta, u32 CullBitsMask, u32 * OutCullMasks) {
+	FCullPlanes Planes[32];
+	u32 PlanesNum = 0;
+	for (u32 Bit = 0; Bit < 32; ++Bit) {
+		if (CullBitsMask & (1 << Bit)) {
+			SetupCullPlanes(Planes[PlanesNum++], Bounds, Frusta[Bit], Bit);
+		}
+	}
+
+	ParallelFor(Bounds.Size(), CULL_CHUNK_SIZE, [&](u32 Begin, u32 End) {
+		check(Begin % 4 == 0);
+		// last group reads into padding, lanes past End are dropped
+		for (u32 Index = Begin; Index < End; Index += 4) {
+			__m128i Masks = _mm_setzero_si128();
+			for (u32 FrustumIndex = 0; FrustumIndex < PlanesNum; ++FrustumIndex) {
+				__m128i Inside = _mm_castps_si128(CullBounds4(Planes[FrustumIndex], Index));
+				Masks = _mm_or_si128(Masks, _mm_and_si128(Inside, _mm_set1_epi32(1 << Planes[FrustumIndex].CullBit)));
+			}
+
+			if (Index + 4 <= End) {
+				_mm_storeu_si128((__m128i*)&OutCullMasks[Index], Masks);
+			}
+			else {
+				alignas(16) u32 Lanes[4];
+				_mm_store_si128((__m128i*)Lanes, Masks);
+				for (u32 Lane = 0; Index + Lane < End; ++Lane) {
+					OutCullMasks[Index + Lane] = Lanes[Lane];
+				}
+			}
+		}
+	});
+}
+
+/////////////////////////////////////////
+
+void BenchmarkCulling() {
+	// camera in origin looking down +z, 90 degree fov, row vector D3D projection
+	const float Near = 0.1f;
+	const float Far = 1000.f;
+	float4x4 Projection(
+		1.f, 0, 0, 0,
+		0, 1.f, 0, 0,
+		0, 0, Far / (Far - Near), 1.f,
+		0, 0, -Near * Far / (Far - Near), 0);
+	FFrustum Frusta[2];
+	Frusta[0] = CreateFrustum(Projection);
+	// second pass looking the other way, as a shadow or reflection view would
+	float4x4 Flip(
+		-1.f, 0, 0, 0,
+		0, 1.f, 0, 0,
+		0, 0, -1.f, 0,
+		0, 0, 0, 1.f);
+	Frusta[1] = CreateFrustum(Flip * Projection);
+
+	const u32 Counts[] = { 100000, 250000, 1000000 };
+	for (u32 ActorsNum : Counts) {
+		std::mt19937 Rng(ActorsNum);
+		std::uniform_real_distribution<float> Position(-1000.f, 1000.f);
+		std::uniform_real_distribution<float> Size(0.5f, 10.f);
+
+		FBoundsSoA Bounds;
+		for (u32 Index = 0; Index < ActorsNum; ++Index) {
+			float3 Center = float3(Position(Rng), Position(Rng), Position(Rng));
+			float3 Extent = float3(Size(Rng), Size(Rng), Size(Rng));
+			Bounds.PushBack(FBBox(Center - Extent, Center + Extent));
+		}
+
+		eastl::vector<u32> ReferenceMasks(ActorsNum);
+		i64 StartTicks = GetCpuTicks();
+		for (u32 Index = 0; Index < ActorsNum; ++Index) {
+			FBBox Box = Bounds.Get(Index);
+			ReferenceMasks[Index] = (u32)Intersects(Frusta[0], Box) | ((u32)Intersects(Frusta[1], Box) << 1);
+		}
+		double ScalarMs = CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+
+		eastl::vector<u32> CullMasks(ActorsNum);
+		// warm up workers and caches, then take the best of few runs
+		CullBounds(Bounds, Frusta, 0x3, CullMasks.data());
+		double BestMs = 1e9;
+		for (u32 Run = 0; Run < 8; ++Run) {
+			StartTicks = GetCpuTicks();
+			CullBounds(Bounds, Frusta, 0x3, CullMasks.data());
+			BestMs = eastl::min(BestMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+		}
+
+		u32 Mismatches = 0;
+		u32 Visible = 0;
+		for (u32 Index = 0; Index < ActorsNum; ++Index) {
+			Mismatches += CullMasks[Index] != ReferenceMasks[Index];
+			Visible += CullMasks[Index] != 0;
+		}
+
+		PrintFormated(L"culling %u actors, 2 frusta: scalar %.3f ms, simd %u workers %.3f ms, %u visible, %u mismatches\n",
+			ActorsNum, ScalarMs, GetWorkersNum(), BestMs, Visible, Mismatches);
+
+		// removal keeps padding empty and moves last box into the hole, reference masks move the same way
+		u32 RemovedNum = ActorsNum / 10 + 3;
+		for (u32 Removed = 0; Removed < RemovedNum; ++Removed) {
+			u32 Index = Rng() % Bounds.Size();
+			Bounds.RemoveSwap(Index);
+			ReferenceMasks[Index] = ReferenceMasks.back();
+			ReferenceMasks.pop_back();
+		}
+		CullBounds(Bounds, Frusta, 0x3, CullMasks.data());
+		Mismatches = 0;
+		for (u32 Index = 0; Index < Bounds.Size(); ++Index) {
+			Mismatches += CullMasks[Index] != ReferenceMasks[Index];
+		}
+		PrintFormated(L"culling after removing %u actors: %u left, %u mismatches\n", RemovedNum, Bounds.Size(), Mismatches);
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "Essence.h"
+#include "MathGeometry.h"
+#include <EASTL/vector.h>
+
+// actors culled by one task
+const u32 CULL_CHUNK_SIZE = 4096;
+
+// world bounds SoA, arrays are padded to a multiple of 4 with empty boxes that never pass a test
+class FBoundsSoA {
+public:
+	eastl::vector<float>	MinX;
+	eastl::vector<float>	MinY;
+	eastl::vector<float>	MinZ;
+	eastl::vector<float>	MaxX;
+	eastl::vector<float>	MaxY;
+	eastl::vector<float>	MaxZ;
+
+	u32 Size() const { return Num; }
+	void Clear();
+	void PushBack(FBBox const& Bounds);
+	void Set(u32 Index, FBBox const& Bounds);
+	FBBox Get(u32 Index) const;
+	// moves last element into Index
+	void RemoveSwap(u32 Index);
+
+private:
+	u32						Num = 0;
+};
+
+// writes bit N of OutCullMasks[i] when bounds i are inside Frusta[N], only bits in CullBitsMask are tested
+// 4 boxes per SSE test, split across task workers in CULL_CHUNK_SIZE chunks
+void CullBounds(FBoundsSoA const& Bounds, FFrustum const * Frusta, u32 CullBitsMask, u32 * OutCullMasks);
+
+// scalar Intersects against CullBounds for 100k-1M boxes, no GPU needed
+void BenchmarkCulling();
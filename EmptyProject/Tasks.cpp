@@ -0,0 +1,146 @@
+#include "Tasks.h"
+#include "AssertionMacros.h"
+#include <EASTL/deque.h>
+#include <EASTL/vector.h>
+#include <EASTL/unique_ptr.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct FQueuedTask {
+	FTaskFunc		Func;
+	FTaskCounter *	Counter;
+};
+
+class FTaskSystem {
+public:
+	eastl::vector<std::thread>	Workers;
+	eastl::deque<FQueuedTask>	Queue;
+	std::mutex					QueueLock;
+	std::condition_variable		QueueSignal;
+	std::atomic<bool>			Quit{ false };
+
+	bool TryPop(FQueuedTask & OutTask) {
+		std::lock_guard<std::mutex> Lock(QueueLock);
+		if (Queue.empty()) {
+			return false;
+		}
+		OutTask = std::move(Queue.front());
+		Queue.pop_front();
+		return true;
+	}
+
+	void Execute(FQueuedTask & Task) {
+		Task.Func();
+		Task.Counter->Pending.fetch_sub(1, std::memory_order_release);
+	}
+};
+
+const u32 INVALID_WORKER_INDEX = 0xFFFFFFFF;
+
+eastl::unique_ptr<FTaskSystem>	GTaskSystem;
+// set once system is fully constructed, lock is taken only when it isn't
+std::atomic<bool>				GTaskSystemReady{ false };
+std::mutex						GTaskSystemLock;
+thread_local u32				GWorkerIndex = INVALID_WORKER_INDEX;
+
+void WorkerLoop(FTaskSystem * System, u32 WorkerIndex) {
+	GWorkerIndex = WorkerIndex;
+
+	while (1) {
+		FQueuedTask Task;
+		{
+			std::unique_lock<std::mutex> Lock(System->QueueLock);
+			System->QueueSignal.wait(Lock, [System]() { return System->Quit || !System->Queue.empty(); });
+			if (System->Queue.empty()) {
+				// quit requested and nothing left
+				return;
+			}
+			Task = std::move(System->Queue.front());
+			System->Queue.pop_front();
+		}
+		System->Execute(Task);
+	}
+}
+
+void InitTaskSystem(u32 WorkersNum) {
+	if (GTaskSystemReady.load(std::memory_order_acquire)) {
+		return;
+	}
+	std::lock_guard<std::mutex> InitLock(GTaskSystemLock);
+	if (GTaskSystem.get()) {
+		return;
+	}
+
+	if (WorkersNum == 0) {
+		u32 HardwareThreads = std::thread::hardware_concurrency();
+		WorkersNum = HardwareThreads > 1 ? HardwareThreads - 1 : 0;
+	}
+
+	GWorkerIndex = 0;
+	GTaskSystem = eastl::make_unique<FTaskSystem>();
+	for (u32 Index = 0; Index < WorkersNum; ++Index) {
+		GTaskSystem->Workers.push_back(std::thread(WorkerLoop, GTaskSystem.get(), Index + 1));
+	}
+	GTaskSystemReady.store(true, std::memory_order_release);
+}
+
+void ShutdownTaskSystem() {
+	std::lock_guard<std::mutex> InitLock(GTaskSystemLock);
+	if (!GTaskSystem.get()) {
+		return;
+	}
+	GTaskSystemReady.store(false, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> Lock(GTaskSystem->QueueLock);
+		GTaskSystem->Quit = true;
+	}
+	GTaskSystem->QueueSignal.notify_all();
+	for (auto & Worker : GTaskSystem->Workers) {
+		Worker.join();
+	}
+	GTaskSystem.reset();
+}
+
+u32 GetWorkersNum() {
+	InitTaskSystem();
+	return (u32)GTaskSystem->Workers.size() + 1;
+}
+
+u32 GetCurrentWorkerIndex() {
+	InitTaskSystem();
+	// per-thread data is sized by GetWorkersNum, two threads sharing an index would race on it
+	check(GWorkerIndex != INVALID_WORKER_INDEX);
+	return GWorkerIndex;
+}
+
+void SpawnTask(FTaskCounter & Counter, FTaskFunc Task) {
+	InitTaskSystem();
+
+	Counter.Pending.fetch_add(1, std::memory_order_relaxed);
+
+	if (GTaskSystem->Workers.size() == 0) {
+		FQueuedTask Inline = { std::move(Task), &Counter };
+		GTaskSystem->Execute(Inline);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> Lock(GTaskSystem->QueueLock);
+		GTaskSystem->Queue.push_back({ std::move(Task), &Counter });
+	}
+	GTaskSystem->QueueSignal.notify_one();
+}
+
+void WaitForTasks(FTaskCounter & Counter) {
+	while (Counter.Pending.load(std::memory_order_acquire) > 0) {
+		FQueuedTask Task;
+		if (GTaskSystem->TryPop(Task)) {
+			GTaskSystem->Execute(Task);
+		}
+		else {
+			std::this_thread::yield();
+		}
+	}
+}
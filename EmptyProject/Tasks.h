@@ -0,0 +1,78 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/functional.h>
+#include <EASTL/algorithm.h>
+#include <EASTL/vector.h>
+#include <atomic>
+#include <thread>
+
+typedef eastl::function<void()> FTaskFunc;
+
+// counts tasks in flight, wait on it to join spawned work
+class FTaskCounter {
+public:
+	std::atomic<u32> Pending{ 0 };
+
+	FTaskCounter() = default;
+	FTaskCounter(FTaskCounter const&) = delete;
+
+	// non-blocking check, use WaitForTasks to join
+	bool IsDone() const { return Pending.load(std::memory_order_acquire) == 0; }
+};
+
+// workers are created on first use, 0 means hardware concurrency - 1
+// thread that starts the system becomes main thread, thread safe against concurrent first uses
+void InitTaskSystem(u32 WorkersNum = 0);
+void ShutdownTaskSystem();
+
+// main thread + workers
+u32 GetWorkersNum();
+// 0 for main thread, workers are 1..N, other threads have no index and must not call it (checked)
+// use to index per-thread scratch data (arenas, local lists)
+u32 GetCurrentWorkerIndex();
+
+void SpawnTask(FTaskCounter & Counter, FTaskFunc Task);
+// executes queued tasks while waiting, safe to call from inside tasks
+void WaitForTasks(FTaskCounter & Counter);
+
+// Func(u32 Begin, u32 End) over [0, Num) in chunks of Granularity
+template<typename F>
+void ParallelFor(u32 Num, u32 Granularity, F const& Func) {
+	if (Num == 0) {
+		return;
+	}
+	Granularity = Granularity ? Granularity : 1;
+	if (Num <= Granularity || GetWorkersNum() == 1) {
+		Func(0, Num);
+		return;
+	}
+
+	FTaskCounter Counter;
+	for (u32 Begin = Granularity; Begin < Num; Begin += Granularity) {
+		u32 End = eastl::min(Begin + Granularity, Num);
+		SpawnTask(Counter, [&Func, Begin, End]() { Func(Begin, End); });
+	}
+	Func(0, Granularity);
+	WaitForTasks(Counter);
+}
+
+// for benchmarks, Func(ThreadIndex) on ThreadsNum plain threads released together, returns ms from release to last join
+template<typename F>
+double RunOnThreads(u32 ThreadsNum, F const& Func) {
+	std::atomic<bool> Go{ false };
+	eastl::vector<std::thread> Threads;
+	for (u32 Index = 0; Index < ThreadsNum; ++Index) {
+		Threads.push_back(std::thread([&Go, &Func, Index]() {
+			while (!Go.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+			Func(Index);
+		}));
+	}
+	i64 StartTicks = GetCpuTicks();
+	Go.store(true, std::memory_order_release);
+	for (auto & Thread : Threads) {
+		Thread.join();
+	}
+	return CpuTicksToMilliseconds(GetCpuTicks() - StartTicks);
+}
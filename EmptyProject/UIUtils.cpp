@@ -5,6 +5,9 @@
 #include "Device.h"
 #include "Shader.h"
 #include "Pipeline.h"
+#include "Commands.h"
+#include "VideoMemory.h"
+#include "Descriptors.h"
 
 void ShowMemoryInfo() {
 	auto localMemory = GetLocalMemoryInfo();
@@ -42,6 +45,59 @@ void ShowMemoryInfo() {
 		, Megabytes(perfInfo.PhysicalTotal * perfInfo.PageSize)
 		, Megabytes(perfInfo.PhysicalAvailable * perfInfo.PageSize));
 	ImGui::Unindent();
+
+	ImGui::Separator();
+
+	ImGui::BulletText("Placed render targets");
+	FHeapStats heapStats = GetPooledRenderTargetAllocator()->GetHeapStats();
+	ImGui::Indent();
+	ImGui::Text("Heaps:
+Heaps size:
+In use:
+Largest free range:
+Free ranges:
+Cached textures:"); ImGui::SameLine();
+	ImGui::Text("%u\n%llu Mb\n%llu Mb\n%llu Mb\n%u\n%u"
+		, heapStats.HeapsNum
+		, Megabytes(heapStats.HeapsBytes)
+		, Megabytes(heapStats.AllocatedBytes)
+		, Megabytes(heapStats.LargestFreeBytes)
+		, heapStats.FreeBlocksNum
+		, GetPooledRenderTargetAllocator()->GetCachedNum());
+	ImGui::Unindent();
+
+	ImGui::Separator();
+
+	ImGui::BulletText("Descriptors");
+	ImGui::Indent();
+	const char * HeapNames[] = { "Shader visible", "Views" };
+	FDescriptorAllocator * Heaps[] = { GetOnlineDescriptorsAllocator(), GetViewDescriptorsAllocator() };
+	for (u32 Index = 0; Index < _countof(Heaps); ++Index) {
+		FDescriptorRangesStats descStats = Heaps[Index]->GetStats();
+		u32 bucketCapacity = descStats.BucketBlocksNum * FDescriptorRanges::BLOCK_SIZE;
+		ImGui::Text(HeapNames[Index]);
+		ImGui::Text("Blocks used:\nTemporary blocks:\nBucket occupancy:\nRounding waste:\nReleased blocks:"); ImGui::SameLine();
+		ImGui::Text("%u / %u\n%u\n%.1f%%\n%u\n%u"
+			, descStats.UsedBlocksNum, descStats.BlocksNum
+			, descStats.TemporaryBlocksNum
+			, bucketCapacity ? 100.f * descStats.AllocatedDescriptors / bucketCapacity : 0.f
+			, descStats.AllocatedDescriptors - descStats.RequestedDescriptors
+			, descStats.ReleasedBlocksNum);
+	}
+	ImGui::Unindent();
+
+	ImGui::Separator();
+
+	ImGui::BulletText("Staging ring");
+	FStagingStats stagingStats = GetStagingAllocator()->GetStats();
+	ImGui::Indent();
+	ImGui::Text("In flight:\nPending batches:\nSkipped at wrap:\nFallbacks:"); ImGui::SameLine();
+	ImGui::Text("%llu / %llu Mb\n%u\n%llu Mb\n%u (%llu Mb)"
+		, Megabytes(stagingStats.UsedBytes), Megabytes(stagingStats.RingSize)
+		, stagingStats.BatchesNum
+		, Megabytes(stagingStats.WrapWaste)
+		, stagingStats.FallbacksNum, Megabytes(stagingStats.FallbackBytes));
+	ImGui::Unindent();
 }
 
 void ShowAppStats() {
@@ -56,6 +112,13 @@ void ShowAppStats() {
 		ImGui::Text("Shaders:\nPSOs:\nCurrent shaders version:"); ImGui::SameLine();
 		ImGui::Text("%u\n%u\n%u", GetShadersNum(), GetPSOsNum(), (u32)GShadersCompilationVersion);
 	}
+	if (ImGui::CollapsingHeader("Commands")) {
+		commands_stats_t const& Stats = GetLastFrameStats().command_stats;
+
+		ImGui::Text("Barriers:\nElided barriers:\nCompacted packets:\nCompacted bytes:\nBundles recorded:\nBundles executed:\nAliasing barriers:\nTransients unaliased:\nTransients packed:"); ImGui::SameLine();
+		ImGui::Text("%u\n%u\n%u\n%llu\n%u\n%u\n%u\n%llu Mb\n%llu Mb", Stats.barriers, Stats.barriers_elided, Stats.packets_compacted, Stats.bytes_compacted, Stats.bundles_recorded, Stats.bundles_executed,
+			Stats.aliasing_barriers, Megabytes(Stats.transient_bytes), Megabytes(Stats.transient_bytes_packed));
+	}
 	if (ImGui::CollapsingHeader("Memory")) {
 		ShowMemoryInfo();
 	}
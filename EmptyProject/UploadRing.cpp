@@ -0,0 +1,174 @@
+#include "UploadRing.h"
+#include "AssertionMacros.h"
+#include "Print.h"
+#include <EASTL/vector.h>
+#include <EASTL/map.h>
+#include <EASTL/algorithm.h>
+#include <random>
+
+FUploadRing::FUploadRing(u64 InSize) : Size(InSize) {
+}
+
+bool FUploadRing::Allocate(u64 AllocationSize, u64 Alignment, u64 * OutOffset) {
+	check(Alignment && (Alignment & (Alignment - 1)) == 0);
+	if (AllocationSize > Size) {
+		return false;
+	}
+
+	u64 Position = Head;
+	u64 Offset = Position % Size;
+	u64 Aligned = (Offset + Alignment - 1) & ~(Alignment - 1);
+	u64 Skipped = 0;
+	if (Aligned + AllocationSize > Size) {
+		Skipped = Size - Offset;
+		Position += Skipped;
+		Offset = 0;
+		Aligned = 0;
+	}
+
+	u64 End = Position + (Aligned - Offset) + AllocationSize;
+	if (End - Tail > Size) {
+		return false;
+	}
+
+	WrapWaste += Skipped;
+	Head = End;
+	*OutOffset = Aligned;
+	return true;
+}
+
+void FUploadRing::CloseBatch(u64 FenceValue) {
+	check(!Batches.size() || Batches.back().FenceValue <= FenceValue);
+	if (Head == ClosedHead) {
+		return;
+	}
+	Batches.push({ Head, FenceValue });
+	ClosedHead = Head;
+}
+
+u32 FUploadRing::Reclaim(u64 CompletedValue) {
+	u32 ReclaimedNum = 0;
+	while (Batches.size() && Batches.front().FenceValue <= CompletedValue) {
+		Tail = Batches.front().End;
+		Batches.pop();
+		ReclaimedNum++;
+	}
+	return ReclaimedNum;
+}
+
+/////////////////////////////////////////
+
+void BenchmarkUploadRing() {
+	const u64 MB = 1024 * 1024;
+	const u64 RingSize = 32 * MB;
+	const u32 FramesNum = 2000;
+	// frame N is done on fake gpu when frame N + Latency starts
+	const u64 Latency = 2;
+
+	// per frame: constant-ish buffer updates, texture every few frames, now and then one bigger than ring
+	struct FUpload {
+		u64 Size;
+		u64 Alignment;
+	};
+	eastl::vector<eastl::vector<FUpload>> Frames(FramesNum);
+	std::mt19937 Rng(FramesNum);
+	u64 TotalBytes = 0;
+	u32 UploadsNum = 0;
+	for (u32 Frame = 0; Frame < FramesNum; ++Frame) {
+		u32 BuffersNum = 100 + Rng() % 200;
+		for (u32 Index = 0; Index < BuffersNum; ++Index) {
+			Frames[Frame].push_back({ 256 + Rng() % (64 * 1024), 256 });
+		}
+		if (Frame % 8 == 0) {
+			Frames[Frame].push_back({ (1 + Rng() % 8) * MB, 512 });
+		}
+		if (Frame % 250 == 249) {
+			Frames[Frame].push_back({ 48 * MB, 512 });
+		}
+		for (FUpload const& Upload : Frames[Frame]) {
+			TotalBytes += Upload.Size;
+		}
+		UploadsNum += (u32)Frames[Frame].size();
+	}
+
+	// ranges stay live until fake gpu finishes their frame, new range must not overlap any of them
+	eastl::map<u64, u64> LiveRanges;
+	eastl::vector<eastl::vector<u64>> InFlight(FramesNum);
+
+	u32 Errors = 0;
+	double RingMs = 1e9;
+	u32 Stalls = 0;
+	u32 Fallbacks = 0;
+	u64 PeakUsed = 0;
+	u64 WrapWaste = 0;
+	for (u32 Run = 0; Run < 4; ++Run) {
+		const bool bValidate = Run == 0;
+		FUploadRing Ring(RingSize);
+		u64 Completed = 0;
+		u64 Verified = 0;
+		Stalls = 0;
+		Fallbacks = 0;
+
+		auto Complete = [&](u64 Value) {
+			Completed = eastl::max(Completed, Value);
+			if (!bValidate) {
+				return;
+			}
+			for (; Verified < Completed; ++Verified) {
+				for (u64 Offset : InFlight[Verified]) {
+					LiveRanges.erase(Offset);
+				}
+				InFlight[Verified].clear();
+			}
+		};
+
+		i64 StartTicks = GetCpuTicks();
+		for (u32 Frame = 0; Frame < FramesNum; ++Frame) {
+			// fence value of frame is its index + 1
+			Complete(Frame > Latency ? Frame - Latency : 0);
+			Ring.Reclaim(Completed);
+
+			for (u32 Index = 0; Index < Frames[Frame].size(); ++Index) {
+				FUpload const& Upload = Frames[Frame][Index];
+				u64 Offset;
+				bool bAllocated = Ring.Allocate(Upload.Size, Upload.Alignment, &Offset);
+				// wait for oldest frame on fake gpu and try again
+				while (!bAllocated && Ring.GetBatchesNum()) {
+					Stalls++;
+					Complete(Ring.GetOldestFence());
+					Ring.Reclaim(Completed);
+					bAllocated = Ring.Allocate(Upload.Size, Upload.Alignment, &Offset);
+				}
+				if (!bAllocated) {
+					Fallbacks++;
+					continue;
+				}
+
+				if (bValidate) {
+					Errors += Offset % Upload.Alignment != 0 || Offset + Upload.Size > RingSize;
+					auto Next = LiveRanges.lower_bound(Offset);
+					Errors += Next != LiveRanges.end() && Next->first < Offset + Upload.Size;
+					Errors += Next != LiveRanges.begin() && eastl::prev(Next)->second > Offset;
+					LiveRanges[Offset] = Offset + Upload.Size;
+					InFlight[Frame].push_back(Offset);
+					PeakUsed = eastl::max(PeakUsed, Ring.GetUsedSize());
+				}
+			}
+			Ring.CloseBatch(Frame + 1);
+		}
+		Complete(FramesNum);
+		Ring.Reclaim(Completed);
+		Errors += Ring.GetUsedSize() != 0 || Ring.GetBatchesNum() != 0 || LiveRanges.size() != 0;
+
+		if (bValidate) {
+			WrapWaste = Ring.GetWrapWaste();
+		}
+		else {
+			RingMs = eastl::min(RingMs, CpuTicksToMilliseconds(GetCpuTicks() - StartTicks));
+		}
+	}
+
+	PrintFormated(L"upload ring, %u frames, %u uploads, %llu MB through %llu MB ring: %.3f ms (%.1f Mallocs/s), peak %llu MB used, %llu MB skipped at wrap, %u stalls, %u fallbacks, %u errors\n",
+		FramesNum, UploadsNum, TotalBytes / MB, RingSize / MB,
+		RingMs, UploadsNum / RingMs / 1000., PeakUsed / MB, WrapWaste / MB, Stalls, Fallbacks, Errors);
+}
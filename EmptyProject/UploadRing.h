@@ -0,0 +1,43 @@
+#pragma once
+#include "Essence.h"
+#include <EASTL/queue.h>
+
+// ring over [0, Size) handing out ranges in submission order, given back a batch at a time once batch fence completes
+// fence values only have to grow, gpu queue values in engine and counter in benchmark
+// range never wraps: one that would cross the end starts at 0 and the gap before the end is skipped
+class FUploadRing {
+public:
+	explicit FUploadRing(u64 InSize);
+
+	// false when there is no room until older batches complete, or Size is bigger than ring
+	bool Allocate(u64 Size, u64 Alignment, u64 * OutOffset);
+	// ranges allocated since last call complete with FenceValue, nothing is kept for empty batch
+	void CloseBatch(u64 FenceValue);
+	// gives back batches with fence value <= CompletedValue, returns their number
+	u32 Reclaim(u64 CompletedValue);
+
+	u64 GetSize() const { return Size; }
+	u64 GetUsedSize() const { return Head - Tail; }
+	u32 GetBatchesNum() const { return (u32)Batches.size(); }
+	// fence to wait for when Allocate fails, only valid with batches pending
+	u64 GetOldestFence() const { return Batches.front().FenceValue; }
+	// bytes skipped at the end of the ring since start
+	u64 GetWrapWaste() const { return WrapWaste; }
+
+private:
+	struct FBatch {
+		u64 End;
+		u64 FenceValue;
+	};
+
+	const u64				Size;
+	// positions grow forever, offset is position % Size
+	u64						Head = 0;
+	u64						Tail = 0;
+	u64						ClosedHead = 0;
+	u64						WrapWaste = 0;
+	eastl::queue<FBatch>	Batches;
+};
+
+// frames of buffer and texture uploads with gpu latency faked by a counter, no range is reused before fake gpu is done with it
+void BenchmarkUploadRing();
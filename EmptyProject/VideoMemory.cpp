@@ -2,7 +2,10 @@
 #include "d3dx12.h"
 #include "Descriptors.h"
 #include <EASTL/queue.h>
+#include <EASTL/algorithm.h>
 #include "PointerMath.h"
+#include "Hash.h"
+#include "Tasks.h"
 #include <atomic>  
 
 eastl::unique_ptr<FDescriptorAllocator> OnlineSOVsAllocator;
@@ -13,9 +16,11 @@ eastl::unique_ptr<FDescriptorAllocator> RTVsAllocator;
 eastl::unique_ptr<FTextureAllocator> TexturesAllocator;
 eastl::unique_ptr<FLinearAllocator> ConstantsAllocator;
 eastl::unique_ptr<FUploadBufferAllocator> UploadAllocator;
+eastl::unique_ptr<FStagingAllocator> StagingAllocator;
 eastl::unique_ptr<FBuffersAllocator> BuffersAllocator;
 
 eastl::unique_ptr<FPooledRenderTargetAllocator>	PooledRenderTargetAllocator;
+eastl::unique_ptr<FTransientTextureAllocator>	TransientTexturesAllocator;
 
 void FreeAllocators() {
 	OnlineSOVsAllocator.detach();
@@ -26,9 +31,11 @@ void FreeAllocators() {
 	TexturesAllocator.detach();
 	ConstantsAllocator.detach();
 	UploadAllocator.detach();
+	StagingAllocator.detach();
 	BuffersAllocator.detach();
 
 	PooledRenderTargetAllocator.detach();
+	TransientTexturesAllocator.detach();
 }
 
 void TickDescriptors(FGPUSyncPoint FrameEndSync) {
@@ -136,62 +143,70 @@ void eastl::default_delete<FGPUResource>::operator()(FGPUResource* GPUResource)
 	}
 }
 
-FLinearAllocator::~FLinearAllocator() {
-	check(PendingQueue.size() == 0);
-}
-
-void	FLinearAllocator::AllocateNewBlock() {
-	if (CurrentBlock) {
-		PendingBlocks.push(std::move(CurrentBlock));
-		++CurrentFrameBlocks;
+// upload buffers as blocks, view slots are temporary descriptors fenced with the frame
+class FUploadLinearBlockBackend : public FLinearBlockBackend {
+public:
+	FUploadBufferAllocator *		HelperAllocator;
+	eastl::vector<FGPUResourceRef>	Buffers;
+
+	FUploadLinearBlockBackend(FUploadBufferAllocator * InHelperAllocator) : HelperAllocator(InHelperAllocator) {}
+
+	void CreateBlock(u64 Size, FLinearBlock * OutBlock) override {
+		FGPUResourceRef Buffer = HelperAllocator->CreateBuffer(Size, 0);
+		Buffer->SetDebugName(L"FLinearAllocator Block");
+		OutBlock->Handle = Buffer.get();
+		OutBlock->CPUPtr = (u8*)Buffer->FatData->CpuPtr;
+		OutBlock->GPUAddress = Buffer->D12Resource->GetGPUVirtualAddress();
+		Buffers.push_back(std::move(Buffer));
 	}
 
-	CurrentBlockOffset = 0;
+	void DestroyBlock(FLinearBlock * Block) override {
+	}
 
-	if (ReadyBlocks.size()) {
-		CurrentBlock = std::move(ReadyBlocks.back());
-		ReadyBlocks.pop_back();
-		return;
+	u32 ReserveViews(u32 Num) override {
+		return SOVsAllocator->FastTemporaryAllocate(Num).HeapOffset;
 	}
+};
 
-	CurrentBlock = std::move(HelperAllocator->CreateBuffer(BlockSize, 0));
-	CurrentBlock->SetDebugName(L"FLinearAllocator Block");
+FLinearAllocator::FLinearAllocator(u32 MaxResources, u32 blockSize) : FResourceAllocator(MaxResources) {
+	HelperAllocator = eastl::make_unique<FUploadBufferAllocator>(1024);
+	Backend = eastl::make_unique<FUploadLinearBlockBackend>(HelperAllocator.get());
+	Blocks = eastl::make_unique<FConcurrentLinearAllocator>(Backend.get(), blockSize, GetWorkersNum());
 }
 
-FFastUploadAllocation		FLinearAllocator::Allocate(u64 size, u64 alignment) {
-	check(size <= BlockSize);
-	u64 allocationOffset = ((CurrentBlockOffset + alignment - 1) & ~(alignment - 1));
-	u64 nextOffset = allocationOffset + size;
-
-	if (!CurrentBlock || nextOffset > BlockSize) {
-		AllocateNewBlock();
-		allocationOffset = ((CurrentBlockOffset + alignment - 1) & ~(alignment - 1));
-		nextOffset = allocationOffset + size;
-	}
+FLinearAllocator::~FLinearAllocator() {
+	check(PendingQueue.size() == 0);
+}
 
-	CurrentBlockOffset = nextOffset;
+FFastUploadAllocation		FLinearAllocator::Allocate(u64 size, u64 alignment) {
+	FLinearAllocation allocation = Blocks->Allocate(GetCurrentWorkerIndex(), size, alignment, true);
 
-	auto handle = SOVsAllocator->FastTemporaryAllocate(1);
 	FFastUploadAllocation result = {};
-	result.CPUPtr = pointer_add(CurrentBlock->FatData->CpuPtr, allocationOffset);
-	result.CPUHandle = handle.GetCPUHandle(0);
+	result.CPUPtr = allocation.CPUPtr;
+	result.GPUAddress = allocation.GPUAddress;
+	result.CPUHandle = CD3DX12_CPU_DESCRIPTOR_HANDLE(SOVsAllocator->D12DescriptorHeap->GetCPUDescriptorHandleForHeapStart(), allocation.View, SOVsAllocator->IncrementSize);
 
+	// views can be created from any thread
 	D3D12_CONSTANT_BUFFER_VIEW_DESC CbvDesc = {};
-	CbvDesc.BufferLocation = CurrentBlock->D12Resource->GetGPUVirtualAddress() + allocationOffset;
+	CbvDesc.BufferLocation = allocation.GPUAddress;
 	CbvDesc.SizeInBytes = (u32)(size + 255) & ~255;
 	GetPrimaryDevice()->D12Device->CreateConstantBufferView(&CbvDesc, result.CPUHandle);
 
 	return result;
 }
 
-void	FLinearAllocator::FenceFrameAllocations(FGPUSyncPoint sync) {
-	if (CurrentBlock) {
-		PendingBlocks.push(std::move(CurrentBlock));
-		++CurrentFrameBlocks;
-	}
+FFastUploadAllocation		FLinearAllocator::AllocateWithoutView(u64 size, u64 alignment) {
+	FLinearAllocation allocation = Blocks->Allocate(GetCurrentWorkerIndex(), size, alignment, false);
 
-	PendingQueue.push(FencedBlocks(sync, CurrentFrameBlocks));
-	CurrentFrameBlocks = 0;
+	FFastUploadAllocation result = {};
+	result.CPUPtr = allocation.CPUPtr;
+	result.GPUAddress = allocation.GPUAddress;
+	return result;
+}
+
+void	FLinearAllocator::FenceFrameAllocations(FGPUSyncPoint sync) {
+	PendingQueue.push(FencedBlocks(sync, {}));
+	Blocks->CloseFrame(PendingQueue.back().second);
 }
 
 void	FLinearAllocator::Tick() {
@@ -199,10 +214,8 @@ void	FLinearAllocator::Tick() {
 	HelperAllocator->Tick();
 
 	while (PendingQueue.size() && PendingQueue.front().first.IsCompleted()) {
-		u32 Num = PendingQueue.front().second;
-		for (u32 i = 0; i < Num; ++i) {
-			ReadyBlocks.push_back(std::move(PendingBlocks.front()));
-			PendingBlocks.pop();
+		for (FLinearBlock * Block : PendingQueue.front().second) {
+			Blocks->ReturnBlock(Block);
 		}
 		PendingQueue.pop();
 	}
@@ -224,6 +237,103 @@ FUploadBufferAllocator *	GetUploadAllocator() {
 	return UploadAllocator.get();
 }
 
+FStagingAllocator::FStagingAllocator(u32 MaxResources) : FResourceAllocator(MaxResources), Ring(RING_SIZE) {
+	HelperAllocator = eastl::make_unique<FUploadBufferAllocator>(1024);
+	RingBuffer = HelperAllocator->CreateBuffer(RING_SIZE, 0);
+	RingBuffer->SetDebugName(L"FStagingAllocator Ring");
+}
+
+FStagingAllocation	FStagingAllocator::Allocate(u64 size, u64 alignment, FGPUSyncPoint Consumer) {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	u64 Offset;
+	bool bAllocated = Ring.Allocate(size, alignment, &Offset);
+	if (!bAllocated && Ring.GetBatchesNum()) {
+		Reclaim();
+		bAllocated = Ring.Allocate(size, alignment, &Offset);
+	}
+
+	FStagingAllocation result = {};
+	if (bAllocated) {
+		// consumers of one batch are the same few command lists
+		if (eastl::find(BatchConsumers.begin(), BatchConsumers.end(), Consumer) == BatchConsumers.end()) {
+			BatchConsumers.push_back(Consumer);
+		}
+		result.CPUPtr = (u8*)RingBuffer->FatData->CpuPtr + Offset;
+		result.Resource = RingBuffer.get();
+		result.Offset = Offset;
+		result.GPUAddress = RingBuffer->GetGPUAddress() + Offset;
+		return result;
+	}
+
+	// buffer is released right away, deletion waits for consumer
+	FallbacksNum++;
+	FallbackBytes += size;
+	FGPUResourceRef Buffer = HelperAllocator->CreateBuffer(size, alignment);
+	Buffer->FenceDeletion(Consumer);
+	result.CPUPtr = Buffer->FatData->CpuPtr;
+	result.Resource = Buffer.get();
+	result.Offset = 0;
+	result.GPUAddress = Buffer->GetGPUAddress();
+	return result;
+}
+
+void	FStagingAllocator::Reclaim() {
+	while (PendingQueue.size()) {
+		eastl::vector<FGPUSyncPoint> & Consumers = PendingQueue.front().second;
+		while (Consumers.size() && Consumers.back().IsCompleted()) {
+			Consumers.pop_back();
+		}
+		if (Consumers.size()) {
+			break;
+		}
+		CompletedTicket = PendingQueue.front().first;
+		PendingQueue.pop();
+	}
+	Ring.Reclaim(CompletedTicket);
+}
+
+void	FStagingAllocator::FenceFrameAllocations() {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	if (!BatchConsumers.size()) {
+		return;
+	}
+	u64 Ticket = NextTicket++;
+	Ring.CloseBatch(Ticket);
+	PendingQueue.push(FencedBatch(Ticket, {}));
+	PendingQueue.back().second.swap(BatchConsumers);
+}
+
+void	FStagingAllocator::Tick() {
+	FResourceAllocator::Tick();
+	HelperAllocator->Tick();
+
+	std::lock_guard<std::mutex> Guard(Lock);
+	Reclaim();
+}
+
+FStagingStats	FStagingAllocator::GetStats() {
+	std::lock_guard<std::mutex> Guard(Lock);
+
+	FStagingStats Stats = {};
+	Stats.RingSize = Ring.GetSize();
+	Stats.UsedBytes = Ring.GetUsedSize();
+	Stats.BatchesNum = Ring.GetBatchesNum();
+	Stats.WrapWaste = Ring.GetWrapWaste();
+	Stats.FallbacksNum = FallbacksNum;
+	Stats.FallbackBytes = FallbackBytes;
+	return Stats;
+}
+
+FStagingAllocator *	GetStagingAllocator() {
+	if (!StagingAllocator.get()) {
+		StagingAllocator = eastl::make_unique<FStagingAllocator>(64 * 1024);
+	}
+
+	return StagingAllocator.get();
+}
+
 FGPUResourceRef FUploadBufferAllocator::CreateBuffer(u64 size, u64 alignment) {
 	FGPUResourceRef resource = Allocate();
 	resource->FatData->Type = ResourceType::BUFFER;
@@ -357,6 +467,11 @@ void InitDescriptorHeaps() {
 	}
 }
 
+FDescriptorAllocator* GetViewDescriptorsAllocator() {
+	InitDescriptorHeaps();
+	return SOVsAllocator.get();
+}
+
 void InitNullDescriptors() {
 	InitDescriptorHeaps();
 }
@@ -561,7 +676,7 @@ void AllocateResourceViews(FGPUResource* resource) {
 	AllocateResourceViews(resource, resource->FatData->ViewFormat, resource->FatData->Views.MainSet);
 }
 
-void ConstructTexture(FGPUResource * Resource, u64 width, u32 height, u32 depthOrArraySize, DXGI_FORMAT format, TextureFlags flags, wchar_t const* debugName, DXGI_FORMAT clearFormat, float4 clearColor, float clearDepth, u8 clearStencil) {
+static D3D12_RESOURCE_DESC GetTextureDesc(u64 width, u32 height, u32 depthOrArraySize, DXGI_FORMAT format, TextureFlags flags) {
 	check(!((flags & (ALLOW_RENDER_TARGET | ALLOW_UNORDERED_ACCESS)) && (flags & ALLOW_DEPTH_STENCIL)));
 	check(!((flags & TEXTURE_3D) && (flags & TEXTURE_CUBEMAP)));
 	check(!((flags & TEXTURE_CUBEMAP) && (depthOrArraySize % 6) != 0));
@@ -581,6 +696,13 @@ void ConstructTexture(FGPUResource * Resource, u64 width, u32 height, u32 depthO
 		| ((flags & ALLOW_DEPTH_STENCIL) ? D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL : D3D12_RESOURCE_FLAG_NONE)
 		| ((flags & ALLOW_UNORDERED_ACCESS) ? D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS : D3D12_RESOURCE_FLAG_NONE)
 		;
+	return desc;
+}
+
+// committed by default, placed when Heaps or Placement is given
+// Heaps: range is allocated from them and written to Placement, Placement only: texture is placed at that range
+void ConstructTexture(FGPUResource * Resource, u64 width, u32 height, u32 depthOrArraySize, DXGI_FORMAT format, TextureFlags flags, wchar_t const* debugName, DXGI_FORMAT clearFormat, float4 clearColor, float clearDepth, u8 clearStencil, FHeapSuballocator * Heaps = nullptr, FHeapAllocation * Placement = nullptr) {
+	D3D12_RESOURCE_DESC desc = GetTextureDesc(width, height, depthOrArraySize, format, flags);
 
 	Resource->FatData->PlanesNum = 1;
 	if ((flags & ALLOW_DEPTH_STENCIL) && HasStencil(format)) {
@@ -673,20 +795,42 @@ void ConstructTexture(FGPUResource * Resource, u64 width, u32 height, u32 depthO
 			GetResourceStateRegistry()->SetCurrentState(Resource, ALL_SUBRESOURCES, EAccessType::WRITE_UAV);
 		}
 		else {
-			initialState = D3D12_RESOURCE_STATE_COPY_DEST;
+			// copy on any queue promotes it to copy dest, so read only textures can be uploaded on copy queue
+			initialState = D3D12_RESOURCE_STATE_COMMON;
 		}
 
-		Resource->FatData->IsCommited = 1;
 		Resource->FatData->HeapProperties = heapProperties;
 
-		VERIFYDX12(GetPrimaryDevice()->D12Device->CreateCommittedResource(
-			&heapProperties,
-			D3D12_HEAP_FLAG_NONE,
-			&desc,
-			initialState,
-			clearFormat != DXGI_FORMAT_UNKNOWN ? &clearValue : nullptr,
-			IID_PPV_ARGS(Resource->D12Resource.get_init())
-		));
+		if (Heaps || Placement) {
+			if (Heaps) {
+				D3D12_RESOURCE_ALLOCATION_INFO allocationInfo = GetPrimaryDevice()->D12Device->GetResourceAllocationInfo(0, 1, &desc);
+				*Placement = Heaps->Allocate(allocationInfo.SizeInBytes, allocationInfo.Alignment);
+			}
+			check(Placement->IsValid());
+
+			Resource->FatData->IsPlaced = 1;
+
+			VERIFYDX12(GetPrimaryDevice()->D12Device->CreatePlacedResource(
+				(ID3D12Heap*)Placement->Heap,
+				Placement->Offset,
+				&desc,
+				initialState,
+				clearFormat != DXGI_FORMAT_UNKNOWN ? &clearValue : nullptr,
+				IID_PPV_ARGS(Resource->D12Resource.get_init())
+			));
+		}
+		else {
+			Resource->FatData->IsCommited = 1;
+
+			VERIFYDX12(GetPrimaryDevice()->D12Device->CreateCommittedResource(
+				&heapProperties,
+				D3D12_HEAP_FLAG_NONE,
+				&desc,
+				initialState,
+				clearFormat != DXGI_FORMAT_UNKNOWN ? &clearValue : nullptr,
+				IID_PPV_ARGS(Resource->D12Resource.get_init())
+			));
+		}
 	}
 
 	Resource->FatData->Desc = Resource->D12Resource->GetDesc();
@@ -824,30 +968,218 @@ FBuffersAllocator *			GetBuffersAllocator() {
 }
 
 
-struct FHeap {
-	unique_com_ptr<ID3D12Heap> D3D12Heap;
-	u64 Size;
-};
+// heaps of one kind on primary device, tier 1 hardware can't mix render targets with other textures in one heap
+class FD3D12HeapBackend final : public FHeapBackend {
+public:
+	D3D12_HEAP_FLAGS Flags;
+
+	FD3D12HeapBackend(D3D12_HEAP_FLAGS InFlags) : Flags(InFlags) {}
 
-typedef eastl::tuple<u64, u64> FRangeTuple;
+	void * CreateHeap(u64 Size) override {
+		D3D12_HEAP_DESC desc = {};
+		desc.SizeInBytes = Size;
+		desc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+		desc.Alignment = D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT;
+		desc.Flags = Flags;
+
+		ID3D12Heap * Heap = nullptr;
+		if (FAILED(GetPrimaryDevice()->D12Device->CreateHeap(&desc, IID_PPV_ARGS(&Heap)))) {
+			return nullptr;
+		}
+		return Heap;
+	}
 
-struct FSharedHeapInfo {
-	eastl::vector<FRangeTuple> RangesInUse;
+	void DestroyHeap(void * Heap) override {
+		((ID3D12Heap*)Heap)->Release();
+	}
 };
 
-// AllocateFromPool
-	// find free <resource, range>
-		// if found return
-	// find free range (create heap if needed)
-		// placement create new <resource, range>, return
+FPooledRenderTargetAllocator::FPooledRenderTargetAllocator(u32 MaxResources) : FResourceAllocator(MaxResources) {
+	RenderTargetHeapBackend = eastl::make_unique<FD3D12HeapBackend>(D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES);
+	TextureHeapBackend = eastl::make_unique<FD3D12HeapBackend>(D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES);
+	RenderTargetHeaps = eastl::make_unique<FHeapSuballocator>(RenderTargetHeapBackend.get(), HEAP_SIZE);
+	TextureHeaps = eastl::make_unique<FHeapSuballocator>(TextureHeapBackend.get(), HEAP_SIZE);
+}
+
+FPooledRenderTargetAllocator::~FPooledRenderTargetAllocator() {
+	FResourceAllocator::Tick();
+	// released this frame too, age doesn't matter when heaps are destroyed
+	Cache.EvictAll([&](TPlacedResourceCache<FGPUResource*>::FEntry const& Entry) { Evict(Entry); });
+}
+
+FGPUResourceRef FPooledRenderTargetAllocator::CreateTexture(u64 width, u32 height, u32 depthOrArraySize, DXGI_FORMAT format, TextureFlags flags, wchar_t const * debugName, DXGI_FORMAT clearFormat, float4 clearColor, float clearDepth, u8 clearStencil) {
+	struct {
+		u64				Width;
+		u32				Height;
+		u32				DepthOrArraySize;
+		DXGI_FORMAT		Format;
+		TextureFlags	Flags;
+		DXGI_FORMAT		ClearFormat;
+		float4			ClearColor;
+		float			ClearDepth;
+		u32				ClearStencil;
+		// hashed as bytes, tail padding has to be zeroed
+		u32				Padding;
+	} Key = { width, height, depthOrArraySize, format, flags, clearFormat, clearColor, clearDepth, clearStencil, 0 };
+	static_assert(sizeof(Key) == 56, "desc key must not have padding");
+	const u64 DescHash = MurmurHash2_64(&Key, sizeof(Key), 0);
+
+	TPlacedResourceCache<FGPUResource*>::FEntry Entry;
+	if (Cache.Acquire(DescHash, &Entry)) {
+		FGPUResource * Resource = Entry.Resource;
+		Resource->FatData->DeletionGPUSyncPoint = {};
+		if (debugName) {
+			Resource->FatData->Name = eastl::wstring(debugName);
+			SetDebugName(Resource->D12Resource.get(), debugName);
+		}
+		return FGPUResourceRef(Resource);
+	}
+
+	FHeapSuballocator * Heaps = (flags & (ALLOW_RENDER_TARGET | ALLOW_DEPTH_STENCIL)) ? RenderTargetHeaps.get() : TextureHeaps.get();
+	FGPUResourceRef result = Allocate();
+	FHeapAllocation Allocation;
+	ConstructTexture(result.get(), width, height, depthOrArraySize, format, flags, debugName, clearFormat, clearColor, clearDepth, clearStencil, Heaps, &Allocation);
+	Placed[result.get()] = { DescHash, Allocation, Heaps };
+
+	return result;
+}
+
+void FPooledRenderTargetAllocator::Free(FGPUResource * Resource) {
+	auto Iter = Placed.find(Resource);
+	check(Iter != Placed.end());
+	Cache.Release(Iter->second.DescHash, Resource, Iter->second.Allocation, FrameCounter);
+}
+
+void FPooledRenderTargetAllocator::Evict(TPlacedResourceCache<FGPUResource*>::FEntry const& Entry) {
+	auto Iter = Placed.find(Entry.Resource);
+	FHeapSuballocator * Heaps = Iter->second.Heaps;
+	Placed.erase(Iter);
+	// resource is released before its range is given to anything else
+	FResourceAllocator::Free(Entry.Resource);
+	Heaps->Free(Entry.Allocation);
+}
+
+void FPooledRenderTargetAllocator::Tick() {
+	FResourceAllocator::Tick();
+
+	FrameCounter++;
+	if (Cache.Evict(FrameCounter, MAX_IDLE_FRAMES, [&](TPlacedResourceCache<FGPUResource*>::FEntry const& Entry) { Evict(Entry); })) {
+		RenderTargetHeaps->ReleaseEmptyHeaps();
+		TextureHeaps->ReleaseEmptyHeaps();
+	}
+}
+
+FHeapStats FPooledRenderTargetAllocator::GetHeapStats() const {
+	FHeapStats Stats = RenderTargetHeaps->GetStats();
+	FHeapStats TextureStats = TextureHeaps->GetStats();
+	Stats.HeapsNum += TextureStats.HeapsNum;
+	Stats.HeapsBytes += TextureStats.HeapsBytes;
+	Stats.AllocatedBytes += TextureStats.AllocatedBytes;
+	Stats.FreeBytes += TextureStats.FreeBytes;
+	Stats.LargestFreeBytes = eastl::max(Stats.LargestFreeBytes, TextureStats.LargestFreeBytes);
+	Stats.FreeBlocksNum += TextureStats.FreeBlocksNum;
+	return Stats;
+}
+
+FTransientTextureAllocator::FTransientTextureAllocator(u32 MaxResources) : FResourceAllocator(MaxResources) {
+	HeapBackend = eastl::make_unique<FD3D12HeapBackend>(D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES);
+	Heaps = eastl::make_unique<FHeapSuballocator>(HeapBackend.get(), HEAP_SIZE);
+}
+
+FTransientTextureAllocator::~FTransientTextureAllocator() {
+	Textures.clear();
+	PrevTextures.clear();
+	FResourceAllocator::Tick();
+	for (auto & Retired : RetiredRanges) {
+		Heaps->Free(Retired.second);
+	}
+	if (Range.IsValid()) {
+		Heaps->Free(Range);
+	}
+}
+
+D3D12_RESOURCE_ALLOCATION_INFO FTransientTextureAllocator::GetTextureAllocationInfo(u64 width, u32 height, DXGI_FORMAT format, TextureFlags flags) {
+	D3D12_RESOURCE_DESC desc = GetTextureDesc(width, height, 1, format, flags);
+	return GetPrimaryDevice()->D12Device->GetResourceAllocationInfo(0, 1, &desc);
+}
+
+void FTransientTextureAllocator::BeginFrame(u64 Size) {
+	// not asked for during last frame
+	PrevTextures = eastl::move(Textures);
+	Textures.clear();
+
+	if (Size > Range.Size) {
+		// gpu may still use textures placed in old range, it's freed with them
+		PrevTextures.clear();
+		if (Range.IsValid()) {
+			RetiredRanges.push_back(eastl::make_pair(GetCurrentFrameGPUSyncPoint(), Range));
+		}
+		Range = Heaps->Allocate(padded_size(Size, RANGE_GRANULARITY));
+		check(Range.IsValid());
+	}
+}
+
+FGPUResourceRef FTransientTextureAllocator::CreateTexture(u64 Offset, u64 width, u32 height, DXGI_FORMAT format, TextureFlags flags, wchar_t const * debugName) {
+	// tier 1 heaps can't hold other textures together with render targets
+	check(flags & (ALLOW_RENDER_TARGET | ALLOW_DEPTH_STENCIL));
+
+	struct {
+		u64				Width;
+		u64				Offset;
+		u32				Height;
+		DXGI_FORMAT		Format;
+		TextureFlags	Flags;
+		u32				Padding;
+	} Key = { width, Offset, height, format, flags, 0 };
+	static_assert(sizeof(Key) == 32, "desc key must not have padding");
+	const u64 DescHash = MurmurHash2_64(&Key, sizeof(Key), 0);
+
+	auto Iter = PrevTextures.find(DescHash);
+	if (Iter != PrevTextures.end()) {
+		FGPUResourceRef Texture = Iter->second.back();
+		Iter->second.pop_back();
+		if (Iter->second.empty()) {
+			PrevTextures.erase(Iter);
+		}
+		Textures[DescHash].push_back(Texture);
+		return Texture;
+	}
+
+	FHeapAllocation Placement = Range;
+	Placement.Offset += Offset;
+
+	FGPUResourceRef result = Allocate();
+	ConstructTexture(result.get(), width, height, 1, format, flags, debugName, DXGI_FORMAT_UNKNOWN, float4(0, 0, 0, 0), 1.f, 0, nullptr, &Placement);
+	Textures[DescHash].push_back(result);
+	return result;
+}
 
-// FreeToPool
-	// mark range as free: return <resource, range> to free pools
+void FTransientTextureAllocator::Tick() {
+	FResourceAllocator::Tick();
 
+	u32 Kept = 0;
+	for (auto & Retired : RetiredRanges) {
+		if (Retired.first.IsCompleted()) {
+			Heaps->Free(Retired.second);
+		}
+		else {
+			RetiredRanges[Kept++] = Retired;
+		}
+	}
+	RetiredRanges.resize(Kept);
+	Heaps->ReleaseEmptyHeaps();
+}
 
 FPooledRenderTargetAllocator * GetPooledRenderTargetAllocator() {
 	if (!PooledRenderTargetAllocator.get()) {
 		PooledRenderTargetAllocator = eastl::make_unique<FPooledRenderTargetAllocator>(64 * 1024);
 	}
 	return PooledRenderTargetAllocator.get();
+}
+
+FTransientTextureAllocator * GetTransientTexturesAllocator() {
+	if (!TransientTexturesAllocator.get()) {
+		TransientTexturesAllocator = eastl::make_unique<FTransientTextureAllocator>(4 * 1024);
+	}
+	return TransientTexturesAllocator.get();
 }
\ No newline at end of file
@@ -3,8 +3,12 @@
 #include "Device.h"
 #include "Commands.h"
 #include "Resource.h"
+#include "HeapAllocator.h"
+#include "LinearAllocator.h"
+#include "UploadRing.h"
 #include <EASTL/vector.h>
 #include <EASTL/hash_map.h>
+#include <mutex>
 
 struct memory_stats_t {
 	u64		heaps_memory;
@@ -34,7 +38,7 @@ public:
 	FGPUResourceRef Allocate();
 	// used on pointer to destruct data (and construct back immediately)
 	// vector of resources owns data and on allocator destruction needs to call destructor on all elements, they can't have stale data (hence this destructor makes sure to recreate it)
-	void Free(FGPUResource*);
+	virtual void Free(FGPUResource*);
 	void Free(FGPUResource*, FGPUSyncPoint);
 
 	virtual void Tick();
@@ -49,32 +53,80 @@ public:
 
 struct FFastUploadAllocation {
 	void * CPUPtr;
+	D3D12_GPU_VIRTUAL_ADDRESS	GPUAddress;
 	D3D12_CPU_DESCRIPTOR_HANDLE	CPUHandle;
 };
 
+// per-frame upload data, Allocate is safe from task workers while recording
+// blocks go back to the pool once the frame they were fenced with completes
 class FLinearAllocator : public FResourceAllocator {
 	eastl::unique_ptr<FUploadBufferAllocator> HelperAllocator;
+	eastl::unique_ptr<FLinearBlockBackend> Backend;
+	eastl::unique_ptr<FConcurrentLinearAllocator> Blocks;
 
-	const u32 BlockSize;
-	FGPUResourceRef CurrentBlock;
-	u64 CurrentBlockOffset = 0;
-
-	typedef eastl::pair<FGPUSyncPoint, u32> FencedBlocks;
+	typedef eastl::pair<FGPUSyncPoint, eastl::vector<FLinearBlock*>> FencedBlocks;
 	eastl::queue<FencedBlocks> PendingQueue;
-	u32 CurrentFrameBlocks = 0;
-	eastl::queue<FGPUResourceRef> PendingBlocks;
-	eastl::vector<FGPUResourceRef> ReadyBlocks;
 public:
-	FLinearAllocator(u32 MaxResources, u32 blockSize = 1048576) : BlockSize(blockSize), FResourceAllocator(MaxResources) {
-		HelperAllocator = eastl::make_unique<FUploadBufferAllocator>(1024);
-	}
-
+	FLinearAllocator(u32 MaxResources, u32 blockSize = 1048576);
 	~FLinearAllocator();
 
-	void AllocateNewBlock();
+	// cbv is written into descriptor range reserved once per sub-block
 	FFastUploadAllocation Allocate(u64 size, u64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+	// no descriptor, for data bound by gpu address (root cbv, vertex data)
+	FFastUploadAllocation AllocateWithoutView(u64 size, u64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+	// no Allocate can run concurrently
 	void FenceFrameAllocations(FGPUSyncPoint sync);
 	void Tick() override;
+	FLinearAllocatorStats GetStats() const { return Blocks->GetStats(); }
+};
+
+struct FStagingAllocation {
+	void *						CPUPtr;
+	FGPUResource *				Resource;
+	u64							Offset;
+	D3D12_GPU_VIRTUAL_ADDRESS	GPUAddress;
+};
+
+struct FStagingStats {
+	u64 RingSize;
+	u64 UsedBytes;
+	u32 BatchesNum;
+	u64 WrapWaste;
+	// uploads that got buffer of their own, too big for ring or ring was full
+	u32 FallbacksNum;
+	u64 FallbackBytes;
+};
+
+// source data of texture and buffer copies, sub-allocated from one persistent mapped upload buffer
+// ranges of a frame form a batch given back once every consumer that copied from them has completed
+// when ring is full allocation falls back to separate upload buffer instead of waiting for gpu
+class FStagingAllocator : public FResourceAllocator {
+	eastl::unique_ptr<FUploadBufferAllocator> HelperAllocator;
+	FGPUResourceRef				RingBuffer;
+	FUploadRing					Ring;
+	std::mutex					Lock;
+
+	// batch fence values are tickets, ticket completes with all consumer sync points of its batch
+	typedef eastl::pair<u64, eastl::vector<FGPUSyncPoint>> FencedBatch;
+	eastl::queue<FencedBatch>	PendingQueue;
+	eastl::vector<FGPUSyncPoint>	BatchConsumers;
+	u64							NextTicket = 1;
+	u64							CompletedTicket = 0;
+	u32							FallbacksNum = 0;
+	u64							FallbackBytes = 0;
+
+	void Reclaim();
+public:
+	static const u64 RING_SIZE = 64 * 1024 * 1024;
+
+	FStagingAllocator(u32 MaxResources);
+
+	// thread safe, Consumer is sync point of command list reading the range
+	FStagingAllocation Allocate(u64 size, u64 alignment, FGPUSyncPoint Consumer);
+	// no Allocate can run concurrently
+	void FenceFrameAllocations();
+	void Tick() override;
+	FStagingStats GetStats();
 };
 
 class FTextureAllocator : public FResourceAllocator {
@@ -98,11 +150,70 @@ public:
 	FGPUResourceRef CreateAtomicCounter();
 };
 
+// textures placed in shared heaps, render targets and depth buffers get heaps of their own
+// released texture keeps its range and is handed out again for the same desc, unused ones are evicted after MAX_IDLE_FRAMES
 class FPooledRenderTargetAllocator : public FResourceAllocator {
 public:
-	FPooledRenderTargetAllocator(u32 MaxResources) : FResourceAllocator(MaxResources) {}
+	static const u64 HEAP_SIZE = 256 * 1024 * 1024;
+	static const u64 MAX_IDLE_FRAMES = 60;
+
+	FPooledRenderTargetAllocator(u32 MaxResources);
+	~FPooledRenderTargetAllocator();
+	// contents are undefined, range may have held evicted textures: render and depth targets have to be fully cleared before other use
 	FGPUResourceRef CreateTexture(u64 width, u32 height, u32 depthOrArraySize, DXGI_FORMAT format, TextureFlags flags, wchar_t const * debugName, DXGI_FORMAT clearFormat = DXGI_FORMAT_UNKNOWN, float4 clearColor = float4(0, 0, 0, 0), float clearDepth = 1.f, u8 clearStencil = 0);
 	FGPUResourceRef CreateShadow(FGPUResource * Resource);
+
+	// called once fenced deletion completes, texture goes to the cache instead of being destroyed
+	void Free(FGPUResource*) override;
+	void Tick() override;
+	FHeapStats GetHeapStats() const;
+	u32 GetCachedNum() const { return Cache.GetCachedNum(); }
+
+private:
+	struct FPlacedTexture {
+		u64						DescHash;
+		FHeapAllocation			Allocation;
+		FHeapSuballocator *		Heaps;
+	};
+	eastl::unique_ptr<FHeapBackend>			RenderTargetHeapBackend;
+	eastl::unique_ptr<FHeapBackend>			TextureHeapBackend;
+	eastl::unique_ptr<FHeapSuballocator>		RenderTargetHeaps;
+	eastl::unique_ptr<FHeapSuballocator>		TextureHeaps;
+	eastl::hash_map<FGPUResource*, FPlacedTexture>	Placed;
+	TPlacedResourceCache<FGPUResource*>		Cache;
+	u64										FrameCounter = 0;
+
+	void Evict(TPlacedResourceCache<FGPUResource*>::FEntry const& Entry);
+};
+
+// render and depth targets living for part of a frame, render graph packs them into one range and picks their offsets
+// texture placed last frame at the same offset with the same desc is reused, so steady graphs create nothing
+class FTransientTextureAllocator : public FResourceAllocator {
+public:
+	static const u64 HEAP_SIZE = 256 * 1024 * 1024;
+	// range grows in these steps, so slowly growing graphs don't reallocate every frame
+	static const u64 RANGE_GRANULARITY = 16 * 1024 * 1024;
+
+	FTransientTextureAllocator(u32 MaxResources);
+	~FTransientTextureAllocator();
+
+	D3D12_RESOURCE_ALLOCATION_INFO GetTextureAllocationInfo(u64 width, u32 height, DXGI_FORMAT format, TextureFlags flags);
+	// range for packing of this frame, textures of previous frame not created again are released
+	void BeginFrame(u64 Size);
+	// contents are undefined, first use has to clear or fully overwrite it
+	FGPUResourceRef CreateTexture(u64 Offset, u64 width, u32 height, DXGI_FORMAT format, TextureFlags flags, wchar_t const * debugName);
+	void Tick() override;
+	u64 GetRangeSize() const { return Range.Size; }
+
+private:
+	eastl::unique_ptr<FHeapBackend>			HeapBackend;
+	eastl::unique_ptr<FHeapSuballocator>		Heaps;
+	FHeapAllocation							Range;
+	// replaced ranges, freed once frames using them are done
+	eastl::vector<eastl::pair<FGPUSyncPoint, FHeapAllocation>>	RetiredRanges;
+	// by hash of desc and offset, transients not alive at the same time can share both so each key holds a list
+	eastl::hash_map<u64, eastl::vector<FGPUResourceRef>>	Textures;
+	eastl::hash_map<u64, eastl::vector<FGPUResourceRef>>	PrevTextures;
 };
 
 void SetIgnoreRelease();
@@ -110,9 +221,13 @@ void SetIgnoreRelease();
 FLinearAllocator * GetConstantsAllocator();
 FTextureAllocator * GetTexturesAllocator();
 FDescriptorAllocator * GetOnlineDescriptorsAllocator();
+// non shader visible cbv, srv and uav views
+FDescriptorAllocator * GetViewDescriptorsAllocator();
 FUploadBufferAllocator * GetUploadAllocator();
+FStagingAllocator * GetStagingAllocator();
 FBuffersAllocator * GetBuffersAllocator();
 FPooledRenderTargetAllocator * GetPooledRenderTargetAllocator();
+FTransientTextureAllocator * GetTransientTexturesAllocator();
 void TickDescriptors(FGPUSyncPoint FrameEndSync);
 
 void FreeAllocators();
\ No newline at end of file